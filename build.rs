@@ -0,0 +1,66 @@
+//! Compiles the eBPF probes under pkg/instrumentors/bpf into OUT_DIR, as
+//! `<probe>.bpf.o`, where the agent embeds them from with `probe_object!`.
+//! Uses the same flags as the Makefile's `bpf` target; set CLANG to use
+//! another compiler.
+
+use std::env;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+
+const PROBES_DIR: &str = "pkg/instrumentors/bpf";
+const INCLUDE_DIR: &str = "include";
+
+fn main() {
+    let out_dir = PathBuf::from(env::var_os("OUT_DIR").expect("OUT_DIR is set by cargo"));
+    let clang = env::var("CLANG").unwrap_or_else(|_| "clang".to_string());
+    let arch = env::var("CARGO_CFG_TARGET_ARCH").expect("CARGO_CFG_TARGET_ARCH is set by cargo");
+
+    println!("cargo:rerun-if-env-changed=CLANG");
+    println!("cargo:rerun-if-changed={}", INCLUDE_DIR);
+
+    let mut probes: Vec<_> = fs::read_dir(PROBES_DIR)
+        .unwrap_or_else(|e| panic!("Failed to list {}: {}", PROBES_DIR, e))
+        .filter_map(|entry| entry.ok())
+        .map(|entry| entry.path())
+        .filter(|dir| dir.join("bpf/probe.bpf.c").is_file())
+        .collect();
+    probes.sort();
+
+    for dir in probes {
+        let source = dir.join("bpf/probe.bpf.c");
+        let name = dir
+            .file_name()
+            .and_then(|name| name.to_str())
+            .expect("probe directories have UTF-8 names");
+        println!("cargo:rerun-if-changed={}", source.display());
+        compile(
+            &clang,
+            &arch,
+            &source,
+            &out_dir.join(format!("{}.bpf.o", name)),
+        );
+    }
+}
+
+fn compile(clang: &str, arch: &str, source: &Path, object: &Path) {
+    let status = Command::new(clang)
+        .args(["-O2", "-g", "-target", "bpf"])
+        .arg(format!("-D__TARGET_ARCH_{}", arch))
+        .arg(format!("-I{}/libbpf", INCLUDE_DIR))
+        .arg(format!("-I{}", INCLUDE_DIR))
+        .arg("-c")
+        .arg(source)
+        .arg("-o")
+        .arg(object)
+        .status()
+        .unwrap_or_else(|e| {
+            panic!(
+                "Failed to run {} (install clang or set CLANG): {}",
+                clang, e
+            )
+        });
+    if !status.success() {
+        panic!("Failed to compile {}: {}", source.display(), status);
+    }
+}
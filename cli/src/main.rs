@@ -1,6 +1,7 @@
 use clap::Parser;
 use log::{error, info};
 use std::sync::Arc;
+use std::time::Duration;
 use tokio::signal;
 use tokio::sync::broadcast;
 
@@ -10,7 +11,9 @@ mod opentelemetry_controller;
 mod process;
 
 use errors::Result;
-use instrumentors::Manager;
+use instrumentors::{
+    Config, FunctionTracingConfig, Manager, ProfilingConfig, Propagators, SlowRequestConfig,
+};
 use opentelemetry_controller::Controller;
 use process::{Analyzer, TargetArgs};
 
@@ -35,6 +38,74 @@ struct Args {
     #[arg(long, env = "OTEL_STDOUT", default_value = "false")]
     stdout: bool,
 
+    #[arg(long, env = "OTEL_RUST_LONG_POLL_THRESHOLD_MS", default_value = "0")]
+    long_poll_threshold_ms: u64,
+
+    #[arg(long, env = "OTEL_RUST_CPU_ACCOUNTING", default_value = "false")]
+    cpu_accounting: bool,
+
+    #[arg(long, env = "OTEL_RUST_PROFILING", default_value = "false")]
+    profiling: bool,
+
+    #[arg(long, env = "OTEL_RUST_PROFILING_FREQUENCY_HZ", default_value = "49")]
+    profiling_frequency_hz: u64,
+
+    #[arg(
+        long,
+        env = "OTEL_RUST_PROFILING_OUTPUT_DIR",
+        default_value = "/var/lib/otel-rust-agent/profiles"
+    )]
+    profiling_output_dir: String,
+
+    #[arg(long, env = "OTEL_RUST_SLOW_REQUEST_THRESHOLD_MS", default_value = "0")]
+    slow_request_threshold_ms: u64,
+
+    #[arg(long, env = "OTEL_RUST_SLOW_REQUEST_ROUTES")]
+    slow_request_routes: Option<String>,
+
+    #[arg(long, env = "OTEL_RUST_MAX_ROUTES", default_value = "1000")]
+    max_routes: usize,
+
+    #[arg(long, env = "OTEL_RUST_TOWER_LAYERS")]
+    tower_layers: Option<String>,
+
+    #[arg(long, env = "OTEL_RUST_TRACE_FUNCTIONS")]
+    trace_functions: Option<String>,
+
+    #[arg(long, env = "OTEL_RUST_TRACE_FUNCTIONS_MAX", default_value = "256")]
+    trace_functions_max: usize,
+
+    #[arg(long, env = "OTEL_RUST_TRACE_FUNCTIONS_RATE", default_value = "1000")]
+    trace_functions_rate: u64,
+
+    #[arg(
+        long,
+        env = "OTEL_RUST_TRACE_FUNCTIONS_MIN_DURATION_US",
+        default_value = "0"
+    )]
+    trace_functions_min_duration_us: u64,
+
+    #[arg(long, env = "OTEL_RUST_TRACE_ASYNC_FUNCTIONS")]
+    trace_async_functions: Option<String>,
+
+    #[arg(long, env = "OTEL_RUST_TRACE_FUNCTIONS_CAPTURE")]
+    trace_functions_capture: Option<String>,
+
+    #[arg(long, env = "OTEL_RUST_TRACE_FUNCTIONS_ERRORS")]
+    trace_functions_errors: Option<String>,
+
+    #[arg(long, env = "OTEL_RUST_TRACING_BRIDGE", default_value = "false")]
+    tracing_bridge: bool,
+
+    #[arg(long, env = "OTEL_RUST_SDK_INTEGRATION", default_value = "false")]
+    sdk_integration: bool,
+
+    #[arg(long, env = "OTEL_RUST_BAGGAGE_KEYS")]
+    baggage_keys: Option<String>,
+
+    #[arg(long, env = "OTEL_PROPAGATORS", default_value = "tracecontext,baggage")]
+    propagators: String,
+
     #[arg(long, short, default_value = "info")]
     log_level: String,
 }
@@ -70,7 +141,48 @@ async fn main() -> Result<()> {
 
     let controller = Arc::new(controller);
     let analyzer = Analyzer::new();
-    let manager = Manager::new(Arc::clone(&controller));
+    let route_thresholds = match args.slow_request_routes.as_deref() {
+        Some(routes) => SlowRequestConfig::parse_routes(routes)?,
+        None => Vec::new(),
+    };
+    let slow_request_threshold = Duration::from_millis(args.slow_request_threshold_ms);
+    let function_captures = match args.trace_functions_capture.as_deref() {
+        Some(spec) => FunctionTracingConfig::parse_captures(spec)?,
+        None => Vec::new(),
+    };
+
+    let config = Config {
+        long_poll_threshold: Duration::from_millis(args.long_poll_threshold_ms),
+        cpu_accounting: args.cpu_accounting,
+        profiling: args.profiling.then(|| ProfilingConfig {
+            frequency_hz: args.profiling_frequency_hz,
+            output_dir: args.profiling_output_dir.into(),
+            period: Duration::from_secs(10),
+        }),
+        slow_requests: (!slow_request_threshold.is_zero() || !route_thresholds.is_empty()).then(
+            || SlowRequestConfig {
+                default_threshold: slow_request_threshold,
+                route_thresholds,
+            },
+        ),
+        max_routes: args.max_routes,
+        tower_layers: comma_separated(args.tower_layers.as_deref()),
+        traced_functions: (args.trace_functions.is_some() || args.trace_async_functions.is_some())
+            .then(|| FunctionTracingConfig {
+                patterns: comma_separated(args.trace_functions.as_deref()),
+                async_patterns: comma_separated(args.trace_async_functions.as_deref()),
+                captures: function_captures,
+                error_patterns: comma_separated(args.trace_functions_errors.as_deref()),
+                max_functions: args.trace_functions_max,
+                max_calls_per_sec: args.trace_functions_rate,
+                min_duration: Duration::from_micros(args.trace_functions_min_duration_us),
+            }),
+        tracing_bridge: args.tracing_bridge,
+        sdk_integration: args.sdk_integration,
+        baggage_keys: comma_separated(args.baggage_keys.as_deref()),
+        propagators: Propagators::parse(&args.propagators)?,
+    };
+    let mut manager = Manager::new(Arc::clone(&controller), config);
 
     let shutdown_tx_clone = shutdown_tx.clone();
     tokio::spawn(async move {
@@ -113,10 +225,23 @@ async fn main() -> Result<()> {
         }
     }
 
+    controller.shutdown();
     info!("Agent shutdown complete");
     Ok(())
 }
 
+/// Non-empty, trimmed entries of a comma-separated option.
+fn comma_separated(list: Option<&str>) -> Vec<String> {
+    list.map(|list| {
+        list.split(',')
+            .map(str::trim)
+            .filter(|entry| !entry.is_empty())
+            .map(String::from)
+            .collect()
+    })
+    .unwrap_or_default()
+}
+
 mod errors {
     use thiserror::Error;
 
@@ -134,6 +259,9 @@ mod errors {
         #[error("eBPF error: {0}")]
         Ebpf(String),
 
+        #[error("Invalid configuration: {0}")]
+        InvalidConfig(String),
+
         #[error("OpenTelemetry error: {0}")]
         OpenTelemetry(String),
 
@@ -149,79 +277,136 @@ mod errors {
 
 mod opentelemetry_controller {
     use super::errors::{Error, Result};
+    use log::warn;
+    use opentelemetry::metrics::{Meter, MeterProvider};
     use opentelemetry::trace::TracerProvider;
     use opentelemetry_otlp::WithExportConfig;
-    use opentelemetry_sdk::trace::Tracer;
+    use opentelemetry_sdk::metrics::{PeriodicReader, SdkMeterProvider};
+    use opentelemetry_sdk::trace::{SdkTracer, SdkTracerProvider};
+    use opentelemetry_sdk::Resource;
     use std::time::Duration;
 
     pub struct Controller {
-        tracer: Tracer,
+        tracer_provider: SdkTracerProvider,
+        meter_provider: SdkMeterProvider,
+        tracer: SdkTracer,
+        meter: Meter,
         service_name: String,
     }
 
     impl Controller {
         pub fn new(endpoint: &str, service_name: &str) -> Result<Self> {
-            let exporter = opentelemetry_otlp::new_exporter()
-                .tonic()
+            let span_exporter = opentelemetry_otlp::SpanExporter::builder()
+                .with_tonic()
                 .with_endpoint(endpoint)
-                .with_timeout(Duration::from_secs(10));
-
-            let provider = opentelemetry_otlp::new_pipeline()
-                .tracing()
-                .with_exporter(exporter)
-                .with_trace_config(
-                    opentelemetry_sdk::trace::Config::default()
-                        .with_resource(opentelemetry_sdk::Resource::new(vec![
-                            opentelemetry::KeyValue::new("service.name", service_name.to_string()),
-                        ])),
-                )
-                .install_batch(opentelemetry_sdk::runtime::Tokio)
+                .with_timeout(Duration::from_secs(10))
+                .build()
                 .map_err(|e| Error::OpenTelemetry(e.to_string()))?;
 
-            let tracer = provider.tracer("rust-auto-instrumentation");
+            let tracer_provider = SdkTracerProvider::builder()
+                .with_batch_exporter(span_exporter)
+                .with_resource(Self::resource(service_name))
+                .build();
 
-            Ok(Self {
-                tracer,
-                service_name: service_name.to_string(),
-            })
+            let metric_exporter = opentelemetry_otlp::MetricExporter::builder()
+                .with_tonic()
+                .with_endpoint(endpoint)
+                .with_timeout(Duration::from_secs(10))
+                .build()
+                .map_err(|e| Error::OpenTelemetry(e.to_string()))?;
+
+            let meter_provider = SdkMeterProvider::builder()
+                .with_reader(PeriodicReader::builder(metric_exporter).build())
+                .with_resource(Self::resource(service_name))
+                .build();
+
+            Ok(Self::with_providers(
+                tracer_provider,
+                meter_provider,
+                service_name,
+            ))
         }
 
         pub fn new_stdout(service_name: &str) -> Result<Self> {
-            let provider = opentelemetry_sdk::trace::TracerProvider::builder()
+            let tracer_provider = SdkTracerProvider::builder()
                 .with_simple_exporter(opentelemetry_stdout::SpanExporter::default())
-                .with_resource(opentelemetry_sdk::Resource::new(vec![
-                    opentelemetry::KeyValue::new("service.name", service_name.to_string()),
-                ]))
+                .with_resource(Self::resource(service_name))
                 .build();
 
-            let tracer = provider.tracer("rust-auto-instrumentation");
+            let meter_provider = SdkMeterProvider::builder()
+                .with_reader(
+                    PeriodicReader::builder(opentelemetry_stdout::MetricExporter::default())
+                        .build(),
+                )
+                .with_resource(Self::resource(service_name))
+                .build();
+
+            Ok(Self::with_providers(
+                tracer_provider,
+                meter_provider,
+                service_name,
+            ))
+        }
+
+        fn resource(service_name: &str) -> Resource {
+            Resource::builder()
+                .with_service_name(service_name.to_string())
+                .build()
+        }
 
-            Ok(Self {
-                tracer,
+        fn with_providers(
+            tracer_provider: SdkTracerProvider,
+            meter_provider: SdkMeterProvider,
+            service_name: &str,
+        ) -> Self {
+            Self {
+                tracer: tracer_provider.tracer("rust-auto-instrumentation"),
+                meter: meter_provider.meter("rust-auto-instrumentation"),
+                tracer_provider,
+                meter_provider,
                 service_name: service_name.to_string(),
-            })
+            }
         }
 
-        pub fn tracer(&self) -> &Tracer {
+        pub fn tracer(&self) -> &SdkTracer {
             &self.tracer
         }
 
+        pub fn meter(&self) -> &Meter {
+            &self.meter
+        }
+
         pub fn service_name(&self) -> &str {
             &self.service_name
         }
+
+        /// Flushes the spans and metrics still buffered by the exporters.
+        pub fn shutdown(&self) {
+            if let Err(e) = self.tracer_provider.shutdown() {
+                warn!("Failed to shut down the tracer provider: {}", e);
+            }
+            if let Err(e) = self.meter_provider.shutdown() {
+                warn!("Failed to shut down the meter provider: {}", e);
+            }
+        }
     }
 }
 
 mod process {
+    use super::dwarf::{self, ArgLoc, DebugInfo, Parameter};
     use super::errors::{Error, Result};
+    use super::symbols::{self, SymbolTable};
+    use goblin::elf::program_header::PT_LOAD;
     use goblin::elf::Elf;
     use log::{debug, info};
     use memmap2::Mmap;
     use procfs::process::Process;
     use rustc_demangle::demangle;
-    use std::collections::HashMap;
+    use std::collections::{HashMap, HashSet};
     use std::fs::File;
+    use std::os::unix::fs::FileExt;
     use std::path::PathBuf;
+    use std::sync::Arc;
     use std::time::Duration;
 
     pub struct TargetArgs {
@@ -246,6 +431,45 @@ mod process {
         pub demangled_name: String,
         pub address: u64,
         pub size: u64,
+        /// Entry locations from DWARF, empty without debug info.
+        pub parameters: Vec<Parameter>,
+    }
+
+    impl FunctionInfo {
+        /// Whether this is `name`, given as a demangled path without hash.
+        pub fn is(&self, name: &str) -> bool {
+            match self.demangled_name.strip_prefix(name) {
+                Some(rest) => rest.is_empty() || rest.starts_with("::h"),
+                None => false,
+            }
+        }
+
+        /// Where `parameter` is at entry, for a probe's `arg_loc` constant.
+        /// An unresolved parameter keeps the probe's ABI default.
+        pub fn arg_loc(&self, parameter: &str) -> ArgLoc {
+            self.parameters
+                .iter()
+                .filter(|p| p.name == parameter)
+                .map(ArgLoc::for_parameter)
+                .find(|loc| *loc != ArgLoc::ABI)
+                .unwrap_or(ArgLoc::ABI)
+        }
+    }
+
+    /// Fills in the entry parameters of `functions` from `debug_info`.
+    fn resolve_parameters(debug_info: &DebugInfo, functions: &mut [FunctionInfo]) {
+        let names: HashSet<&str> = functions.iter().map(|f| f.name.as_str()).collect();
+        match dwarf::parameter_locations(debug_info, &names) {
+            Ok(mut parameters) => {
+                debug!("Resolved parameters of {} functions", parameters.len());
+                for function in functions {
+                    if let Some(params) = parameters.remove(&function.name) {
+                        function.parameters = params;
+                    }
+                }
+            }
+            Err(e) => debug!("No parameter locations: {}", e),
+        }
     }
 
     #[derive(Debug)]
@@ -254,6 +478,70 @@ mod process {
         pub exe_path: PathBuf,
         pub functions: Vec<FunctionInfo>,
         pub libraries: Vec<String>,
+        pub symbols: Arc<SymbolTable>,
+        pub debug_info: Arc<DebugInfo>,
+        /// Loadable segments of the executable as (address, file offset,
+        /// file size), to read the code of functions from.
+        segments: Vec<(u64, u64, u64)>,
+    }
+
+    impl TargetDetails {
+        /// Offsets from the start of `function` of its return
+        /// instructions, where return probes are attached. Empty when its
+        /// code cannot be read or decoded.
+        pub fn return_offsets(&self, function: &FunctionInfo) -> Vec<u64> {
+            let end = function.address + function.size;
+            let Some(&(address, offset, _)) = self
+                .segments
+                .iter()
+                .find(|(address, _, size)| function.address >= *address && end <= address + size)
+            else {
+                return Vec::new();
+            };
+            let mut code = vec![0; function.size as usize];
+            let read = File::open(&self.exe_path).and_then(|file| {
+                file.read_exact_at(&mut code, offset + function.address - address)
+            });
+            match read {
+                Ok(()) => return_instructions(&code),
+                Err(e) => {
+                    debug!("Failed to read the code of {}: {}", function.name, e);
+                    Vec::new()
+                }
+            }
+        }
+
+        /// Where `parameter` of the first of `functions` that has it is at
+        /// entry, for a probe's `arg_loc` constant. Unresolved parameters
+        /// keep the probe's ABI default.
+        pub fn arg_loc(&self, functions: &[&str], parameter: &str) -> ArgLoc {
+            self.functions
+                .iter()
+                .filter(|f| functions.iter().any(|name| f.is(name)))
+                .map(|f| f.arg_loc(parameter))
+                .find(|loc| *loc != ArgLoc::ABI)
+                .unwrap_or(ArgLoc::ABI)
+        }
+
+        /// Resolves the entry parameters of `functions` found after the
+        /// analysis, such as instances discovered in the symbol table.
+        pub fn resolve_parameters(&self, functions: &mut [FunctionInfo]) {
+            resolve_parameters(&self.debug_info, functions);
+        }
+
+        /// Where the data pointer and length of the slice `parameter` of
+        /// the first of `functions` that has it are at entry, for a pair of
+        /// a probe's `arg_loc` constants.
+        pub fn slice_arg_locs(&self, functions: &[&str], parameter: &str) -> [ArgLoc; 2] {
+            self.functions
+                .iter()
+                .filter(|f| functions.iter().any(|name| f.is(name)))
+                .flat_map(|f| &f.parameters)
+                .filter(|p| p.name == parameter)
+                .map(ArgLoc::for_slice)
+                .find(|locs| *locs != [ArgLoc::ABI; 2])
+                .unwrap_or([ArgLoc::ABI; 2])
+        }
     }
 
     pub struct Analyzer;
@@ -329,18 +617,13 @@ mod process {
             for sym in elf.syms.iter() {
                 if sym.st_type() == goblin::elf::sym::STT_FUNC && sym.st_size > 0 {
                     if let Some(name) = elf.strtab.get_at(sym.st_name) {
-                        let demangled = demangle(name).to_string();
-
-                        let matches = relevant_funcs.is_empty()
-                            || relevant_funcs.contains_key(name)
-                            || relevant_funcs.contains_key(&demangled);
-
-                        if matches {
+                        if is_relevant(&relevant_funcs, name) {
                             functions.push(FunctionInfo {
                                 name: name.to_string(),
-                                demangled_name: demangled,
+                                demangled_name: demangle(name).to_string(),
                                 address: sym.st_value,
                                 size: sym.st_size,
+                                parameters: Vec::new(),
                             });
                         }
                     }
@@ -350,18 +633,13 @@ mod process {
             for sym in elf.dynsyms.iter() {
                 if sym.st_type() == goblin::elf::sym::STT_FUNC && sym.st_size > 0 {
                     if let Some(name) = elf.dynstrtab.get_at(sym.st_name) {
-                        let demangled = demangle(name).to_string();
-
-                        let matches = relevant_funcs.is_empty()
-                            || relevant_funcs.contains_key(name)
-                            || relevant_funcs.contains_key(&demangled);
-
-                        if matches {
+                        if is_relevant(&relevant_funcs, name) {
                             functions.push(FunctionInfo {
                                 name: name.to_string(),
-                                demangled_name: demangled,
+                                demangled_name: demangle(name).to_string(),
                                 address: sym.st_value,
                                 size: sym.st_size,
+                                parameters: Vec::new(),
                             });
                         }
                     }
@@ -370,24 +648,142 @@ mod process {
 
             info!("Found {} relevant functions", functions.len());
 
+            let debug_info = match DebugInfo::load(&elf, &mmap) {
+                Ok(debug_info) => debug_info,
+                Err(e) => {
+                    debug!("No debug info: {}", e);
+                    DebugInfo::empty()
+                }
+            };
+            resolve_parameters(&debug_info, &mut functions);
+
+            let index = symbols::index_for(&elf, &mmap);
+            let load_bias = symbols::load_bias(pid, &exe_path, &elf);
+            let symbols = Arc::new(SymbolTable::new(index, load_bias));
+            debug!(
+                "Indexed {} function symbols (load bias {:#x})",
+                symbols.len(),
+                load_bias
+            );
+
+            let segments = elf
+                .program_headers
+                .iter()
+                .filter(|ph| ph.p_type == PT_LOAD)
+                .map(|ph| (ph.p_vaddr, ph.p_offset, ph.p_filesz))
+                .collect();
+
             Ok(TargetDetails {
                 pid,
                 exe_path,
                 functions,
                 libraries,
+                symbols,
+                debug_info: Arc::new(debug_info),
+                segments,
+            })
+        }
+    }
+
+    /// Whether the symbol `name` is one of `relevant_funcs`, given as
+    /// mangled names or demangled paths without hash. Empty means all.
+    fn is_relevant(relevant_funcs: &HashMap<String, ()>, name: &str) -> bool {
+        relevant_funcs.is_empty()
+            || relevant_funcs.contains_key(name)
+            || relevant_funcs.contains_key(&format!("{:#}", demangle(name)))
+    }
+
+    /// Offsets of the `ret` instructions in `code`.
+    #[cfg(target_arch = "x86_64")]
+    fn return_instructions(code: &[u8]) -> Vec<u64> {
+        use iced_x86::{Decoder, DecoderOptions, FlowControl};
+        Decoder::with_ip(64, code, 0, DecoderOptions::NONE)
+            .iter()
+            .filter(|insn| insn.flow_control() == FlowControl::Return)
+            .map(|insn| insn.ip())
+            .collect()
+    }
+
+    /// Offsets of the `ret` instructions in `code`: RET, RETAA and RETAB.
+    #[cfg(target_arch = "aarch64")]
+    fn return_instructions(code: &[u8]) -> Vec<u64> {
+        code.chunks_exact(4)
+            .enumerate()
+            .filter(|(_, insn)| {
+                let insn = u32::from_le_bytes([insn[0], insn[1], insn[2], insn[3]]);
+                insn & 0xffff_fc1f == 0xd65f_0000 || insn == 0xd65f_0bff || insn == 0xd65f_0fff
             })
+            .map(|(i, _)| i as u64 * 4)
+            .collect()
+    }
+
+    #[cfg(not(any(target_arch = "x86_64", target_arch = "aarch64")))]
+    fn return_instructions(_code: &[u8]) -> Vec<u64> {
+        Vec::new()
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+
+        #[inline(never)]
+        fn located(value: u64) -> u64 {
+            std::hint::black_box(value) + 1
+        }
+
+        #[test]
+        fn relevant_functions_match_without_hash() {
+            let mangled = "_ZN5hyper5proto2h14role6Server5parse17h0123456789abcdefE";
+            let relevant =
+                HashMap::from([("hyper::proto::h1::role::Server::parse".to_string(), ())]);
+            assert!(is_relevant(&relevant, mangled));
+            assert!(is_relevant(
+                &HashMap::from([(mangled.to_string(), ())]),
+                mangled
+            ));
+            assert!(is_relevant(&HashMap::new(), mangled));
+            let other = HashMap::from([("hyper::proto::h1::role::Server".to_string(), ())]);
+            assert!(!is_relevant(&other, mangled));
+        }
+
+        #[tokio::test]
+        async fn analyze_finds_functions_by_path_without_hash() {
+            assert_eq!(located(std::hint::black_box(1)), 2);
+            let path = format!("{}::located", module_path!());
+            let relevant = HashMap::from([(path.clone(), ())]);
+
+            let pid = std::process::id() as i32;
+            let target = Analyzer::new().analyze(pid, relevant).await.unwrap();
+
+            let function = target
+                .functions
+                .iter()
+                .find(|f| f.is(&path))
+                .expect("the test binary has a symbol table");
+            assert!(function.address != 0 && function.size != 0);
+            assert!(function.demangled_name.starts_with(&path));
+            // Test builds carry debug info.
+            let value = function
+                .parameters
+                .iter()
+                .find(|p| p.name == "value")
+                .expect("the parameter is resolved from DWARF");
+            assert!(value.location.is_some());
         }
     }
 }
 
 mod instrumentors {
+    use super::dwarf::{self, DebugInfo};
     use super::errors::{Error, Result};
     use super::opentelemetry_controller::Controller;
+    use super::path_normalizer::PathNormalizer;
     use super::process::TargetDetails;
+    use super::symbols::SymbolTable;
     use async_trait::async_trait;
     use log::{info, warn};
     use std::collections::HashMap;
-    use std::sync::Arc;
+    use std::sync::{Arc, Mutex};
     use tokio::sync::broadcast;
 
     #[derive(Debug, Clone)]
@@ -396,162 +792,8247 @@ mod instrumentors {
         pub name: String,
         pub start_time: u64,
         pub end_time: u64,
+        pub kind: opentelemetry::trace::SpanKind,
         pub trace_id: [u8; 16],
         pub span_id: [u8; 8],
+        pub parent_span_id: Option<[u8; 8]>,
         pub attributes: Vec<(String, String)>,
+        pub poll_stats: Option<PollStats>,
+        pub events: Vec<SpanEvent>,
     }
 
-    #[async_trait]
-    pub trait Instrumentor: Send + Sync {
-        fn library_name(&self) -> &str;
-        fn func_names(&self) -> Vec<&str>;
-        async fn load(&mut self, target: &TargetDetails) -> Result<()>;
-        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()>;
-        fn close(&mut self);
+    #[derive(Debug, Clone)]
+    pub struct SpanEvent {
+        pub name: String,
+        pub attributes: Vec<(String, String)>,
     }
 
-    pub struct Manager {
-        instrumentors: HashMap<String, Box<dyn Instrumentor>>,
-        controller: Arc<Controller>,
+    /// Async poll accounting of the task that served a request, as
+    /// accumulated in-kernel by the tokio probes.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy, Default)]
+    pub struct PollStats {
+        pub polls: u64,
+        pub busy_ns: u64,
+        pub max_poll_ns: u64,
+        /// On-CPU time within those polls. Only collected when on-CPU
+        /// accounting is enabled, 0 otherwise.
+        pub cpu_ns: u64,
     }
 
-    impl Manager {
-        pub fn new(controller: Arc<Controller>) -> Self {
-            let mut instrumentors: HashMap<String, Box<dyn Instrumentor>> = HashMap::new();
-
-            instrumentors.insert(
-                "hyper".to_string(),
-                Box::new(super::hyper_instrumentor::HyperInstrumentor::new()),
-            );
-
-            Self {
-                instrumentors,
-                controller,
-            }
+    impl PollStats {
+        /// Time the request spent suspended, waiting to be polled again.
+        pub fn wait_ns(&self, start_time: u64, end_time: u64) -> u64 {
+            end_time
+                .saturating_sub(start_time)
+                .saturating_sub(self.busy_ns)
         }
+    }
 
-        pub fn get_relevant_funcs(&self) -> HashMap<String, ()> {
-            let mut funcs = HashMap::new();
-            for inst in self.instrumentors.values() {
-                for func in inst.func_names() {
-                    funcs.insert(func.to_string(), ());
-                }
-            }
-            funcs
-        }
+    /// Agent-wide options that change what the probes collect.
+    #[derive(Debug, Clone, Default)]
+    pub struct Config {
+        /// Task polls longer than this are reported as blocking the executor.
+        /// Zero disables the detector.
+        pub long_poll_threshold: std::time::Duration,
+        /// Charges on-CPU time to requests using the sched_switch tracepoint.
+        pub cpu_accounting: bool,
+        /// Continuous CPU profiling of the target, disabled when `None`.
+        pub profiling: Option<ProfilingConfig>,
+        /// Stack snapshots of slow requests, disabled when `None`.
+        pub slow_requests: Option<SlowRequestConfig>,
+        /// Cap on route templates learned from raw paths.
+        pub max_routes: usize,
+        /// Type path prefixes of the tower layers to time, e.g.
+        /// `tower::timeout`. Empty disables layer tracing.
+        pub tower_layers: Vec<String>,
+        /// Timing of user-selected functions, disabled when `None`.
+        pub traced_functions: Option<FunctionTracingConfig>,
+        /// Exports the application's `tracing` spans under its requests.
+        pub tracing_bridge: bool,
+        /// Joins spans the application starts with the OpenTelemetry SDK to
+        /// the requests they run in.
+        pub sdk_integration: bool,
+        /// `baggage` keys recorded as attributes of server spans. Empty
+        /// disables capturing and propagating baggage.
+        pub baggage_keys: Vec<String>,
+        /// Header formats span contexts are extracted from and injected in.
+        pub propagators: Propagators,
+    }
 
-        pub fn filter_unused_instrumentors(&self, target: &TargetDetails) {
-            let existing_funcs: HashMap<String, ()> = target
-                .functions
-                .iter()
-                .map(|f| (f.demangled_name.clone(), ()))
-                .collect();
+    /// Header formats of the probes' `propagators` constant, in
+    /// propagation.h.
+    #[derive(Debug, Clone, Copy, PartialEq, Eq)]
+    pub struct Propagators(pub u32);
 
-            for (name, inst) in &self.instrumentors {
-                let found = inst
-                    .func_names()
-                    .iter()
-                    .filter(|f| existing_funcs.contains_key(*f))
-                    .count();
+    impl Propagators {
+        pub const W3C: u32 = 0x1;
+        pub const B3_SINGLE: u32 = 0x2;
+        pub const B3_MULTI: u32 = 0x4;
+        pub const JAEGER: u32 = 0x8;
 
-                if found == 0 {
-                    warn!("Instrumentor {} has no matching functions", name);
-                } else {
-                    info!(
-                        "Instrumentor {} found {}/{} functions",
-                        name,
-                        found,
-                        inst.func_names().len()
-                    );
-                }
-            }
+        /// Parses `OTEL_PROPAGATORS` names, e.g. `tracecontext,b3multi`.
+        /// `baggage` is accepted but configured by `OTEL_RUST_BAGGAGE_KEYS`,
+        /// and `none` selects no format.
+        pub fn parse(spec: &str) -> Result<Self> {
+            spec.split(',')
+                .map(str::trim)
+                .filter(|name| !name.is_empty())
+                .try_fold(0, |set, name| {
+                    let format = match name {
+                        "tracecontext" => Self::W3C,
+                        "b3" => Self::B3_SINGLE,
+                        "b3multi" => Self::B3_MULTI,
+                        "jaeger" => Self::JAEGER,
+                        "baggage" | "none" => 0,
+                        _ => {
+                            return Err(Error::InvalidConfig(format!(
+                                "Unknown propagator {}",
+                                name
+                            )))
+                        }
+                    };
+                    Ok(set | format)
+                })
+                .map(Self)
         }
+    }
 
-        pub async fn run(
-            &self,
-            target: &TargetDetails,
-            mut shutdown_rx: broadcast::Receiver<()>,
-        ) -> Result<()> {
-            let (events_tx, mut events_rx) = tokio::sync::mpsc::channel::<Event>(1024);
-
-            info!("Starting instrumentors for {} libraries", self.instrumentors.len());
+    impl Default for Propagators {
+        fn default() -> Self {
+            Self(Self::W3C)
+        }
+    }
 
-            let controller = Arc::clone(&self.controller);
-            let events_handler = tokio::spawn(async move {
-                use opentelemetry::trace::{Span, SpanKind, Tracer};
-                let tracer = controller.tracer();
+    /// Layout of `http::HeaderMap` and its `Bucket`, the same for http 0.2
+    /// and 1.x in offset_results.json, or of a hashbrown table of headers
+    /// when `kind` is `HASHBROWN`.
+    #[derive(Debug, Clone, Copy)]
+    pub struct HeaderMapLayout {
+        pub kind: u8,
+        pub entries_ptr: u64,
+        pub entries_len: u64,
+        pub bucket_size: u64,
+        pub bucket_key: u64,
+        pub bucket_value: u64,
+    }
 
-                while let Some(event) = events_rx.recv().await {
-                    let mut span = tracer
-                        .span_builder(event.name.clone())
-                        .with_kind(SpanKind::Server)
-                        .start(tracer);
+    impl HeaderMapLayout {
+        /// Values of header_map.h's `HEADER_MAP_*` kinds.
+        pub const HTTP: u8 = 0;
+        pub const HASHBROWN: u8 = 1;
+    }
 
-                    for (key, value) in event.attributes {
-                        span.set_attribute(opentelemetry::KeyValue::new(key, value));
-                    }
+    pub const HEADER_MAP_LAYOUT: HeaderMapLayout = HeaderMapLayout {
+        kind: HeaderMapLayout::HTTP,
+        entries_ptr: 32,
+        entries_len: 40,
+        bucket_size: 104,
+        bucket_key: 40,
+        bucket_value: 0,
+    };
 
-                    span.end();
-                }
-            });
+    /// Layout of `http::Request`, `http::Uri` and `http::Response`, the
+    /// values of the `*_pos` constants in http_request.h. The Uri's
+    /// components are `Bytes`, read through their pointer and length.
+    #[derive(Debug, Clone, Copy)]
+    pub struct HttpLayout {
+        pub method: u64,
+        pub uri: u64,
+        pub path: u64,
+        pub authority: u64,
+        pub request_headers: u64,
+        pub response_status: u64,
+    }
 
-            tokio::select! {
-                _ = shutdown_rx.recv() => {
-                    info!("Shutdown signal received");
-                    return Err(Error::Interrupted);
-                }
-                _ = events_handler => {
-                    info!("Events handler completed");
-                }
-            }
+    /// As tracked for http 1.x in offset_results.json.
+    pub const HTTP_LAYOUT: HttpLayout = HttpLayout {
+        method: 0,
+        uri: 32,
+        path: 64,
+        authority: 32,
+        request_headers: 72,
+        response_status: 0,
+    };
 
-            Ok(())
+    impl HttpLayout {
+        /// Reads the layout from the target's DWARF, `None` when it does
+        /// not describe the `http` types. A request's `Parts` lead it.
+        pub fn from_dwarf(debug_info: &DebugInfo) -> Option<Self> {
+            let offsets = |type_path: &str, fields: &[&str]| {
+                dwarf::member_offsets(debug_info, type_path, fields).unwrap_or_default()
+            };
+            let request = offsets("http::request::Parts", &["method", "uri", "headers"]);
+            let uri = offsets("http::uri::Uri", &[URI_AUTHORITY_FIELD, URI_PATH_FIELD]);
+            let response = offsets("http::response::Parts", &["status"]);
+            Some(Self {
+                method: *request.get("method")?,
+                uri: *request.get("uri")?,
+                path: *uri.get(URI_PATH_FIELD)?,
+                authority: *uri.get(URI_AUTHORITY_FIELD)?,
+                request_headers: *request.get("headers")?,
+                response_status: *response.get("status")?,
+            })
         }
     }
-}
 
-mod hyper_instrumentor {
-    use super::errors::Result;
-    use super::instrumentors::{Event, Instrumentor};
-    use super::process::TargetDetails;
-    use async_trait::async_trait;
+    const URI_AUTHORITY_FIELD: &str = "authority.data.bytes.ptr";
+    const URI_PATH_FIELD: &str = "path_and_query.data.bytes.ptr";
 
-    pub struct HyperInstrumentor {
-        loaded: bool,
+    /// Runtime addresses of the `clone` functions of the `bytes` crate's
+    /// heap-backed vtables, the values of the `bytes_*_clone` constants in
+    /// header_map.h. Probes only overwrite a header value whose buffer
+    /// these show to be owned by that value alone.
+    #[derive(Debug, Clone, Copy, Default)]
+    pub struct BytesVtables {
+        pub promotable_even_clone: u64,
+        pub promotable_odd_clone: u64,
+        pub shared_clone: u64,
     }
 
-    impl HyperInstrumentor {
-        pub fn new() -> Self {
-            Self { loaded: false }
+    impl BytesVtables {
+        /// Missing functions stay 0, which keeps the probes from writing
+        /// headers.
+        pub fn resolve(symbols: &SymbolTable) -> Self {
+            let address = |name: &str| {
+                symbols.function_address(name).unwrap_or_else(|| {
+                    warn!("{} not found, trace headers will not be injected", name);
+                    0
+                })
+            };
+            Self {
+                promotable_even_clone: address("bytes::bytes::promotable_even_clone"),
+                promotable_odd_clone: address("bytes::bytes::promotable_odd_clone"),
+                shared_clone: address("bytes::bytes::shared_clone"),
+            }
         }
     }
 
-    #[async_trait]
-    impl Instrumentor for HyperInstrumentor {
-        fn library_name(&self) -> &str {
-            "hyper"
-        }
+    #[derive(Debug, Clone)]
+    pub struct FunctionTracingConfig {
+        /// Globs over demangled names, e.g. `myapp::billing::*`, or regular
+        /// expressions after `re:`, e.g. `re:myapp::(orders|billing)::.*`.
+        pub patterns: Vec<String>,
+        /// Globs over the paths of async fns, traced from their first poll
+        /// until they return `Ready`.
+        pub async_patterns: Vec<String>,
+        /// Arguments, or fields reached from them, recorded on the spans of
+        /// traced functions matching each glob, e.g. `req.tenant_id`.
+        pub captures: Vec<(String, Vec<String>)>,
+        /// Globs over traced functions returning a `Result` whose `Err`
+        /// marks their span and the request as errored.
+        pub error_patterns: Vec<String>,
+        /// Matches beyond this are not attached.
+        pub max_functions: usize,
+        /// Calls timed per function, per CPU and per second. Zero means
+        /// unlimited.
+        pub max_calls_per_sec: u64,
+        /// Calls shorter than this are not reported.
+        pub min_duration: std::time::Duration,
+    }
 
-        fn func_names(&self) -> Vec<&str> {
-            vec![
-                "hyper::proto::h1::dispatch::Dispatcher<D,Bs,I,T>::poll_read",
-                "hyper::server::conn::Http::serve_connection",
-                "<hyper::server::server::Server<I,S,E>>::serve",
-            ]
+    impl FunctionTracingConfig {
+        /// Parses `glob=expr,expr` entries separated by semicolons, e.g.
+        /// `myapp::billing::charge=tenant,items;myapp::*::handle=req.path`.
+        pub fn parse_captures(spec: &str) -> Result<Vec<(String, Vec<String>)>> {
+            spec.split(';')
+                .map(str::trim)
+                .filter(|entry| !entry.is_empty())
+                .map(|entry| {
+                    let (pattern, exprs) = entry.split_once('=').ok_or_else(|| {
+                        Error::InvalidConfig(format!("Expected glob=expr,.., got {}", entry))
+                    })?;
+                    let exprs: Vec<String> = exprs
+                        .split(',')
+                        .map(str::trim)
+                        .filter(|expr| !expr.is_empty())
+                        .map(String::from)
+                        .collect();
+                    let is_path = |expr: &String| {
+                        expr.split('.').all(|part| {
+                            !part.is_empty()
+                                && part.chars().all(|c| c.is_alphanumeric() || c == '_')
+                        })
+                    };
+                    if exprs.is_empty() || !exprs.iter().all(is_path) {
+                        return Err(Error::InvalidConfig(format!(
+                            "Invalid capture expressions in {}",
+                            entry
+                        )));
+                    }
+                    Ok((pattern.trim().to_string(), exprs))
+                })
+                .collect()
         }
+    }
 
-        async fn load(&mut self, _target: &TargetDetails) -> Result<()> {
-            self.loaded = true;
-            Ok(())
+    #[derive(Debug, Clone)]
+    pub struct SlowRequestConfig {
+        /// Threshold for routes without their own; zero means only the
+        /// listed routes are captured.
+        pub default_threshold: std::time::Duration,
+        pub route_thresholds: Vec<(String, std::time::Duration)>,
+    }
+
+    impl SlowRequestConfig {
+        /// Parses `route=millis` pairs separated by commas, e.g.
+        /// `/api/orders=200,/pkg.Service/Method=50`.
+        pub fn parse_routes(spec: &str) -> Result<Vec<(String, std::time::Duration)>> {
+            spec.split(',')
+                .map(str::trim)
+                .filter(|entry| !entry.is_empty())
+                .map(|entry| {
+                    let (route, millis) = entry.rsplit_once('=').ok_or_else(|| {
+                        Error::InvalidConfig(format!("Expected route=millis, got {}", entry))
+                    })?;
+                    let millis: u64 = millis.trim().parse().map_err(|_| {
+                        Error::InvalidConfig(format!("Invalid threshold in {}", entry))
+                    })?;
+                    Ok((
+                        route.trim().to_string(),
+                        std::time::Duration::from_millis(millis),
+                    ))
+                })
+                .collect()
         }
 
-        async fn run(&self, _events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
-            Ok(())
+        /// Values of the probes' `slow_request_capture_enabled` and
+        /// `slow_request_threshold_ns` constants.
+        pub fn constants(&self) -> (u8, u64) {
+            (1, self.default_threshold.as_nanos() as u64)
         }
 
-        fn close(&mut self) {
-            self.loaded = false;
+        /// Entries for the probes' `slow_request_thresholds` map.
+        pub fn route_threshold_entries(&self) -> Vec<(u64, u64)> {
+            self.route_thresholds
+                .iter()
+                .map(|(route, threshold)| (route_hash(route), threshold.as_nanos() as u64))
+                .collect()
         }
     }
-}
 
+    /// FNV-1a hash of a route, as computed in-kernel by `fnv1a_update`.
+    pub fn route_hash(route: &str) -> u64 {
+        route.bytes().fold(0xcbf29ce484222325, |hash, b| {
+            (hash ^ b as u64).wrapping_mul(0x100000001b3)
+        })
+    }
+
+    /// Entries for the probes' `baggage_keys` map, hashed like routes.
+    pub fn baggage_key_entries(keys: &[String]) -> Vec<(u64, u8)> {
+        keys.iter().map(|key| (route_hash(key), 1)).collect()
+    }
+
+    /// `baggage.<key>` attributes for the allowlisted entries a server probe
+    /// kept, `key=value` pairs separated by commas. Values are recorded as
+    /// they were sent, percent-encoding included.
+    pub fn baggage_attributes(entries: &str) -> Vec<(String, String)> {
+        entries
+            .split(',')
+            .filter_map(|entry| entry.split_once('='))
+            .map(|(key, value)| (format!("baggage.{}", key), value.to_string()))
+            .collect()
+    }
+
+    /// Span event carrying the user stacks captured for a slow request.
+    pub fn stack_snapshot_event(
+        symbols: &SymbolTable,
+        entry_stack: &[u64],
+        return_stack: &[u64],
+    ) -> SpanEvent {
+        let mut attributes = Vec::new();
+        if !entry_stack.is_empty() {
+            attributes.push((
+                "code.stacktrace.entry".to_string(),
+                symbols.format_stack(entry_stack),
+            ));
+        }
+        if !return_stack.is_empty() {
+            attributes.push((
+                "code.stacktrace".to_string(),
+                symbols.format_stack(return_stack),
+            ));
+        }
+        SpanEvent {
+            name: "slow_request.stack".to_string(),
+            attributes,
+        }
+    }
+
+    #[derive(Debug, Clone)]
+    pub struct ProfilingConfig {
+        /// Per-CPU sampling frequency of the perf_event program.
+        pub frequency_hz: u64,
+        /// Directory pprof files are written to.
+        pub output_dir: std::path::PathBuf,
+        /// How often in-kernel counts are drained into a profile.
+        pub period: std::time::Duration,
+    }
+
+    /// Names of recently exported spans by span ID, so profile samples
+    /// tagged with a span context can be grouped per endpoint.
+    pub type SpanNames = Arc<Mutex<HashMap<[u8; 8], String>>>;
+
+    const MAX_SPAN_NAMES: usize = 65536;
+
+    /// Mirrors `struct string_definition_t` in string_intern.h.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct StringDefinition {
+        pub id: u64,
+        pub value: [u8; 128],
+    }
+
+    /// Strings interned by the probes, such as route templates, by ID. Each
+    /// ID is defined once per process and then referenced from events.
+    #[derive(Debug, Default)]
+    pub struct InternedStrings {
+        strings: std::sync::RwLock<HashMap<u64, Arc<str>>>,
+    }
+
+    impl InternedStrings {
+        pub fn define(&self, def: &StringDefinition) {
+            if let Ok(mut strings) = self.strings.write() {
+                strings
+                    .entry(def.id)
+                    .or_insert_with(|| Arc::from(c_str(&def.value)));
+            }
+        }
+
+        pub fn resolve(&self, id: u64) -> Option<Arc<str>> {
+            if id == 0 {
+                return None;
+            }
+            self.strings.read().ok()?.get(&id).cloned()
+        }
+    }
+
+    /// Marks of `trace_errors` in span_errors.h.
+    pub const SPAN_ERROR_PANIC: u32 = 0x1;
+    pub const SPAN_ERROR_RESULT: u32 = 0x2;
+
+    /// `error.type` attribute for the error marks of a span, which also
+    /// sets its status. A panic outranks an `Err` it may have caused.
+    pub fn error_attribute(errors: u32) -> Option<(String, String)> {
+        let error_type = if errors & SPAN_ERROR_PANIC != 0 {
+            "panic"
+        } else if errors & SPAN_ERROR_RESULT != 0 {
+            "result"
+        } else {
+            return None;
+        };
+        Some(("error.type".to_string(), error_type.to_string()))
+    }
+
+    /// Mirrors `struct http_request_t` in rust_context.h, reported by every
+    /// HTTP server probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct HttpRequestEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub method: [u8; 16],
+        pub path: [u8; 256],
+        pub status_code: u16,
+        pub route_id: u64,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+        pub polls: PollStats,
+        pub entry_stack_id: i64,
+        pub return_stack_id: i64,
+        pub errors: u32,
+        pub baggage_id: u64,
+    }
+
+    impl HttpRequestEvent {
+        /// Server span named after the route template, so names stay
+        /// low-cardinality however many distinct paths are served.
+        pub fn to_event(&self, library: &str, route: &str, events: Vec<SpanEvent>) -> Event {
+            let method = c_str(&self.method);
+            let mut attributes = vec![
+                ("http.request.method".to_string(), method.clone()),
+                ("url.path".to_string(), c_str(&self.path)),
+                ("http.route".to_string(), route.to_string()),
+                (
+                    "http.response.status_code".to_string(),
+                    self.status_code.to_string(),
+                ),
+            ];
+            attributes.extend(error_attribute(self.errors));
+
+            Event {
+                library: library.to_string(),
+                name: format!("{} {}", method, route),
+                start_time: self.start_time,
+                end_time: self.end_time,
+                kind: opentelemetry::trace::SpanKind::Server,
+                trace_id: self.trace_id,
+                span_id: self.span_id,
+                parent_span_id: (self.parent_span_id != [0; 8]).then_some(self.parent_span_id),
+                attributes,
+                // Polls are only counted while the tokio probe tracks the
+                // task serving the request.
+                poll_stats: (self.polls.polls > 0).then_some(self.polls),
+                events,
+            }
+        }
+    }
+
+    /// Mirrors `struct http_client_request_t` in rust_context.h, reported
+    /// by every HTTP client probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct HttpClientEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub method: [u8; 16],
+        pub host: [u8; 64],
+        pub path: [u8; 256],
+        pub status_code: u16,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+        pub pool: PoolTimings,
+        pub error: u32,
+    }
+
+    /// Mirrors `struct pool_timings`: how a pooled client got its
+    /// connection. All zero for clients without pool probes.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy, Default)]
+    pub struct PoolTimings {
+        pub wait_ns: u64,
+        pub connect_ns: u64,
+        pub outcome: u8,
+    }
+
+    impl PoolTimings {
+        const HIT: u8 = 1;
+        const MISS: u8 = 2;
+
+        fn attributes(&self) -> Vec<(String, String)> {
+            let outcome = match self.outcome {
+                Self::HIT => "hit",
+                Self::MISS => "miss",
+                _ => return Vec::new(),
+            };
+            let mut attributes = vec![
+                ("http.client.pool.outcome".to_string(), outcome.to_string()),
+                (
+                    "http.client.pool.wait_ns".to_string(),
+                    self.wait_ns.to_string(),
+                ),
+            ];
+            if self.connect_ns > 0 {
+                attributes.push((
+                    "http.client.connect_ns".to_string(),
+                    self.connect_ns.to_string(),
+                ));
+            }
+            attributes
+        }
+    }
+
+    impl HttpClientEvent {
+        const CANCELLED: u32 = 0x1;
+        const FAILED: u32 = 0x2;
+
+        pub fn to_event(&self, library: &str) -> Event {
+            let method = c_str(&self.method);
+            let host = c_str(&self.host);
+            let path = c_str(&self.path);
+
+            let mut attributes = vec![
+                ("http.request.method".to_string(), method.clone()),
+                ("server.address".to_string(), host.clone()),
+                ("url.path".to_string(), path),
+            ];
+            if self.status_code != 0 {
+                attributes.push((
+                    "http.response.status_code".to_string(),
+                    self.status_code.to_string(),
+                ));
+            }
+            attributes.extend(self.pool.attributes());
+            let error_type = match self.error {
+                Self::CANCELLED => Some("cancelled"),
+                Self::FAILED => Some("failed"),
+                _ => None,
+            };
+            if let Some(error_type) = error_type {
+                attributes.push(("error.type".to_string(), error_type.to_string()));
+            }
+
+            Event {
+                library: library.to_string(),
+                name: format!("{} {}", method, host),
+                start_time: self.start_time,
+                end_time: self.end_time,
+                kind: opentelemetry::trace::SpanKind::Client,
+                trace_id: self.trace_id,
+                span_id: self.span_id,
+                parent_span_id: (self.parent_span_id != [0; 8]).then_some(self.parent_span_id),
+                attributes,
+                poll_stats: None,
+                events: Vec::new(),
+            }
+        }
+    }
+
+    /// Mirrors `struct db_query_t` in db_query.h, reported by every
+    /// database client probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct DbQueryEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub statement_id: u64,
+        pub rows_affected: u64,
+        pub rows_returned: u64,
+        pub error: u32,
+        pub padding: u32,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+    }
+
+    impl DbQueryEvent {
+        /// Client span named after the statement's operation. `statement`
+        /// is the normalized text interned under the fingerprint, cut
+        /// short by the probe; `system` is unknown for clients that serve
+        /// several databases.
+        pub fn to_event(
+            &self,
+            library: &str,
+            system: Option<&str>,
+            statement: Option<&str>,
+        ) -> Event {
+            let mut attributes = vec![(
+                "db.query.fingerprint".to_string(),
+                format!("{:016x}", self.statement_id),
+            )];
+            if let Some(system) = system {
+                attributes.push(("db.system.name".to_string(), system.to_string()));
+            }
+            let operation = statement
+                .and_then(|statement| statement.split_whitespace().next())
+                .map(|keyword| keyword.to_ascii_uppercase());
+            if let Some(operation) = &operation {
+                attributes.push(("db.operation.name".to_string(), operation.clone()));
+            }
+            if let Some(statement) = statement {
+                attributes.push(("db.query.text".to_string(), statement.to_string()));
+            }
+            attributes.push((
+                "db.response.affected_rows".to_string(),
+                self.rows_affected.to_string(),
+            ));
+            if self.rows_returned > 0 {
+                attributes.push((
+                    "db.response.returned_rows".to_string(),
+                    self.rows_returned.to_string(),
+                ));
+            }
+            if self.error != 0 {
+                attributes.push(("error.type".to_string(), "database".to_string()));
+            }
+
+            Event {
+                library: library.to_string(),
+                name: operation.unwrap_or_else(|| system.unwrap_or(library).to_string()),
+                start_time: self.start_time,
+                end_time: self.end_time,
+                kind: opentelemetry::trace::SpanKind::Client,
+                trace_id: self.trace_id,
+                span_id: self.span_id,
+                parent_span_id: (self.parent_span_id != [0; 8]).then_some(self.parent_span_id),
+                attributes,
+                poll_stats: None,
+                events: Vec::new(),
+            }
+        }
+    }
+
+    /// Route templates of server requests: the one a router reported, when
+    /// its probe sent a template ID, otherwise one learned from the path.
+    pub struct RouteResolver {
+        templates: InternedStrings,
+        normalizer: PathNormalizer,
+    }
+
+    impl RouteResolver {
+        pub fn new(max_routes: usize) -> Self {
+            Self {
+                templates: InternedStrings::default(),
+                normalizer: PathNormalizer::new(max_routes),
+            }
+        }
+
+        pub fn define(&self, def: &StringDefinition) {
+            self.templates.define(def);
+        }
+
+        pub fn resolve(&self, route_id: u64, path: &[u8]) -> Arc<str> {
+            self.templates
+                .resolve(route_id)
+                .unwrap_or_else(|| self.normalizer.normalize(&c_str(path)))
+        }
+
+        /// Other strings interned by the server probes, such as baggage
+        /// attributes, share the templates' definitions.
+        pub fn resolve_string(&self, id: u64) -> Option<Arc<str>> {
+            self.templates.resolve(id)
+        }
+    }
+
+    /// Decodes a NUL-padded buffer filled in by a probe.
+    pub fn c_str(buf: &[u8]) -> String {
+        let len = buf.iter().position(|&b| b == 0).unwrap_or(buf.len());
+        String::from_utf8_lossy(&buf[..len]).into_owned()
+    }
+
+    #[async_trait]
+    pub trait Instrumentor: Send + Sync {
+        fn library_name(&self) -> &str;
+        fn func_names(&self) -> Vec<&str>;
+        async fn load(&mut self, target: &TargetDetails) -> Result<()>;
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()>;
+        fn close(&mut self);
+    }
+
+    pub struct Manager {
+        instrumentors: HashMap<String, Box<dyn Instrumentor>>,
+        controller: Arc<Controller>,
+        span_names: SpanNames,
+    }
+
+    impl Manager {
+        pub fn new(controller: Arc<Controller>, config: Config) -> Self {
+            let mut instrumentors: HashMap<String, Box<dyn Instrumentor>> = HashMap::new();
+
+            let routes = Arc::new(RouteResolver::new(config.max_routes));
+            let propagators = config.propagators;
+            instrumentors.insert(
+                "hyper".to_string(),
+                Box::new(super::hyper_instrumentor::HyperInstrumentor::new(
+                    config.slow_requests.clone(),
+                    Arc::clone(&routes),
+                    config.baggage_keys.clone(),
+                    propagators,
+                )),
+            );
+
+            instrumentors.insert(
+                "actix".to_string(),
+                Box::new(super::actix_instrumentor::ActixInstrumentor::new(
+                    config.slow_requests.clone(),
+                    Arc::clone(&routes),
+                    config.baggage_keys.clone(),
+                    propagators,
+                )),
+            );
+
+            instrumentors.insert(
+                "axum".to_string(),
+                Box::new(super::axum_instrumentor::AxumInstrumentor::new(Arc::clone(
+                    &routes,
+                ))),
+            );
+
+            instrumentors.insert(
+                "hyper_client".to_string(),
+                Box::new(
+                    super::hyper_client_instrumentor::HyperClientInstrumentor::new(
+                        config.baggage_keys.clone(),
+                        propagators,
+                    ),
+                ),
+            );
+
+            instrumentors.insert(
+                "reqwest".to_string(),
+                Box::new(super::reqwest_instrumentor::ReqwestInstrumentor::new(
+                    config.baggage_keys.clone(),
+                    propagators,
+                )),
+            );
+
+            instrumentors.insert(
+                "tonic".to_string(),
+                Box::new(super::tonic_instrumentor::TonicInstrumentor::new(
+                    config.slow_requests.clone(),
+                    config.baggage_keys.clone(),
+                    propagators,
+                )),
+            );
+
+            instrumentors.insert(
+                "tokio".to_string(),
+                Box::new(super::tokio_instrumentor::TokioInstrumentor::new(
+                    config.long_poll_threshold,
+                    config.cpu_accounting,
+                )),
+            );
+
+            instrumentors.insert(
+                "panic".to_string(),
+                Box::new(super::panic_instrumentor::PanicInstrumentor::new()),
+            );
+
+            instrumentors.insert(
+                "sqlx".to_string(),
+                Box::new(super::sqlx_instrumentor::SqlxInstrumentor::new()),
+            );
+
+            instrumentors.insert(
+                "tokio_postgres".to_string(),
+                Box::new(super::postgres_instrumentor::PostgresInstrumentor::new()),
+            );
+
+            if config.tracing_bridge {
+                instrumentors.insert(
+                    "tracing".to_string(),
+                    Box::new(super::tracing_instrumentor::TracingInstrumentor::new()),
+                );
+            }
+
+            if config.sdk_integration {
+                instrumentors.insert(
+                    "opentelemetry_sdk".to_string(),
+                    Box::new(super::otel_sdk_instrumentor::OtelSdkInstrumentor::new()),
+                );
+            }
+
+            if !config.tower_layers.is_empty() {
+                instrumentors.insert(
+                    "tower".to_string(),
+                    Box::new(super::tower_instrumentor::TowerInstrumentor::new(
+                        config.tower_layers,
+                    )),
+                );
+            }
+
+            if let Some(traced_functions) = config.traced_functions {
+                instrumentors.insert(
+                    "functions".to_string(),
+                    Box::new(super::functions_instrumentor::FunctionsInstrumentor::new(
+                        traced_functions,
+                    )),
+                );
+            }
+
+            let span_names = SpanNames::default();
+            if let Some(profiling) = config.profiling {
+                instrumentors.insert(
+                    "profiler".to_string(),
+                    Box::new(super::profiler_instrumentor::ProfilerInstrumentor::new(
+                        profiling,
+                        Arc::clone(&span_names),
+                        routes,
+                    )),
+                );
+            }
+
+            Self {
+                instrumentors,
+                controller,
+                span_names,
+            }
+        }
+
+        pub fn get_relevant_funcs(&self) -> HashMap<String, ()> {
+            let mut funcs = HashMap::new();
+            for inst in self.instrumentors.values() {
+                for func in inst.func_names() {
+                    funcs.insert(func.to_string(), ());
+                }
+            }
+            funcs
+        }
+
+        pub fn filter_unused_instrumentors(&self, target: &TargetDetails) {
+            for (name, inst) in &self.instrumentors {
+                if inst.func_names().is_empty() {
+                    continue;
+                }
+
+                let found = inst
+                    .func_names()
+                    .iter()
+                    .filter(|name| target.functions.iter().any(|f| f.is(name)))
+                    .count();
+
+                if found == 0 {
+                    warn!("Instrumentor {} has no matching functions", name);
+                } else {
+                    info!(
+                        "Instrumentor {} found {}/{} functions",
+                        name,
+                        found,
+                        inst.func_names().len()
+                    );
+                }
+            }
+        }
+
+        pub async fn run(
+            &mut self,
+            target: &TargetDetails,
+            mut shutdown_rx: broadcast::Receiver<()>,
+        ) -> Result<()> {
+            let (events_tx, mut events_rx) = tokio::sync::mpsc::channel::<Event>(1024);
+
+            info!("Starting instrumentors for {} libraries", self.instrumentors.len());
+
+            let controller = Arc::clone(&self.controller);
+            let span_names = Arc::clone(&self.span_names);
+            let events_handler = tokio::spawn(async move {
+                use opentelemetry::trace::{
+                    Span, SpanContext, SpanId, Status, TraceContextExt, TraceFlags, TraceId,
+                    TraceState, Tracer,
+                };
+                use opentelemetry::{Context, KeyValue};
+                let tracer = controller.tracer();
+                let meter = controller.meter();
+
+                let poll_count = meter
+                    .u64_histogram("rust.async.poll.count")
+                    .with_description("Number of polls of the task serving a request")
+                    .build();
+                let poll_busy = meter
+                    .u64_histogram("rust.async.poll.busy_time")
+                    .with_unit("ns")
+                    .with_description("Time spent inside polls of the task serving a request")
+                    .build();
+                let poll_max = meter
+                    .u64_histogram("rust.async.poll.max_duration")
+                    .with_unit("ns")
+                    .with_description("Longest single poll of the task serving a request")
+                    .build();
+                let cpu_time = meter
+                    .u64_counter("rust.request.cpu_time")
+                    .with_unit("ns")
+                    .with_description("On-CPU time spent serving requests, per route")
+                    .build();
+
+                while let Some(event) = events_rx.recv().await {
+                    let trace_id = TraceId::from_bytes(event.trace_id);
+
+                    // Spans whose context was propagated downstream must be
+                    // exported with the same IDs the probes injected.
+                    let parent_cx = match event.parent_span_id {
+                        Some(parent_span_id) => {
+                            Context::new().with_remote_span_context(SpanContext::new(
+                                trace_id,
+                                SpanId::from_bytes(parent_span_id),
+                                TraceFlags::SAMPLED,
+                                true,
+                                TraceState::default(),
+                            ))
+                        }
+                        None => Context::new(),
+                    };
+
+                    let mut span = tracer
+                        .span_builder(event.name.clone())
+                        .with_kind(event.kind.clone())
+                        .with_trace_id(trace_id)
+                        .with_span_id(SpanId::from_bytes(event.span_id))
+                        .start_with_context(tracer, &parent_cx);
+
+                    if let Some(stats) = event.poll_stats {
+                        let wait_ns = stats.wait_ns(event.start_time, event.end_time);
+                        span.set_attribute(KeyValue::new(
+                            "rust.async.poll_count",
+                            stats.polls as i64,
+                        ));
+                        span.set_attribute(KeyValue::new(
+                            "rust.async.busy_ns",
+                            stats.busy_ns as i64,
+                        ));
+                        span.set_attribute(KeyValue::new("rust.async.wait_ns", wait_ns as i64));
+                        span.set_attribute(KeyValue::new(
+                            "rust.async.max_poll_ns",
+                            stats.max_poll_ns as i64,
+                        ));
+
+                        let attrs = [KeyValue::new("span.name", event.name.clone())];
+                        poll_count.record(stats.polls, &attrs);
+                        poll_busy.record(stats.busy_ns, &attrs);
+                        poll_max.record(stats.max_poll_ns, &attrs);
+
+                        if stats.cpu_ns > 0 {
+                            span.set_attribute(KeyValue::new(
+                                "rust.cpu_time_ns",
+                                stats.cpu_ns as i64,
+                            ));
+
+                            let route = event
+                                .attributes
+                                .iter()
+                                .find(|(key, _)| key == "http.route")
+                                .map(|(_, value)| value.clone())
+                                .unwrap_or_else(|| event.name.clone());
+                            cpu_time.add(stats.cpu_ns, &[KeyValue::new("http.route", route)]);
+                        }
+                    }
+
+                    for (key, value) in event.attributes {
+                        if key == "error.type" {
+                            span.set_status(Status::error(value.clone()));
+                        }
+                        span.set_attribute(opentelemetry::KeyValue::new(key, value));
+                    }
+
+                    for span_event in event.events {
+                        let attributes = span_event
+                            .attributes
+                            .into_iter()
+                            .map(|(key, value)| KeyValue::new(key, value))
+                            .collect();
+                        span.add_event(span_event.name, attributes);
+                    }
+
+                    span.end();
+
+                    if let Ok(mut names) = span_names.lock() {
+                        if names.len() >= MAX_SPAN_NAMES {
+                            names.clear();
+                        }
+                        names.insert(event.span_id, event.name);
+                    }
+                }
+            });
+
+            // The other probes find the task a thread is polling through
+            // the tokio probe, so it is attached first.
+            let mut instrumentors: Vec<_> = self.instrumentors.iter_mut().collect();
+            instrumentors.sort_by_key(|(name, _)| name.as_str() != "tokio");
+            for (name, inst) in instrumentors {
+                if let Err(e) = inst.load(target).await {
+                    warn!("Failed to load instrumentor {}: {}", name, e);
+                    continue;
+                }
+                if let Err(e) = inst.run(events_tx.clone()).await {
+                    warn!("Failed to run instrumentor {}: {}", name, e);
+                }
+            }
+
+            let result = tokio::select! {
+                _ = shutdown_rx.recv() => {
+                    info!("Shutdown signal received");
+                    Err(Error::Interrupted)
+                }
+                _ = events_handler => {
+                    info!("Events handler completed");
+                    Ok(())
+                }
+            };
+
+            for inst in self.instrumentors.values_mut() {
+                inst.close();
+            }
+            result
+        }
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+
+        #[test]
+        fn propagators_parse_names() {
+            assert_eq!(
+                Propagators::parse("tracecontext,b3multi").unwrap(),
+                Propagators(Propagators::W3C | Propagators::B3_MULTI)
+            );
+            assert_eq!(
+                Propagators::parse(" b3 , jaeger ,").unwrap(),
+                Propagators(Propagators::B3_SINGLE | Propagators::JAEGER)
+            );
+            assert_eq!(
+                Propagators::parse("tracecontext,tracecontext").unwrap(),
+                Propagators(Propagators::W3C)
+            );
+            assert_eq!(Propagators::default(), Propagators(Propagators::W3C));
+        }
+
+        #[test]
+        fn propagators_parse_empty_and_none() {
+            assert_eq!(Propagators::parse("").unwrap(), Propagators(0));
+            assert_eq!(Propagators::parse(" , ").unwrap(), Propagators(0));
+            assert_eq!(Propagators::parse("none").unwrap(), Propagators(0));
+            assert_eq!(
+                Propagators::parse("baggage,tracecontext").unwrap(),
+                Propagators(Propagators::W3C)
+            );
+        }
+
+        #[test]
+        fn propagators_parse_rejects_unknown_names() {
+            assert!(matches!(
+                Propagators::parse("xray"),
+                Err(Error::InvalidConfig(_))
+            ));
+            assert!(matches!(
+                Propagators::parse("tracecontext,B3"),
+                Err(Error::InvalidConfig(_))
+            ));
+        }
+
+        #[test]
+        fn route_hash_is_fnv1a() {
+            assert_eq!(route_hash(""), 0xcbf29ce484222325);
+            assert_eq!(route_hash("a"), 0xaf63dc4c8601ec8c);
+            assert_eq!(route_hash("foobar"), 0x85944171f73967e8);
+            assert_ne!(route_hash("/users/{id}"), route_hash("/users/{id}/"));
+        }
+
+        #[test]
+        fn baggage_key_entries_hash_each_key() {
+            assert!(baggage_key_entries(&[]).is_empty());
+            assert_eq!(
+                baggage_key_entries(&["user.id".to_string(), "".to_string()]),
+                vec![(route_hash("user.id"), 1), (route_hash(""), 1)]
+            );
+        }
+
+        #[test]
+        fn baggage_attributes_split_entries() {
+            assert!(baggage_attributes("").is_empty());
+            assert!(baggage_attributes("novalue").is_empty());
+            assert_eq!(
+                baggage_attributes("user=J%C3%B6rg,broken,tenant="),
+                vec![
+                    ("baggage.user".to_string(), "J%C3%B6rg".to_string()),
+                    ("baggage.tenant".to_string(), String::new()),
+                ]
+            );
+            assert_eq!(
+                baggage_attributes("k=v=w"),
+                vec![("baggage.k".to_string(), "v=w".to_string())]
+            );
+        }
+
+        #[test]
+        fn route_thresholds_are_keyed_by_route_hash() {
+            let config = SlowRequestConfig {
+                default_threshold: std::time::Duration::ZERO,
+                route_thresholds: SlowRequestConfig::parse_routes("/api/orders=200, /a/b=5")
+                    .unwrap(),
+            };
+            assert_eq!(config.constants(), (1, 0));
+            assert_eq!(
+                config.route_threshold_entries(),
+                vec![
+                    (route_hash("/api/orders"), 200_000_000),
+                    (route_hash("/a/b"), 5_000_000),
+                ]
+            );
+            assert!(matches!(
+                SlowRequestConfig::parse_routes("/api/orders"),
+                Err(Error::InvalidConfig(_))
+            ));
+        }
+
+        #[test]
+        fn routes_fall_back_to_the_learned_template() {
+            let routes = RouteResolver::new(100);
+            let mut path = [0u8; 128];
+            path[..9].copy_from_slice(b"/users/42");
+            // No router reported a template for the request.
+            assert_eq!(&*routes.resolve(0, &path), "/users/{id}");
+
+            let mut def = StringDefinition {
+                id: route_hash("/users/:id"),
+                value: [0; 128],
+            };
+            def.value[..10].copy_from_slice(b"/users/:id");
+            // A template ID that was not defined yet, as after a perf drop.
+            assert_eq!(&*routes.resolve(def.id, &path), "/users/{id}");
+            routes.define(&def);
+            assert_eq!(&*routes.resolve(def.id, &path), "/users/:id");
+        }
+    }
+}
+
+#[macro_use]
+mod probes {
+    use super::dwarf::{ArgLoc, CaptureRecipe, ResultRecipe};
+    use super::errors::{Error, Result};
+    use super::instrumentors::{
+        BytesVtables, Event, HeaderMapLayout, HttpLayout, SlowRequestConfig,
+    };
+    use super::process::{FunctionInfo, TargetDetails};
+    use aya::maps::perf::AsyncPerfEventArray;
+    use aya::maps::{HashMap as BpfHashMap, MapData, StackTraceMap};
+    use aya::programs::{TracePoint, UProbe, UProbeAttachLocation};
+    use aya::util::online_cpus;
+    use aya::{Ebpf, EbpfLoader, Pod};
+    use bytes::BytesMut;
+    use log::{debug, warn};
+    use std::path::PathBuf;
+    use std::sync::atomic::{AtomicBool, Ordering};
+    use std::sync::{Arc, Mutex};
+    use tokio::sync::mpsc::Sender;
+
+    /// bpffs directory the maps shared between probes, such as
+    /// `spans_in_progress`, are pinned in, so every probe object uses the
+    /// same instance of each.
+    pub const PIN_PATH: &str = "/sys/fs/bpf/otel-rust-agent";
+
+    /// Events read from a perf buffer at once.
+    const READ_BATCH: usize = 16;
+
+    /// Whether the sched_switch tracepoint that invalidates the per-CPU
+    /// task slot of task_context.h is attached.
+    static TASK_CACHE_ENABLED: AtomicBool = AtomicBool::new(false);
+
+    /// The compiled object of the probe in pkg/instrumentors/bpf/`$name`,
+    /// built into OUT_DIR by build.rs.
+    macro_rules! probe_object {
+        ($name:literal) => {
+            aya::include_bytes_aligned!(concat!(env!("OUT_DIR"), "/", $name, ".bpf.o"))
+        };
+    }
+
+    // Mirror `struct arg_loc`, `struct capture_recipe` and
+    // `struct result_recipe`, plain C structs without padding.
+    unsafe impl Pod for ArgLoc {}
+    unsafe impl Pod for CaptureRecipe {}
+    unsafe impl Pod for ResultRecipe {}
+
+    pub fn ebpf_error(e: impl std::fmt::Display) -> Error {
+        Error::Ebpf(e.to_string())
+    }
+
+    /// Sets the `header_*` and `bytes_*_clone` constants of header_map.h.
+    pub fn set_header_map<'a>(
+        loader: &mut EbpfLoader<'a>,
+        layout: &'a HeaderMapLayout,
+        vtables: &'a BytesVtables,
+    ) {
+        loader
+            .set_global("header_map_kind", &layout.kind, true)
+            .set_global("header_entries_ptr_pos", &layout.entries_ptr, true)
+            .set_global("header_entries_len_pos", &layout.entries_len, true)
+            .set_global("header_bucket_size", &layout.bucket_size, true)
+            .set_global("header_bucket_key_pos", &layout.bucket_key, true)
+            .set_global("header_bucket_value_pos", &layout.bucket_value, true)
+            .set_global(
+                "bytes_promotable_even_clone",
+                &vtables.promotable_even_clone,
+                true,
+            )
+            .set_global(
+                "bytes_promotable_odd_clone",
+                &vtables.promotable_odd_clone,
+                true,
+            )
+            .set_global("bytes_shared_clone", &vtables.shared_clone, true);
+    }
+
+    /// Sets the `*_pos` constants of http_request.h.
+    pub fn set_http_layout<'a>(loader: &mut EbpfLoader<'a>, layout: &'a HttpLayout) {
+        loader
+            .set_global("method_ptr_pos", &layout.method, true)
+            .set_global("uri_ptr_pos", &layout.uri, true)
+            .set_global("path_ptr_pos", &layout.path, true)
+            .set_global("authority_ptr_pos", &layout.authority, true)
+            .set_global("request_headers_pos", &layout.request_headers, true)
+            .set_global("response_status_pos", &layout.response_status, true);
+    }
+
+    /// Sets the `slow_request_*` constants of stack_trace.h, as given by
+    /// [`SlowRequestConfig::constants`].
+    pub fn set_slow_requests<'a>(loader: &mut EbpfLoader<'a>, constants: &'a (u8, u64)) {
+        loader
+            .set_global("slow_request_capture_enabled", &constants.0, true)
+            .set_global("slow_request_threshold_ns", &constants.1, true);
+    }
+
+    /// Writes the per-route thresholds of `config` into the pinned
+    /// `slow_request_thresholds` map and returns the stacks map the
+    /// captured stack IDs refer to.
+    pub fn slow_request_stacks(
+        bpf: &mut Ebpf,
+        config: &SlowRequestConfig,
+    ) -> Result<Arc<StackTraceMap<MapData>>> {
+        let mut thresholds: BpfHashMap<_, u64, u64> = BpfHashMap::try_from(
+            bpf.map_mut("slow_request_thresholds")
+                .ok_or_else(|| ebpf_error("missing slow_request_thresholds map"))?,
+        )
+        .map_err(ebpf_error)?;
+        for (route, threshold) in config.route_threshold_entries() {
+            thresholds.insert(route, threshold, 0).map_err(ebpf_error)?;
+        }
+        user_stacks(bpf)
+    }
+
+    /// Writes the hashed keys of the baggage entries recorded as
+    /// attributes into the pinned `baggage_keys` map of baggage.h.
+    pub fn set_baggage_keys(bpf: &mut Ebpf, entries: &[(u64, u8)]) -> Result<()> {
+        let mut keys: BpfHashMap<_, u64, u8> = BpfHashMap::try_from(
+            bpf.map_mut("baggage_keys")
+                .ok_or_else(|| ebpf_error("missing baggage_keys map"))?,
+        )
+        .map_err(ebpf_error)?;
+        for &(hash, value) in entries {
+            keys.insert(hash, value, 0).map_err(ebpf_error)?;
+        }
+        Ok(())
+    }
+
+    /// Loader pinning the shared maps under [`PIN_PATH`]. Constants are
+    /// set on it before the object is loaded.
+    pub fn loader<'a>() -> Result<EbpfLoader<'a>> {
+        std::fs::create_dir_all(PIN_PATH)?;
+        let mut loader = EbpfLoader::new();
+        loader.map_pin_path(PIN_PATH);
+        let task_cache_enabled = if TASK_CACHE_ENABLED.load(Ordering::Acquire) {
+            &1u8
+        } else {
+            &0u8
+        };
+        loader.set_global("task_cache_enabled", task_cache_enabled, false);
+        Ok(loader)
+    }
+
+    /// Lets the probes loaded from now on read the current task from the
+    /// per-CPU slot, once sched_switch invalidates it.
+    pub fn enable_task_cache() {
+        TASK_CACHE_ENABLED.store(true, Ordering::Release);
+    }
+
+    /// Loads the tracepoint `program` of `bpf` and attaches it to
+    /// `category`:`name`.
+    pub fn attach_tracepoint(
+        bpf: &mut Ebpf,
+        program: &str,
+        category: &str,
+        name: &str,
+    ) -> Result<()> {
+        let tracepoint: &mut TracePoint = bpf
+            .program_mut(program)
+            .ok_or_else(|| ebpf_error(format!("missing {} program", program)))?
+            .try_into()
+            .map_err(ebpf_error)?;
+        tracepoint.load().map_err(ebpf_error)?;
+        tracepoint.attach(category, name).map_err(ebpf_error)?;
+        Ok(())
+    }
+
+    /// A probe object loaded by `run`. Its programs stay attached until it
+    /// is dropped, when the instrumentor is closed.
+    #[derive(Clone, Default)]
+    pub struct LoadedProbe(Arc<Mutex<Option<Ebpf>>>);
+
+    impl LoadedProbe {
+        pub fn keep(&self, bpf: Ebpf) {
+            if let Ok(mut probe) = self.0.lock() {
+                *probe = Some(bpf);
+            }
+        }
+
+        pub fn close(&self) {
+            if let Ok(mut probe) = self.0.lock() {
+                probe.take();
+            }
+        }
+    }
+
+    /// The functions of the target an instrumentor attaches to, resolved
+    /// when it is loaded, with the offsets of their return instructions.
+    #[derive(Debug, Clone, Default)]
+    pub struct ProbeTarget {
+        pid: i32,
+        exe_path: PathBuf,
+        functions: Vec<(FunctionInfo, Vec<u64>)>,
+    }
+
+    impl ProbeTarget {
+        /// The functions of `target` that are one of `names`, demangled
+        /// paths as given to [`FunctionInfo::is`].
+        pub fn new(target: &TargetDetails, names: &[&str]) -> Self {
+            Self::with_functions(
+                target,
+                target
+                    .functions
+                    .iter()
+                    .filter(|f| names.iter().any(|name| f.is(name))),
+            )
+        }
+
+        pub fn pid(&self) -> i32 {
+            self.pid
+        }
+
+        pub fn with_functions<'a>(
+            target: &TargetDetails,
+            functions: impl IntoIterator<Item = &'a FunctionInfo>,
+        ) -> Self {
+            Self {
+                pid: target.pid,
+                exe_path: target.exe_path.clone(),
+                functions: functions
+                    .into_iter()
+                    .map(|f| (f.clone(), target.return_offsets(f)))
+                    .collect(),
+            }
+        }
+
+        /// Attaches `program` to the entry of the functions that are one
+        /// of `names`, returning to how many.
+        pub fn attach_entry(&self, bpf: &mut Ebpf, program: &str, names: &[&str]) -> Result<usize> {
+            let uprobe = uprobe(bpf, program)?;
+            let mut attached = 0;
+            for (function, _) in self.matching(names) {
+                attached += self.attach(uprobe, function, 0, None) as usize;
+            }
+            Ok(attached)
+        }
+
+        /// Attaches `program` to the entry of the functions `cookie` gives
+        /// a BPF cookie for, with that cookie, returning to how many.
+        pub fn attach_entry_with_cookies(
+            &self,
+            bpf: &mut Ebpf,
+            program: &str,
+            cookie: impl Fn(&FunctionInfo) -> Option<u64>,
+        ) -> Result<usize> {
+            let uprobe = uprobe(bpf, program)?;
+            let mut attached = 0;
+            for (function, _) in &self.functions {
+                if let Some(cookie) = cookie(function) {
+                    attached += self.attach(uprobe, function, 0, Some(cookie)) as usize;
+                }
+            }
+            Ok(attached)
+        }
+
+        /// Attaches `program` to every return instruction of the functions
+        /// that are one of `names`, returning to how many functions.
+        pub fn attach_return(
+            &self,
+            bpf: &mut Ebpf,
+            program: &str,
+            names: &[&str],
+        ) -> Result<usize> {
+            let uprobe = uprobe(bpf, program)?;
+            let functions = self.matching(names).map(|f| (f, None));
+            Ok(self.attach_returns(uprobe, functions))
+        }
+
+        /// Like [`ProbeTarget::attach_return`], for the functions `cookie`
+        /// gives a BPF cookie for.
+        pub fn attach_return_with_cookies(
+            &self,
+            bpf: &mut Ebpf,
+            program: &str,
+            cookie: impl Fn(&FunctionInfo) -> Option<u64>,
+        ) -> Result<usize> {
+            let uprobe = uprobe(bpf, program)?;
+            let functions = self
+                .functions
+                .iter()
+                .filter_map(|f| Some((f, Some(cookie(&f.0)?))));
+            Ok(self.attach_returns(uprobe, functions))
+        }
+
+        fn attach_returns<'a>(
+            &self,
+            uprobe: &mut UProbe,
+            functions: impl Iterator<Item = (&'a (FunctionInfo, Vec<u64>), Option<u64>)>,
+        ) -> usize {
+            let mut attached = 0;
+            for ((function, returns), cookie) in functions {
+                if returns.is_empty() {
+                    warn!(
+                        "No return instructions found in {}",
+                        function.demangled_name
+                    );
+                    continue;
+                }
+                let mut ok = true;
+                for &offset in returns {
+                    ok &= self.attach(uprobe, function, offset, cookie);
+                }
+                attached += ok as usize;
+            }
+            attached
+        }
+
+        fn matching<'a>(
+            &'a self,
+            names: &'a [&str],
+        ) -> impl Iterator<Item = &'a (FunctionInfo, Vec<u64>)> {
+            self.functions
+                .iter()
+                .filter(|(f, _)| names.iter().any(|name| f.is(name)))
+        }
+
+        /// Attaches at `offset` into `function`. A function that cannot be
+        /// probed, for instance one inlined away from its symbol, is skipped
+        /// rather than failing the instrumentor.
+        fn attach(
+            &self,
+            uprobe: &mut UProbe,
+            function: &FunctionInfo,
+            offset: u64,
+            cookie: Option<u64>,
+        ) -> bool {
+            let location = UProbeAttachLocation::SymbolOffset(&function.name, offset);
+            match uprobe.attach(location, &self.exe_path, Some(self.pid), cookie) {
+                Ok(_) => true,
+                Err(e) => {
+                    warn!(
+                        "Failed to attach to {}+{:#x}: {}",
+                        function.demangled_name, offset, e
+                    );
+                    false
+                }
+            }
+        }
+    }
+
+    /// Loads the uprobe `program` of `bpf` for attaching.
+    fn uprobe<'a>(bpf: &'a mut Ebpf, program: &str) -> Result<&'a mut UProbe> {
+        let uprobe: &mut UProbe = bpf
+            .program_mut(program)
+            .ok_or_else(|| ebpf_error(format!("missing {} program", program)))?
+            .try_into()
+            .map_err(ebpf_error)?;
+        uprobe.load().map_err(ebpf_error)?;
+        Ok(uprobe)
+    }
+
+    /// The `user_stacks` map of stack_trace.h, taken out of `bpf` so the
+    /// event readers can resolve the stack IDs they receive.
+    pub fn user_stacks(bpf: &mut Ebpf) -> Result<Arc<StackTraceMap<MapData>>> {
+        let stacks = StackTraceMap::try_from(
+            bpf.take_map("user_stacks")
+                .ok_or_else(|| ebpf_error("missing user_stacks map"))?,
+        )
+        .map_err(ebpf_error)?;
+        Ok(Arc::new(stacks))
+    }
+
+    /// Frames of the stack `id` refers to, innermost first. Empty when no
+    /// stack was taken (-1) or it was evicted before it was read.
+    pub fn stack_frames(stacks: &StackTraceMap<MapData>, id: i64) -> Vec<u64> {
+        if id < 0 {
+            return Vec::new();
+        }
+        stacks
+            .get(&(id as u32), 0)
+            .map(|stack| stack.frames().iter().map(|frame| frame.ip).collect())
+            .unwrap_or_default()
+    }
+
+    /// Entry and return stacks of a request, both empty unless slow-request
+    /// capture is on.
+    pub fn slow_request_frames(
+        stacks: Option<&StackTraceMap<MapData>>,
+        entry_stack_id: i64,
+        return_stack_id: i64,
+    ) -> (Vec<u64>, Vec<u64>) {
+        match stacks {
+            Some(stacks) => (
+                stack_frames(stacks, entry_stack_id),
+                stack_frames(stacks, return_stack_id),
+            ),
+            None => Default::default(),
+        }
+    }
+
+    /// Reads the `T`s the perf event array `map` carries on every online
+    /// CPU and sends what `convert` makes of each to `events_tx`. `convert`
+    /// returns `None` for records that are not spans, such as string
+    /// definitions.
+    pub fn read_events<T, F>(
+        bpf: &mut Ebpf,
+        map: &'static str,
+        events_tx: &Sender<Event>,
+        convert: F,
+    ) -> Result<()>
+    where
+        T: Copy + Send + 'static,
+        F: Fn(&T) -> Option<Event> + Clone + Send + 'static,
+    {
+        let mut perf_array = AsyncPerfEventArray::try_from(
+            bpf.take_map(map)
+                .ok_or_else(|| ebpf_error(format!("missing {} map", map)))?,
+        )
+        .map_err(ebpf_error)?;
+
+        for cpu in online_cpus().map_err(|(_, e)| Error::Io(e))? {
+            let mut buf = perf_array.open(cpu, None).map_err(ebpf_error)?;
+            let events_tx = events_tx.clone();
+            let convert = convert.clone();
+            tokio::spawn(async move {
+                let mut buffers = (0..READ_BATCH)
+                    .map(|_| BytesMut::with_capacity(std::mem::size_of::<T>()))
+                    .collect::<Vec<_>>();
+                loop {
+                    let events = match buf.read_events(&mut buffers).await {
+                        Ok(events) => events,
+                        Err(e) => {
+                            warn!("Failed to read {} on CPU {}: {}", map, cpu, e);
+                            return;
+                        }
+                    };
+                    if events.lost > 0 {
+                        debug!("Lost {} records of {} on CPU {}", events.lost, map, cpu);
+                    }
+                    for record in buffers.iter().take(events.read) {
+                        if record.len() < std::mem::size_of::<T>() {
+                            continue;
+                        }
+                        // Records are copied out of the perf buffer without
+                        // any alignment guarantee.
+                        let raw = unsafe { std::ptr::read_unaligned(record.as_ptr() as *const T) };
+                        if let Some(event) = convert(&raw) {
+                            if events_tx.send(event).await.is_err() {
+                                return;
+                            }
+                        }
+                    }
+                }
+            });
+        }
+        Ok(())
+    }
+}
+
+mod hyper_instrumentor {
+    use super::dwarf::{self, ArgLoc};
+    use super::errors::Result;
+    use super::instrumentors::{
+        baggage_attributes, baggage_key_entries, stack_snapshot_event, BytesVtables, Event,
+        HeaderMapLayout, HttpClientEvent, HttpLayout, HttpRequestEvent, Instrumentor, Propagators,
+        RouteResolver, SlowRequestConfig, HEADER_MAP_LAYOUT, HTTP_LAYOUT,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use super::symbols::SymbolTable;
+    use async_trait::async_trait;
+    use log::{info, warn};
+    use std::sync::Arc;
+
+    /// The HTTP/1 server dispatcher of hyper 0.14 and 1.x.
+    const RECV_MSG: [&str; 2] = [
+        "<hyper::proto::h1::dispatch::Server<S,hyper::body::body::Body> as hyper::proto::h1::dispatch::Dispatch>::recv_msg",
+        "<hyper::proto::h1::dispatch::Server<S,hyper::body::incoming::Incoming> as hyper::proto::h1::dispatch::Dispatch>::recv_msg",
+    ];
+    const POLL_MSG: [&str; 2] = [
+        "<hyper::proto::h1::dispatch::Server<S,hyper::body::body::Body> as hyper::proto::h1::dispatch::Dispatch>::poll_msg",
+        "<hyper::proto::h1::dispatch::Server<S,hyper::body::incoming::Incoming> as hyper::proto::h1::dispatch::Dispatch>::poll_msg",
+    ];
+    const ENCODE: &str =
+        "<hyper::proto::h1::role::Server as hyper::proto::h1::Http1Transaction>::encode";
+    const POLL_ACCEPT: &str = "h2::server::Connection<T,B>::poll_accept";
+    const CONVERT_POLL_MESSAGE: &str =
+        "<h2::server::Peer as h2::proto::peer::Peer>::convert_poll_message";
+    const SEND_RESPONSE: &str = "h2::server::SendResponse<B>::send_response";
+    const SEND_REQUEST: &str = "h2::client::SendRequest<B>::send_request";
+    const H2_RESPONSE_POLL: &str =
+        "<h2::client::ResponseFuture as core::future::future::Future>::poll";
+
+    /// The stream store inside an h2 server `Connection`, the
+    /// `OpaqueStreamRef` of `SendResponse` and `ResponseFuture`, and the
+    /// store and stream ID inside it, as tracked for h2 0.3 and 0.4 in
+    /// offset_results.json.
+    const H2_CONN_STREAMS_POS: u64 = 16;
+    const H2_SEND_RESPONSE_STREAM_REF_POS: u64 = 0;
+    const H2_RESPONSE_FUTURE_STREAM_REF_POS: u64 = 0;
+    const H2_STREAM_REF_INNER_POS: u64 = 0;
+    const H2_STREAM_REF_STREAM_ID_POS: u64 = 12;
+
+    /// Types of recv_msg's `msg`, for hyper 0.14 and 1.x.
+    const REQUEST_MSG_TYPES: [&str; 2] = [
+        "core::result::Result<(hyper::proto::MessageHead<hyper::proto::RequestLine>, hyper::body::body::Body), hyper::error::Error>",
+        "core::result::Result<(hyper::proto::MessageHead<hyper::proto::RequestLine>, hyper::body::incoming::Incoming), hyper::error::Error>",
+    ];
+    const METHOD_FIELD: &str = "Ok.__0.__0.subject.__0";
+    const URI_FIELD: &str = "Ok.__0.__0.subject.__1";
+    const HEADERS_FIELD: &str = "Ok.__0.__0.headers";
+    const ENCODE_TYPE: &str = "hyper::proto::h1::Encode<http::status::StatusCode>";
+    const RESPONSE_HEAD_TYPE: &str = "hyper::proto::MessageHead<http::status::StatusCode>";
+
+    /// Offsets the HTTP/1 server probes read, the values of the probe's
+    /// `recv_msg_*_pos`, `encode_head_pos` and `response_head_status_pos`
+    /// constants.
+    #[derive(Debug, Clone, Copy)]
+    pub struct H1Layout {
+        pub method: u64,
+        pub uri: u64,
+        pub headers: u64,
+        pub encode_head: u64,
+        pub response_status: u64,
+    }
+
+    #[derive(Clone)]
+    pub struct HyperInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        h1_layout: Option<H1Layout>,
+        http_layout: HttpLayout,
+        dispatcher_arg_loc: ArgLoc,
+        recv_msg_arg_loc: ArgLoc,
+        poll_msg_arg_loc: ArgLoc,
+        encode_arg_loc: ArgLoc,
+        h2_arg_locs: [ArgLoc; 6],
+        slow_requests: Option<SlowRequestConfig>,
+        symbols: Option<Arc<SymbolTable>>,
+        routes: Arc<RouteResolver>,
+        baggage_keys: Vec<String>,
+        propagators: Propagators,
+        bytes_vtables: BytesVtables,
+    }
+
+    impl HyperInstrumentor {
+        pub fn new(
+            slow_requests: Option<SlowRequestConfig>,
+            routes: Arc<RouteResolver>,
+            baggage_keys: Vec<String>,
+            propagators: Propagators,
+        ) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                h1_layout: None,
+                http_layout: HTTP_LAYOUT,
+                dispatcher_arg_loc: ArgLoc::ABI,
+                recv_msg_arg_loc: ArgLoc::ABI,
+                poll_msg_arg_loc: ArgLoc::ABI,
+                encode_arg_loc: ArgLoc::ABI,
+                h2_arg_locs: [ArgLoc::ABI; 6],
+                slow_requests,
+                symbols: None,
+                routes,
+                baggage_keys,
+                propagators,
+                bytes_vtables: BytesVtables::default(),
+            }
+        }
+
+        pub fn request_event_to_span(
+            &self,
+            raw: &HttpRequestEvent,
+            entry_stack: &[u64],
+            return_stack: &[u64],
+        ) -> Event {
+            let route = self.routes.resolve(raw.route_id, &raw.path);
+
+            let mut events = Vec::new();
+            if let Some(symbols) = &self.symbols {
+                if !entry_stack.is_empty() || !return_stack.is_empty() {
+                    events.push(stack_snapshot_event(symbols, entry_stack, return_stack));
+                }
+            }
+
+            let mut event = raw.to_event("hyper", &route, events);
+            if let Some(baggage) = self.routes.resolve_string(raw.baggage_id) {
+                event.attributes.extend(baggage_attributes(&baggage));
+            }
+            event
+        }
+
+        /// Client span of an HTTP/2 stream opened through hyper.
+        pub fn client_event_to_span(&self, raw: &HttpClientEvent) -> Event {
+            raw.to_event("hyper")
+        }
+
+        /// Values of the probe's `poll_accept_arg_loc`, `stream_id_arg_loc`,
+        /// `send_response_arg_loc`, `response_arg_loc`,
+        /// `send_request_arg_loc` and `response_future_arg_loc` constants.
+        pub fn h2_arg_locs(&self) -> [ArgLoc; 6] {
+            self.h2_arg_locs
+        }
+
+        /// Values of the probe's `slow_request_capture_enabled` and
+        /// `slow_request_threshold_ns` constants.
+        pub fn slow_request_constants(&self) -> (u8, u64) {
+            self.slow_requests
+                .as_ref()
+                .map_or((0, 0), SlowRequestConfig::constants)
+        }
+
+        /// Value of the probe's `baggage_enabled` constant.
+        pub fn baggage_enabled(&self) -> u8 {
+            !self.baggage_keys.is_empty() as u8
+        }
+
+        /// Entries for the probe's `baggage_keys` map.
+        pub fn baggage_key_entries(&self) -> Vec<(u64, u8)> {
+            baggage_key_entries(&self.baggage_keys)
+        }
+
+        /// Value of the probe's `propagators` constant.
+        pub fn propagators(&self) -> u32 {
+            self.propagators.0
+        }
+
+        /// Values of the probe's `header_*` constants.
+        pub fn header_map_layout(&self) -> HeaderMapLayout {
+            HEADER_MAP_LAYOUT
+        }
+
+        /// Values of the probe's `bytes_*_clone` constants.
+        pub fn bytes_vtables(&self) -> BytesVtables {
+            self.bytes_vtables
+        }
+
+        pub fn symbols(&self) -> Option<&SymbolTable> {
+            self.symbols.as_deref()
+        }
+    }
+
+    /// Reads the HTTP/1 layout from the target's DWARF. The request head is
+    /// only reachable through hyper's internal types, so there is no
+    /// fallback without debug info.
+    fn h1_layout(target: &TargetDetails) -> Option<H1Layout> {
+        let offsets = |type_path: &str, fields: &[&str]| {
+            dwarf::member_offsets(&target.debug_info, type_path, fields).unwrap_or_default()
+        };
+        let request_fields = [METHOD_FIELD, URI_FIELD, HEADERS_FIELD];
+        let (method, uri, headers) = REQUEST_MSG_TYPES.iter().find_map(|type_path| {
+            let request = offsets(type_path, &request_fields);
+            Some((
+                *request.get(METHOD_FIELD)?,
+                *request.get(URI_FIELD)?,
+                *request.get(HEADERS_FIELD)?,
+            ))
+        })?;
+        Some(H1Layout {
+            method,
+            uri,
+            headers,
+            encode_head: *offsets(ENCODE_TYPE, &["head"]).get("head")?,
+            response_status: *offsets(RESPONSE_HEAD_TYPE, &["subject"]).get("subject")?,
+        })
+    }
+
+    #[async_trait]
+    impl Instrumentor for HyperInstrumentor {
+        fn library_name(&self) -> &str {
+            "hyper"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![
+                "hyper::proto::h1::dispatch::Dispatcher<D,Bs,I,T>::poll_read",
+                "<hyper::server::server::Server<I,S,E>>::serve",
+                RECV_MSG[0],
+                RECV_MSG[1],
+                POLL_MSG[0],
+                POLL_MSG[1],
+                ENCODE,
+                POLL_ACCEPT,
+                CONVERT_POLL_MESSAGE,
+                SEND_RESPONSE,
+                SEND_REQUEST,
+                H2_RESPONSE_POLL,
+            ]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            if self.slow_requests.is_some() {
+                self.symbols = Some(Arc::clone(&target.symbols));
+            }
+            self.h1_layout = h1_layout(target);
+            match self.h1_layout {
+                Some(layout) => info!("Tracing hyper HTTP/1 requests, layout {:?}", layout),
+                None => warn!(
+                    "Tracing hyper HTTP/1 requests needs debug info describing {}",
+                    RESPONSE_HEAD_TYPE
+                ),
+            }
+            self.http_layout = HttpLayout::from_dwarf(&target.debug_info).unwrap_or(HTTP_LAYOUT);
+            self.dispatcher_arg_loc = target.arg_loc(&RECV_MSG, "self");
+            self.recv_msg_arg_loc = target.arg_loc(&RECV_MSG, "msg");
+            self.poll_msg_arg_loc = target.arg_loc(&POLL_MSG, "self");
+            self.encode_arg_loc = target.arg_loc(&[ENCODE], "msg");
+            self.h2_arg_locs = [
+                target.arg_loc(&[POLL_ACCEPT], "self"),
+                target.arg_loc(&[CONVERT_POLL_MESSAGE], "stream_id"),
+                target.arg_loc(&[SEND_RESPONSE], "self"),
+                target.arg_loc(&[SEND_RESPONSE], "response"),
+                target.arg_loc(&[SEND_REQUEST], "request"),
+                target.arg_loc(&[H2_RESPONSE_POLL], "self"),
+            ];
+            self.bytes_vtables = BytesVtables::resolve(&target.symbols);
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches the HTTP/2 stream probes
+        /// and, when the request head's layout is known, the HTTP/1 server
+        /// probes, and reads the server and client spans they report.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let header_map = self.header_map_layout();
+            let slow_requests = self.slow_request_constants();
+            let [poll_accept, stream_id, send_response, response, send_request, response_future] =
+                self.h2_arg_locs();
+            let baggage_enabled = self.baggage_enabled();
+            let propagators = self.propagators();
+            let mut loader = probes::loader()?;
+            probes::set_header_map(&mut loader, &header_map, &self.bytes_vtables);
+            probes::set_http_layout(&mut loader, &self.http_layout);
+            probes::set_slow_requests(&mut loader, &slow_requests);
+            loader
+                .set_global("baggage_enabled", &baggage_enabled, true)
+                .set_global("propagators", &propagators, true)
+                .set_global("h2_conn_streams_pos", &H2_CONN_STREAMS_POS, true)
+                .set_global(
+                    "h2_send_response_stream_ref_pos",
+                    &H2_SEND_RESPONSE_STREAM_REF_POS,
+                    true,
+                )
+                .set_global(
+                    "h2_response_future_stream_ref_pos",
+                    &H2_RESPONSE_FUTURE_STREAM_REF_POS,
+                    true,
+                )
+                .set_global("h2_stream_ref_inner_pos", &H2_STREAM_REF_INNER_POS, true)
+                .set_global(
+                    "h2_stream_ref_stream_id_pos",
+                    &H2_STREAM_REF_STREAM_ID_POS,
+                    true,
+                )
+                .set_global("poll_accept_arg_loc", &poll_accept, true)
+                .set_global("stream_id_arg_loc", &stream_id, true)
+                .set_global("send_response_arg_loc", &send_response, true)
+                .set_global("response_arg_loc", &response, true)
+                .set_global("send_request_arg_loc", &send_request, true)
+                .set_global("response_future_arg_loc", &response_future, true);
+            if let Some(h1) = &self.h1_layout {
+                loader
+                    .set_global("recv_msg_method_pos", &h1.method, true)
+                    .set_global("recv_msg_uri_pos", &h1.uri, true)
+                    .set_global("recv_msg_headers_pos", &h1.headers, true)
+                    .set_global("encode_head_pos", &h1.encode_head, true)
+                    .set_global("response_head_status_pos", &h1.response_status, true)
+                    .set_global("dispatcher_arg_loc", &self.dispatcher_arg_loc, true)
+                    .set_global("recv_msg_arg_loc", &self.recv_msg_arg_loc, true)
+                    .set_global("poll_msg_arg_loc", &self.poll_msg_arg_loc, true)
+                    .set_global("encode_arg_loc", &self.encode_arg_loc, true);
+            }
+            let mut bpf = loader.load(probe_object!("hyper")).map_err(ebpf_error)?;
+            probes::set_baggage_keys(&mut bpf, &self.baggage_key_entries())?;
+
+            let target = &self.target;
+            if self.h1_layout.is_some() {
+                let dispatchers =
+                    target.attach_entry(&mut bpf, "uprobe_hyper_h1_recv_msg", &RECV_MSG)?;
+                target.attach_entry(&mut bpf, "uprobe_hyper_h1_poll_msg", &POLL_MSG)?;
+                target.attach_entry(&mut bpf, "uprobe_hyper_h1_encode", &[ENCODE])?;
+                info!("Tracing {} hyper HTTP/1 dispatchers", dispatchers);
+            }
+            let connections =
+                target.attach_entry(&mut bpf, "uprobe_h2_server_poll_accept", &[POLL_ACCEPT])?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_h2_server_poll_accept_return",
+                &[POLL_ACCEPT],
+            )?;
+            target.attach_entry(
+                &mut bpf,
+                "uprobe_h2_server_convert_poll_message",
+                &[CONVERT_POLL_MESSAGE],
+            )?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_h2_server_convert_poll_message_return",
+                &[CONVERT_POLL_MESSAGE],
+            )?;
+            target.attach_entry(&mut bpf, "uprobe_h2_server_send_response", &[SEND_RESPONSE])?;
+            let clients =
+                target.attach_entry(&mut bpf, "uprobe_h2_client_send_request", &[SEND_REQUEST])?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_h2_client_send_request_return",
+                &[SEND_REQUEST],
+            )?;
+            target.attach_entry(
+                &mut bpf,
+                "uprobe_h2_client_response_poll",
+                &[H2_RESPONSE_POLL],
+            )?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_h2_client_response_poll_return",
+                &[H2_RESPONSE_POLL],
+            )?;
+            info!(
+                "Tracing {} h2 server connection and {} client types",
+                connections, clients
+            );
+
+            let stacks = match &self.slow_requests {
+                Some(config) => Some(probes::slow_request_stacks(&mut bpf, config)?),
+                None => None,
+            };
+            let hyper = Arc::new(self.clone());
+            let server = Arc::clone(&hyper);
+            probes::read_events(
+                &mut bpf,
+                "events",
+                &events_tx,
+                move |raw: &HttpRequestEvent| {
+                    let (entry, ret) = probes::slow_request_frames(
+                        stacks.as_deref(),
+                        raw.entry_stack_id,
+                        raw.return_stack_id,
+                    );
+                    Some(server.request_event_to_span(raw, &entry, &ret))
+                },
+            )?;
+            probes::read_events(
+                &mut bpf,
+                "http_client_events",
+                &events_tx,
+                move |raw: &HttpClientEvent| Some(hyper.client_event_to_span(raw)),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod actix_instrumentor {
+    use super::dwarf::{self, ArgLoc};
+    use super::errors::Result;
+    use super::instrumentors::{
+        baggage_attributes, baggage_key_entries, stack_snapshot_event, BytesVtables, Event,
+        HeaderMapLayout, HttpLayout, HttpRequestEvent, Instrumentor, Propagators, RouteResolver,
+        SlowRequestConfig, StringDefinition, HTTP_LAYOUT,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use super::symbols::SymbolTable;
+    use async_trait::async_trait;
+    use log::{info, warn};
+    use std::sync::Arc;
+
+    const APP_CALL: &str = "<actix_web::app_service::AppInitService<T,B> as actix_service::Service<actix_http::requests::request::Request>>::call";
+    const RESOURCE_MATCH: &str = "actix_router::resource::ResourceDef::capture_match_info_fn";
+    const SEND_RESPONSE: &str =
+        "actix_http::h1::dispatcher::InnerDispatcher<T,S,B,X,U>::send_response_inner";
+
+    /// `actix_http::Request` with its default `BoxedPayloadStream`.
+    const REQUEST_TYPE: &str = "actix_http::requests::request::Request<core::pin::Pin<alloc::boxed::Box<dyn futures_core::stream::Stream<Item=core::result::Result<bytes::bytes::Bytes, actix_http::error::PayloadError>>, alloc::alloc::Global>>>";
+    /// The `Rc<RequestHead>` in the request's `Message<RequestHead>`.
+    const REQUEST_HEAD_FIELD: &str = "head.head.ptr.pointer";
+    /// `RcBox` was renamed `RcInner` in Rust 1.84.
+    const RC_TYPES: [&str; 2] = [
+        "alloc::rc::RcInner<actix_http::requests::head::RequestHead>",
+        "alloc::rc::RcBox<actix_http::requests::head::RequestHead>",
+    ];
+    const REQUEST_HEAD_TYPE: &str = "actix_http::requests::head::RequestHead";
+    const RESPONSE_HEAD_TYPE: &str = "actix_http::responses::head::ResponseHead";
+    const RESOURCE_DEF_TYPE: &str = "actix_router::resource::ResourceDef";
+    const PATTERN_LEN_FIELD: &str = "patterns.Single.__0.vec.len";
+    /// `RawVec` keeps its pointer in a `RawVecInner` since Rust 1.84.
+    const PATTERN_PTR_FIELDS: [&str; 2] = [
+        "patterns.Single.__0.vec.buf.inner.ptr.pointer.pointer",
+        "patterns.Single.__0.vec.buf.ptr.pointer.pointer",
+    ];
+    const HEADER_MAP_TYPE: &str = "actix_http::header::map::HeaderMap";
+    /// The hashbrown `RawTableInner` of the map, an `AHashMap` wrapping a
+    /// std `HashMap` or the std `HashMap` itself.
+    const HEADER_TABLE_FIELDS: [&str; 2] = ["inner.__0.base.table.table", "inner.base.table.table"];
+    const HEADER_BUCKET_TYPE: &str =
+        "(http::header::name::HeaderName, actix_http::header::map::Value)";
+    /// The first `HeaderValue` of the `SmallVec<[HeaderValue; 4]>` in a
+    /// `Value`, with smallvec's enum or union storage. Values that spilled
+    /// to the heap are not read.
+    const HEADER_VALUE_FIELDS: [&str; 2] = ["__1.inner.data.Inline.__0", "__1.inner.data.inline"];
+
+    /// Offsets the actix probe reads, the values of its `request_head_pos`,
+    /// `rc_value_pos`, `method_ptr_pos`, `uri_ptr_pos`,
+    /// `response_head_status_pos` and `resource_*_pos` constants.
+    #[derive(Debug, Clone, Copy)]
+    pub struct ActixLayout {
+        pub request_head: u64,
+        pub rc_value: u64,
+        pub method: u64,
+        pub uri: u64,
+        pub response_status: u64,
+        pub pattern_ptr: u64,
+        pub pattern_len: u64,
+        pub is_prefix: u64,
+    }
+
+    /// Server spans for actix-web, which serves requests with its own
+    /// actix-http dispatcher instead of hyper's. The span starts when the
+    /// app service is called, takes its route from the `ResourceDef`s the
+    /// router matched on the way from the app to the resource and ends when
+    /// the dispatcher sends the response. actix types are only described by
+    /// the target's debug info; without it the probe is not attached.
+    #[derive(Clone)]
+    pub struct ActixInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        layout: Option<ActixLayout>,
+        http_layout: HttpLayout,
+        request_headers: u64,
+        header_map: Option<HeaderMapLayout>,
+        request_arg_loc: ArgLoc,
+        resource_arg_loc: ArgLoc,
+        response_arg_loc: ArgLoc,
+        slow_requests: Option<SlowRequestConfig>,
+        symbols: Option<Arc<SymbolTable>>,
+        routes: Arc<RouteResolver>,
+        baggage_keys: Vec<String>,
+        propagators: Propagators,
+    }
+
+    impl ActixInstrumentor {
+        pub fn new(
+            slow_requests: Option<SlowRequestConfig>,
+            routes: Arc<RouteResolver>,
+            baggage_keys: Vec<String>,
+            propagators: Propagators,
+        ) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                layout: None,
+                http_layout: HTTP_LAYOUT,
+                request_headers: 0,
+                header_map: None,
+                request_arg_loc: ArgLoc::ABI,
+                resource_arg_loc: ArgLoc::ABI,
+                response_arg_loc: ArgLoc::ABI,
+                slow_requests,
+                symbols: None,
+                routes,
+                baggage_keys,
+                propagators,
+            }
+        }
+
+        /// `None` when the probe must not be attached.
+        pub fn layout(&self) -> Option<ActixLayout> {
+            self.layout
+        }
+
+        /// Values of the probe's `request_arg_loc`, `resource_arg_loc` and
+        /// `response_arg_loc` constants.
+        pub fn arg_locs(&self) -> (ArgLoc, ArgLoc, ArgLoc) {
+            (
+                self.request_arg_loc,
+                self.resource_arg_loc,
+                self.response_arg_loc,
+            )
+        }
+
+        /// Value of the probe's `request_headers_pos` constant.
+        pub fn request_headers(&self) -> u64 {
+            self.request_headers
+        }
+
+        /// Values of the probe's `header_*` constants.
+        pub fn header_map_layout(&self) -> Option<HeaderMapLayout> {
+            self.header_map
+        }
+
+        /// Value of the probe's `baggage_enabled` constant. Headers are
+        /// only read when the debug info describes actix's `HeaderMap`.
+        pub fn baggage_enabled(&self) -> u8 {
+            (!self.baggage_keys.is_empty() && self.header_map.is_some()) as u8
+        }
+
+        /// Entries for the probe's `baggage_keys` map.
+        pub fn baggage_key_entries(&self) -> Vec<(u64, u8)> {
+            baggage_key_entries(&self.baggage_keys)
+        }
+
+        /// Value of the probe's `propagators` constant, none without
+        /// actix's `HeaderMap` layout.
+        pub fn propagators(&self) -> u32 {
+            match self.header_map {
+                Some(_) => self.propagators.0,
+                None => 0,
+            }
+        }
+
+        /// Values of the probe's `slow_request_capture_enabled` and
+        /// `slow_request_threshold_ns` constants.
+        pub fn slow_request_constants(&self) -> (u8, u64) {
+            self.slow_requests
+                .as_ref()
+                .map_or((0, 0), SlowRequestConfig::constants)
+        }
+
+        pub fn define_route(&self, def: &StringDefinition) {
+            self.routes.define(def);
+        }
+
+        pub fn request_event_to_span(
+            &self,
+            raw: &HttpRequestEvent,
+            entry_stack: &[u64],
+            return_stack: &[u64],
+        ) -> Event {
+            let route = self.routes.resolve(raw.route_id, &raw.path);
+
+            let mut events = Vec::new();
+            if let Some(symbols) = &self.symbols {
+                if !entry_stack.is_empty() || !return_stack.is_empty() {
+                    events.push(stack_snapshot_event(symbols, entry_stack, return_stack));
+                }
+            }
+
+            let mut event = raw.to_event("actix-web", &route, events);
+            if let Some(baggage) = self.routes.resolve_string(raw.baggage_id) {
+                event.attributes.extend(baggage_attributes(&baggage));
+            }
+            event
+        }
+    }
+
+    /// Reads the actix layout from the target's DWARF.
+    fn layout(target: &TargetDetails) -> Option<ActixLayout> {
+        let offsets = |type_path: &str, fields: &[&str]| {
+            dwarf::member_offsets(&target.debug_info, type_path, fields).unwrap_or_default()
+        };
+        let head = offsets(REQUEST_HEAD_TYPE, &["method", "uri"]);
+        let mut resource_fields = vec![PATTERN_LEN_FIELD, "is_prefix"];
+        resource_fields.extend(PATTERN_PTR_FIELDS);
+        let resource = offsets(RESOURCE_DEF_TYPE, &resource_fields);
+        Some(ActixLayout {
+            request_head: *offsets(REQUEST_TYPE, &[REQUEST_HEAD_FIELD]).get(REQUEST_HEAD_FIELD)?,
+            rc_value: RC_TYPES
+                .iter()
+                .find_map(|type_path| offsets(type_path, &["value"]).get("value").copied())?,
+            method: *head.get("method")?,
+            uri: *head.get("uri")?,
+            response_status: *offsets(RESPONSE_HEAD_TYPE, &["status"]).get("status")?,
+            pattern_ptr: PATTERN_PTR_FIELDS
+                .iter()
+                .find_map(|field| resource.get(*field).copied())?,
+            pattern_len: *resource.get(PATTERN_LEN_FIELD)?,
+            is_prefix: *resource.get("is_prefix")?,
+        })
+    }
+
+    /// Reads the offset of the headers in a `RequestHead` and the layout of
+    /// actix's hashbrown `HeaderMap` from the target's DWARF.
+    fn header_map_layout(target: &TargetDetails) -> Option<(u64, HeaderMapLayout)> {
+        let offsets = |type_path: &str, fields: &[&str]| {
+            dwarf::member_offsets(&target.debug_info, type_path, fields).unwrap_or_default()
+        };
+        let request_headers = *offsets(REQUEST_HEAD_TYPE, &["headers"]).get("headers")?;
+        let (entries_ptr, entries_len) = HEADER_TABLE_FIELDS.iter().find_map(|table| {
+            let ctrl = format!("{}.ctrl.pointer", table);
+            let bucket_mask = format!("{}.bucket_mask", table);
+            let map = offsets(HEADER_MAP_TYPE, &[ctrl.as_str(), bucket_mask.as_str()]);
+            Some((*map.get(&ctrl)?, *map.get(&bucket_mask)?))
+        })?;
+        let mut bucket_fields = vec!["__0"];
+        bucket_fields.extend(HEADER_VALUE_FIELDS);
+        let bucket = offsets(HEADER_BUCKET_TYPE, &bucket_fields);
+        let layout = HeaderMapLayout {
+            kind: HeaderMapLayout::HASHBROWN,
+            entries_ptr,
+            entries_len,
+            bucket_size: dwarf::struct_size(&target.debug_info, HEADER_BUCKET_TYPE).ok()??,
+            bucket_key: *bucket.get("__0")?,
+            bucket_value: HEADER_VALUE_FIELDS
+                .iter()
+                .find_map(|field| bucket.get(*field).copied())?,
+        };
+        Some((request_headers, layout))
+    }
+
+    #[async_trait]
+    impl Instrumentor for ActixInstrumentor {
+        fn library_name(&self) -> &str {
+            "actix-web"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![APP_CALL, RESOURCE_MATCH, SEND_RESPONSE]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            if self.slow_requests.is_some() {
+                self.symbols = Some(Arc::clone(&target.symbols));
+            }
+            self.request_arg_loc = target.arg_loc(&[APP_CALL], "req");
+            self.resource_arg_loc = target.arg_loc(&[RESOURCE_MATCH], "self");
+            self.response_arg_loc = target.arg_loc(&[SEND_RESPONSE], "res");
+            self.layout = layout(target);
+            self.http_layout = HttpLayout::from_dwarf(&target.debug_info).unwrap_or(HTTP_LAYOUT);
+            match self.layout {
+                Some(layout) => info!("Tracing actix-web requests, layout {:?}", layout),
+                None => warn!(
+                    "Tracing actix-web requests needs debug info describing {} and {}",
+                    REQUEST_HEAD_TYPE, RESOURCE_DEF_TYPE
+                ),
+            }
+            match header_map_layout(target) {
+                Some((request_headers, layout)) => {
+                    self.request_headers = request_headers;
+                    self.header_map = Some(layout);
+                }
+                None => warn!(
+                    "Reading actix-web request headers needs debug info describing {}",
+                    HEADER_MAP_TYPE
+                ),
+            }
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches it to the app service, the
+        /// router and the dispatcher and reads the spans it reports, as
+        /// well as the route templates it interns. Nothing is attached
+        /// without the actix layout.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let Some(layout) = self.layout() else {
+                return Ok(());
+            };
+            // method_ptr_pos, uri_ptr_pos and request_headers_pos are
+            // relative to the RequestHead; the Uri is http's.
+            let http_layout = HttpLayout {
+                method: layout.method,
+                uri: layout.uri,
+                request_headers: self.request_headers(),
+                ..self.http_layout
+            };
+            let header_map = self.header_map_layout();
+            // actix's server probe reads headers but never writes them.
+            let bytes_vtables = BytesVtables::default();
+            let (request, resource, response) = self.arg_locs();
+            let slow_requests = self.slow_request_constants();
+            let baggage_enabled = self.baggage_enabled();
+            let propagators = self.propagators();
+            let mut loader = probes::loader()?;
+            if let Some(header_map) = &header_map {
+                probes::set_header_map(&mut loader, header_map, &bytes_vtables);
+            }
+            probes::set_http_layout(&mut loader, &http_layout);
+            probes::set_slow_requests(&mut loader, &slow_requests);
+            loader
+                .set_global("baggage_enabled", &baggage_enabled, true)
+                .set_global("propagators", &propagators, true)
+                .set_global("request_head_pos", &layout.request_head, true)
+                .set_global("rc_value_pos", &layout.rc_value, true)
+                .set_global("response_head_status_pos", &layout.response_status, true)
+                .set_global("resource_pattern_ptr_pos", &layout.pattern_ptr, true)
+                .set_global("resource_pattern_len_pos", &layout.pattern_len, true)
+                .set_global("resource_is_prefix_pos", &layout.is_prefix, true)
+                .set_global("request_arg_loc", &request, true)
+                .set_global("resource_arg_loc", &resource, true)
+                .set_global("response_arg_loc", &response, true);
+            let mut bpf = loader.load(probe_object!("actix")).map_err(ebpf_error)?;
+            probes::set_baggage_keys(&mut bpf, &self.baggage_key_entries())?;
+
+            let target = &self.target;
+            let apps = target.attach_entry(&mut bpf, "uprobe_actix_app_call", &[APP_CALL])?;
+            target.attach_entry(&mut bpf, "uprobe_actix_resource_match", &[RESOURCE_MATCH])?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_actix_resource_match_return",
+                &[RESOURCE_MATCH],
+            )?;
+            target.attach_entry(&mut bpf, "uprobe_actix_send_response", &[SEND_RESPONSE])?;
+            info!("Tracing {} actix-web apps", apps);
+
+            let stacks = match &self.slow_requests {
+                Some(config) => Some(probes::slow_request_stacks(&mut bpf, config)?),
+                None => None,
+            };
+            let actix = Arc::new(self.clone());
+            let routes = Arc::clone(&actix);
+            probes::read_events(
+                &mut bpf,
+                "string_definitions",
+                &events_tx,
+                move |def: &StringDefinition| {
+                    routes.define_route(def);
+                    None
+                },
+            )?;
+            probes::read_events(
+                &mut bpf,
+                "events",
+                &events_tx,
+                move |raw: &HttpRequestEvent| {
+                    let (entry, ret) = probes::slow_request_frames(
+                        stacks.as_deref(),
+                        raw.entry_stack_id,
+                        raw.return_stack_id,
+                    );
+                    Some(actix.request_event_to_span(raw, &entry, &ret))
+                },
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod axum_instrumentor {
+    use super::dwarf::ArgLoc;
+    use super::errors::Result;
+    use super::instrumentors::{Event, Instrumentor, RouteResolver, StringDefinition};
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use async_trait::async_trait;
+    use log::info;
+    use std::sync::Arc;
+
+    const APPEND_NESTED_MATCHED_PATH: &str =
+        "axum::extract::matched_path::append_nested_matched_path";
+
+    /// The `Arc<str>` fat pointer and the data of its `ArcInner`, as
+    /// tracked for axum 0.6 and 0.7 in offset_results.json.
+    const MATCHED_PATH_PTR_POS: u64 = 0;
+    const MATCHED_PATH_LEN_POS: u64 = 8;
+    const ARC_DATA_POS: u64 = 16;
+
+    /// Reads the route template axum matched for each request. The probe
+    /// only reports an ID per request; the template itself is defined once
+    /// per process through `StringDefinition`s and resolved by the hyper
+    /// instrumentor when it names the server span.
+    #[derive(Clone)]
+    pub struct AxumInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        matched_path_arg_loc: ArgLoc,
+        routes: Arc<RouteResolver>,
+    }
+
+    impl AxumInstrumentor {
+        pub fn new(routes: Arc<RouteResolver>) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                matched_path_arg_loc: ArgLoc::ABI,
+                routes,
+            }
+        }
+
+        /// Value of the probe's `matched_path_arg_loc` constant.
+        pub fn arg_loc(&self) -> ArgLoc {
+            self.matched_path_arg_loc
+        }
+
+        pub fn define_route(&self, def: &StringDefinition) {
+            self.routes.define(def);
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for AxumInstrumentor {
+        fn library_name(&self) -> &str {
+            "axum"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![APPEND_NESTED_MATCHED_PATH]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.matched_path_arg_loc =
+                target.arg_loc(&[APPEND_NESTED_MATCHED_PATH], "matched_path");
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Attaches the probe to `append_nested_matched_path` and defines
+        /// the route templates it interns. Every load starts with an empty
+        /// `interned_strings` map, so a restarted agent is sent each
+        /// template again the next time it is matched.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let arg_loc = self.arg_loc();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("matched_path_ptr_pos", &MATCHED_PATH_PTR_POS, true)
+                .set_global("matched_path_len_pos", &MATCHED_PATH_LEN_POS, true)
+                .set_global("arc_data_pos", &ARC_DATA_POS, true)
+                .set_global("matched_path_arg_loc", &arg_loc, true);
+            let mut bpf = loader.load(probe_object!("axum")).map_err(ebpf_error)?;
+
+            let routers = self.target.attach_entry(
+                &mut bpf,
+                "uprobe_axum_matched_path",
+                &[APPEND_NESTED_MATCHED_PATH],
+            )?;
+            info!("Tracing {} axum routers", routers);
+
+            let axum = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "string_definitions",
+                &events_tx,
+                move |def: &StringDefinition| {
+                    axum.define_route(def);
+                    None
+                },
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod hyper_client_instrumentor {
+    use super::dwarf::ArgLoc;
+    use super::errors::Result;
+    use super::instrumentors::{
+        baggage_key_entries, BytesVtables, Event, HeaderMapLayout, HttpClientEvent, HttpLayout,
+        Instrumentor, Propagators, HEADER_MAP_LAYOUT, HTTP_LAYOUT,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use async_trait::async_trait;
+    use log::info;
+    use std::sync::Arc;
+
+    const SEND_REQUEST: [&str; 2] = [
+        "hyper::client::client::PoolClient<B>::send_request_retryable",
+        "hyper_util::client::legacy::client::PoolClient<B>::try_send_request",
+    ];
+    /// `Client::request` of hyper 0.14 and hyper-util's legacy client.
+    pub const CLIENT_REQUEST: [&str; 2] = [
+        "hyper::client::client::Client<C,B>::request",
+        "hyper_util::client::legacy::client::Client<C,B>::request",
+    ];
+    /// `ResponseFuture::poll` of the same clients. Both ResponseFutures are
+    /// a single boxed `dyn Future`.
+    pub const RESPONSE_FUTURE_POLL: [&str; 2] = [
+        "<hyper::client::client::ResponseFuture as core::future::future::Future>::poll",
+        "<hyper_util::client::legacy::client::ResponseFuture as core::future::future::Future>::poll",
+    ];
+
+    const POOL_CHECKOUT: [&str; 2] = [
+        "hyper::client::pool::Pool<T>::checkout",
+        "hyper_util::client::legacy::pool::Pool<T,K>::checkout",
+    ];
+    const POOL_REUSE: [&str; 2] = [
+        "hyper::client::pool::Pool<T>::reuse",
+        "hyper_util::client::legacy::pool::Pool<T,K>::reuse",
+    ];
+    const POOL_CONNECTING: [&str; 2] = [
+        "hyper::client::pool::Pool<T>::connecting",
+        "hyper_util::client::legacy::pool::Pool<T,K>::connecting",
+    ];
+    const POOL_POOLED: [&str; 2] = [
+        "hyper::client::pool::Pool<T>::pooled",
+        "hyper_util::client::legacy::pool::Pool<T,K>::pooled",
+    ];
+
+    const RESPONSE_FUTURE_DROP: [&str; 2] = [
+        "core::ptr::drop_in_place<hyper::client::client::ResponseFuture>",
+        "core::ptr::drop_in_place<hyper_util::client::legacy::client::ResponseFuture>",
+    ];
+    /// Constructors of the errors a failed request creates while its
+    /// future is polled. hyper-util builds its client errors in place, so
+    /// connect failures are seen through the HttpConnector's error.
+    const ERROR_NEW: [&str; 3] = [
+        "hyper::error::Error::new",
+        "hyper::client::connect::http::ConnectError::new",
+        "hyper_util::client::legacy::connect::http::ConnectError::new",
+    ];
+
+    /// Client spans for `hyper::Client` and hyper-util's legacy client,
+    /// including how the request got its connection: pool hit or miss, the
+    /// time spent waiting for the pool and the time to establish a new
+    /// connection. Requests are keyed by the boxed future of the
+    /// `ResponseFuture` that `Client::request` returns, and one dropped
+    /// without a response ends its span as failed or cancelled.
+    #[derive(Clone)]
+    pub struct HyperClientInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        http_layout: HttpLayout,
+        request_arg_loc: ArgLoc,
+        response_future_arg_loc: ArgLoc,
+        baggage_keys: Vec<String>,
+        propagators: Propagators,
+        bytes_vtables: BytesVtables,
+    }
+
+    impl HyperClientInstrumentor {
+        pub fn new(baggage_keys: Vec<String>, propagators: Propagators) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                http_layout: HTTP_LAYOUT,
+                request_arg_loc: ArgLoc::ABI,
+                response_future_arg_loc: ArgLoc::ABI,
+                baggage_keys,
+                propagators,
+                bytes_vtables: BytesVtables::default(),
+            }
+        }
+
+        /// Values of the probe's `request_arg_loc` and
+        /// `response_future_arg_loc` constants.
+        pub fn arg_locs(&self) -> (ArgLoc, ArgLoc) {
+            (self.request_arg_loc, self.response_future_arg_loc)
+        }
+
+        /// Value of the probe's `baggage_enabled` constant.
+        pub fn baggage_enabled(&self) -> u8 {
+            !self.baggage_keys.is_empty() as u8
+        }
+
+        /// Entries for the probe's `baggage_keys` map.
+        pub fn baggage_key_entries(&self) -> Vec<(u64, u8)> {
+            baggage_key_entries(&self.baggage_keys)
+        }
+
+        /// Value of the probe's `propagators` constant.
+        pub fn propagators(&self) -> u32 {
+            self.propagators.0
+        }
+
+        /// Values of the probe's `header_*` constants.
+        pub fn header_map_layout(&self) -> HeaderMapLayout {
+            HEADER_MAP_LAYOUT
+        }
+
+        /// Values of the probe's `bytes_*_clone` constants.
+        pub fn bytes_vtables(&self) -> BytesVtables {
+            self.bytes_vtables
+        }
+
+        pub fn client_event_to_span(&self, raw: &HttpClientEvent) -> Event {
+            raw.to_event("hyper_client")
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for HyperClientInstrumentor {
+        fn library_name(&self) -> &str {
+            "hyper_client"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            [
+                CLIENT_REQUEST,
+                POOL_CHECKOUT,
+                POOL_REUSE,
+                POOL_CONNECTING,
+                POOL_POOLED,
+                SEND_REQUEST,
+                RESPONSE_FUTURE_POLL,
+                RESPONSE_FUTURE_DROP,
+            ]
+            .iter()
+            .flatten()
+            .chain(&ERROR_NEW)
+            .copied()
+            .collect()
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.http_layout = HttpLayout::from_dwarf(&target.debug_info).unwrap_or(HTTP_LAYOUT);
+            self.request_arg_loc = target.arg_loc(&CLIENT_REQUEST, "req");
+            self.response_future_arg_loc = target.arg_loc(&RESPONSE_FUTURE_POLL, "self");
+            self.bytes_vtables = BytesVtables::resolve(&target.symbols);
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches it to the client, its
+        /// connection pool and its `ResponseFuture`, and reads the spans it
+        /// reports.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let header_map = self.header_map_layout();
+            let (request, response_future) = self.arg_locs();
+            let baggage_enabled = self.baggage_enabled();
+            let propagators = self.propagators();
+            let mut loader = probes::loader()?;
+            probes::set_header_map(&mut loader, &header_map, &self.bytes_vtables);
+            probes::set_http_layout(&mut loader, &self.http_layout);
+            loader
+                .set_global("baggage_enabled", &baggage_enabled, true)
+                .set_global("propagators", &propagators, true)
+                .set_global("request_arg_loc", &request, true)
+                .set_global("response_future_arg_loc", &response_future, true);
+            let mut bpf = loader
+                .load(probe_object!("hyper_client"))
+                .map_err(ebpf_error)?;
+            probes::set_baggage_keys(&mut bpf, &self.baggage_key_entries())?;
+
+            let target = &self.target;
+            let clients =
+                target.attach_entry(&mut bpf, "uprobe_hyper_client_request", &CLIENT_REQUEST)?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_hyper_client_request_return",
+                &CLIENT_REQUEST,
+            )?;
+            target.attach_entry(&mut bpf, "uprobe_hyper_pool_checkout", &POOL_CHECKOUT)?;
+            target.attach_entry(&mut bpf, "uprobe_hyper_pool_reuse", &POOL_REUSE)?;
+            target.attach_entry(&mut bpf, "uprobe_hyper_pool_connecting", &POOL_CONNECTING)?;
+            target.attach_entry(&mut bpf, "uprobe_hyper_pool_pooled", &POOL_POOLED)?;
+            target.attach_entry(&mut bpf, "uprobe_hyper_client_send_request", &SEND_REQUEST)?;
+            target.attach_entry(&mut bpf, "uprobe_hyper_client_error_new", &ERROR_NEW)?;
+            target.attach_entry(
+                &mut bpf,
+                "uprobe_hyper_client_response_poll",
+                &RESPONSE_FUTURE_POLL,
+            )?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_hyper_client_response_poll_return",
+                &RESPONSE_FUTURE_POLL,
+            )?;
+            target.attach_entry(
+                &mut bpf,
+                "uprobe_hyper_client_response_drop",
+                &RESPONSE_FUTURE_DROP,
+            )?;
+            info!("Tracing {} hyper clients", clients);
+
+            let hyper_client = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "http_client_events",
+                &events_tx,
+                move |raw: &HttpClientEvent| Some(hyper_client.client_event_to_span(raw)),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod reqwest_instrumentor {
+    use super::dwarf::{self, ArgLoc, DebugInfo};
+    use super::errors::Result;
+    use super::hyper_client_instrumentor::{CLIENT_REQUEST, RESPONSE_FUTURE_POLL};
+    use super::instrumentors::{
+        baggage_key_entries, BytesVtables, Event, HeaderMapLayout, HttpClientEvent, HttpLayout,
+        Instrumentor, Propagators, HEADER_MAP_LAYOUT, HTTP_LAYOUT,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use async_trait::async_trait;
+    use log::info;
+    use std::sync::Arc;
+
+    const EXECUTE_REQUEST: &str = "reqwest::async_impl::client::Client::execute_request";
+    const RESPONSE_NEW: &str = "reqwest::async_impl::response::Response::new";
+    const PENDING_POLL: &str =
+        "<reqwest::async_impl::client::Pending as core::future::future::Future>::poll";
+    const PENDING_DROP: &str = "core::ptr::drop_in_place<reqwest::async_impl::client::Pending>";
+    const ERROR_NEW: &str = "reqwest::error::Error::new";
+
+    const REQUEST_TYPE: &str = "reqwest::async_impl::request::Request";
+    const URL_TYPE: &str = "url::Url";
+    const URL_LEN_FIELD: &str = "serialization.vec.len";
+    /// `RawVec` keeps its pointer in a `RawVecInner` since Rust 1.84.
+    const URL_PTR_FIELDS: [&str; 2] = [
+        "serialization.vec.buf.inner.ptr.pointer.pointer",
+        "serialization.vec.buf.ptr.pointer.pointer",
+    ];
+    /// The `hyper::Response` given to `Response::new`, for hyper 0.14 and
+    /// 1.x.
+    const HYPER_RESPONSE_TYPES: [&str; 2] = [
+        "http::response::Response<hyper::body::body::Body>",
+        "http::response::Response<hyper::body::incoming::Incoming>",
+    ];
+
+    /// Offsets the reqwest probe reads, the values of its `method_ptr_pos`,
+    /// `url_pos`, `headers_pos`, `response_status_pos` and `url_*_pos`
+    /// constants.
+    #[derive(Debug, Clone, Copy)]
+    pub struct ReqwestLayout {
+        pub method: u64,
+        pub url: u64,
+        pub headers: u64,
+        pub response_status: u64,
+        pub url_serialization_ptr: u64,
+        pub url_serialization_len: u64,
+        pub url_host_start: u64,
+        pub url_host_end: u64,
+        pub url_path_start: u64,
+    }
+
+    /// As tracked for reqwest 0.12 and url 2.x in offset_results.json, with
+    /// the serialization `String` laid out as `{cap, ptr, len}` and the
+    /// response head leading the `hyper::Response`.
+    pub const REQWEST_LAYOUT: ReqwestLayout = ReqwestLayout {
+        method: 0,
+        url: 32,
+        headers: 96,
+        response_status: HTTP_LAYOUT.response_status,
+        url_serialization_ptr: 8,
+        url_serialization_len: 16,
+        url_host_start: 32,
+        url_host_end: 36,
+        url_path_start: 48,
+    };
+
+    impl ReqwestLayout {
+        /// Reads the layout from the target's DWARF, `None` when it does
+        /// not describe reqwest's `Request` and `url::Url`.
+        pub fn from_dwarf(debug_info: &DebugInfo) -> Option<Self> {
+            let offsets = |type_path: &str, fields: &[&str]| {
+                dwarf::member_offsets(debug_info, type_path, fields).unwrap_or_default()
+            };
+            let request = offsets(REQUEST_TYPE, &["method", "url", "headers"]);
+            let mut url_fields = vec![URL_LEN_FIELD, "host_start", "host_end", "path_start"];
+            url_fields.extend(URL_PTR_FIELDS);
+            let url = offsets(URL_TYPE, &url_fields);
+            let response_status = HYPER_RESPONSE_TYPES
+                .iter()
+                .find_map(|type_path| {
+                    offsets(type_path, &["head.status"])
+                        .get("head.status")
+                        .copied()
+                })
+                .or_else(|| HttpLayout::from_dwarf(debug_info).map(|http| http.response_status))?;
+            Some(Self {
+                method: *request.get("method")?,
+                url: *request.get("url")?,
+                headers: *request.get("headers")?,
+                response_status,
+                url_serialization_ptr: URL_PTR_FIELDS
+                    .iter()
+                    .find_map(|field| url.get(*field).copied())?,
+                url_serialization_len: *url.get(URL_LEN_FIELD)?,
+                url_host_start: *url.get("host_start")?,
+                url_host_end: *url.get("host_end")?,
+                url_path_start: *url.get("path_start")?,
+            })
+        }
+    }
+
+    /// Client spans for outgoing reqwest calls. The probe starts the span
+    /// at `Client::execute_request`, injects `traceparent` into the request
+    /// headers and ends the span when the response is built. Requests are
+    /// keyed by the hyper future their `Pending` wraps, so a task can await
+    /// several at once; a `Pending` dropped without a response ends its span
+    /// as failed or cancelled.
+    #[derive(Clone)]
+    pub struct ReqwestInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        layout: ReqwestLayout,
+        request_arg_loc: ArgLoc,
+        response_arg_loc: ArgLoc,
+        pending_arg_loc: ArgLoc,
+        response_future_arg_loc: ArgLoc,
+        baggage_keys: Vec<String>,
+        propagators: Propagators,
+        bytes_vtables: BytesVtables,
+    }
+
+    impl ReqwestInstrumentor {
+        pub fn new(baggage_keys: Vec<String>, propagators: Propagators) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                layout: REQWEST_LAYOUT,
+                request_arg_loc: ArgLoc::ABI,
+                response_arg_loc: ArgLoc::ABI,
+                pending_arg_loc: ArgLoc::ABI,
+                response_future_arg_loc: ArgLoc::ABI,
+                baggage_keys,
+                propagators,
+                bytes_vtables: BytesVtables::default(),
+            }
+        }
+
+        /// Values of the probe's `request_arg_loc`, `response_arg_loc`,
+        /// `pending_arg_loc` and `response_future_arg_loc` constants.
+        pub fn arg_locs(&self) -> [ArgLoc; 4] {
+            [
+                self.request_arg_loc,
+                self.response_arg_loc,
+                self.pending_arg_loc,
+                self.response_future_arg_loc,
+            ]
+        }
+
+        /// Value of the probe's `baggage_enabled` constant.
+        pub fn baggage_enabled(&self) -> u8 {
+            !self.baggage_keys.is_empty() as u8
+        }
+
+        /// Entries for the probe's `baggage_keys` map.
+        pub fn baggage_key_entries(&self) -> Vec<(u64, u8)> {
+            baggage_key_entries(&self.baggage_keys)
+        }
+
+        /// Value of the probe's `propagators` constant.
+        pub fn propagators(&self) -> u32 {
+            self.propagators.0
+        }
+
+        /// Values of the probe's `header_*` constants.
+        pub fn header_map_layout(&self) -> HeaderMapLayout {
+            HEADER_MAP_LAYOUT
+        }
+
+        /// Values of the probe's `bytes_*_clone` constants.
+        pub fn bytes_vtables(&self) -> BytesVtables {
+            self.bytes_vtables
+        }
+
+        pub fn client_event_to_span(&self, raw: &HttpClientEvent) -> Event {
+            raw.to_event("reqwest")
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for ReqwestInstrumentor {
+        fn library_name(&self) -> &str {
+            "reqwest"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            let mut names = vec![
+                EXECUTE_REQUEST,
+                RESPONSE_NEW,
+                PENDING_POLL,
+                PENDING_DROP,
+                ERROR_NEW,
+            ];
+            names.extend(CLIENT_REQUEST);
+            names.extend(RESPONSE_FUTURE_POLL);
+            names
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.layout = ReqwestLayout::from_dwarf(&target.debug_info).unwrap_or(REQWEST_LAYOUT);
+            self.request_arg_loc = target.arg_loc(&[EXECUTE_REQUEST], "req");
+            self.response_arg_loc = target.arg_loc(&[RESPONSE_NEW], "res");
+            self.pending_arg_loc = target.arg_loc(&[PENDING_POLL], "self");
+            self.response_future_arg_loc = target.arg_loc(&RESPONSE_FUTURE_POLL, "self");
+            self.bytes_vtables = BytesVtables::resolve(&target.symbols);
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches it to reqwest's client and
+        /// to the hyper client calls it makes and reads the spans it
+        /// reports.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let header_map = self.header_map_layout();
+            let [request, response, pending, response_future] = self.arg_locs();
+            let layout = &self.layout;
+            let baggage_enabled = self.baggage_enabled();
+            let propagators = self.propagators();
+            let mut loader = probes::loader()?;
+            probes::set_header_map(&mut loader, &header_map, &self.bytes_vtables);
+            loader
+                .set_global("baggage_enabled", &baggage_enabled, true)
+                .set_global("propagators", &propagators, true)
+                .set_global("method_ptr_pos", &layout.method, true)
+                .set_global("url_pos", &layout.url, true)
+                .set_global("headers_pos", &layout.headers, true)
+                .set_global("response_status_pos", &layout.response_status, true)
+                .set_global(
+                    "url_serialization_ptr_pos",
+                    &layout.url_serialization_ptr,
+                    true,
+                )
+                .set_global(
+                    "url_serialization_len_pos",
+                    &layout.url_serialization_len,
+                    true,
+                )
+                .set_global("url_host_start_pos", &layout.url_host_start, true)
+                .set_global("url_host_end_pos", &layout.url_host_end, true)
+                .set_global("url_path_start_pos", &layout.url_path_start, true)
+                .set_global("request_arg_loc", &request, true)
+                .set_global("response_arg_loc", &response, true)
+                .set_global("pending_arg_loc", &pending, true)
+                .set_global("response_future_arg_loc", &response_future, true);
+            let mut bpf = loader.load(probe_object!("reqwest")).map_err(ebpf_error)?;
+            probes::set_baggage_keys(&mut bpf, &self.baggage_key_entries())?;
+
+            let target = &self.target;
+            let clients = target.attach_entry(
+                &mut bpf,
+                "uprobe_reqwest_execute_request",
+                &[EXECUTE_REQUEST],
+            )?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_reqwest_execute_request_return",
+                &[EXECUTE_REQUEST],
+            )?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_reqwest_hyper_request_return",
+                &CLIENT_REQUEST,
+            )?;
+            target.attach_entry(&mut bpf, "uprobe_reqwest_pending_poll", &[PENDING_POLL])?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_reqwest_pending_poll_return",
+                &[PENDING_POLL],
+            )?;
+            target.attach_entry(
+                &mut bpf,
+                "uprobe_reqwest_response_future_poll",
+                &RESPONSE_FUTURE_POLL,
+            )?;
+            target.attach_entry(&mut bpf, "uprobe_reqwest_response_new", &[RESPONSE_NEW])?;
+            target.attach_entry(&mut bpf, "uprobe_reqwest_error_new", &[ERROR_NEW])?;
+            target.attach_entry(&mut bpf, "uprobe_reqwest_pending_drop", &[PENDING_DROP])?;
+            info!("Tracing {} reqwest clients, layout {:?}", clients, layout);
+
+            let reqwest = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "http_client_events",
+                &events_tx,
+                move |raw: &HttpClientEvent| Some(reqwest.client_event_to_span(raw)),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod tonic_instrumentor {
+    use super::dwarf::{self, ArgLoc};
+    use super::errors::Result;
+    use super::instrumentors::{
+        baggage_key_entries, c_str, error_attribute, stack_snapshot_event, BytesVtables, Event,
+        HeaderMapLayout, HttpLayout, Instrumentor, PollStats, Propagators, SlowRequestConfig,
+        SpanEvent, HEADER_MAP_LAYOUT,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use super::symbols::SymbolTable;
+    use async_trait::async_trait;
+    use log::{debug, info};
+    use opentelemetry::trace::SpanKind;
+    use std::sync::Arc;
+
+    const SERVER_CALLS: [&str; 4] = [
+        "tonic::server::grpc::Grpc<T>::unary",
+        "tonic::server::grpc::Grpc<T>::server_streaming",
+        "tonic::server::grpc::Grpc<T>::client_streaming",
+        "tonic::server::grpc::Grpc<T>::streaming",
+    ];
+    const CLIENT_CALLS: [&str; 4] = [
+        "tonic::client::grpc::Grpc<T>::unary",
+        "tonic::client::grpc::Grpc<T>::server_streaming",
+        "tonic::client::grpc::Grpc<T>::client_streaming",
+        "tonic::client::grpc::Grpc<T>::streaming",
+    ];
+
+    const GRPC_METHOD_TYPE: &str = "tonic::GrpcMethod";
+
+    /// Offsets the tonic probe reads, the values of its `service_ptr_pos`,
+    /// `method_ptr_pos`, `metadata_ptr_pos`, `request_headers_pos` and
+    /// `request_path_pos` constants.
+    #[derive(Debug, Clone, Copy)]
+    pub struct TonicLayout {
+        pub service: u64,
+        pub method: u64,
+        pub metadata: u64,
+        pub request_headers: u64,
+        pub request_path: u64,
+    }
+
+    /// As tracked for tonic 0.11, on http 0.2, in offset_results.json. The
+    /// `GrpcMethod` and `http::Request` offsets are taken from DWARF when
+    /// available.
+    const LAYOUT: TonicLayout = TonicLayout {
+        service: 0,
+        method: 32,
+        metadata: 0,
+        request_headers: 56,
+        request_path: 72,
+    };
+
+    /// Mirrors `struct grpc_request_t` in rust_context.h. Server calls
+    /// carry the whole gRPC path in `service`, and no `method`.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct GrpcRequestEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub service: [u8; 256],
+        pub method: [u8; 16],
+        pub status_code: u32,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+        pub polls: PollStats,
+        pub entry_stack_id: i64,
+        pub return_stack_id: i64,
+        pub errors: u32,
+        pub baggage_id: u64,
+    }
+
+    impl GrpcRequestEvent {
+        /// Span named `<service>/<method>`, as the gRPC path is without its
+        /// leading slash.
+        pub fn to_event(&self, kind: SpanKind, events: Vec<SpanEvent>) -> Event {
+            let server = kind == SpanKind::Server;
+            let (service, method) = if server {
+                let path = c_str(&self.service);
+                match path.trim_start_matches('/').split_once('/') {
+                    Some((service, method)) => (service.to_string(), method.to_string()),
+                    None => (path, String::new()),
+                }
+            } else {
+                (c_str(&self.service), c_str(&self.method))
+            };
+
+            let mut attributes = vec![
+                ("rpc.system".to_string(), "grpc".to_string()),
+                ("rpc.service".to_string(), service.clone()),
+                ("rpc.method".to_string(), method.clone()),
+            ];
+            attributes.extend(error_attribute(self.errors));
+
+            Event {
+                library: "tonic".to_string(),
+                name: format!("{}/{}", service, method),
+                start_time: self.start_time,
+                end_time: self.end_time,
+                kind,
+                trace_id: self.trace_id,
+                span_id: self.span_id,
+                parent_span_id: (self.parent_span_id != [0; 8]).then_some(self.parent_span_id),
+                attributes,
+                poll_stats: (server && self.polls.polls > 0).then_some(self.polls),
+                events,
+            }
+        }
+    }
+
+    /// Server and client spans for gRPC calls made through tonic. Server
+    /// calls join the trace and capture the baggage of the `http::Request`
+    /// they are given; client calls write the span context and baggage into the request's
+    /// `MetadataMap`, which wraps an `http::HeaderMap`.
+    #[derive(Clone)]
+    pub struct TonicInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        layout: TonicLayout,
+        server_arg_loc: ArgLoc,
+        server_request_arg_loc: ArgLoc,
+        client_arg_loc: ArgLoc,
+        request_arg_loc: ArgLoc,
+        baggage_keys: Vec<String>,
+        propagators: Propagators,
+        bytes_vtables: BytesVtables,
+        slow_requests: Option<SlowRequestConfig>,
+        symbols: Option<Arc<SymbolTable>>,
+    }
+
+    impl TonicInstrumentor {
+        pub fn new(
+            slow_requests: Option<SlowRequestConfig>,
+            baggage_keys: Vec<String>,
+            propagators: Propagators,
+        ) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                layout: LAYOUT,
+                server_arg_loc: ArgLoc::ABI,
+                server_request_arg_loc: ArgLoc::ABI,
+                client_arg_loc: ArgLoc::ABI,
+                request_arg_loc: ArgLoc::ABI,
+                baggage_keys,
+                propagators,
+                bytes_vtables: BytesVtables::default(),
+                slow_requests,
+                symbols: None,
+            }
+        }
+
+        /// The span of a call, with the stacks captured if it was slow.
+        pub fn grpc_event_to_span(
+            &self,
+            raw: &GrpcRequestEvent,
+            kind: SpanKind,
+            entry_stack: &[u64],
+            return_stack: &[u64],
+        ) -> Event {
+            let mut events = Vec::new();
+            if let Some(symbols) = &self.symbols {
+                if !entry_stack.is_empty() || !return_stack.is_empty() {
+                    events.push(stack_snapshot_event(symbols, entry_stack, return_stack));
+                }
+            }
+            raw.to_event(kind, events)
+        }
+
+        /// Values of the probe's `slow_request_capture_enabled` and
+        /// `slow_request_threshold_ns` constants.
+        pub fn slow_request_constants(&self) -> (u8, u64) {
+            self.slow_requests
+                .as_ref()
+                .map_or((0, 0), SlowRequestConfig::constants)
+        }
+
+        /// Value of the probe's `baggage_enabled` constant.
+        pub fn baggage_enabled(&self) -> u8 {
+            !self.baggage_keys.is_empty() as u8
+        }
+
+        /// Entries for the probe's `baggage_keys` map.
+        pub fn baggage_key_entries(&self) -> Vec<(u64, u8)> {
+            baggage_key_entries(&self.baggage_keys)
+        }
+
+        /// Value of the probe's `propagators` constant.
+        pub fn propagators(&self) -> u32 {
+            self.propagators.0
+        }
+
+        /// Values of the probe's `header_*` constants.
+        pub fn header_map_layout(&self) -> HeaderMapLayout {
+            HEADER_MAP_LAYOUT
+        }
+
+        /// Values of the probe's `bytes_*_clone` constants.
+        pub fn bytes_vtables(&self) -> BytesVtables {
+            self.bytes_vtables
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for TonicInstrumentor {
+        fn library_name(&self) -> &str {
+            "tonic"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            SERVER_CALLS.iter().chain(&CLIENT_CALLS).copied().collect()
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            if self.slow_requests.is_some() {
+                self.symbols = Some(Arc::clone(&target.symbols));
+            }
+            let fields = ["service", "method"];
+            match dwarf::member_offsets(&target.debug_info, GRPC_METHOD_TYPE, &fields) {
+                Ok(offsets) => {
+                    if let (Some(&service), Some(&method)) =
+                        (offsets.get("service"), offsets.get("method"))
+                    {
+                        self.layout.service = service;
+                        self.layout.method = method;
+                    }
+                }
+                Err(e) => debug!("Using the tonic 0.11 layout: {}", e),
+            }
+            if let Some(http) = HttpLayout::from_dwarf(&target.debug_info) {
+                self.layout.request_headers = http.request_headers;
+                self.layout.request_path = http.uri + http.path;
+            }
+            self.server_arg_loc = target.arg_loc(&SERVER_CALLS, "self");
+            self.server_request_arg_loc = target.arg_loc(&SERVER_CALLS, "req");
+            self.client_arg_loc = target.arg_loc(&CLIENT_CALLS, "self");
+            self.request_arg_loc = target.arg_loc(&CLIENT_CALLS, "request");
+            self.bytes_vtables = BytesVtables::resolve(&target.symbols);
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches it to the entry and return
+        /// instructions of the server and client calls and reads the spans
+        /// it reports.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let header_map = self.header_map_layout();
+            let slow_requests = self.slow_request_constants();
+            let baggage_enabled = self.baggage_enabled();
+            let propagators = self.propagators();
+            let mut loader = probes::loader()?;
+            probes::set_header_map(&mut loader, &header_map, &self.bytes_vtables);
+            probes::set_slow_requests(&mut loader, &slow_requests);
+            loader
+                .set_global("baggage_enabled", &baggage_enabled, true)
+                .set_global("propagators", &propagators, true)
+                .set_global("service_ptr_pos", &self.layout.service, true)
+                .set_global("method_ptr_pos", &self.layout.method, true)
+                .set_global("metadata_ptr_pos", &self.layout.metadata, true)
+                .set_global("request_headers_pos", &self.layout.request_headers, true)
+                .set_global("request_path_pos", &self.layout.request_path, true)
+                .set_global("server_arg_loc", &self.server_arg_loc, true)
+                .set_global("server_request_arg_loc", &self.server_request_arg_loc, true)
+                .set_global("client_arg_loc", &self.client_arg_loc, true)
+                .set_global("request_arg_loc", &self.request_arg_loc, true);
+            let mut bpf = loader.load(probe_object!("tonic")).map_err(ebpf_error)?;
+            probes::set_baggage_keys(&mut bpf, &self.baggage_key_entries())?;
+
+            let servers =
+                self.target
+                    .attach_entry(&mut bpf, "uprobe_tonic_server_serve", &SERVER_CALLS)?;
+            self.target.attach_return(
+                &mut bpf,
+                "uprobe_tonic_server_serve_return",
+                &SERVER_CALLS,
+            )?;
+            let clients =
+                self.target
+                    .attach_entry(&mut bpf, "uprobe_tonic_client_call", &CLIENT_CALLS)?;
+            self.target.attach_return(
+                &mut bpf,
+                "uprobe_tonic_client_call_return",
+                &CLIENT_CALLS,
+            )?;
+            info!(
+                "Tracing {} tonic server and {} client call types",
+                servers, clients
+            );
+
+            let stacks = match &self.slow_requests {
+                Some(config) => Some(probes::slow_request_stacks(&mut bpf, config)?),
+                None => None,
+            };
+            let tonic = Arc::new(self.clone());
+            for (map, kind) in [
+                ("grpc_events", SpanKind::Server),
+                ("grpc_client_events", SpanKind::Client),
+            ] {
+                let tonic = Arc::clone(&tonic);
+                let stacks = stacks.clone();
+                probes::read_events(&mut bpf, map, &events_tx, move |raw: &GrpcRequestEvent| {
+                    let (entry, ret) = probes::slow_request_frames(
+                        stacks.as_deref(),
+                        raw.entry_stack_id,
+                        raw.return_stack_id,
+                    );
+                    Some(tonic.grpc_event_to_span(raw, kind.clone(), &entry, &ret))
+                })?;
+            }
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod tokio_instrumentor {
+    use super::errors::{Error, Result};
+    use super::instrumentors::{Event, Instrumentor};
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use super::symbols::SymbolTable;
+    use async_trait::async_trait;
+    use aya::maps::HashMap as BpfHashMap;
+    use aya::programs::perf_event::{
+        perf_sw_ids::PERF_COUNT_SW_CPU_CLOCK, PerfEvent, PerfEventScope, PerfTypeId, SamplePolicy,
+    };
+    use aya::util::online_cpus;
+    use aya::Ebpf;
+    use log::info;
+    use opentelemetry::trace::SpanKind;
+    use std::sync::Arc;
+    use std::time::Duration;
+
+    const TASK_POLL: &str = "tokio::runtime::task::raw::RawTask::poll";
+    const SPAWN_INNER: &str = "tokio::task::spawn::spawn_inner";
+    const DEALLOC: &str = "tokio::runtime::task::raw::dealloc";
+
+    /// Offset of the RawTask in a JoinHandle, from offset_results.json.
+    const JOIN_HANDLE_RAW_POS: u64 = 0;
+
+    /// Mirrors `struct blocking_event_t` in the tokio probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct BlockingEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub task: u64,
+        pub stack_id: i64,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+    }
+
+    /// Tracks which tokio task each worker thread is polling, so that spans
+    /// can be linked across `.await` points and thread migrations. When a
+    /// long-poll threshold is set, also reports polls that block the
+    /// executor together with a user stack taken while the poll was still
+    /// running, and optionally charges on-CPU time to requests via
+    /// sched_switch.
+    #[derive(Clone)]
+    pub struct TokioInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        long_poll_threshold: Duration,
+        cpu_accounting: bool,
+        symbols: Option<Arc<SymbolTable>>,
+    }
+
+    impl TokioInstrumentor {
+        pub fn new(long_poll_threshold: Duration, cpu_accounting: bool) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                long_poll_threshold,
+                cpu_accounting,
+                symbols: None,
+            }
+        }
+
+        /// Value of the probe's `cpu_accounting_enabled` constant.
+        pub fn cpu_accounting_enabled(&self) -> u8 {
+            self.cpu_accounting as u8
+        }
+
+        /// Value of the probe's `long_poll_threshold_ns` constant.
+        pub fn long_poll_threshold_ns(&self) -> u64 {
+            self.long_poll_threshold.as_nanos() as u64
+        }
+
+        /// Value of the probe's `long_poll_sample_period_ns` constant: the
+        /// per-CPU sampler runs at twice the threshold's rate, so a spinning
+        /// poll is sampled at least once before it crosses the threshold.
+        pub fn long_poll_sample_period_ns(&self) -> u64 {
+            self.long_poll_threshold_ns() / 2
+        }
+
+        /// Whether the sched_switch tracepoint is attached: it drives the
+        /// on-CPU accounting and catches long polls that block in the kernel.
+        pub fn sched_switch_enabled(&self) -> bool {
+            self.cpu_accounting || !self.long_poll_threshold.is_zero()
+        }
+
+        pub fn blocking_event_to_span(&self, raw: &BlockingEvent, stack: &[u64]) -> Event {
+            let mut attributes = vec![
+                ("rust.tokio.task".to_string(), format!("{:#x}", raw.task)),
+                (
+                    "rust.async.poll_duration_ns".to_string(),
+                    raw.end_time.saturating_sub(raw.start_time).to_string(),
+                ),
+            ];
+            if let Some(symbols) = &self.symbols {
+                if !stack.is_empty() {
+                    attributes.push(("code.stacktrace".to_string(), symbols.format_stack(stack)));
+                }
+            }
+
+            Event {
+                library: "tokio".to_string(),
+                name: "tokio.long_poll".to_string(),
+                start_time: raw.start_time,
+                end_time: raw.end_time,
+                kind: SpanKind::Internal,
+                trace_id: raw.trace_id,
+                span_id: raw.span_id,
+                parent_span_id: (raw.parent_span_id != [0; 8]).then_some(raw.parent_span_id),
+                attributes,
+                poll_stats: None,
+                events: Vec::new(),
+            }
+        }
+
+        /// Attaches the long-poll sampler to every online CPU. Samples of
+        /// threads that are not polling a task return at once.
+        fn attach_sampler(&self, bpf: &mut Ebpf) -> Result<()> {
+            let program: &mut PerfEvent = bpf
+                .program_mut("perf_event_sample_long_poll")
+                .ok_or_else(|| ebpf_error("missing perf_event_sample_long_poll program"))?
+                .try_into()
+                .map_err(ebpf_error)?;
+            program.load().map_err(ebpf_error)?;
+            for cpu in online_cpus().map_err(|(_, e)| Error::Io(e))? {
+                program
+                    .attach(
+                        PerfTypeId::Software,
+                        PERF_COUNT_SW_CPU_CLOCK as u64,
+                        PerfEventScope::AllProcessesOneCpu { cpu },
+                        SamplePolicy::Period(self.long_poll_sample_period_ns()),
+                        true,
+                    )
+                    .map_err(ebpf_error)?;
+            }
+            Ok(())
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for TokioInstrumentor {
+        fn library_name(&self) -> &str {
+            "tokio"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![TASK_POLL, SPAWN_INNER, DEALLOC]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            if !self.long_poll_threshold.is_zero() {
+                self.symbols = Some(Arc::clone(&target.symbols));
+            }
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Attaches the task tracking probes, the sched_switch tracepoint
+        /// when on-CPU accounting or the long-poll detector needs it and,
+        /// when a long-poll threshold is set, the sampler, reporting
+        /// blocking polls with their stack.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let cpu_accounting = self.cpu_accounting_enabled();
+            let threshold = self.long_poll_threshold_ns();
+            let sample_period = self.long_poll_sample_period_ns();
+            let sched_switch = self.sched_switch_enabled();
+            let task_cache_enabled = sched_switch as u8;
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("join_handle_raw_pos", &JOIN_HANDLE_RAW_POS, true)
+                .set_global("cpu_accounting_enabled", &cpu_accounting, true)
+                .set_global("long_poll_threshold_ns", &threshold, true)
+                .set_global("long_poll_sample_period_ns", &sample_period, true)
+                .set_global("task_cache_enabled", &task_cache_enabled, true);
+            let mut bpf = loader.load(probe_object!("tokio")).map_err(ebpf_error)?;
+
+            // The tracepoint goes first: the per-CPU task slot must not be
+            // filled before something invalidates it.
+            if sched_switch {
+                let mut target_pids: BpfHashMap<_, u32, u8> = BpfHashMap::try_from(
+                    bpf.map_mut("target_pids")
+                        .ok_or_else(|| ebpf_error("missing target_pids map"))?,
+                )
+                .map_err(ebpf_error)?;
+                target_pids
+                    .insert(self.target.pid() as u32, 1, 0)
+                    .map_err(ebpf_error)?;
+                probes::attach_tracepoint(
+                    &mut bpf,
+                    "tracepoint_sched_switch",
+                    "sched",
+                    "sched_switch",
+                )?;
+                probes::enable_task_cache();
+            }
+
+            let target = &self.target;
+            let polls = target.attach_entry(&mut bpf, "uprobe_tokio_task_poll", &[TASK_POLL])?;
+            target.attach_return(&mut bpf, "uprobe_tokio_task_poll_return", &[TASK_POLL])?;
+            target.attach_return(&mut bpf, "uprobe_tokio_spawn_return", &[SPAWN_INNER])?;
+            target.attach_entry(&mut bpf, "uprobe_tokio_task_dealloc", &[DEALLOC])?;
+            info!("Tracking tokio tasks through {} poll functions", polls);
+
+            if threshold > 0 {
+                self.attach_sampler(&mut bpf)?;
+                let user_stacks = probes::user_stacks(&mut bpf)?;
+                let tokio = Arc::new(self.clone());
+                probes::read_events(
+                    &mut bpf,
+                    "blocking_events",
+                    &events_tx,
+                    move |raw: &BlockingEvent| {
+                        let stack = probes::stack_frames(&user_stacks, raw.stack_id);
+                        Some(tokio.blocking_event_to_span(raw, &stack))
+                    },
+                )?;
+                info!(
+                    "Reporting tokio polls longer than {:?}",
+                    self.long_poll_threshold
+                );
+            }
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod tower_instrumentor {
+    use super::dwarf::ArgLoc;
+    use super::errors::Result;
+    use super::instrumentors::{Event, Instrumentor};
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::{FunctionInfo, TargetDetails};
+    use async_trait::async_trait;
+    use log::{info, warn};
+    use opentelemetry::trace::SpanKind;
+    use std::sync::Arc;
+
+    /// Layers beyond this are not attached, bounding the number of probes.
+    const MAX_LAYERS: usize = 64;
+
+    /// Mirrors `struct layer_span_t` in the tower probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct LayerEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub layer_id: u64,
+        pub polls: u64,
+        pub busy_ns: u64,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+    }
+
+    /// An enabled tower layer and the monomorphised symbols to attach to,
+    /// by mangled name. The layer's index is its BPF cookie.
+    #[derive(Debug, Default)]
+    pub struct Layer {
+        pub name: String,
+        pub calls: Vec<String>,
+        pub polls: Vec<String>,
+        pub drops: Vec<String>,
+    }
+
+    /// Times tower middleware. For every enabled `Service` type found in
+    /// the binary, each `<S as tower_service::Service<R>>::call` instance
+    /// and the `poll` and `drop_in_place` of the response futures defined
+    /// next to it are probed, yielding one child span per layer invocation.
+    /// A layer's span is active while its future is polled, so the spans of
+    /// the layers below it are its children.
+    #[derive(Clone)]
+    pub struct TowerInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        enabled: Vec<String>,
+        layers: Arc<Vec<Layer>>,
+        future_arg_loc: ArgLoc,
+        drop_arg_loc: ArgLoc,
+    }
+
+    /// Type path of a demangled self type, without generic arguments.
+    fn type_path(ty: &str) -> &str {
+        ty.split('<').next().unwrap_or(ty)
+    }
+
+    /// Self type of a demangled `<T as Trait>::method` name.
+    fn impl_self_type<'a>(name: &'a str, trait_path: &str, method: &str) -> Option<&'a str> {
+        let rest = name.strip_prefix('<')?.strip_suffix(method)?;
+        let (ty, _) = rest.split_once(&format!(" as {}", trait_path))?;
+        Some(ty)
+    }
+
+    impl TowerInstrumentor {
+        pub fn new(enabled: Vec<String>) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                enabled,
+                layers: Arc::default(),
+                future_arg_loc: ArgLoc::ABI,
+                drop_arg_loc: ArgLoc::ABI,
+            }
+        }
+
+        pub fn layers(&self) -> &[Layer] {
+            &self.layers
+        }
+
+        /// Values of the probe's `future_arg_loc` and `drop_arg_loc`
+        /// constants, taken from the first instance that describes them.
+        pub fn arg_locs(&self) -> (ArgLoc, ArgLoc) {
+            (self.future_arg_loc, self.drop_arg_loc)
+        }
+
+        /// The ID of the layer `function` is a call, poll or drop of, its
+        /// BPF cookie.
+        fn layer_id(&self, function: &FunctionInfo) -> Option<u64> {
+            let name = &function.name;
+            self.layers
+                .iter()
+                .position(|layer| {
+                    layer.calls.contains(name)
+                        || layer.polls.contains(name)
+                        || layer.drops.contains(name)
+                })
+                .map(|id| id as u64)
+        }
+
+        fn discover(&mut self, target: &TargetDetails) {
+            let symbols = &target.symbols;
+            let mut layers: Vec<Layer> = Vec::new();
+            let mut functions = Vec::new();
+
+            for function in symbols.find_functions("tower_service", |name| {
+                impl_self_type(name, "tower_service::Service<", ">::call").is_some()
+            }) {
+                let name = &function.demangled_name;
+                let Some(ty) = impl_self_type(name, "tower_service::Service<", ">::call") else {
+                    continue;
+                };
+                let path = type_path(ty);
+                if !self
+                    .enabled
+                    .iter()
+                    .any(|prefix| path.starts_with(prefix.as_str()))
+                {
+                    continue;
+                }
+                let mangled = function.name.clone();
+                if let Some(layer) = layers.iter_mut().find(|layer| layer.name == path) {
+                    layer.calls.push(mangled);
+                } else if layers.len() < MAX_LAYERS {
+                    layers.push(Layer {
+                        name: path.to_string(),
+                        calls: vec![mangled],
+                        ..Default::default()
+                    });
+                } else {
+                    warn!("Too many tower layers, not tracing {}", path);
+                    continue;
+                }
+                functions.push(function);
+            }
+
+            // Response futures live in the layer's module or a submodule of
+            // it, e.g. tower::timeout::future::ResponseFuture for
+            // tower::timeout::Timeout.
+            let module_of = |layer: &Layer| {
+                layer
+                    .name
+                    .rsplit_once("::")
+                    .map(|(module, _)| format!("{}::", module))
+                    .unwrap_or_default()
+            };
+            let modules: Vec<String> = layers.iter().map(module_of).collect();
+            let layer_for = |ty: &str| {
+                let path = type_path(ty);
+                modules
+                    .iter()
+                    .position(|module| !module.is_empty() && path.starts_with(module.as_str()))
+            };
+
+            let mut polls = Vec::new();
+            for function in symbols.find_functions("poll", |name| {
+                impl_self_type(name, "core::future::future::Future", ">::poll").is_some()
+            }) {
+                let ty = impl_self_type(
+                    &function.demangled_name,
+                    "core::future::future::Future",
+                    ">::poll",
+                );
+                if let Some(id) = ty.and_then(layer_for) {
+                    layers[id].polls.push(function.name.clone());
+                    polls.push(function);
+                }
+            }
+
+            let mut drops = Vec::new();
+            for function in symbols.find_functions("drop_in_place", |name| {
+                name.starts_with("core::ptr::drop_in_place<")
+            }) {
+                let ty = function
+                    .demangled_name
+                    .strip_prefix("core::ptr::drop_in_place<")
+                    .and_then(|ty| ty.strip_suffix('>'));
+                if let Some(id) = ty.and_then(layer_for) {
+                    layers[id].drops.push(function.name.clone());
+                    drops.push(function);
+                }
+            }
+
+            // The instances are not among the functions analysed up front,
+            // so their parameters are resolved here.
+            target.resolve_parameters(&mut polls);
+            target.resolve_parameters(&mut drops);
+            let first_arg_loc = |functions: &[FunctionInfo], parameter: &str| {
+                functions
+                    .iter()
+                    .map(|f| f.arg_loc(parameter))
+                    .find(|loc| *loc != ArgLoc::ABI)
+                    .unwrap_or(ArgLoc::ABI)
+            };
+            self.future_arg_loc = first_arg_loc(&polls, "self");
+            self.drop_arg_loc = first_arg_loc(&drops, "to_drop");
+
+            layers.retain(|layer| {
+                let usable = !layer.polls.is_empty() && !layer.drops.is_empty();
+                if !usable {
+                    warn!("No response future found for tower layer {}", layer.name);
+                }
+                usable
+            });
+            for layer in &layers {
+                info!(
+                    "Tracing tower layer {} ({} call, {} poll, {} drop sites)",
+                    layer.name,
+                    layer.calls.len(),
+                    layer.polls.len(),
+                    layer.drops.len()
+                );
+            }
+            self.layers = Arc::new(layers);
+            functions.extend(polls);
+            functions.extend(drops);
+            let functions: Vec<FunctionInfo> = functions
+                .into_iter()
+                .filter(|f| self.layer_id(f).is_some())
+                .collect();
+            self.target = ProbeTarget::with_functions(target, &functions);
+        }
+
+        pub fn layer_event_to_span(&self, raw: &LayerEvent) -> Option<Event> {
+            let layer = self.layers.get(raw.layer_id as usize)?;
+            Some(Event {
+                library: "tower".to_string(),
+                name: layer.name.clone(),
+                start_time: raw.start_time,
+                end_time: raw.end_time,
+                kind: SpanKind::Internal,
+                trace_id: raw.trace_id,
+                span_id: raw.span_id,
+                parent_span_id: (raw.parent_span_id != [0; 8]).then_some(raw.parent_span_id),
+                attributes: vec![
+                    ("rust.tower.layer".to_string(), layer.name.clone()),
+                    ("rust.async.poll_count".to_string(), raw.polls.to_string()),
+                    ("rust.async.busy_ns".to_string(), raw.busy_ns.to_string()),
+                ],
+                poll_stats: None,
+                events: Vec::new(),
+            })
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for TowerInstrumentor {
+        fn library_name(&self) -> &str {
+            "tower"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            // Instances are discovered from the symbol table at load time.
+            Vec::new()
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.discover(target);
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches it to every call, poll and
+        /// drop of the enabled layers with the layer's ID as the cookie and
+        /// reads the layer spans it reports.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            if self.layers.is_empty() {
+                return Ok(());
+            }
+            let (future_arg_loc, drop_arg_loc) = self.arg_locs();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("future_arg_loc", &future_arg_loc, true)
+                .set_global("drop_arg_loc", &drop_arg_loc, true);
+            let mut bpf = loader.load(probe_object!("tower")).map_err(ebpf_error)?;
+
+            let layers = &self.layers;
+            let layer_of = |names: fn(&Layer) -> &Vec<String>| {
+                move |function: &FunctionInfo| {
+                    layers
+                        .iter()
+                        .position(|layer| names(layer).contains(&function.name))
+                        .map(|id| id as u64)
+                }
+            };
+            let target = &self.target;
+            let calls = target.attach_entry_with_cookies(
+                &mut bpf,
+                "uprobe_tower_service_call",
+                layer_of(|layer| &layer.calls),
+            )?;
+            target.attach_entry_with_cookies(
+                &mut bpf,
+                "uprobe_tower_future_poll",
+                layer_of(|layer| &layer.polls),
+            )?;
+            target.attach_return_with_cookies(
+                &mut bpf,
+                "uprobe_tower_future_poll_return",
+                layer_of(|layer| &layer.polls),
+            )?;
+            target.attach_entry_with_cookies(
+                &mut bpf,
+                "uprobe_tower_future_drop",
+                layer_of(|layer| &layer.drops),
+            )?;
+            info!("Tracing {} tower layer call sites", calls);
+
+            let tower = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "layer_events",
+                &events_tx,
+                move |raw: &LayerEvent| tower.layer_event_to_span(raw),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod functions_instrumentor {
+    use super::dwarf::{
+        self, AsyncFnLayout, Capture, CaptureFormat, CaptureRecipe, ResultRecipe, MAX_CAPTURES,
+        MAX_CAPTURE_STR_SIZE,
+    };
+    use super::errors::Result;
+    use super::instrumentors::{
+        error_attribute, Event, FunctionTracingConfig, Instrumentor, PollStats,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::{FunctionInfo, TargetDetails};
+    use async_trait::async_trait;
+    use aya::maps::{Array, HashMap as BpfHashMap};
+    use aya::Pod;
+    use log::{info, warn};
+    use opentelemetry::trace::SpanKind;
+    use regex::Regex;
+    use std::collections::{HashMap, HashSet};
+    use std::sync::Arc;
+
+    /// Prefix of configured patterns that are regular expressions.
+    const REGEX_PREFIX: &str = "re:";
+
+    /// Matches programs' cookie space in the functions probe.
+    const MAX_TRACED_FUNCTIONS: usize = 1024;
+
+    /// Mirrors `struct function_span_t` in the functions probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct FunctionEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub function_id: u64,
+        pub polls: u64,
+        pub busy_ns: u64,
+        pub max_poll_ns: u64,
+        pub errors: u32,
+        pub padding: u32,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+        pub captures: [CapturedValue; MAX_CAPTURES],
+    }
+
+    /// Mirrors `struct captured_value` in captures.h.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct CapturedValue {
+        pub value: u64,
+        pub str: [u8; MAX_CAPTURE_STR_SIZE],
+    }
+
+    /// Mirrors `struct function_captures_t` in the functions probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy, Default)]
+    pub struct FunctionCaptures {
+        pub count: u32,
+        pub padding: u32,
+        pub recipes: [CaptureRecipe; MAX_CAPTURES],
+    }
+
+    // Mirrors a plain C struct without padding.
+    unsafe impl Pod for FunctionCaptures {}
+
+    /// A function selected for tracing; its index is its ID in the probe.
+    #[derive(Debug)]
+    pub struct TracedFunction {
+        pub mangled_name: String,
+        pub name: String,
+        /// Set for async fn bodies, which are traced across polls.
+        pub async_layout: Option<AsyncFnLayout>,
+        /// Values read at entry, by the expression that selected them.
+        pub captures: Vec<(String, Capture)>,
+        /// Set when an `Err` return marks the call as failed.
+        pub result: Option<ResultRecipe>,
+    }
+
+    impl TracedFunction {
+        /// BPF cookie of the function's probes. For async fn bodies it also
+        /// packs the layout of the state machine, see the functions probe.
+        pub fn cookie(&self, function_id: usize) -> u64 {
+            let Some(layout) = self.async_layout else {
+                return function_id as u64;
+            };
+            function_id as u64
+                | (layout.state_offset & 0xffff_ffff) << 16
+                | (layout.state_size as u64) << 48
+                | async_self_arg(&layout) << 56
+        }
+    }
+
+    /// Argument holding the future in an async fn body's poll function. On
+    /// x86-64 a `Poll<T>` wider than two registers is returned through a
+    /// hidden pointer in the first argument; aarch64 passes that in x8.
+    fn async_self_arg(layout: &AsyncFnLayout) -> u64 {
+        let indirect_return = layout.poll_size.is_some_and(|size| size > 16);
+        if cfg!(target_arch = "x86_64") && indirect_return {
+            2
+        } else {
+            1
+        }
+    }
+
+    /// Path of the async fn whose body is `name`, e.g. `myapp::create` for
+    /// `myapp::create::{{closure}}` (`{closure#0}` with v0 mangling).
+    fn async_fn_path(name: &str) -> Option<&str> {
+        let (path, last) = name.rsplit_once("::")?;
+        (last == "{{closure}}" || last.starts_with("{closure#")).then_some(path)
+    }
+
+    /// Attribute value of a captured argument. The probe reads integers in
+    /// registers at full width, so they are truncated to their type here.
+    pub fn render_capture(capture: &Capture, value: &CapturedValue) -> String {
+        let bits = match capture.recipe.size {
+            size @ 1..=7 => size * 8,
+            _ => 64,
+        };
+        let mask = u64::MAX >> (64 - bits);
+        let raw = value.value & mask;
+        match &capture.format {
+            CaptureFormat::Unsigned | CaptureFormat::Len => raw.to_string(),
+            CaptureFormat::Signed => (((raw << (64 - bits)) as i64) >> (64 - bits)).to_string(),
+            CaptureFormat::Bool => (raw != 0).to_string(),
+            CaptureFormat::Str => {
+                let len = (value.value as usize).min(MAX_CAPTURE_STR_SIZE);
+                String::from_utf8_lossy(&value.str[..len]).into_owned()
+            }
+            CaptureFormat::Variant(variants, other) => variants
+                .iter()
+                .find(|(discriminant, _)| discriminant & mask == raw)
+                .map(|(_, name)| name.clone())
+                .or_else(|| other.clone())
+                .unwrap_or_else(|| raw.to_string()),
+        }
+    }
+
+    /// Shell-style match of `name` against `pattern`, where `*` matches any
+    /// run of characters (including `::`) and `?` a single one.
+    pub fn glob_match(pattern: &str, name: &str) -> bool {
+        let (pattern, name) = (pattern.as_bytes(), name.as_bytes());
+        let (mut p, mut n) = (0, 0);
+        let mut backtrack: Option<(usize, usize)> = None;
+        while n < name.len() {
+            match pattern.get(p) {
+                Some(b'*') => {
+                    backtrack = Some((p, n));
+                    p += 1;
+                }
+                Some(&c) if c == b'?' || c == name[n] => {
+                    p += 1;
+                    n += 1;
+                }
+                _ => match backtrack {
+                    Some((star, matched)) => {
+                        p = star + 1;
+                        n = matched + 1;
+                        backtrack = Some((star, matched + 1));
+                    }
+                    None => return false,
+                },
+            }
+        }
+        pattern[p..].iter().all(|&c| c == b'*')
+    }
+
+    /// Adds `function` unless it is already traced. False once `limit` is
+    /// reached.
+    fn add_function(
+        functions: &mut Vec<TracedFunction>,
+        limit: usize,
+        function: TracedFunction,
+    ) -> bool {
+        if functions
+            .iter()
+            .any(|f| f.mangled_name == function.mangled_name)
+        {
+            return true;
+        }
+        if functions.len() >= limit {
+            warn!(
+                "Function tracing limited to {} functions, ignoring the rest",
+                limit
+            );
+            return false;
+        }
+        functions.push(function);
+        true
+    }
+
+    /// Longest literal identifier in a pattern. Mangled names spell out each
+    /// path segment, so it narrows the symbols that need demangling.
+    fn mangled_hint(pattern: &str) -> &str {
+        pattern
+            .split(|c: char| !(c.is_alphanumeric() || c == '_'))
+            .max_by_key(|part| part.len())
+            .unwrap_or("")
+    }
+
+    /// A configured pattern over demangled names: a glob, or after `re:` a
+    /// regular expression that must match the whole name.
+    pub enum NamePattern {
+        Glob(String),
+        Regex(Regex),
+    }
+
+    impl NamePattern {
+        pub fn new(pattern: &str) -> std::result::Result<Self, regex::Error> {
+            match pattern.strip_prefix(REGEX_PREFIX) {
+                Some(re) => Regex::new(&format!("^(?:{})$", re)).map(Self::Regex),
+                None => Ok(Self::Glob(pattern.to_string())),
+            }
+        }
+
+        pub fn matches(&self, name: &str) -> bool {
+            match self {
+                Self::Glob(glob) => glob_match(glob, name),
+                Self::Regex(re) => re.is_match(name),
+            }
+        }
+
+        /// Substring of the mangled names of all matches. A regular
+        /// expression's literals may sit in alternatives, so every symbol is
+        /// demangled and tried.
+        fn mangled_hint(&self) -> &str {
+            match self {
+                Self::Glob(glob) => mangled_hint(glob),
+                Self::Regex(_) => "",
+            }
+        }
+    }
+
+    /// Compiles a configured pattern, or warns and returns `None` when it is
+    /// not a valid regular expression.
+    fn name_pattern(pattern: &str) -> Option<NamePattern> {
+        NamePattern::new(pattern)
+            .map_err(|e| warn!("Ignoring function pattern {}: {}", pattern, e))
+            .ok()
+    }
+
+    /// Times user-selected functions: every symbol whose demangled name
+    /// matches one of the configured globs gets an entry and a return probe
+    /// and each call becomes a child span of the active request. The number
+    /// of attached functions and the calls timed per second are capped.
+    ///
+    /// Async fns are matched by path instead and traced through the poll
+    /// function of their body: the span starts at the first poll, found
+    /// from the state machine's initial state, and ends when a poll leaves
+    /// it returned, with the polls in between as its poll stats. Their
+    /// state machine layout is read from DWARF, so the target needs debug
+    /// info.
+    #[derive(Clone)]
+    pub struct FunctionsInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        config: FunctionTracingConfig,
+        functions: Arc<Vec<TracedFunction>>,
+    }
+
+    impl FunctionsInstrumentor {
+        pub fn new(config: FunctionTracingConfig) -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                config,
+                functions: Arc::default(),
+            }
+        }
+
+        pub fn functions(&self) -> &[TracedFunction] {
+            &self.functions
+        }
+
+        /// Values of the probe's `max_calls_per_sec` and `min_duration_ns`
+        /// constants.
+        pub fn probe_constants(&self) -> (u64, u64) {
+            (
+                self.config.max_calls_per_sec,
+                self.config.min_duration.as_nanos() as u64,
+            )
+        }
+
+        fn discover(&mut self, target: &TargetDetails) {
+            let limit = self.config.max_functions.min(MAX_TRACED_FUNCTIONS);
+            let mut functions: Vec<TracedFunction> = Vec::new();
+            let mut found: Vec<FunctionInfo> = Vec::new();
+
+            'patterns: for pattern in &self.config.patterns {
+                let Some(matcher) = name_pattern(pattern) else {
+                    continue;
+                };
+                let matches = target
+                    .symbols
+                    .find_functions(matcher.mangled_hint(), |name| matcher.matches(name));
+                if matches.is_empty() {
+                    warn!("No function matches {}", pattern);
+                }
+                for info in matches {
+                    let function = TracedFunction {
+                        mangled_name: info.name.clone(),
+                        name: info.demangled_name.clone(),
+                        async_layout: None,
+                        captures: Vec::new(),
+                        result: None,
+                    };
+                    if !add_function(&mut functions, limit, function) {
+                        break 'patterns;
+                    }
+                    found.push(info);
+                }
+            }
+
+            if !self.config.async_patterns.is_empty() && functions.len() < limit {
+                self.discover_async(target, &mut functions, &mut found, limit);
+            }
+            if !self.config.captures.is_empty() {
+                self.resolve_captures(target, &mut functions);
+            }
+            if !self.config.error_patterns.is_empty() {
+                self.resolve_results(target, &mut functions);
+            }
+
+            info!("Tracing {} user functions", functions.len());
+            let traced: HashSet<&str> = functions.iter().map(|f| f.mangled_name.as_str()).collect();
+            let probed = found.iter().filter(|f| traced.contains(f.name.as_str()));
+            self.target = ProbeTarget::with_functions(target, probed);
+            self.functions = Arc::new(functions);
+        }
+
+        fn discover_async(
+            &self,
+            target: &TargetDetails,
+            functions: &mut Vec<TracedFunction>,
+            found: &mut Vec<FunctionInfo>,
+            limit: usize,
+        ) {
+            let layouts = match dwarf::async_fn_layouts(&target.debug_info) {
+                Ok(layouts) => layouts,
+                Err(e) => {
+                    warn!("Async function tracing disabled: {}", e);
+                    return;
+                }
+            };
+            if layouts.is_empty() {
+                warn!(
+                    "Async function tracing needs debug info, none found in {:?}",
+                    target.exe_path
+                );
+                return;
+            }
+
+            for pattern in &self.config.async_patterns {
+                let Some(matcher) = name_pattern(pattern) else {
+                    continue;
+                };
+                let matches = target
+                    .symbols
+                    .find_functions(matcher.mangled_hint(), |name| {
+                        async_fn_path(name).is_some_and(|path| matcher.matches(path))
+                    });
+                let mut matched = false;
+                for info in matches {
+                    // Closures are named like async fn bodies; only the
+                    // latter have a state machine in the debug info.
+                    let Some(&layout) = layouts.get(&info.name) else {
+                        continue;
+                    };
+                    matched = true;
+                    let name = &info.demangled_name;
+                    let function = TracedFunction {
+                        name: async_fn_path(name).unwrap_or(name).to_string(),
+                        mangled_name: info.name.clone(),
+                        async_layout: Some(layout),
+                        captures: Vec::new(),
+                        result: None,
+                    };
+                    if !add_function(functions, limit, function) {
+                        return;
+                    }
+                    found.push(info);
+                }
+                if !matched {
+                    warn!("No async function matches {}", pattern);
+                }
+            }
+        }
+
+        /// Resolves the configured captures of the synchronous functions
+        /// among `functions`. An async fn's arguments live in its state
+        /// machine, which the poll function only reaches through `self`.
+        fn resolve_captures(&self, target: &TargetDetails, functions: &mut [TracedFunction]) {
+            let captures: Vec<(NamePattern, &Vec<String>)> = self
+                .config
+                .captures
+                .iter()
+                .filter_map(|(pattern, exprs)| Some((name_pattern(pattern)?, exprs)))
+                .collect();
+            let mut wanted: HashMap<String, Vec<String>> = HashMap::new();
+            for function in functions.iter().filter(|f| f.async_layout.is_none()) {
+                for (pattern, exprs) in &captures {
+                    if pattern.matches(&function.name) {
+                        wanted
+                            .entry(function.mangled_name.clone())
+                            .or_default()
+                            .extend(exprs.iter().cloned());
+                    }
+                }
+            }
+            if wanted.is_empty() {
+                return;
+            }
+
+            let mut recipes = match dwarf::capture_recipes(&target.debug_info, &wanted) {
+                Ok(recipes) => recipes,
+                Err(e) => {
+                    warn!("Argument capture disabled: {}", e);
+                    return;
+                }
+            };
+            for function in functions.iter_mut() {
+                if !wanted.contains_key(&function.mangled_name) {
+                    continue;
+                }
+                let Some(resolved) = recipes.remove(&function.mangled_name) else {
+                    warn!("No debug info for {}, not capturing", function.name);
+                    continue;
+                };
+                for (expr, capture) in resolved {
+                    match capture {
+                        Ok(_) if function.captures.len() == MAX_CAPTURES => warn!(
+                            "Capturing at most {} values of {}, ignoring {}",
+                            MAX_CAPTURES, function.name, expr
+                        ),
+                        Ok(capture) => function.captures.push((expr, capture)),
+                        Err(reason) => {
+                            warn!("Cannot capture {} of {}: {}", expr, function.name, reason)
+                        }
+                    }
+                }
+            }
+        }
+
+        /// Resolves the `Result` layout of the synchronous functions among
+        /// `functions` selected for error tracking.
+        fn resolve_results(&self, target: &TargetDetails, functions: &mut [TracedFunction]) {
+            let patterns: Vec<NamePattern> = self
+                .config
+                .error_patterns
+                .iter()
+                .filter_map(|pattern| name_pattern(pattern))
+                .collect();
+            let wanted: HashSet<&str> = functions
+                .iter()
+                .filter(|f| f.async_layout.is_none())
+                .filter(|f| patterns.iter().any(|pattern| pattern.matches(&f.name)))
+                .map(|f| f.mangled_name.as_str())
+                .collect();
+            if wanted.is_empty() {
+                return;
+            }
+
+            let mut recipes = match dwarf::result_recipes(&target.debug_info, &wanted) {
+                Ok(recipes) => recipes,
+                Err(e) => {
+                    warn!("Function error tracking disabled: {}", e);
+                    return;
+                }
+            };
+            for function in functions.iter_mut() {
+                match recipes.remove(&function.mangled_name) {
+                    Some(Ok(recipe)) => function.result = Some(recipe),
+                    Some(Err(reason)) => {
+                        warn!("Not tracking errors of {}: {}", function.name, reason)
+                    }
+                    None => {}
+                }
+            }
+        }
+
+        /// Entries for the probe's `function_results` map, keyed by
+        /// function ID.
+        pub fn result_entries(&self) -> Vec<(u32, ResultRecipe)> {
+            self.functions
+                .iter()
+                .enumerate()
+                .filter_map(|(id, function)| Some((id as u32, function.result?)))
+                .collect()
+        }
+
+        /// Entries for the probe's `function_captures` map, keyed by
+        /// function ID.
+        pub fn capture_entries(&self) -> Vec<(u32, FunctionCaptures)> {
+            self.functions
+                .iter()
+                .enumerate()
+                .filter(|(_, function)| !function.captures.is_empty())
+                .map(|(id, function)| {
+                    let mut entry = FunctionCaptures {
+                        count: function.captures.len() as u32,
+                        ..Default::default()
+                    };
+                    for (recipe, (_, capture)) in entry.recipes.iter_mut().zip(&function.captures) {
+                        *recipe = capture.recipe;
+                    }
+                    (id as u32, entry)
+                })
+                .collect()
+        }
+
+        pub fn function_event_to_span(&self, raw: &FunctionEvent) -> Option<Event> {
+            let function = self.functions.get(raw.function_id as usize)?;
+            let mut attributes = vec![("code.function".to_string(), function.name.clone())];
+            attributes.extend(function.captures.iter().zip(&raw.captures).map(
+                |((expr, capture), value)| {
+                    (format!("rust.arg.{}", expr), render_capture(capture, value))
+                },
+            ));
+            attributes.extend(error_attribute(raw.errors));
+            Some(Event {
+                library: "functions".to_string(),
+                name: function.name.clone(),
+                start_time: raw.start_time,
+                end_time: raw.end_time,
+                kind: SpanKind::Internal,
+                trace_id: raw.trace_id,
+                span_id: raw.span_id,
+                parent_span_id: (raw.parent_span_id != [0; 8]).then_some(raw.parent_span_id),
+                attributes,
+                poll_stats: function.async_layout.map(|_| PollStats {
+                    polls: raw.polls,
+                    busy_ns: raw.busy_ns,
+                    max_poll_ns: raw.max_poll_ns,
+                    cpu_ns: 0,
+                }),
+                events: Vec::new(),
+            })
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for FunctionsInstrumentor {
+        fn library_name(&self) -> &str {
+            "functions"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            // Matches are found in the symbol table at load time.
+            Vec::new()
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.discover(target);
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches the entry and return
+        /// programs to every traced function, or the poll programs to an
+        /// async fn body, with its cookie and reads the spans they report.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            if self.functions.is_empty() {
+                return Ok(());
+            }
+            let (max_calls_per_sec, min_duration_ns) = self.probe_constants();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("max_calls_per_sec", &max_calls_per_sec, true)
+                .set_global("min_duration_ns", &min_duration_ns, true);
+            let mut bpf = loader
+                .load(probe_object!("functions"))
+                .map_err(ebpf_error)?;
+
+            // The recipes must be in place before the first call is seen.
+            let mut captures: Array<_, FunctionCaptures> = Array::try_from(
+                bpf.map_mut("function_captures")
+                    .ok_or_else(|| ebpf_error("missing function_captures map"))?,
+            )
+            .map_err(ebpf_error)?;
+            for (id, entry) in self.capture_entries() {
+                captures.set(id, entry, 0).map_err(ebpf_error)?;
+            }
+            let mut results: BpfHashMap<_, u32, ResultRecipe> = BpfHashMap::try_from(
+                bpf.map_mut("function_results")
+                    .ok_or_else(|| ebpf_error("missing function_results map"))?,
+            )
+            .map_err(ebpf_error)?;
+            for (id, recipe) in self.result_entries() {
+                results.insert(id, recipe, 0).map_err(ebpf_error)?;
+            }
+
+            let ids: HashMap<&str, usize> = self
+                .functions
+                .iter()
+                .enumerate()
+                .map(|(id, function)| (function.mangled_name.as_str(), id))
+                .collect();
+            // Async fn bodies get the poll programs, with the layout of
+            // their state machine packed into the cookie.
+            let cookie = |is_async: bool| {
+                let ids = &ids;
+                move |info: &FunctionInfo| {
+                    let id = *ids.get(info.name.as_str())?;
+                    let function = &self.functions[id];
+                    (function.async_layout.is_some() == is_async).then(|| function.cookie(id))
+                }
+            };
+            let target = &self.target;
+            let attached = target.attach_entry_with_cookies(
+                &mut bpf,
+                "uprobe_function_entry",
+                cookie(false),
+            )?;
+            target.attach_return_with_cookies(&mut bpf, "uprobe_function_return", cookie(false))?;
+            let polled = target.attach_entry_with_cookies(
+                &mut bpf,
+                "uprobe_async_function_poll",
+                cookie(true),
+            )?;
+            target.attach_return_with_cookies(
+                &mut bpf,
+                "uprobe_async_function_poll_return",
+                cookie(true),
+            )?;
+            info!(
+                "Timing {} user functions and {} async fn bodies",
+                attached, polled
+            );
+
+            let functions = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "function_events",
+                &events_tx,
+                move |raw: &FunctionEvent| functions.function_event_to_span(raw),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+
+        #[test]
+        fn glob_match_empty() {
+            assert!(glob_match("", ""));
+            assert!(!glob_match("", "a"));
+            assert!(glob_match("*", ""));
+            assert!(glob_match("**", ""));
+            assert!(!glob_match("?", ""));
+        }
+
+        #[test]
+        fn glob_match_literals_and_single_characters() {
+            assert!(glob_match("app::main", "app::main"));
+            assert!(!glob_match("app::main", "app::mai"));
+            assert!(!glob_match("app::mai", "app::main"));
+            assert!(glob_match("a?c", "abc"));
+            assert!(!glob_match("a?c", "ac"));
+            assert!(!glob_match("a?c", "abbc"));
+        }
+
+        #[test]
+        fn glob_match_stars_cross_path_separators() {
+            assert!(glob_match("app::*", "app::api::users::get"));
+            assert!(glob_match("*::handle", "app::api::handle"));
+            assert!(!glob_match("*::handle", "app::api::handle_all"));
+            assert!(glob_match("app::*::get", "app::users::get"));
+            assert!(!glob_match("app::*::get", "app::get"));
+            assert!(glob_match("a*", "a"));
+        }
+
+        #[test]
+        fn glob_match_backtracks() {
+            assert!(glob_match("*ab", "aab"));
+            assert!(glob_match("a*b*c", "axxbyybzc"));
+            assert!(!glob_match("a*b*c", "axxbyyb"));
+            assert!(glob_match("*a*a*a", "aaaa"));
+            assert!(!glob_match("*a*a*a", "aa"));
+        }
+
+        #[test]
+        fn name_patterns_are_globs_or_anchored_regexes() {
+            let glob = NamePattern::new("myapp::*::get").unwrap();
+            assert!(glob.matches("myapp::users::get"));
+            assert_eq!(glob.mangled_hint(), "myapp");
+
+            let re = NamePattern::new("re:app::(users|orders)::get").unwrap();
+            assert!(re.matches("app::orders::get"));
+            assert!(!re.matches("app::orders::get_all"));
+            assert!(!re.matches("myapp::orders::get"));
+            assert_eq!(re.mangled_hint(), "");
+            assert!(NamePattern::new("re:app::(").is_err());
+        }
+
+        #[test]
+        fn async_cookies_pack_the_state_machine_layout() {
+            let mut function = TracedFunction {
+                mangled_name: String::new(),
+                name: "app::handle".to_string(),
+                async_layout: None,
+                captures: Vec::new(),
+                result: None,
+            };
+            assert_eq!(function.cookie(7), 7);
+
+            function.async_layout = Some(AsyncFnLayout {
+                state_offset: 0x28,
+                state_size: 1,
+                poll_size: Some(8),
+            });
+            let cookie = function.cookie(7);
+            assert_eq!(cookie & 0xffff, 7);
+            assert_eq!((cookie >> 16) & 0xffff_ffff, 0x28);
+            assert_eq!((cookie >> 48) & 0xff, 1);
+            assert_eq!(cookie >> 56, 1);
+        }
+    }
+}
+
+mod panic_instrumentor {
+    use super::dwarf::ArgLoc;
+    use super::errors::Result;
+    use super::instrumentors::{c_str, Event, Instrumentor};
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use super::symbols::SymbolTable;
+    use async_trait::async_trait;
+    use log::info;
+    use opentelemetry::trace::SpanKind;
+    use std::sync::Arc;
+
+    const RUST_PANIC_WITH_HOOK: &str = "std::panicking::rust_panic_with_hook";
+
+    /// Offsets of `file`, `line` and `col` in `core::panic::Location`. The
+    /// struct is std-internal and has kept this layout across releases.
+    const LOCATION_LAYOUT: (u64, u64, u64) = (0, 16, 20);
+
+    /// Mirrors `struct panic_event_t` in the panic probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct PanicEvent {
+        pub time: u64,
+        pub stack_id: i64,
+        pub line: u32,
+        pub column: u32,
+        pub file: [u8; 128],
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+    }
+
+    /// Reports panics as spans under the span that was active when they
+    /// happened, with their location and user stack. The probe also marks
+    /// the trace, so the server span of the request ends up errored even
+    /// when the panic is caught, e.g. by tokio for a spawned task.
+    #[derive(Clone)]
+    pub struct PanicInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        location_arg_loc: ArgLoc,
+        symbols: Option<Arc<SymbolTable>>,
+    }
+
+    impl PanicInstrumentor {
+        pub fn new() -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                location_arg_loc: ArgLoc::ABI,
+                symbols: None,
+            }
+        }
+
+        /// Value of the probe's `location_arg_loc` constant.
+        pub fn location_arg_loc(&self) -> ArgLoc {
+            self.location_arg_loc
+        }
+
+        /// Values of the probe's `location_file_pos`, `location_line_pos`
+        /// and `location_col_pos` constants.
+        pub fn location_layout(&self) -> (u64, u64, u64) {
+            LOCATION_LAYOUT
+        }
+
+        pub fn panic_event_to_span(&self, raw: &PanicEvent, stack: &[u64]) -> Event {
+            let mut attributes = vec![
+                ("exception.type".to_string(), "panic".to_string()),
+                ("error.type".to_string(), "panic".to_string()),
+            ];
+            let file = c_str(&raw.file);
+            if !file.is_empty() {
+                attributes.push(("code.filepath".to_string(), file));
+                attributes.push(("code.lineno".to_string(), raw.line.to_string()));
+                attributes.push(("code.column".to_string(), raw.column.to_string()));
+            }
+            if let Some(symbols) = &self.symbols {
+                if !stack.is_empty() {
+                    attributes.push((
+                        "exception.stacktrace".to_string(),
+                        symbols.format_stack(stack),
+                    ));
+                }
+            }
+
+            Event {
+                library: "panic".to_string(),
+                name: "panic".to_string(),
+                start_time: raw.time,
+                end_time: raw.time,
+                kind: SpanKind::Internal,
+                trace_id: raw.trace_id,
+                span_id: raw.span_id,
+                parent_span_id: (raw.parent_span_id != [0; 8]).then_some(raw.parent_span_id),
+                attributes,
+                poll_stats: None,
+                events: Vec::new(),
+            }
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for PanicInstrumentor {
+        fn library_name(&self) -> &str {
+            "panic"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![RUST_PANIC_WITH_HOOK]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.location_arg_loc = target.arg_loc(&[RUST_PANIC_WITH_HOOK], "location");
+            self.symbols = Some(Arc::clone(&target.symbols));
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants, attaches it to
+        /// `rust_panic_with_hook` and reads the panics it reports with
+        /// their user stacks.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let location_arg_loc = self.location_arg_loc();
+            let (file_pos, line_pos, col_pos) = self.location_layout();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("location_arg_loc", &location_arg_loc, true)
+                .set_global("location_file_pos", &file_pos, true)
+                .set_global("location_line_pos", &line_pos, true)
+                .set_global("location_col_pos", &col_pos, true);
+            let mut bpf = loader.load(probe_object!("panic")).map_err(ebpf_error)?;
+
+            let hooks = self.target.attach_entry(
+                &mut bpf,
+                "uprobe_rust_panic_with_hook",
+                &[RUST_PANIC_WITH_HOOK],
+            )?;
+            info!("Tracing panics through {} panic hooks", hooks);
+
+            let user_stacks = probes::user_stacks(&mut bpf)?;
+            let panics = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "panic_events",
+                &events_tx,
+                move |raw: &PanicEvent| {
+                    let stack = probes::stack_frames(&user_stacks, raw.stack_id);
+                    Some(panics.panic_event_to_span(raw, &stack))
+                },
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod tracing_instrumentor {
+    use super::dwarf::{self, ArgLoc, Capture, CaptureRecipe, RETURN_POINTER};
+    use super::errors::Result;
+    use super::functions_instrumentor::{render_capture, CapturedValue};
+    use super::instrumentors::{Event, Instrumentor, InternedStrings, PollStats, StringDefinition};
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use async_trait::async_trait;
+    use aya::maps::HashMap as BpfHashMap;
+    use log::{info, warn};
+    use opentelemetry::trace::SpanKind;
+    use std::collections::HashMap;
+    use std::sync::Arc;
+
+    const MAKE_SPAN: &str = "tracing::span::Span::make_with";
+    const DISPATCH_ENTER: &str = "tracing_core::dispatcher::Dispatch::enter";
+    const DISPATCH_EXIT: &str = "tracing_core::dispatcher::Dispatch::exit";
+    const DISPATCH_TRY_CLOSE: &str = "tracing_core::dispatcher::Dispatch::try_close";
+    const VALUE_TRAIT: &str = "tracing_core::field::Value";
+
+    /// Match the tracing probe's `MAX_TRACING_FIELDS` and
+    /// `MAX_VALUE_TYPES`.
+    const MAX_TRACING_FIELDS: usize = 8;
+    const MAX_VALUE_TYPES: usize = 1024;
+
+    /// `tracing_core::Level` values, from `TRACE` up.
+    const LEVELS: [&str; 5] = ["TRACE", "DEBUG", "INFO", "WARN", "ERROR"];
+
+    /// Offsets the tracing probe reads, as tracked for tracing-core 0.1 and
+    /// tracing 0.1 in offset_results.json.
+    #[derive(Debug, Clone, Copy)]
+    pub struct TracingLayout {
+        pub metadata_level: u64,
+        pub metadata_name: u64,
+        pub metadata_target: u64,
+        pub attributes_values: u64,
+        pub value_set_values: u64,
+        pub field_names: u64,
+        pub field_index: u64,
+        pub span_id: u64,
+    }
+
+    const LAYOUT: TracingLayout = TracingLayout {
+        metadata_level: 0,
+        metadata_name: 16,
+        metadata_target: 32,
+        attributes_values: 24,
+        value_set_values: 0,
+        field_names: 0,
+        field_index: 32,
+        span_id: 24,
+    };
+
+    /// Mirrors `struct tracing_field_t` in the tracing probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct TracingField {
+        pub name_id: u64,
+        pub vtable: u64,
+        pub value: CapturedValue,
+    }
+
+    /// Mirrors `struct tracing_span_t` in the tracing probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct TracingSpanEvent {
+        pub start_time: u64,
+        pub end_time: u64,
+        pub name_id: u64,
+        pub target_id: u64,
+        pub busy_ns: u64,
+        pub max_entered_ns: u64,
+        pub entries: u32,
+        pub level: u32,
+        pub field_count: u32,
+        pub padding: u32,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+        pub parent_trace_id: [u8; 16],
+        pub parent_span_id: [u8; 8],
+        pub fields: [TracingField; MAX_TRACING_FIELDS],
+    }
+
+    /// Exports the spans an application creates with the `tracing` crate
+    /// as children of the request they run in, with their fields as
+    /// attributes. The probes sit on the dispatcher, so spans only reach
+    /// them when a subscriber enables them; with no subscriber installed
+    /// the `span!` macros do nothing. Field values are read in-kernel for
+    /// the types the binary's DWARF describes: integers, bools, strings and
+    /// references or `Display`/`Debug` wrappers around them.
+    #[derive(Clone)]
+    pub struct TracingInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        meta_arg_loc: ArgLoc,
+        attributes_arg_loc: ArgLoc,
+        /// Field value types by the runtime address of their vtable.
+        value_types: Arc<HashMap<u64, Capture>>,
+        strings: Arc<InternedStrings>,
+    }
+
+    impl TracingInstrumentor {
+        pub fn new() -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                meta_arg_loc: ArgLoc::ABI,
+                attributes_arg_loc: ArgLoc::ABI,
+                value_types: Arc::default(),
+                strings: Arc::default(),
+            }
+        }
+
+        /// Values of the probe's `meta_arg_loc` and `attributes_arg_loc`
+        /// constants.
+        pub fn arg_locs(&self) -> (ArgLoc, ArgLoc) {
+            (self.meta_arg_loc, self.attributes_arg_loc)
+        }
+
+        /// Value of the probe's `return_pointer_reg` constant.
+        pub fn return_pointer_reg(&self) -> u32 {
+            RETURN_POINTER as u32
+        }
+
+        /// Values of the probe's layout constants.
+        pub fn layout(&self) -> TracingLayout {
+            LAYOUT
+        }
+
+        /// Entries for the probe's `value_types` map.
+        pub fn value_type_entries(&self) -> Vec<(u64, CaptureRecipe)> {
+            self.value_types
+                .iter()
+                .map(|(&vtable, capture)| (vtable, capture.recipe))
+                .collect()
+        }
+
+        pub fn define(&self, def: &StringDefinition) {
+            self.strings.define(def);
+        }
+
+        fn resolve_value_types(&mut self, target: &TargetDetails) {
+            let captures = match dwarf::vtable_captures(&target.debug_info, VALUE_TRAIT) {
+                Ok(captures) => captures,
+                Err(e) => {
+                    warn!("Not recording `tracing` span fields: {}", e);
+                    return;
+                }
+            };
+            if captures.is_empty() {
+                warn!(
+                    "Recording `tracing` span fields needs debug info, none found in {:?}",
+                    target.exe_path
+                );
+                return;
+            }
+
+            let total = captures.len();
+            let mut value_types = HashMap::new();
+            for (address, (type_name, capture)) in captures {
+                match capture {
+                    Ok(_) if value_types.len() == MAX_VALUE_TYPES => {
+                        warn!(
+                            "Recording fields of at most {} types, ignoring {}",
+                            MAX_VALUE_TYPES, type_name
+                        );
+                    }
+                    Ok(capture) => {
+                        value_types.insert(target.symbols.runtime_address(address), capture);
+                    }
+                    Err(_) => {}
+                }
+            }
+            info!(
+                "Recording `tracing` fields of {} of {} value types",
+                value_types.len(),
+                total
+            );
+            self.value_types = Arc::new(value_types);
+        }
+
+        pub fn tracing_event_to_span(&self, raw: &TracingSpanEvent) -> Event {
+            let name = self
+                .strings
+                .resolve(raw.name_id)
+                .map_or_else(|| "span".to_string(), |name| name.to_string());
+            let mut attributes = Vec::new();
+            if let Some(target) = self.strings.resolve(raw.target_id) {
+                attributes.push(("code.namespace".to_string(), target.to_string()));
+            }
+            if let Some(level) = LEVELS.get(raw.level as usize) {
+                attributes.push(("rust.tracing.level".to_string(), level.to_string()));
+            }
+            let count = (raw.field_count as usize).min(MAX_TRACING_FIELDS);
+            for field in &raw.fields[..count] {
+                let (Some(key), Some(capture)) = (
+                    self.strings.resolve(field.name_id),
+                    self.value_types.get(&field.vtable),
+                ) else {
+                    continue;
+                };
+                attributes.push((key.to_string(), render_capture(capture, &field.value)));
+            }
+
+            Event {
+                library: "tracing".to_string(),
+                name,
+                start_time: raw.start_time,
+                end_time: raw.end_time,
+                kind: SpanKind::Internal,
+                trace_id: raw.trace_id,
+                span_id: raw.span_id,
+                parent_span_id: (raw.parent_span_id != [0; 8]).then_some(raw.parent_span_id),
+                attributes,
+                poll_stats: (raw.entries > 0).then(|| PollStats {
+                    polls: raw.entries as u64,
+                    busy_ns: raw.busy_ns,
+                    max_poll_ns: raw.max_entered_ns,
+                    cpu_ns: 0,
+                }),
+                events: Vec::new(),
+            }
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for TracingInstrumentor {
+        fn library_name(&self) -> &str {
+            "tracing"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![MAKE_SPAN, DISPATCH_ENTER, DISPATCH_EXIT, DISPATCH_TRY_CLOSE]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.meta_arg_loc = target.arg_loc(&[MAKE_SPAN], "meta");
+            self.attributes_arg_loc = target.arg_loc(&[MAKE_SPAN], "new_span");
+            self.resolve_value_types(target);
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's constants and field value types, attaches it to
+        /// the dispatcher and reads the spans it reports along with the
+        /// names and targets they intern.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let (meta_arg_loc, attributes_arg_loc) = self.arg_locs();
+            let return_pointer_reg = self.return_pointer_reg();
+            let layout = self.layout();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("metadata_level_pos", &layout.metadata_level, true)
+                .set_global("metadata_name_pos", &layout.metadata_name, true)
+                .set_global("metadata_target_pos", &layout.metadata_target, true)
+                .set_global("attributes_values_pos", &layout.attributes_values, true)
+                .set_global("value_set_values_pos", &layout.value_set_values, true)
+                .set_global("field_names_pos", &layout.field_names, true)
+                .set_global("field_index_pos", &layout.field_index, true)
+                .set_global("span_id_pos", &layout.span_id, true)
+                .set_global("meta_arg_loc", &meta_arg_loc, true)
+                .set_global("attributes_arg_loc", &attributes_arg_loc, true)
+                .set_global("return_pointer_reg", &return_pointer_reg, true);
+            let mut bpf = loader.load(probe_object!("tracing")).map_err(ebpf_error)?;
+
+            let mut value_types: BpfHashMap<_, u64, CaptureRecipe> = BpfHashMap::try_from(
+                bpf.map_mut("value_types")
+                    .ok_or_else(|| ebpf_error("missing value_types map"))?,
+            )
+            .map_err(ebpf_error)?;
+            for (vtable, recipe) in self.value_type_entries() {
+                value_types.insert(vtable, recipe, 0).map_err(ebpf_error)?;
+            }
+
+            let target = &self.target;
+            let spans = target.attach_entry(&mut bpf, "uprobe_tracing_make_span", &[MAKE_SPAN])?;
+            target.attach_return(&mut bpf, "uprobe_tracing_make_span_return", &[MAKE_SPAN])?;
+            target.attach_entry(&mut bpf, "uprobe_tracing_enter", &[DISPATCH_ENTER])?;
+            target.attach_entry(&mut bpf, "uprobe_tracing_exit", &[DISPATCH_EXIT])?;
+            target.attach_entry(&mut bpf, "uprobe_tracing_try_close", &[DISPATCH_TRY_CLOSE])?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_tracing_try_close_return",
+                &[DISPATCH_TRY_CLOSE],
+            )?;
+            info!("Tracing `tracing` spans made in {} places", spans);
+
+            let strings = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "string_definitions",
+                &events_tx,
+                move |def: &StringDefinition| {
+                    strings.define(def);
+                    None
+                },
+            )?;
+            let tracing = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "tracing_events",
+                &events_tx,
+                move |raw: &TracingSpanEvent| Some(tracing.tracing_event_to_span(raw)),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod otel_sdk_instrumentor {
+    use super::dwarf::{self, RETURN_POINTER};
+    use super::errors::Result;
+    use super::instrumentors::{Event, Instrumentor};
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use async_trait::async_trait;
+    use log::{info, warn};
+
+    /// `SdkTracer` was named `Tracer` before opentelemetry_sdk 0.27.
+    const BUILD_WITH_CONTEXT: [&str; 2] = [
+        "<opentelemetry_sdk::trace::tracer::SdkTracer as opentelemetry::trace::tracer::Tracer>::build_with_context",
+        "<opentelemetry_sdk::trace::tracer::Tracer as opentelemetry::trace::tracer::Tracer>::build_with_context",
+    ];
+    const SPAN_END: &str = "opentelemetry_sdk::trace::span::Span::ensure_ended_and_exported";
+
+    const SPAN_TYPE: &str = "opentelemetry_sdk::trace::span::Span";
+    const TRACE_ID_FIELD: &str = "span_context.trace_id";
+    const SPAN_ID_FIELD: &str = "span_context.span_id";
+    const PARENT_SPAN_ID_FIELD: &str = "data.Some.__0.parent_span_id";
+
+    /// Offsets of the IDs in the SDK's `Span`, the values of the probe's
+    /// `span_trace_id_pos`, `span_span_id_pos` and `span_parent_span_id_pos`
+    /// constants.
+    #[derive(Debug, Clone, Copy)]
+    pub struct SdkSpanLayout {
+        pub trace_id: u64,
+        pub span_id: u64,
+        pub parent_span_id: u64,
+    }
+
+    /// Makes spans the application starts with the OpenTelemetry SDK part
+    /// of the agent's traces. Root spans started while a probed span is
+    /// active are rewritten to be its children, and are the task's active
+    /// span until they end. The probe writes into the SDK's `Span`, whose
+    /// layout varies across SDK releases, so it is only attached when the
+    /// target's debug info describes it.
+    pub struct OtelSdkInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        layout: Option<SdkSpanLayout>,
+    }
+
+    impl OtelSdkInstrumentor {
+        pub fn new() -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                layout: None,
+            }
+        }
+
+        /// `None` when the probe must not be attached.
+        pub fn layout(&self) -> Option<SdkSpanLayout> {
+            self.layout
+        }
+
+        /// Value of the probe's `return_pointer_reg` constant.
+        pub fn return_pointer_reg(&self) -> u32 {
+            RETURN_POINTER as u32
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for OtelSdkInstrumentor {
+        fn library_name(&self) -> &str {
+            "opentelemetry_sdk"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            let mut names = BUILD_WITH_CONTEXT.to_vec();
+            names.push(SPAN_END);
+            names
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            let fields = [TRACE_ID_FIELD, SPAN_ID_FIELD, PARENT_SPAN_ID_FIELD];
+            let offsets = dwarf::member_offsets(&target.debug_info, SPAN_TYPE, &fields)
+                .unwrap_or_else(|e| {
+                    warn!("OpenTelemetry SDK integration disabled: {}", e);
+                    Default::default()
+                });
+            self.layout = match fields.map(|field| offsets.get(field).copied()) {
+                [Some(trace_id), Some(span_id), Some(parent_span_id)] => Some(SdkSpanLayout {
+                    trace_id,
+                    span_id,
+                    parent_span_id,
+                }),
+                _ => {
+                    warn!(
+                        "OpenTelemetry SDK integration needs debug info describing {}",
+                        SPAN_TYPE
+                    );
+                    None
+                }
+            };
+            if let Some(layout) = self.layout {
+                info!("Joining OpenTelemetry SDK spans, layout {:?}", layout);
+            }
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the layout of the SDK's `Span` and attaches the probe to
+        /// the tracer and to span end. The SDK exports the spans itself, so
+        /// there is nothing to read.
+        async fn run(&self, _events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let Some(layout) = self.layout() else {
+                return Ok(());
+            };
+            let return_pointer_reg = self.return_pointer_reg();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("span_trace_id_pos", &layout.trace_id, true)
+                .set_global("span_span_id_pos", &layout.span_id, true)
+                .set_global("span_parent_span_id_pos", &layout.parent_span_id, true)
+                .set_global("return_pointer_reg", &return_pointer_reg, true);
+            let mut bpf = loader.load(probe_object!("otel_sdk")).map_err(ebpf_error)?;
+
+            let target = &self.target;
+            let tracers = target.attach_entry(
+                &mut bpf,
+                "uprobe_sdk_build_with_context",
+                &BUILD_WITH_CONTEXT,
+            )?;
+            target.attach_return(
+                &mut bpf,
+                "uprobe_sdk_build_with_context_return",
+                &BUILD_WITH_CONTEXT,
+            )?;
+            target.attach_entry(&mut bpf, "uprobe_sdk_span_end", &[SPAN_END])?;
+            info!("Joining spans of {} OpenTelemetry SDK tracers", tracers);
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod sqlx_instrumentor {
+    use super::dwarf::{self, ArgLoc};
+    use super::errors::Result;
+    use super::instrumentors::{
+        DbQueryEvent, Event, Instrumentor, InternedStrings, StringDefinition,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use async_trait::async_trait;
+    use log::{info, warn};
+    use std::sync::Arc;
+
+    const QUERY_FINISH: &str = "sqlx_core::logger::QueryLogger::finish";
+    /// Named `MessageFormat` before sqlx 0.8.
+    const MESSAGE_FORMAT: [&str; 2] = [
+        "sqlx_postgres::message::BackendMessageFormat::try_from_u8",
+        "sqlx_postgres::message::MessageFormat::try_from_u8",
+    ];
+
+    const LOGGER_TYPE: &str = "sqlx_core::logger::QueryLogger";
+    const SQL_PTR_FIELD: &str = "sql.data_ptr";
+    const SQL_LEN_FIELD: &str = "sql.length";
+    const ROWS_RETURNED_FIELD: &str = "rows_returned";
+    const ROWS_AFFECTED_FIELD: &str = "rows_affected";
+    const START_SECS_FIELD: &str = "start.__0.t.tv_sec";
+    const START_NANOS_FIELD: &str = "start.__0.t.tv_nsec.__0";
+
+    /// Offsets in sqlx's `QueryLogger`, the values of the probe's layout
+    /// constants.
+    #[derive(Debug, Clone, Copy)]
+    pub struct QueryLoggerLayout {
+        pub sql_ptr: u64,
+        pub sql_len: u64,
+        pub rows_returned: u64,
+        pub rows_affected: u64,
+        pub start_secs: u64,
+        pub start_nanos: u64,
+    }
+
+    /// Client spans for queries run through sqlx, reported when the query's
+    /// `QueryLogger` finishes. The logger is internal to sqlx and its
+    /// layout is read from the target's debug info; without it the probe
+    /// is not attached. Errors are only detected for PostgreSQL, the one
+    /// driver whose server messages are probed.
+    #[derive(Clone)]
+    pub struct SqlxInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        logger_arg_loc: ArgLoc,
+        layout: Option<QueryLoggerLayout>,
+        postgres: bool,
+        statements: Arc<InternedStrings>,
+    }
+
+    impl SqlxInstrumentor {
+        pub fn new() -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                logger_arg_loc: ArgLoc::ABI,
+                layout: None,
+                postgres: false,
+                statements: Arc::default(),
+            }
+        }
+
+        /// Value of the probe's `logger_arg_loc` constant.
+        pub fn arg_loc(&self) -> ArgLoc {
+            self.logger_arg_loc
+        }
+
+        /// `None` when the probe must not be attached.
+        pub fn layout(&self) -> Option<QueryLoggerLayout> {
+            self.layout
+        }
+
+        pub fn define(&self, def: &StringDefinition) {
+            self.statements.define(def);
+        }
+
+        pub fn query_event_to_span(&self, raw: &DbQueryEvent) -> Event {
+            let statement = self.statements.resolve(raw.statement_id);
+            let system = self.postgres.then_some("postgresql");
+            raw.to_event("sqlx", system, statement.as_deref())
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for SqlxInstrumentor {
+        fn library_name(&self) -> &str {
+            "sqlx"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            let mut names = MESSAGE_FORMAT.to_vec();
+            names.push(QUERY_FINISH);
+            names
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.logger_arg_loc = target.arg_loc(&[QUERY_FINISH], "self");
+            self.postgres = target
+                .functions
+                .iter()
+                .any(|f| MESSAGE_FORMAT.iter().any(|name| f.is(name)));
+
+            let fields = [
+                SQL_PTR_FIELD,
+                SQL_LEN_FIELD,
+                ROWS_RETURNED_FIELD,
+                ROWS_AFFECTED_FIELD,
+                START_SECS_FIELD,
+                START_NANOS_FIELD,
+            ];
+            let offsets = dwarf::member_offsets(&target.debug_info, LOGGER_TYPE, &fields)
+                .unwrap_or_else(|e| {
+                    warn!("sqlx queries not traced: {}", e);
+                    Default::default()
+                });
+            let offset = |field: &str| offsets.get(field).copied();
+            self.layout = (|| {
+                Some(QueryLoggerLayout {
+                    sql_ptr: offset(SQL_PTR_FIELD)?,
+                    sql_len: offset(SQL_LEN_FIELD)?,
+                    rows_returned: offset(ROWS_RETURNED_FIELD)?,
+                    rows_affected: offset(ROWS_AFFECTED_FIELD)?,
+                    start_secs: offset(START_SECS_FIELD)?,
+                    start_nanos: offset(START_NANOS_FIELD)?,
+                })
+            })();
+            match self.layout {
+                Some(layout) => info!("Tracing sqlx queries, layout {:?}", layout),
+                None => warn!(
+                    "Tracing sqlx queries needs debug info describing {}",
+                    LOGGER_TYPE
+                ),
+            }
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the `QueryLogger` layout, attaches the probe to the
+        /// logger's `finish` and to the PostgreSQL driver's message parser
+        /// and reads the queries it reports with their interned
+        /// statements.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let Some(layout) = self.layout() else {
+                return Ok(());
+            };
+            let logger_arg_loc = self.arg_loc();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("sql_ptr_pos", &layout.sql_ptr, true)
+                .set_global("sql_len_pos", &layout.sql_len, true)
+                .set_global("rows_returned_pos", &layout.rows_returned, true)
+                .set_global("rows_affected_pos", &layout.rows_affected, true)
+                .set_global("start_secs_pos", &layout.start_secs, true)
+                .set_global("start_nanos_pos", &layout.start_nanos, true)
+                .set_global("logger_arg_loc", &logger_arg_loc, true);
+            let mut bpf = loader.load(probe_object!("sqlx")).map_err(ebpf_error)?;
+
+            let target = &self.target;
+            let loggers =
+                target.attach_entry(&mut bpf, "uprobe_sqlx_query_finish", &[QUERY_FINISH])?;
+            if self.postgres {
+                target.attach_entry(&mut bpf, "uprobe_sqlx_message_format", &MESSAGE_FORMAT)?;
+            }
+            info!("Tracing sqlx queries through {} query loggers", loggers);
+
+            let statements = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "string_definitions",
+                &events_tx,
+                move |def: &StringDefinition| {
+                    statements.define(def);
+                    None
+                },
+            )?;
+            let queries = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "db_events",
+                &events_tx,
+                move |raw: &DbQueryEvent| Some(queries.query_event_to_span(raw)),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod postgres_instrumentor {
+    use super::dwarf::{self, ArgLoc};
+    use super::errors::Result;
+    use super::instrumentors::{
+        DbQueryEvent, Event, Instrumentor, InternedStrings, StringDefinition,
+    };
+    use super::probes::{self, ebpf_error, LoadedProbe, ProbeTarget};
+    use super::process::TargetDetails;
+    use async_trait::async_trait;
+    use log::{info, warn};
+    use std::sync::Arc;
+
+    const PREPARE_ENCODE: &str = "tokio_postgres::prepare::encode";
+    const QUERY_ENCODE: &str = "tokio_postgres::query::encode";
+    const SIMPLE_QUERY_ENCODE: &str = "tokio_postgres::simple_query::encode";
+    const EXTRACT_ROW_AFFECTED: &str = "tokio_postgres::query::extract_row_affected";
+    const DB_ERROR_PARSE: &str = "tokio_postgres::error::DbError::parse";
+
+    const STATEMENT_TYPE: &str = "alloc::sync::ArcInner<tokio_postgres::statement::StatementInner>";
+    const NAME_LEN_FIELD: &str = "data.name.vec.len";
+    /// `RawVec` keeps its pointer in a `RawVecInner` since Rust 1.84.
+    const NAME_PTR_FIELDS: [&str; 2] = [
+        "data.name.vec.buf.inner.ptr.pointer.pointer",
+        "data.name.vec.buf.ptr.pointer.pointer",
+    ];
+    const COMMAND_COMPLETE_TYPE: &str = "postgres_protocol::message::backend::CommandCompleteBody";
+    const TAG_PTR_FIELD: &str = "tag.ptr";
+    const TAG_LEN_FIELD: &str = "tag.len";
+
+    /// Offsets of a prepared statement's name and of a command tag, the
+    /// values of the probe's layout constants.
+    #[derive(Debug, Clone, Copy)]
+    pub struct PostgresLayout {
+        pub statement_name_ptr: u64,
+        pub statement_name_len: u64,
+        pub command_tag_ptr: u64,
+        pub command_tag_len: u64,
+    }
+
+    /// Client spans for queries run through tokio-postgres, from encoding
+    /// the query, or preparing its statement, to the server's command
+    /// completion or error. Statements are fingerprinted in-kernel and
+    /// their normalized text interned once per fingerprint. The layouts
+    /// the probe reads come from the target's debug info; without them it
+    /// is not attached.
+    #[derive(Clone)]
+    pub struct PostgresInstrumentor {
+        loaded: bool,
+        target: ProbeTarget,
+        probe: LoadedProbe,
+        client_arg_locs: [ArgLoc; 3],
+        statement_arg_loc: ArgLoc,
+        body_arg_loc: ArgLoc,
+        str_arg_locs: [ArgLoc; 6],
+        layout: Option<PostgresLayout>,
+        statements: Arc<InternedStrings>,
+    }
+
+    impl PostgresInstrumentor {
+        pub fn new() -> Self {
+            Self {
+                loaded: false,
+                target: ProbeTarget::default(),
+                probe: LoadedProbe::default(),
+                client_arg_locs: [ArgLoc::ABI; 3],
+                statement_arg_loc: ArgLoc::ABI,
+                body_arg_loc: ArgLoc::ABI,
+                str_arg_locs: [ArgLoc::ABI; 6],
+                layout: None,
+                statements: Arc::default(),
+            }
+        }
+
+        /// Values of the probe's `prepare_client_arg_loc`,
+        /// `query_client_arg_loc` and `simple_query_client_arg_loc`
+        /// constants.
+        pub fn client_arg_locs(&self) -> [ArgLoc; 3] {
+            self.client_arg_locs
+        }
+
+        /// Values of the probe's `statement_arg_loc` and `body_arg_loc`
+        /// constants.
+        pub fn arg_locs(&self) -> (ArgLoc, ArgLoc) {
+            (self.statement_arg_loc, self.body_arg_loc)
+        }
+
+        /// Values of the probe's `name_*_arg_loc`, `query_*_arg_loc` and
+        /// `simple_query_*_arg_loc` constants, pointer before length.
+        pub fn str_arg_locs(&self) -> [ArgLoc; 6] {
+            self.str_arg_locs
+        }
+
+        /// `None` when the probe must not be attached.
+        pub fn layout(&self) -> Option<PostgresLayout> {
+            self.layout
+        }
+
+        pub fn define(&self, def: &StringDefinition) {
+            self.statements.define(def);
+        }
+
+        pub fn query_event_to_span(&self, raw: &DbQueryEvent) -> Event {
+            let statement = self.statements.resolve(raw.statement_id);
+            raw.to_event("tokio_postgres", Some("postgresql"), statement.as_deref())
+        }
+
+        fn resolve_layout(&self, target: &TargetDetails) -> Result<Option<PostgresLayout>> {
+            let mut fields = vec![NAME_LEN_FIELD];
+            fields.extend(NAME_PTR_FIELDS);
+            let names = dwarf::member_offsets(&target.debug_info, STATEMENT_TYPE, &fields)?;
+            let tag = dwarf::member_offsets(
+                &target.debug_info,
+                COMMAND_COMPLETE_TYPE,
+                &[TAG_PTR_FIELD, TAG_LEN_FIELD],
+            )?;
+
+            let name_ptr = NAME_PTR_FIELDS
+                .iter()
+                .find_map(|field| names.get(*field).copied());
+            Ok(
+                match (
+                    name_ptr,
+                    names.get(NAME_LEN_FIELD),
+                    tag.get(TAG_PTR_FIELD),
+                    tag.get(TAG_LEN_FIELD),
+                ) {
+                    (Some(name_ptr), Some(&name_len), Some(&tag_ptr), Some(&tag_len)) => {
+                        Some(PostgresLayout {
+                            statement_name_ptr: name_ptr,
+                            statement_name_len: name_len,
+                            command_tag_ptr: tag_ptr,
+                            command_tag_len: tag_len,
+                        })
+                    }
+                    _ => None,
+                },
+            )
+        }
+    }
+
+    #[async_trait]
+    impl Instrumentor for PostgresInstrumentor {
+        fn library_name(&self) -> &str {
+            "tokio_postgres"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![
+                PREPARE_ENCODE,
+                QUERY_ENCODE,
+                SIMPLE_QUERY_ENCODE,
+                EXTRACT_ROW_AFFECTED,
+                DB_ERROR_PARSE,
+            ]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.client_arg_locs = [PREPARE_ENCODE, QUERY_ENCODE, SIMPLE_QUERY_ENCODE]
+                .map(|function| target.arg_loc(&[function], "client"));
+            self.statement_arg_loc = target.arg_loc(&[QUERY_ENCODE], "statement");
+            self.body_arg_loc = target.arg_loc(&[EXTRACT_ROW_AFFECTED], "body");
+            let [name_ptr, name_len] = target.slice_arg_locs(&[PREPARE_ENCODE], "name");
+            let [query_ptr, query_len] = target.slice_arg_locs(&[PREPARE_ENCODE], "query");
+            let [simple_ptr, simple_len] = target.slice_arg_locs(&[SIMPLE_QUERY_ENCODE], "query");
+            self.str_arg_locs = [
+                name_ptr, name_len, query_ptr, query_len, simple_ptr, simple_len,
+            ];
+            self.layout = self.resolve_layout(target).unwrap_or_else(|e| {
+                warn!("tokio-postgres queries not traced: {}", e);
+                None
+            });
+            match self.layout {
+                Some(layout) => info!("Tracing tokio-postgres queries, layout {:?}", layout),
+                None => warn!(
+                    "Tracing tokio-postgres queries needs debug info describing {} and {}",
+                    STATEMENT_TYPE, COMMAND_COMPLETE_TYPE
+                ),
+            }
+            let probe_target = ProbeTarget::new(target, &self.func_names());
+            self.target = probe_target;
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Sets the probe's layout and argument constants, attaches it to
+        /// the query encoders and to the server's command completion and
+        /// errors, and reads the queries it reports with their interned
+        /// statements.
+        async fn run(&self, events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let Some(layout) = self.layout() else {
+                return Ok(());
+            };
+            let [prepare_client, query_client, simple_query_client] = self.client_arg_locs();
+            let (statement, body) = self.arg_locs();
+            let [name_ptr, name_len, query_ptr, query_len, simple_ptr, simple_len] =
+                self.str_arg_locs();
+            let mut loader = probes::loader()?;
+            loader
+                .set_global("statement_name_ptr_pos", &layout.statement_name_ptr, true)
+                .set_global("statement_name_len_pos", &layout.statement_name_len, true)
+                .set_global("command_tag_ptr_pos", &layout.command_tag_ptr, true)
+                .set_global("command_tag_len_pos", &layout.command_tag_len, true)
+                .set_global("prepare_client_arg_loc", &prepare_client, true)
+                .set_global("query_client_arg_loc", &query_client, true)
+                .set_global("simple_query_client_arg_loc", &simple_query_client, true)
+                .set_global("statement_arg_loc", &statement, true)
+                .set_global("body_arg_loc", &body, true)
+                .set_global("name_ptr_arg_loc", &name_ptr, true)
+                .set_global("name_len_arg_loc", &name_len, true)
+                .set_global("query_ptr_arg_loc", &query_ptr, true)
+                .set_global("query_len_arg_loc", &query_len, true)
+                .set_global("simple_query_ptr_arg_loc", &simple_ptr, true)
+                .set_global("simple_query_len_arg_loc", &simple_len, true);
+            let mut bpf = loader
+                .load(probe_object!("tokio_postgres"))
+                .map_err(ebpf_error)?;
+
+            let target = &self.target;
+            let mut encoders = target.attach_entry(
+                &mut bpf,
+                "uprobe_postgres_prepare_encode",
+                &[PREPARE_ENCODE],
+            )?;
+            encoders +=
+                target.attach_entry(&mut bpf, "uprobe_postgres_query_encode", &[QUERY_ENCODE])?;
+            encoders += target.attach_entry(
+                &mut bpf,
+                "uprobe_postgres_simple_query_encode",
+                &[SIMPLE_QUERY_ENCODE],
+            )?;
+            target.attach_entry(
+                &mut bpf,
+                "uprobe_postgres_command_complete",
+                &[EXTRACT_ROW_AFFECTED],
+            )?;
+            target.attach_entry(&mut bpf, "uprobe_postgres_db_error", &[DB_ERROR_PARSE])?;
+            info!(
+                "Tracing tokio-postgres queries through {} encoders",
+                encoders
+            );
+
+            let statements = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "string_definitions",
+                &events_tx,
+                move |def: &StringDefinition| {
+                    statements.define(def);
+                    None
+                },
+            )?;
+            let queries = Arc::new(self.clone());
+            probes::read_events(
+                &mut bpf,
+                "db_events",
+                &events_tx,
+                move |raw: &DbQueryEvent| Some(queries.query_event_to_span(raw)),
+            )?;
+            self.probe.keep(bpf);
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.probe.close();
+            self.loaded = false;
+        }
+    }
+}
+
+mod pprof {
+    use std::collections::HashMap;
+
+    /// Minimal encoder for the pprof `profile.proto` format. Only the fields
+    /// the agent produces are supported; the output is uncompressed, which
+    /// `go tool pprof` and most profile backends accept.
+    #[derive(Default)]
+    pub struct ProfileBuilder {
+        strings: HashMap<String, i64>,
+        string_table: Vec<String>,
+        functions: HashMap<String, u64>,
+        locations: HashMap<u64, u64>,
+        function_msgs: Vec<Vec<u8>>,
+        location_msgs: Vec<Vec<u8>>,
+        sample_msgs: Vec<Vec<u8>>,
+    }
+
+    impl ProfileBuilder {
+        pub fn new() -> Self {
+            let mut builder = Self::default();
+            builder.string("");
+            builder
+        }
+
+        fn string(&mut self, s: &str) -> i64 {
+            if let Some(&idx) = self.strings.get(s) {
+                return idx;
+            }
+            let idx = self.string_table.len() as i64;
+            self.string_table.push(s.to_string());
+            self.strings.insert(s.to_string(), idx);
+            idx
+        }
+
+        /// Interns a location for `address`, named `function` when known.
+        pub fn location(&mut self, address: u64, function: Option<&str>) -> u64 {
+            if let Some(&id) = self.locations.get(&address) {
+                return id;
+            }
+            let id = self.locations.len() as u64 + 1;
+            let mut msg = Vec::new();
+            put_varint_field(&mut msg, 1, id);
+            put_varint_field(&mut msg, 3, address);
+            if let Some(name) = function {
+                let function_id = self.function(name);
+                let mut line = Vec::new();
+                put_varint_field(&mut line, 1, function_id);
+                put_bytes_field(&mut msg, 4, &line);
+            }
+            self.location_msgs.push(msg);
+            self.locations.insert(address, id);
+            id
+        }
+
+        fn function(&mut self, name: &str) -> u64 {
+            if let Some(&id) = self.functions.get(name) {
+                return id;
+            }
+            let id = self.functions.len() as u64 + 1;
+            let name_idx = self.string(name) as u64;
+            let mut msg = Vec::new();
+            put_varint_field(&mut msg, 1, id);
+            put_varint_field(&mut msg, 2, name_idx);
+            put_varint_field(&mut msg, 3, name_idx);
+            self.function_msgs.push(msg);
+            self.functions.insert(name.to_string(), id);
+            id
+        }
+
+        /// Adds a sample. `location_ids` are innermost first.
+        pub fn sample(&mut self, location_ids: &[u64], count: i64, labels: &[(&str, String)]) {
+            let mut msg = Vec::new();
+            let mut ids = Vec::new();
+            for &id in location_ids {
+                put_varint(&mut ids, id);
+            }
+            put_bytes_field(&mut msg, 1, &ids);
+            let mut values = Vec::new();
+            put_varint(&mut values, count as u64);
+            put_bytes_field(&mut msg, 2, &values);
+            for (key, value) in labels {
+                let mut label = Vec::new();
+                put_varint_field(&mut label, 1, self.string(key) as u64);
+                put_varint_field(&mut label, 2, self.string(value) as u64);
+                put_bytes_field(&mut msg, 3, &label);
+            }
+            self.sample_msgs.push(msg);
+        }
+
+        /// Encodes a CPU profile whose samples were taken every `period_ns`.
+        pub fn build(mut self, time_nanos: i64, duration_nanos: i64, period_ns: i64) -> Vec<u8> {
+            let samples = self.string("samples") as u64;
+            let count = self.string("count") as u64;
+            let cpu = self.string("cpu") as u64;
+            let nanoseconds = self.string("nanoseconds") as u64;
+
+            let mut out = Vec::new();
+            let mut sample_type = Vec::new();
+            put_varint_field(&mut sample_type, 1, samples);
+            put_varint_field(&mut sample_type, 2, count);
+            put_bytes_field(&mut out, 1, &sample_type);
+
+            for msg in &self.sample_msgs {
+                put_bytes_field(&mut out, 2, msg);
+            }
+            for msg in &self.location_msgs {
+                put_bytes_field(&mut out, 4, msg);
+            }
+            for msg in &self.function_msgs {
+                put_bytes_field(&mut out, 5, msg);
+            }
+            for s in &self.string_table {
+                put_bytes_field(&mut out, 6, s.as_bytes());
+            }
+
+            put_varint_field(&mut out, 9, time_nanos as u64);
+            put_varint_field(&mut out, 10, duration_nanos as u64);
+            let mut period_type = Vec::new();
+            put_varint_field(&mut period_type, 1, cpu);
+            put_varint_field(&mut period_type, 2, nanoseconds);
+            put_bytes_field(&mut out, 11, &period_type);
+            put_varint_field(&mut out, 12, period_ns as u64);
+            out
+        }
+    }
+
+    fn put_varint(buf: &mut Vec<u8>, mut value: u64) {
+        while value >= 0x80 {
+            buf.push((value as u8) | 0x80);
+            value >>= 7;
+        }
+        buf.push(value as u8);
+    }
+
+    fn put_varint_field(buf: &mut Vec<u8>, field: u32, value: u64) {
+        put_varint(buf, (field as u64) << 3);
+        put_varint(buf, value);
+    }
+
+    fn put_bytes_field(buf: &mut Vec<u8>, field: u32, bytes: &[u8]) {
+        put_varint(buf, ((field as u64) << 3) | 2);
+        put_varint(buf, bytes.len() as u64);
+        buf.extend_from_slice(bytes);
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+
+        fn varint(value: u64) -> Vec<u8> {
+            let mut buf = Vec::new();
+            put_varint(&mut buf, value);
+            buf
+        }
+
+        #[test]
+        fn varint_boundaries() {
+            assert_eq!(varint(0), [0x00]);
+            assert_eq!(varint(127), [0x7f]);
+            assert_eq!(varint(128), [0x80, 0x01]);
+            assert_eq!(varint(16383), [0xff, 0x7f]);
+            assert_eq!(varint(16384), [0x80, 0x80, 0x01]);
+            let max = varint(u64::MAX);
+            assert_eq!(max.len(), 10);
+            assert_eq!(max[9], 0x01);
+        }
+
+        #[test]
+        fn fields_are_tagged() {
+            let mut buf = Vec::new();
+            put_varint_field(&mut buf, 1, 150);
+            assert_eq!(buf, [0x08, 0x96, 0x01]);
+            buf.clear();
+            put_bytes_field(&mut buf, 6, b"");
+            assert_eq!(buf, [0x32, 0x00]);
+            buf.clear();
+            put_bytes_field(&mut buf, 16, b"ab");
+            assert_eq!(buf, [0x82, 0x01, 0x02, b'a', b'b']);
+        }
+
+        #[test]
+        fn locations_and_functions_are_interned() {
+            let mut builder = ProfileBuilder::new();
+            assert_eq!(builder.string_table, [""]);
+            assert_eq!(builder.location(0x1000, Some("main")), 1);
+            assert_eq!(builder.location(0x1000, Some("other")), 1);
+            assert_eq!(builder.location(0x1008, Some("main")), 2);
+            assert_eq!(builder.location(0, None), 3);
+            assert_eq!(builder.location_msgs.len(), 3);
+            assert_eq!(builder.function_msgs.len(), 1);
+            assert_eq!(builder.string_table, ["", "main"]);
+        }
+
+        #[test]
+        fn build_encodes_header_and_string_table() {
+            let mut builder = ProfileBuilder::new();
+            let id = builder.location(0x1000, Some("main"));
+            builder.sample(&[id], 3, &[("thread", "main".to_string())]);
+            builder.sample(&[], 0, &[]);
+            let profile = builder.build(0, 0, 0);
+
+            // sample_type { type: "samples", unit: "count" }, with "" and
+            // "main" interned first.
+            assert_eq!(&profile[..6], [0x0a, 0x04, 0x08, 0x03, 0x10, 0x04]);
+            // An empty sample still carries its (empty) location list and
+            // its value.
+            let empty_sample = [0x12, 0x05, 0x0a, 0x00, 0x12, 0x01, 0x00];
+            assert!(profile.windows(7).any(|w| w == empty_sample));
+            // String table entry 0 is "".
+            assert!(profile.windows(3).any(|w| w == [0x32, 0x00, 0x32]));
+            // period ends the profile.
+            assert_eq!(&profile[profile.len() - 2..], [0x60, 0x00]);
+        }
+    }
+}
+
+mod profiler_instrumentor {
+    use super::errors::{Error, Result};
+    use super::instrumentors::{Event, Instrumentor, ProfilingConfig, RouteResolver, SpanNames};
+    use super::pprof::ProfileBuilder;
+    use super::probes::{self, ebpf_error};
+    use super::process::TargetDetails;
+    use super::symbols::SymbolTable;
+    use async_trait::async_trait;
+    use aya::maps::{HashMap as BpfHashMap, MapData, StackTraceMap};
+    use aya::programs::perf_event::{
+        perf_sw_ids::PERF_COUNT_SW_CPU_CLOCK, PerfEvent, PerfEventScope, PerfTypeId, SamplePolicy,
+    };
+    use aya::util::online_cpus;
+    use aya::Pod;
+    use log::{info, warn};
+    use std::path::PathBuf;
+    use std::sync::Arc;
+    use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+    /// Mirrors `struct profile_key_t` in the profiler probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+    pub struct ProfileKey {
+        pub pid: u32,
+        pub user_stack_id: i32,
+        pub route_id: u64,
+    }
+
+    /// Mirrors `struct profile_value_t` in the profiler probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy)]
+    pub struct ProfileValue {
+        pub count: u64,
+        pub trace_id: [u8; 16],
+        pub span_id: [u8; 8],
+    }
+
+    // Both are plain C structs without padding.
+    unsafe impl Pod for ProfileKey {}
+    unsafe impl Pod for ProfileValue {}
+
+    /// One drained `stack_counts` entry with its resolved user stack.
+    pub struct StackCount {
+        pub key: ProfileKey,
+        pub value: ProfileValue,
+        pub frames: Vec<u64>,
+    }
+
+    /// Samples the target's user stacks with a perf_event program and
+    /// writes them out as pprof profiles. Samples are counted per stack and
+    /// route, labelled with the route's template, and carry the last span
+    /// they were taken in as an exemplar.
+    #[derive(Clone)]
+    pub struct ProfilerInstrumentor {
+        loaded: bool,
+        config: ProfilingConfig,
+        span_names: SpanNames,
+        routes: Arc<RouteResolver>,
+        symbols: Option<Arc<SymbolTable>>,
+        pid: i32,
+    }
+
+    impl ProfilerInstrumentor {
+        pub fn new(
+            config: ProfilingConfig,
+            span_names: SpanNames,
+            routes: Arc<RouteResolver>,
+        ) -> Self {
+            Self {
+                loaded: false,
+                config,
+                span_names,
+                routes,
+                symbols: None,
+                pid: 0,
+            }
+        }
+
+        /// Sampling period matching the configured frequency.
+        pub fn sample_period(&self) -> Duration {
+            Duration::from_nanos(1_000_000_000 / self.config.frequency_hz.max(1))
+        }
+
+        pub fn write_profile(&self, samples: &[StackCount], duration: Duration) -> Result<PathBuf> {
+            let mut builder = ProfileBuilder::new();
+            let span_names = self.span_names.lock().ok();
+
+            for sample in samples {
+                let location_ids: Vec<u64> = sample
+                    .frames
+                    .iter()
+                    .map(|&addr| {
+                        let function = self
+                            .symbols
+                            .as_ref()
+                            .and_then(|symbols| symbols.function_name(addr));
+                        builder.location(addr, function.as_deref())
+                    })
+                    .collect();
+
+                let mut labels = Vec::new();
+                if sample.key.route_id != 0 {
+                    if let Some(route) = self.routes.resolve_string(sample.key.route_id) {
+                        labels.push(("http.route", route.to_string()));
+                    }
+                }
+                if sample.value.span_id != [0; 8] {
+                    labels.push(("trace_id", hex(&sample.value.trace_id)));
+                    labels.push(("span_id", hex(&sample.value.span_id)));
+                    if let Some(name) = span_names
+                        .as_ref()
+                        .and_then(|names| names.get(&sample.value.span_id))
+                    {
+                        labels.push(("span_name", name.clone()));
+                    }
+                }
+
+                builder.sample(&location_ids, sample.value.count as i64, &labels);
+            }
+
+            let now = SystemTime::now()
+                .duration_since(UNIX_EPOCH)
+                .unwrap_or_default();
+            let profile = builder.build(
+                now.as_nanos() as i64,
+                duration.as_nanos() as i64,
+                self.sample_period().as_nanos() as i64,
+            );
+
+            std::fs::create_dir_all(&self.config.output_dir)?;
+            let file_name = format!("cpu-{}-{}.pb", self.pid, now.as_secs());
+            let path = self.config.output_dir.join(file_name);
+            std::fs::write(&path, profile)?;
+
+            info!(
+                "Wrote CPU profile with {} stacks to {:?}",
+                samples.len(),
+                path
+            );
+            Ok(path)
+        }
+    }
+
+    fn hex(bytes: &[u8]) -> String {
+        bytes.iter().map(|b| format!("{:02x}", b)).collect()
+    }
+
+    /// Removes every entry of `stack_counts` and resolves its user stack.
+    /// Samples the kernel adds between the walk and the removal of their
+    /// key are lost.
+    fn drain(
+        stack_counts: &mut BpfHashMap<MapData, ProfileKey, ProfileValue>,
+        user_stacks: &StackTraceMap<MapData>,
+    ) -> Vec<StackCount> {
+        let entries: Vec<_> = stack_counts.iter().filter_map(|entry| entry.ok()).collect();
+        entries
+            .into_iter()
+            .map(|(key, value)| {
+                let _ = stack_counts.remove(&key);
+                let frames = user_stacks
+                    .get(&(key.user_stack_id as u32), 0)
+                    .map(|stack| stack.frames().iter().map(|frame| frame.ip).collect())
+                    .unwrap_or_default();
+                StackCount { key, value, frames }
+            })
+            .collect()
+    }
+
+    #[async_trait]
+    impl Instrumentor for ProfilerInstrumentor {
+        fn library_name(&self) -> &str {
+            "profiler"
+        }
+
+        fn func_names(&self) -> Vec<&str> {
+            vec![]
+        }
+
+        async fn load(&mut self, target: &TargetDetails) -> Result<()> {
+            self.pid = target.pid;
+            self.symbols = Some(Arc::clone(&target.symbols));
+            self.loaded = true;
+            Ok(())
+        }
+
+        /// Attaches the sampler to every online CPU at the configured
+        /// frequency and spawns the task that drains `stack_counts` into a
+        /// profile every period. The task owns the loaded program, which
+        /// stays attached for the lifetime of the agent.
+        async fn run(&self, _events_tx: tokio::sync::mpsc::Sender<Event>) -> Result<()> {
+            let mut bpf = probes::loader()?
+                .load(probe_object!("profiler"))
+                .map_err(ebpf_error)?;
+
+            let mut target_pids: BpfHashMap<_, u32, u8> = BpfHashMap::try_from(
+                bpf.map_mut("target_pids")
+                    .ok_or_else(|| ebpf_error("missing target_pids map"))?,
+            )
+            .map_err(ebpf_error)?;
+            target_pids
+                .insert(self.pid as u32, 1, 0)
+                .map_err(ebpf_error)?;
+
+            let program: &mut PerfEvent = bpf
+                .program_mut("perf_event_profile_cpu")
+                .ok_or_else(|| ebpf_error("missing perf_event_profile_cpu program"))?
+                .try_into()
+                .map_err(ebpf_error)?;
+            program.load().map_err(ebpf_error)?;
+            let cpus = online_cpus().map_err(|(_, e)| Error::Io(e))?;
+            for &cpu in &cpus {
+                program
+                    .attach(
+                        PerfTypeId::Software,
+                        PERF_COUNT_SW_CPU_CLOCK as u64,
+                        PerfEventScope::AllProcessesOneCpu { cpu },
+                        SamplePolicy::Frequency(self.config.frequency_hz),
+                        true,
+                    )
+                    .map_err(ebpf_error)?;
+            }
+
+            let mut stack_counts: BpfHashMap<MapData, ProfileKey, ProfileValue> =
+                BpfHashMap::try_from(
+                    bpf.take_map("stack_counts")
+                        .ok_or_else(|| ebpf_error("missing stack_counts map"))?,
+                )
+                .map_err(ebpf_error)?;
+            let user_stacks = StackTraceMap::try_from(
+                bpf.take_map("user_stacks")
+                    .ok_or_else(|| ebpf_error("missing user_stacks map"))?,
+            )
+            .map_err(ebpf_error)?;
+
+            info!(
+                "Profiling PID {} at {} Hz on {} CPUs",
+                self.pid,
+                self.config.frequency_hz,
+                cpus.len()
+            );
+
+            let profiler = self.clone();
+            tokio::spawn(async move {
+                let _bpf = bpf;
+                let mut interval = tokio::time::interval(profiler.config.period);
+                interval.tick().await;
+                let mut last_drain = Instant::now();
+                loop {
+                    interval.tick().await;
+                    let samples = drain(&mut stack_counts, &user_stacks);
+                    let now = Instant::now();
+                    if !samples.is_empty() {
+                        if let Err(e) = profiler.write_profile(&samples, now - last_drain) {
+                            warn!("Failed to write CPU profile: {}", e);
+                        }
+                    }
+                    last_drain = now;
+                }
+            });
+            Ok(())
+        }
+
+        fn close(&mut self) {
+            self.loaded = false;
+        }
+    }
+}
+
+mod symbols {
+    use super::process::FunctionInfo;
+    use goblin::elf::program_header::PT_LOAD;
+    use goblin::elf::Elf;
+    use procfs::process::{MMapPath, Process};
+    use rustc_demangle::demangle;
+    use std::collections::hash_map::DefaultHasher;
+    use std::collections::HashMap;
+    use std::fmt;
+    use std::hash::{Hash, Hasher};
+    use std::path::Path;
+    use std::sync::{Arc, Mutex, OnceLock, RwLock, Weak};
+
+    /// Compact, address-sorted index over every function symbol of one
+    /// binary. Addresses are stored struct-of-arrays, with a copy of the
+    /// start addresses in Eytzinger (BFS) order so lookups walk a
+    /// cache-friendly implicit tree. Names are kept mangled in one arena
+    /// and demangled on first use into a second arena. Lookups by name go
+    /// through a table of demangled-name hashes, built on the first one.
+    pub struct SymbolIndex {
+        eytzinger: Vec<u64>,
+        eytzinger_rank: Vec<u32>,
+        starts: Vec<u64>,
+        ends: Vec<u64>,
+        name_spans: Vec<(u32, u32)>,
+        mangled: String,
+        demangled_spans: Vec<OnceLock<(u32, u32)>>,
+        demangled: RwLock<String>,
+        name_hashes: OnceLock<Vec<(u64, u32)>>,
+    }
+
+    impl SymbolIndex {
+        /// Builds the index from `(address, size, mangled name)` triples.
+        pub fn new(mut symbols: Vec<(u64, u64, &str)>) -> Self {
+            symbols.sort_by_key(|&(address, _, _)| address);
+            symbols.dedup_by_key(|&mut (address, _, _)| address);
+
+            let n = symbols.len();
+            let mut starts = Vec::with_capacity(n);
+            let mut ends = Vec::with_capacity(n);
+            let mut name_spans = Vec::with_capacity(n);
+            let mut mangled = String::new();
+            for (address, size, name) in symbols {
+                starts.push(address);
+                ends.push(address + size.max(1));
+                name_spans.push((mangled.len() as u32, name.len() as u32));
+                mangled.push_str(name);
+            }
+
+            let mut eytzinger = vec![0; n + 1];
+            let mut eytzinger_rank = vec![0; n + 1];
+            let mut next = 0;
+            fill_eytzinger(&starts, &mut eytzinger, &mut eytzinger_rank, &mut next, 1);
+
+            Self {
+                eytzinger,
+                eytzinger_rank,
+                starts,
+                ends,
+                name_spans,
+                mangled,
+                demangled_spans: (0..n).map(|_| OnceLock::new()).collect(),
+                demangled: RwLock::new(String::new()),
+                name_hashes: OnceLock::new(),
+            }
+        }
+
+        pub fn len(&self) -> usize {
+            self.ends.len()
+        }
+
+        /// Returns the ID of the symbol containing the link-time `address`.
+        pub fn lookup(&self, address: u64) -> Option<usize> {
+            let n = self.ends.len();
+            let mut k = 1;
+            while k <= n {
+                k = 2 * k + (self.eytzinger[k] <= address) as usize;
+            }
+            // k now points past the first start greater than `address`;
+            // strip the trailing right turns to recover it.
+            k >>= k.trailing_ones() + 1;
+            let upper = if k == 0 {
+                n
+            } else {
+                self.eytzinger_rank[k] as usize
+            };
+
+            let id = upper.checked_sub(1)?;
+            if address < self.ends[id] {
+                Some(id)
+            } else {
+                None
+            }
+        }
+
+        pub fn start(&self, id: usize) -> u64 {
+            self.starts[id]
+        }
+
+        pub fn size(&self, id: usize) -> u64 {
+            self.ends[id] - self.starts[id]
+        }
+
+        pub fn mangled_name(&self, id: usize) -> &str {
+            let (offset, len) = self.name_spans[id];
+            &self.mangled[offset as usize..(offset + len) as usize]
+        }
+
+        /// Calls `f` with the demangled name of symbol `id`, demangling it
+        /// into the arena on first use.
+        pub fn with_name<R>(&self, id: usize, f: impl FnOnce(&str) -> R) -> R {
+            let (offset, len) = *self.demangled_spans[id].get_or_init(|| {
+                let name = format!("{:#}", demangle(self.mangled_name(id)));
+                let mut arena = self.demangled.write().unwrap_or_else(|e| e.into_inner());
+                let offset = arena.len() as u32;
+                arena.push_str(&name);
+                (offset, name.len() as u32)
+            });
+            let arena = self.demangled.read().unwrap_or_else(|e| e.into_inner());
+            f(&arena[offset as usize..(offset + len) as usize])
+        }
+
+        /// Returns the ID of the symbol named `name`, a demangled path
+        /// without hash. The first call demangles every symbol once, into
+        /// a sorted table of name hashes rather than the arena.
+        pub fn find(&self, name: &str) -> Option<usize> {
+            let hashes = self.name_hashes.get_or_init(|| {
+                let mut hashes: Vec<_> = (0..self.len())
+                    .map(|id| {
+                        let demangled = format!("{:#}", demangle(self.mangled_name(id)));
+                        (name_hash(&demangled), id as u32)
+                    })
+                    .collect();
+                hashes.sort_unstable();
+                hashes
+            });
+            let hash = name_hash(name);
+            let first = hashes.partition_point(|&(h, _)| h < hash);
+            hashes[first..]
+                .iter()
+                .take_while(|&&(h, _)| h == hash)
+                .map(|&(_, id)| id as usize)
+                .find(|&id| self.with_name(id, |candidate| candidate == name))
+        }
+    }
+
+    impl fmt::Debug for SymbolIndex {
+        fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+            f.debug_struct("SymbolIndex")
+                .field("symbols", &self.len())
+                .finish_non_exhaustive()
+        }
+    }
+
+    fn name_hash(name: &str) -> u64 {
+        let mut hasher = DefaultHasher::new();
+        name.hash(&mut hasher);
+        hasher.finish()
+    }
+
+    fn fill_eytzinger(
+        sorted: &[u64],
+        eytzinger: &mut [u64],
+        rank: &mut [u32],
+        next: &mut usize,
+        k: usize,
+    ) {
+        if k <= sorted.len() {
+            fill_eytzinger(sorted, eytzinger, rank, next, 2 * k);
+            eytzinger[k] = sorted[*next];
+            rank[k] = *next as u32;
+            *next += 1;
+            fill_eytzinger(sorted, eytzinger, rank, next, 2 * k + 1);
+        }
+    }
+
+    /// Symbol lookups for one process: a possibly shared index plus the
+    /// process's load bias.
+    #[derive(Debug)]
+    pub struct SymbolTable {
+        index: Arc<SymbolIndex>,
+        load_bias: u64,
+    }
+
+    impl SymbolTable {
+        pub fn new(index: Arc<SymbolIndex>, load_bias: u64) -> Self {
+            Self { index, load_bias }
+        }
+
+        pub fn len(&self) -> usize {
+            self.index.len()
+        }
+
+        /// Runtime address of the binary's `address`.
+        pub fn runtime_address(&self, address: u64) -> u64 {
+            address.wrapping_add(self.load_bias)
+        }
+
+        /// Demangled name of the function containing the runtime `address`.
+        pub fn function_name(&self, address: u64) -> Option<String> {
+            let id = self.index.lookup(address.wrapping_sub(self.load_bias))?;
+            Some(self.index.with_name(id, str::to_string))
+        }
+
+        /// Runtime address of the function `name`, a demangled path without
+        /// hash.
+        pub fn function_address(&self, name: &str) -> Option<u64> {
+            let id = self.index.find(name)?;
+            Some(self.runtime_address(self.index.start(id)))
+        }
+
+        /// Functions whose mangled name contains `hint` and whose demangled
+        /// name satisfies `pred`, at their link-time addresses and without
+        /// parameters. Candidates are demangled without going through the
+        /// shared arena, so a scan does not grow it.
+        pub fn find_functions(
+            &self,
+            hint: &str,
+            mut pred: impl FnMut(&str) -> bool,
+        ) -> Vec<FunctionInfo> {
+            (0..self.index.len())
+                .filter(|&id| self.index.mangled_name(id).contains(hint))
+                .filter_map(|id| {
+                    let mangled = self.index.mangled_name(id);
+                    let demangled = format!("{:#}", demangle(mangled));
+                    pred(&demangled).then(|| FunctionInfo {
+                        name: mangled.to_string(),
+                        demangled_name: demangled,
+                        address: self.index.start(id),
+                        size: self.index.size(id),
+                        parameters: Vec::new(),
+                    })
+                })
+                .collect()
+        }
+
+        /// Renders a stack one frame per line, innermost first.
+        pub fn format_stack(&self, frames: &[u64]) -> String {
+            frames
+                .iter()
+                .map(|&addr| {
+                    let address = addr.wrapping_sub(self.load_bias);
+                    match self.index.lookup(address) {
+                        Some(id) => self.index.with_name(id, |name| {
+                            format!("{}+{:#x}", name, address - self.index.start(id))
+                        }),
+                        None => format!("{:#x}", addr),
+                    }
+                })
+                .collect::<Vec<_>>()
+                .join("\n")
+        }
+    }
+
+    /// Indexes already built, by GNU build ID, so that processes running
+    /// the same build share one index.
+    fn shared_indexes() -> &'static Mutex<HashMap<Vec<u8>, Weak<SymbolIndex>>> {
+        static INDEXES: OnceLock<Mutex<HashMap<Vec<u8>, Weak<SymbolIndex>>>> = OnceLock::new();
+        INDEXES.get_or_init(Default::default)
+    }
+
+    pub fn index_for(elf: &Elf, data: &[u8]) -> Arc<SymbolIndex> {
+        let build = || Arc::new(SymbolIndex::new(function_symbols(elf)));
+        let Some(build_id) = build_id(elf, data) else {
+            return build();
+        };
+
+        let mut indexes = shared_indexes().lock().unwrap_or_else(|e| e.into_inner());
+        if let Some(index) = indexes.get(&build_id).and_then(Weak::upgrade) {
+            return index;
+        }
+        indexes.retain(|_, index| index.strong_count() > 0);
+
+        let index = build();
+        indexes.insert(build_id, Arc::downgrade(&index));
+        index
+    }
+
+    fn function_symbols<'a>(elf: &'a Elf) -> Vec<(u64, u64, &'a str)> {
+        let syms = elf.syms.iter().map(|sym| (sym, &elf.strtab));
+        let dynsyms = elf.dynsyms.iter().map(|sym| (sym, &elf.dynstrtab));
+        syms.chain(dynsyms)
+            .filter(|(sym, _)| sym.st_type() == goblin::elf::sym::STT_FUNC && sym.st_size > 0)
+            .filter_map(|(sym, strtab)| {
+                let name = strtab.get_at(sym.st_name)?;
+                Some((sym.st_value, sym.st_size, name))
+            })
+            .collect()
+    }
+
+    pub fn build_id(elf: &Elf, data: &[u8]) -> Option<Vec<u8>> {
+        elf.iter_note_sections(data, Some(".note.gnu.build-id"))?
+            .filter_map(|note| note.ok())
+            .find(|note| note.n_type == goblin::elf::note::NT_GNU_BUILD_ID)
+            .map(|note| note.desc.to_vec())
+    }
+
+    /// Difference between runtime and link-time addresses of the main
+    /// executable, read from /proc/pid/maps. Non-zero only for PIE.
+    pub fn load_bias(pid: i32, exe_path: &Path, elf: &Elf) -> u64 {
+        if elf.header.e_type != goblin::elf::header::ET_DYN {
+            return 0;
+        }
+        let Some(first_load) = elf
+            .program_headers
+            .iter()
+            .filter(|ph| ph.p_type == PT_LOAD)
+            .min_by_key(|ph| ph.p_vaddr)
+        else {
+            return 0;
+        };
+        let Ok(maps) = Process::new(pid).and_then(|proc| proc.maps()) else {
+            return 0;
+        };
+
+        const PAGE_MASK: u64 = !0xfff;
+        maps.into_iter()
+            .find(|map| {
+                matches!(&map.pathname, MMapPath::Path(path) if path == exe_path)
+                    && map.offset == first_load.p_offset & PAGE_MASK
+            })
+            .map(|map| map.address.0.wrapping_sub(first_load.p_vaddr & PAGE_MASK))
+            .unwrap_or(0)
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+
+        fn linear_lookup(symbols: &[(u64, u64)], address: u64) -> Option<usize> {
+            symbols
+                .iter()
+                .position(|&(start, size)| start <= address && address < start + size.max(1))
+        }
+
+        #[test]
+        fn lookup_empty_index() {
+            let index = SymbolIndex::new(Vec::new());
+            assert_eq!(index.len(), 0);
+            assert_eq!(index.lookup(0), None);
+            assert_eq!(index.lookup(u64::MAX), None);
+        }
+
+        #[test]
+        fn lookup_boundaries() {
+            let index = SymbolIndex::new(vec![
+                (0x2000, 0, "c"),
+                (0x1000, 0x10, "a"),
+                (0x1010, 0x20, "b"),
+                (0x1000, 0x40, "a_alias"),
+            ]);
+            assert_eq!(index.len(), 3);
+            assert_eq!(index.lookup(0), None);
+            assert_eq!(index.lookup(0xfff), None);
+            assert_eq!(index.lookup(0x1000), Some(0));
+            assert_eq!(index.lookup(0x100f), Some(0));
+            assert_eq!(index.lookup(0x1010), Some(1));
+            assert_eq!(index.lookup(0x102f), Some(1));
+            assert_eq!(index.lookup(0x1030), None);
+            assert_eq!(index.lookup(0x1fff), None);
+            // Zero-sized symbols cover their first byte.
+            assert_eq!(index.lookup(0x2000), Some(2));
+            assert_eq!(index.lookup(0x2001), None);
+            assert_eq!(index.lookup(u64::MAX), None);
+            assert_eq!(index.mangled_name(0), "a");
+            assert_eq!(index.start(2), 0x2000);
+        }
+
+        #[test]
+        fn lookup_symbol_at_zero() {
+            let index = SymbolIndex::new(vec![(0, 4, "a")]);
+            assert_eq!(index.lookup(0), Some(0));
+            assert_eq!(index.lookup(3), Some(0));
+            assert_eq!(index.lookup(4), None);
+        }
+
+        #[test]
+        fn eytzinger_lookup_matches_linear_scan() {
+            // Every tree shape up to five levels, full and partial.
+            for n in 0..=64u64 {
+                let symbols: Vec<(u64, u64)> =
+                    (0..n).map(|i| (0x100 + i * 16, i % 3 * 8)).collect();
+                let index = SymbolIndex::new(symbols.iter().map(|&(a, s)| (a, s, "f")).collect());
+                for address in 0..0x100 + n * 16 + 16 {
+                    assert_eq!(
+                        index.lookup(address),
+                        linear_lookup(&symbols, address),
+                        "n={} address={:#x}",
+                        n,
+                        address
+                    );
+                }
+            }
+        }
+
+        #[test]
+        fn find_matches_demangled_names_without_hash() {
+            let index = SymbolIndex::new(vec![
+                (0x1000, 0x10, "_ZN4demo4main17h0123456789abcdefE"),
+                (0x1010, 0x10, "_ZN4demo3run17h0123456789abcdefE"),
+                (0x1020, 0x10, "plain"),
+            ]);
+            assert_eq!(index.find("demo::run"), Some(1));
+            assert_eq!(index.find("demo::main"), Some(0));
+            assert_eq!(index.find("plain"), Some(2));
+            assert_eq!(index.find("demo::run::h0123456789abcdef"), None);
+            assert_eq!(index.find("demo"), None);
+        }
+
+        #[test]
+        fn symbol_table_applies_load_bias() {
+            let bias = 0x5555_5555_0000;
+            let index = SymbolIndex::new(vec![
+                (0x1000, 0x10, "_ZN4demo4main17h0123456789abcdefE"),
+                (0x1010, 0x10, "plain"),
+            ]);
+            let table = SymbolTable::new(Arc::new(index), bias);
+            assert_eq!(table.runtime_address(0x1000), bias + 0x1000);
+            assert_eq!(
+                table.function_name(bias + 0x1000).as_deref(),
+                Some("demo::main")
+            );
+            assert_eq!(
+                table.function_name(bias + 0x100f).as_deref(),
+                Some("demo::main")
+            );
+            assert_eq!(table.function_name(bias + 0x1010).as_deref(), Some("plain"));
+            assert_eq!(table.function_name(bias + 0x1020), None);
+            assert_eq!(table.function_name(bias + 0xfff), None);
+            // Link-time addresses are not runtime addresses.
+            assert_eq!(table.function_name(0x1000), None);
+            assert_eq!(table.function_address("demo::main"), Some(bias + 0x1000));
+            assert_eq!(table.function_address("demo"), None);
+            assert_eq!(
+                table.format_stack(&[bias + 0x1004, 0x42]),
+                "demo::main+0x4\n0x42"
+            );
+        }
+    }
+}
+
+mod dwarf {
+    use super::errors::{Error, Result};
+    use gimli::{AttributeValue, EndianArcSlice, RunTimeEndian};
+    use goblin::elf::section_header::{SHF_COMPRESSED, SHT_NOBITS};
+    use goblin::elf::Elf;
+    use std::collections::{HashMap, HashSet};
+    use std::sync::Arc;
+
+    type Reader = EndianArcSlice<RunTimeEndian>;
+
+    /// The target's DWARF, parsed once when it is analyzed and shared by
+    /// every instrumentor that reads types or locations from it. Empty when
+    /// the binary has no (uncompressed) debug info.
+    pub struct DebugInfo {
+        dwarf: gimli::Dwarf<Reader>,
+        units: Vec<gimli::Unit<Reader>>,
+    }
+
+    impl std::fmt::Debug for DebugInfo {
+        fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+            f.debug_struct("DebugInfo")
+                .field("units", &self.units.len())
+                .finish()
+        }
+    }
+
+    impl DebugInfo {
+        /// Copies the DWARF sections out of `data`, the mapped `elf`, and
+        /// parses the header of every unit.
+        pub fn load(elf: &Elf, data: &[u8]) -> Result<Self> {
+            let endian = if elf.little_endian {
+                RunTimeEndian::Little
+            } else {
+                RunTimeEndian::Big
+            };
+            let section = |id: gimli::SectionId| -> gimli::Result<Reader> {
+                let data = elf
+                    .section_headers
+                    .iter()
+                    .filter(|sh| {
+                        sh.sh_type != SHT_NOBITS && sh.sh_flags & SHF_COMPRESSED as u64 == 0
+                    })
+                    .find(|sh| elf.shdr_strtab.get_at(sh.sh_name) == Some(id.name()))
+                    .and_then(|sh| data.get(sh.file_range()?))
+                    .unwrap_or(&[]);
+                Ok(EndianArcSlice::new(Arc::from(data), endian))
+            };
+
+            let read = || -> gimli::Result<Self> {
+                let dwarf = gimli::Dwarf::load(section)?;
+                let mut units = Vec::new();
+                let mut headers = dwarf.units();
+                while let Some(header) = headers.next()? {
+                    units.push(dwarf.unit(header)?);
+                }
+                Ok(Self { dwarf, units })
+            };
+            read().map_err(|e| Error::BinaryAnalysis(format!("Failed to read DWARF: {}", e)))
+        }
+
+        /// Debug info of a binary without any.
+        pub fn empty() -> Self {
+            let empty = |_| {
+                Ok::<_, std::convert::Infallible>(EndianArcSlice::new(
+                    Arc::from(&[][..]),
+                    RunTimeEndian::default(),
+                ))
+            };
+            let dwarf = match gimli::Dwarf::load(empty) {
+                Ok(dwarf) => dwarf,
+                Err(never) => match never {},
+            };
+            Self {
+                dwarf,
+                units: Vec::new(),
+            }
+        }
+
+        fn for_each_unit(
+            &self,
+            mut f: impl FnMut(&gimli::Dwarf<Reader>, &gimli::Unit<Reader>) -> gimli::Result<()>,
+        ) -> Result<()> {
+            self.units
+                .iter()
+                .try_for_each(|unit| f(&self.dwarf, unit))
+                .map_err(|e| Error::BinaryAnalysis(format!("Failed to read DWARF: {}", e)))
+        }
+    }
+
+    /// An out-of-line copy points at an abstract instance, which may in
+    /// turn complete a declaration.
+    const MAX_ORIGIN_DEPTH: usize = 3;
+
+    /// Where an async fn's state machine keeps its discriminant, plus what
+    /// decides how its poll function is called.
+    #[derive(Debug, Clone, Copy, PartialEq, Eq)]
+    pub struct AsyncFnLayout {
+        /// Offset of the `__state` discriminant within the future.
+        pub state_offset: u64,
+        pub state_size: u8,
+        /// Size of the `Poll<T>` the body's poll function returns, when
+        /// the debug info records it.
+        pub poll_size: Option<u64>,
+    }
+
+    /// Where a parameter is at function entry, per its DWARF location.
+    #[derive(Debug, Clone, Copy, PartialEq, Eq)]
+    pub enum ArgLocation {
+        /// In the register with this DWARF number.
+        Register(u16),
+        /// In memory at the register's value plus `offset`.
+        Memory { register: u16, offset: i64 },
+        /// A two-word value, such as a slice, split across these registers.
+        Registers([u16; 2]),
+    }
+
+    #[derive(Debug, Clone)]
+    pub struct Parameter {
+        pub name: String,
+        pub location: Option<ArgLocation>,
+        /// The parameter is a reference, pointer or a newtype around one,
+        /// such as `Pin<&mut Self>`.
+        pub is_pointer: bool,
+    }
+
+    pub const ARG_LOC_ABI: u16 = 0;
+    pub const ARG_LOC_REGISTER: u16 = 1;
+    pub const ARG_LOC_MEMORY: u16 = 2;
+
+    /// Mirrors `struct arg_loc` in include/arguments.h.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+    pub struct ArgLoc {
+        pub kind: u16,
+        pub reg: u16,
+        pub deref: u32,
+        pub offset: i64,
+    }
+
+    impl ArgLoc {
+        /// Leaves the probe on its default ABI position.
+        pub const ABI: ArgLoc = ArgLoc {
+            kind: ARG_LOC_ABI,
+            reg: 0,
+            deref: 0,
+            offset: 0,
+        };
+
+        /// Location of the data a probe reads through `parameter`: the
+        /// pointee of a pointer, or the parameter itself when an aggregate
+        /// is passed in memory. Aggregates passed in registers have no
+        /// address and keep the ABI default.
+        pub fn for_parameter(parameter: &Parameter) -> Self {
+            match parameter.location {
+                Some(ArgLocation::Register(reg)) if parameter.is_pointer => ArgLoc {
+                    kind: ARG_LOC_REGISTER,
+                    reg,
+                    ..Self::ABI
+                },
+                Some(ArgLocation::Memory { register, offset }) => ArgLoc {
+                    kind: ARG_LOC_MEMORY,
+                    reg: register,
+                    deref: parameter.is_pointer as u32,
+                    offset,
+                },
+                _ => Self::ABI,
+            }
+        }
+
+        /// Locations of the data pointer and the length of a slice
+        /// `parameter`, such as a `&str`, passed by value in two registers
+        /// or in memory.
+        pub fn for_slice(parameter: &Parameter) -> [Self; 2] {
+            let register = |reg| ArgLoc {
+                kind: ARG_LOC_REGISTER,
+                reg,
+                ..Self::ABI
+            };
+            let word = |reg, offset| ArgLoc {
+                kind: ARG_LOC_MEMORY,
+                reg,
+                deref: 1,
+                offset,
+            };
+            match parameter.location {
+                Some(ArgLocation::Registers([data, len])) => [register(data), register(len)],
+                Some(ArgLocation::Memory { register, offset }) if !parameter.is_pointer => {
+                    [word(register, offset), word(register, offset + 8)]
+                }
+                _ => [Self::ABI; 2],
+            }
+        }
+    }
+
+    pub const MAX_CAPTURES: usize = 4;
+    pub const MAX_CAPTURE_DEREFS: usize = 3;
+    pub const MAX_CAPTURE_STR_SIZE: usize = 64;
+
+    pub const CAPTURE_REGISTER: u32 = 1;
+    pub const CAPTURE_INT: u32 = 2;
+    pub const CAPTURE_STR: u32 = 3;
+    pub const CAPTURE_LEN: u32 = 4;
+    pub const CAPTURE_REGISTER_STR: u32 = 5;
+    pub const CAPTURE_REGISTER_LEN: u32 = 6;
+
+    /// Mirrors `struct capture_recipe` in captures.h.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+    pub struct CaptureRecipe {
+        pub loc: ArgLoc,
+        pub kind: u32,
+        pub size: u32,
+        pub derefs: u32,
+        pub padding: u32,
+        pub offsets: [i64; MAX_CAPTURE_DEREFS + 1],
+        pub ptr_offset: u64,
+        pub len_offset: u64,
+    }
+
+    /// How a captured value is rendered as an attribute.
+    #[derive(Debug, Clone, PartialEq, Eq)]
+    pub enum CaptureFormat {
+        Unsigned,
+        Signed,
+        Bool,
+        Str,
+        Len,
+        /// Names by discriminant value, and the variant of any other value.
+        Variant(Vec<(u64, String)>, Option<String>),
+    }
+
+    #[derive(Debug, Clone)]
+    pub struct Capture {
+        pub recipe: CaptureRecipe,
+        pub format: CaptureFormat,
+    }
+
+    pub const RESULT_IN_REGISTER: u16 = 1;
+    pub const RESULT_IN_MEMORY: u16 = 2;
+
+    /// Mirrors `struct result_recipe` in the functions probe.
+    #[repr(C)]
+    #[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+    pub struct ResultRecipe {
+        pub location: u16,
+        pub reg: u16,
+        pub size: u32,
+        pub offset: u64,
+        pub value: u64,
+        pub err_is_value: u32,
+        pub padding: u32,
+    }
+
+    /// DWARF number of the register the caller passes the return pointer
+    /// in, for values too large for the two return registers.
+    #[cfg(target_arch = "aarch64")]
+    pub const RETURN_POINTER: u16 = 8;
+    #[cfg(not(target_arch = "aarch64"))]
+    pub const RETURN_POINTER: u16 = 5;
+
+    /// DWARF number of the stack pointer and the distance from it to the
+    /// canonical frame address at function entry.
+    #[cfg(target_arch = "aarch64")]
+    const STACK_POINTER: (u16, i64) = (31, 0);
+    #[cfg(not(target_arch = "aarch64"))]
+    const STACK_POINTER: (u16, i64) = (7, 8);
+
+    /// Reads the layouts of the async fn bodies from the target's debug
+    /// info, keyed by the mangled name of each body's poll function. Empty
+    /// when the binary has no (uncompressed) DWARF.
+    pub fn async_fn_layouts(debug_info: &DebugInfo) -> Result<HashMap<String, AsyncFnLayout>> {
+        let mut layouts = HashMap::new();
+        debug_info.for_each_unit(|dwarf, unit| {
+            let mut tree = unit.entries_tree(None)?;
+            walk(dwarf, unit, tree.root()?, &mut layouts)
+        })?;
+        Ok(layouts)
+    }
+
+    /// Reads where the parameters of `functions`, given by mangled name,
+    /// are on entry. Parameters are in declaration order; those without a
+    /// location valid at the entry address have none.
+    pub fn parameter_locations(
+        debug_info: &DebugInfo,
+        functions: &HashSet<&str>,
+    ) -> Result<HashMap<String, Vec<Parameter>>> {
+        let mut parameters = HashMap::new();
+        debug_info.for_each_unit(|dwarf, unit| {
+            let mut tree = unit.entries_tree(None)?;
+            visit_subprograms(dwarf, unit, tree.root()?, functions, &mut |subprogram| {
+                let mut params = Vec::new();
+                for param in &subprogram.params {
+                    params.push(Parameter {
+                        name: origin_string(dwarf, unit, param, gimli::DW_AT_name)
+                            .unwrap_or_default(),
+                        location: entry_location(
+                            dwarf,
+                            unit,
+                            param,
+                            subprogram.entry_pc,
+                            subprogram.frame_base_is_cfa,
+                        )?,
+                        is_pointer: origin_entry(unit, param, gimli::DW_AT_type)
+                            .map_or(false, |ty| is_pointer_like(unit, &ty)),
+                    });
+                }
+                parameters.insert(subprogram.linkage_name, params);
+                Ok(())
+            })
+        })?;
+        Ok(parameters)
+    }
+
+    /// Resolves the expressions to capture for each function, given by
+    /// mangled name, through the types of its parameters. Expressions that
+    /// cannot be captured come back with the reason.
+    pub fn capture_recipes(
+        debug_info: &DebugInfo,
+        captures: &HashMap<String, Vec<String>>,
+    ) -> Result<HashMap<String, Vec<(String, std::result::Result<Capture, String>)>>> {
+        let functions: HashSet<&str> = captures.keys().map(String::as_str).collect();
+        let mut recipes = HashMap::new();
+        debug_info.for_each_unit(|dwarf, unit| {
+            let mut tree = unit.entries_tree(None)?;
+            visit_subprograms(dwarf, unit, tree.root()?, &functions, &mut |subprogram| {
+                let resolved = captures[&subprogram.linkage_name]
+                    .iter()
+                    .map(|expr| {
+                        (
+                            expr.clone(),
+                            resolve_capture(dwarf, unit, &subprogram, expr),
+                        )
+                    })
+                    .collect();
+                recipes.insert(subprogram.linkage_name, resolved);
+                Ok(())
+            })
+        })?;
+        Ok(recipes)
+    }
+
+    /// Resolves how to tell an `Err` return of each of `functions`, given
+    /// by mangled name. Functions not returning a `Result` come back with
+    /// the reason.
+    pub fn result_recipes(
+        debug_info: &DebugInfo,
+        functions: &HashSet<&str>,
+    ) -> Result<HashMap<String, std::result::Result<ResultRecipe, String>>> {
+        let mut recipes = HashMap::new();
+        debug_info.for_each_unit(|dwarf, unit| {
+            let mut tree = unit.entries_tree(None)?;
+            visit_subprograms(dwarf, unit, tree.root()?, functions, &mut |subprogram| {
+                let recipe = match &subprogram.return_type {
+                    Some(ty) => result_recipe(dwarf, unit, ty),
+                    None => Err("returns nothing".to_string()),
+                };
+                recipes.insert(subprogram.linkage_name, recipe);
+                Ok(())
+            })
+        })?;
+        Ok(recipes)
+    }
+
+    /// Resolves how to read the values behind the vtables of `trait_path`,
+    /// e.g. `tracing_core::field::Value`, keyed by the vtable's address in
+    /// the binary, with the implementing type's name. Types that cannot be
+    /// captured come back with the reason.
+    pub fn vtable_captures(
+        debug_info: &DebugInfo,
+        trait_path: &str,
+    ) -> Result<HashMap<u64, (String, std::result::Result<Capture, String>)>> {
+        let suffix = format!(" as {}>::{{vtable}}", trait_path);
+        let mut captures = HashMap::new();
+        debug_info.for_each_unit(|dwarf, unit| {
+            let mut entries = unit.entries();
+            while let Some((_, entry)) = entries.next_dfs()? {
+                if entry.tag() != gimli::DW_TAG_variable {
+                    continue;
+                }
+                // rustc names them `<T as Trait>::{vtable}`, typed by a
+                // `{vtable_type}` struct whose containing type is T.
+                let Some(name) = attr_string(dwarf, unit, entry, gimli::DW_AT_name) else {
+                    continue;
+                };
+                let Some(type_name) = name
+                    .strip_prefix('<')
+                    .and_then(|name| name.strip_suffix(suffix.as_str()))
+                else {
+                    continue;
+                };
+                let Some(address) = static_address(unit, entry) else {
+                    continue;
+                };
+                let capture = origin_entry(unit, entry, gimli::DW_AT_type)
+                    .and_then(|vtable| origin_entry(unit, &vtable, gimli::DW_AT_containing_type))
+                    .ok_or_else(|| format!("no type for {}", type_name))
+                    .and_then(|ty| resolve_value(dwarf, unit, ty, CaptureRecipe::default(), 0));
+                captures.insert(address, (type_name.to_string(), capture));
+            }
+            Ok(())
+        })?;
+        Ok(captures)
+    }
+
+    /// Offsets of `fields`, dotted paths such as `data.Some.__0.parent_span_id`,
+    /// in the struct `type_path`. Enum variants are entered by name. Fields
+    /// that are not found, like the whole type, are missing from the result.
+    pub fn member_offsets(
+        debug_info: &DebugInfo,
+        type_path: &str,
+        fields: &[&str],
+    ) -> Result<HashMap<String, u64>> {
+        let mut offsets = HashMap::new();
+        let mut found = false;
+        debug_info.for_each_unit(|dwarf, unit| {
+            if found {
+                return Ok(());
+            }
+            let mut tree = unit.entries_tree(None)?;
+            let Some(ty) = find_struct(dwarf, unit, tree.root()?, "", type_path)? else {
+                return Ok(());
+            };
+            found = true;
+            for field in fields {
+                if let Some(offset) = member_path(dwarf, unit, &ty, field) {
+                    offsets.insert(field.to_string(), offset);
+                }
+            }
+            Ok(())
+        })?;
+        Ok(offsets)
+    }
+
+    /// Size of the struct `type_path`, or `None` if it is not described.
+    pub fn struct_size(debug_info: &DebugInfo, type_path: &str) -> Result<Option<u64>> {
+        let mut size = None;
+        debug_info.for_each_unit(|dwarf, unit| {
+            if size.is_some() {
+                return Ok(());
+            }
+            let mut tree = unit.entries_tree(None)?;
+            if let Some(ty) = find_struct(dwarf, unit, tree.root()?, "", type_path)? {
+                size = byte_size(&ty);
+            }
+            Ok(())
+        })?;
+        Ok(size)
+    }
+
+    /// Definition of the struct `type_path` under `node`, whose namespace
+    /// path is `prefix`.
+    fn find_struct<'u, R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &'u gimli::Unit<R>,
+        node: gimli::EntriesTreeNode<'u, 'u, '_, R>,
+        prefix: &str,
+        type_path: &str,
+    ) -> gimli::Result<Option<gimli::DebuggingInformationEntry<'u, 'u, R>>> {
+        let mut children = node.children();
+        while let Some(child) = children.next()? {
+            let entry = child.entry();
+            let Some(name) = attr_string(dwarf, unit, entry, gimli::DW_AT_name) else {
+                continue;
+            };
+            let path = format!("{}{}", prefix, name);
+            match entry.tag() {
+                gimli::DW_TAG_namespace if type_path.starts_with(&path) => {
+                    let prefix = format!("{}::", path);
+                    if let Some(ty) = find_struct(dwarf, unit, child, &prefix, type_path)? {
+                        return Ok(Some(ty));
+                    }
+                }
+                gimli::DW_TAG_structure_type
+                    if path == type_path
+                        && !matches!(
+                            entry.attr_value(gimli::DW_AT_declaration),
+                            Ok(Some(AttributeValue::Flag(true)))
+                        ) =>
+                {
+                    return Ok(Some(entry.clone()));
+                }
+                _ => {}
+            }
+        }
+        Ok(None)
+    }
+
+    /// Offset of the dotted `path` of fields in `ty`.
+    fn member_path<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+        path: &str,
+    ) -> Option<u64> {
+        let mut ty = ty.clone();
+        let mut offset = 0;
+        for name in path.split('.') {
+            let (field_offset, field_ty) = member(dwarf, unit, &ty, name)
+                .or_else(|| variant_member(dwarf, unit, &ty, name))?;
+            offset += field_offset;
+            ty = field_ty;
+        }
+        Some(offset)
+    }
+
+    /// Offset and type of the variant `name` of a Rust enum.
+    fn variant_member<'u, R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &'u gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+        name: &str,
+    ) -> Option<(u64, gimli::DebuggingInformationEntry<'u, 'u, R>)> {
+        children(unit, ty)
+            .into_iter()
+            .filter(|child| child.tag() == gimli::DW_TAG_variant_part)
+            .flat_map(|part| children(unit, &part))
+            .filter(|child| child.tag() == gimli::DW_TAG_variant)
+            .find_map(|variant| member(dwarf, unit, &variant, name))
+    }
+
+    fn walk<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        node: gimli::EntriesTreeNode<R>,
+        layouts: &mut HashMap<String, AsyncFnLayout>,
+    ) -> gimli::Result<()> {
+        // rustc names a body's poll function `{async_fn#N}` and its state
+        // machine `{async_fn_env#N}`, both inside the fn's namespace.
+        let mut envs: HashMap<String, (u64, u8)> = HashMap::new();
+        let mut bodies: Vec<(String, String, Option<u64>)> = Vec::new();
+
+        let mut children = node.children();
+        while let Some(child) = children.next()? {
+            let entry = child.entry();
+            match entry.tag() {
+                gimli::DW_TAG_namespace => walk(dwarf, unit, child, layouts)?,
+                gimli::DW_TAG_structure_type => {
+                    let Some(name) = attr_string(dwarf, unit, entry, gimli::DW_AT_name) else {
+                        continue;
+                    };
+                    if let Some(index) = name.strip_prefix("{async_fn_env") {
+                        if let Some(state) = state_member(unit, child)? {
+                            envs.insert(index.to_string(), state);
+                        }
+                    }
+                }
+                gimli::DW_TAG_subprogram => {
+                    let Some(name) = attr_string(dwarf, unit, entry, gimli::DW_AT_name) else {
+                        continue;
+                    };
+                    let Some(index) = name.strip_prefix("{async_fn") else {
+                        continue;
+                    };
+                    let Some(linkage_name) =
+                        attr_string(dwarf, unit, entry, gimli::DW_AT_linkage_name)
+                    else {
+                        continue;
+                    };
+                    bodies.push((index.to_string(), linkage_name, type_size(unit, entry)));
+                }
+                _ => {}
+            }
+        }
+
+        for (index, linkage_name, poll_size) in bodies {
+            if let Some(&(state_offset, state_size)) = envs.get(&index) {
+                layouts.insert(
+                    linkage_name,
+                    AsyncFnLayout {
+                        state_offset,
+                        state_size,
+                        poll_size,
+                    },
+                );
+            }
+        }
+        Ok(())
+    }
+
+    /// A function definition, with its formal parameters.
+    struct Subprogram<'u, R: gimli::Reader> {
+        linkage_name: String,
+        entry_pc: u64,
+        frame_base_is_cfa: bool,
+        params: Vec<gimli::DebuggingInformationEntry<'u, 'u, R>>,
+        return_type: Option<gimli::DebuggingInformationEntry<'u, 'u, R>>,
+    }
+
+    /// Calls `f` for each definition of one of `functions`, given by
+    /// mangled name.
+    fn visit_subprograms<'u, R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &'u gimli::Unit<R>,
+        node: gimli::EntriesTreeNode<'u, 'u, '_, R>,
+        functions: &HashSet<&str>,
+        f: &mut impl FnMut(Subprogram<'u, R>) -> gimli::Result<()>,
+    ) -> gimli::Result<()> {
+        let mut children = node.children();
+        while let Some(child) = children.next()? {
+            match child.entry().tag() {
+                gimli::DW_TAG_namespace => visit_subprograms(dwarf, unit, child, functions, f)?,
+                gimli::DW_TAG_subprogram => {
+                    let entry = child.entry().clone();
+                    // Definitions of methods and out-of-line copies of
+                    // inlinable functions keep their names elsewhere.
+                    let Some(linkage_name) =
+                        origin_string(dwarf, unit, &entry, gimli::DW_AT_linkage_name)
+                    else {
+                        continue;
+                    };
+                    if !functions.contains(linkage_name.as_str()) {
+                        continue;
+                    }
+                    let Some(low_pc) = entry.attr_value(gimli::DW_AT_low_pc)? else {
+                        continue;
+                    };
+                    let Some(entry_pc) = dwarf.attr_address(unit, low_pc)? else {
+                        continue;
+                    };
+                    let frame_base_is_cfa = match entry.attr_value(gimli::DW_AT_frame_base)? {
+                        Some(AttributeValue::Exprloc(expr)) => matches!(
+                            expr.operations(unit.encoding()).next()?,
+                            Some(gimli::Operation::CallFrameCFA)
+                        ),
+                        _ => false,
+                    };
+
+                    let mut params = Vec::new();
+                    let mut param_nodes = child.children();
+                    while let Some(param) = param_nodes.next()? {
+                        if param.entry().tag() == gimli::DW_TAG_formal_parameter {
+                            params.push(param.entry().clone());
+                        }
+                    }
+                    f(Subprogram {
+                        linkage_name,
+                        entry_pc,
+                        frame_base_is_cfa,
+                        params,
+                        return_type: origin_entry(unit, &entry, gimli::DW_AT_type),
+                    })?;
+                }
+                _ => {}
+            }
+        }
+        Ok(())
+    }
+
+    /// Location of a parameter at `entry_pc`, when it is a plain register
+    /// or memory location. Composite and computed locations are not
+    /// resolved.
+    fn entry_location<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        param: &gimli::DebuggingInformationEntry<R>,
+        entry_pc: u64,
+        frame_base_is_cfa: bool,
+    ) -> gimli::Result<Option<ArgLocation>> {
+        match entry_expression(dwarf, unit, param, entry_pc)? {
+            Some(expr) => match register_pieces(unit, &expr).as_deref() {
+                Some(&[data, len]) => Ok(Some(ArgLocation::Registers([data, len]))),
+                _ => expression_location(unit, expr, frame_base_is_cfa),
+            },
+            None => Ok(None),
+        }
+    }
+
+    /// The location expression of `param` at `entry_pc`.
+    fn entry_expression<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        param: &gimli::DebuggingInformationEntry<R>,
+        entry_pc: u64,
+    ) -> gimli::Result<Option<gimli::Expression<R>>> {
+        Ok(match param.attr_value(gimli::DW_AT_location)? {
+            Some(AttributeValue::Exprloc(expr)) => Some(expr),
+            Some(value) => {
+                let Some(mut locations) = dwarf.attr_locations(unit, value)? else {
+                    return Ok(None);
+                };
+                let mut at_entry = None;
+                while let Some(location) = locations.next()? {
+                    if location.range.begin <= entry_pc && entry_pc < location.range.end {
+                        at_entry = Some(location.data);
+                        break;
+                    }
+                }
+                at_entry
+            }
+            None => None,
+        })
+    }
+
+    fn expression_location<R: gimli::Reader>(
+        unit: &gimli::Unit<R>,
+        expr: gimli::Expression<R>,
+        frame_base_is_cfa: bool,
+    ) -> gimli::Result<Option<ArgLocation>> {
+        let (stack_pointer, cfa_offset) = STACK_POINTER;
+        Ok(match expr.operations(unit.encoding()).next()? {
+            Some(gimli::Operation::Register { register }) => {
+                Some(ArgLocation::Register(register.0))
+            }
+            Some(gimli::Operation::RegisterOffset {
+                register, offset, ..
+            }) => Some(ArgLocation::Memory {
+                register: register.0,
+                offset,
+            }),
+            // Relative to the frame base, which only has a known value at
+            // entry when it is the CFA.
+            Some(gimli::Operation::FrameOffset { offset }) if frame_base_is_cfa => {
+                Some(ArgLocation::Memory {
+                    register: stack_pointer,
+                    offset: cfa_offset + offset,
+                })
+            }
+            _ => None,
+        })
+    }
+
+    /// The registers holding each piece of a value split across registers.
+    fn register_pieces<R: gimli::Reader>(
+        unit: &gimli::Unit<R>,
+        expr: &gimli::Expression<R>,
+    ) -> Option<Vec<u16>> {
+        let mut operations = expr.clone().operations(unit.encoding());
+        let mut registers = Vec::new();
+        loop {
+            match operations.next().ok()? {
+                Some(gimli::Operation::Register { register }) => registers.push(register.0),
+                None if registers.len() > 1 => return Some(registers),
+                _ => return None,
+            }
+            match operations.next().ok()? {
+                Some(gimli::Operation::Piece { .. }) => {}
+                _ => return None,
+            }
+        }
+    }
+
+    /// Address of a static variable whose location is `DW_OP_addr`.
+    fn static_address<R: gimli::Reader>(
+        unit: &gimli::Unit<R>,
+        entry: &gimli::DebuggingInformationEntry<R>,
+    ) -> Option<u64> {
+        let Ok(Some(AttributeValue::Exprloc(expression))) = entry.attr_value(gimli::DW_AT_location)
+        else {
+            return None;
+        };
+        match expression.operations(unit.encoding()).next() {
+            Ok(Some(gimli::Operation::Address { address })) => Some(address),
+            _ => None,
+        }
+    }
+
+    /// The declaration or abstract instance `entry` completes, if any.
+    fn origin<'u, R: gimli::Reader>(
+        unit: &'u gimli::Unit<R>,
+        entry: &gimli::DebuggingInformationEntry<R>,
+    ) -> Option<gimli::DebuggingInformationEntry<'u, 'u, R>> {
+        [gimli::DW_AT_specification, gimli::DW_AT_abstract_origin]
+            .into_iter()
+            .find_map(|attr| match entry.attr_value(attr) {
+                Ok(Some(AttributeValue::UnitRef(offset))) => unit.entry(offset).ok(),
+                _ => None,
+            })
+    }
+
+    /// The entry `attr` of `entry` or of one of its origins refers to.
+    fn origin_entry<'u, R: gimli::Reader>(
+        unit: &'u gimli::Unit<R>,
+        entry: &gimli::DebuggingInformationEntry<R>,
+        attr: gimli::DwAt,
+    ) -> Option<gimli::DebuggingInformationEntry<'u, 'u, R>> {
+        let mut current = entry.clone();
+        for _ in 0..MAX_ORIGIN_DEPTH {
+            if let Ok(Some(AttributeValue::UnitRef(offset))) = current.attr_value(attr) {
+                return unit.entry(offset).ok();
+            }
+            current = origin(unit, &current)?;
+        }
+        None
+    }
+
+    /// String attribute of `entry` or of one of its origins.
+    fn origin_string<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        entry: &gimli::DebuggingInformationEntry<R>,
+        attr: gimli::DwAt,
+    ) -> Option<String> {
+        let mut current = entry.clone();
+        for _ in 0..MAX_ORIGIN_DEPTH {
+            if let Some(value) = attr_string(dwarf, unit, &current, attr) {
+                return Some(value);
+            }
+            current = origin(unit, &current)?;
+        }
+        None
+    }
+
+    fn is_pointer_like<R: gimli::Reader>(
+        unit: &gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+    ) -> bool {
+        matches!(
+            ty.tag(),
+            gimli::DW_TAG_pointer_type | gimli::DW_TAG_reference_type
+        ) || pointee(unit, ty).is_some()
+    }
+
+    /// What `ty` points to, for pointers and for structs the size of a
+    /// pointer whose only sized field is one, such as `Pin<&mut T>` or
+    /// `Box<T>`.
+    fn pointee<'u, R: gimli::Reader>(
+        unit: &'u gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+    ) -> Option<gimli::DebuggingInformationEntry<'u, 'u, R>> {
+        match ty.tag() {
+            gimli::DW_TAG_pointer_type | gimli::DW_TAG_reference_type => {
+                origin_entry(unit, ty, gimli::DW_AT_type)
+            }
+            gimli::DW_TAG_structure_type if byte_size(ty) == Some(8) => {
+                let fields: Vec<_> = children(unit, ty)
+                    .into_iter()
+                    .filter(|child| child.tag() == gimli::DW_TAG_member)
+                    .filter_map(|member| origin_entry(unit, &member, gimli::DW_AT_type))
+                    .filter(|field| byte_size(field) != Some(0))
+                    .collect();
+                match fields.as_slice() {
+                    [field] => pointee(unit, field),
+                    _ => None,
+                }
+            }
+            _ => None,
+        }
+    }
+
+    fn children<'u, R: gimli::Reader>(
+        unit: &'u gimli::Unit<R>,
+        entry: &gimli::DebuggingInformationEntry<R>,
+    ) -> Vec<gimli::DebuggingInformationEntry<'u, 'u, R>> {
+        let mut entries = Vec::new();
+        let Ok(mut tree) = unit.entries_tree(Some(entry.offset())) else {
+            return entries;
+        };
+        let Ok(root) = tree.root() else {
+            return entries;
+        };
+        let mut nodes = root.children();
+        while let Ok(Some(node)) = nodes.next() {
+            entries.push(node.entry().clone());
+        }
+        entries
+    }
+
+    /// Offset and type of the field `name` of a struct.
+    fn member<'u, R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &'u gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+        name: &str,
+    ) -> Option<(u64, gimli::DebuggingInformationEntry<'u, 'u, R>)> {
+        let member = children(unit, ty).into_iter().find(|child| {
+            child.tag() == gimli::DW_TAG_member
+                && attr_string(dwarf, unit, child, gimli::DW_AT_name).as_deref() == Some(name)
+        })?;
+        let offset = attr_udata(&member, gimli::DW_AT_data_member_location)?;
+        Some((offset, origin_entry(unit, &member, gimli::DW_AT_type)?))
+    }
+
+    /// Offset of the first pointer nested in `ty`, e.g. the data pointer
+    /// inside a `Vec`'s `RawVec`.
+    fn first_pointer<R: gimli::Reader>(
+        unit: &gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+        depth: usize,
+    ) -> Option<u64> {
+        if depth == 0 {
+            return None;
+        }
+        children(unit, ty)
+            .into_iter()
+            .filter(|child| child.tag() == gimli::DW_TAG_member)
+            .find_map(|member| {
+                let offset = attr_udata(&member, gimli::DW_AT_data_member_location)?;
+                let field = origin_entry(unit, &member, gimli::DW_AT_type)?;
+                match field.tag() {
+                    gimli::DW_TAG_pointer_type => Some(offset),
+                    gimli::DW_TAG_structure_type => {
+                        Some(offset + first_pointer(unit, &field, depth - 1)?)
+                    }
+                    _ => None,
+                }
+            })
+    }
+
+    /// Resolves `expr`, a parameter name followed by `.field` accesses,
+    /// into a recipe for the functions probe. Field accesses go through
+    /// references and single-pointer wrappers like in Rust.
+    fn resolve_capture<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        subprogram: &Subprogram<R>,
+        expr: &str,
+    ) -> std::result::Result<Capture, String> {
+        let mut path = expr.split('.');
+        let name = path.next().unwrap_or_default();
+        let fields: Vec<&str> = path.collect();
+        let param = subprogram
+            .params
+            .iter()
+            .find(|p| origin_string(dwarf, unit, p, gimli::DW_AT_name).as_deref() == Some(name))
+            .ok_or_else(|| format!("no parameter {}", name))?;
+        let mut ty = origin_entry(unit, param, gimli::DW_AT_type)
+            .ok_or_else(|| format!("{} has no type", name))?;
+        let no_location = || format!("{} has no location at entry", name);
+        let expression = entry_expression(dwarf, unit, param, subprogram.entry_pc)
+            .map_err(|e| e.to_string())?
+            .ok_or_else(no_location)?;
+
+        let mut recipe = CaptureRecipe::default();
+        let mut offset = 0;
+        // Slices passed by value arrive as a pointer and a length register.
+        if let (Some([data, len]), true) = (
+            register_pieces(unit, &expression).as_deref(),
+            fields.is_empty(),
+        ) {
+            let format = classify(dwarf, unit, &ty, &mut recipe, &mut offset)?;
+            recipe.kind = match recipe.kind {
+                CAPTURE_STR => CAPTURE_REGISTER_STR,
+                CAPTURE_LEN => CAPTURE_REGISTER_LEN,
+                _ => return Err(format!("{} is split across registers", name)),
+            };
+            recipe.ptr_offset = *data as u64;
+            recipe.len_offset = *len as u64;
+            return Ok(Capture { recipe, format });
+        }
+
+        let location = expression_location(unit, expression, subprogram.frame_base_is_cfa)
+            .map_err(|e| e.to_string())?
+            .ok_or_else(no_location)?;
+        let is_pointer = is_pointer_like(unit, &ty);
+        recipe.loc = ArgLoc::for_parameter(&Parameter {
+            name: name.to_string(),
+            location: Some(location),
+            is_pointer,
+        });
+        if let (ArgLocation::Register(reg), false) = (location, is_pointer) {
+            let format = classify(dwarf, unit, &ty, &mut recipe, &mut offset)?;
+            if !fields.is_empty() || recipe.kind != CAPTURE_INT || offset != 0 {
+                return Err(format!("{} is passed in a register", name));
+            }
+            recipe.kind = CAPTURE_REGISTER;
+            recipe.loc = ArgLoc {
+                kind: ARG_LOC_REGISTER,
+                reg,
+                ..ArgLoc::ABI
+            };
+            return Ok(Capture { recipe, format });
+        }
+
+        if is_pointer {
+            ty = pointee(unit, &ty).ok_or_else(|| format!("{} points to nothing", name))?;
+        }
+        for field in fields {
+            while let Some(target) = pointee(unit, &ty) {
+                deref(&mut recipe, &mut offset)?;
+                ty = target;
+            }
+            let (field_offset, field_ty) = member(dwarf, unit, &ty, field)
+                .ok_or_else(|| format!("no field {} in {}", field, expr))?;
+            offset += field_offset as i64;
+            ty = field_ty;
+        }
+        resolve_value(dwarf, unit, ty, recipe, offset)
+    }
+
+    /// Completes `recipe` for a value of type `ty` at `offset`, following
+    /// references to what they lead to.
+    fn resolve_value<'u, R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &'u gimli::Unit<R>,
+        mut ty: gimli::DebuggingInformationEntry<'u, 'u, R>,
+        mut recipe: CaptureRecipe,
+        mut offset: i64,
+    ) -> std::result::Result<Capture, String> {
+        while let Some(target) = pointee(unit, &ty) {
+            deref(&mut recipe, &mut offset)?;
+            ty = target;
+        }
+        let format = classify(dwarf, unit, &ty, &mut recipe, &mut offset)?;
+        recipe.offsets[recipe.derefs as usize] = offset;
+        Ok(Capture { recipe, format })
+    }
+
+    fn deref(recipe: &mut CaptureRecipe, offset: &mut i64) -> std::result::Result<(), String> {
+        let derefs = recipe.derefs as usize;
+        if derefs == MAX_CAPTURE_DEREFS {
+            return Err(format!("more than {} dereferences", MAX_CAPTURE_DEREFS));
+        }
+        recipe.offsets[derefs] = *offset;
+        recipe.derefs += 1;
+        *offset = 0;
+        Ok(())
+    }
+
+    /// Sets what the probe reads from a value of type `ty` at `offset`.
+    fn classify<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+        recipe: &mut CaptureRecipe,
+        offset: &mut i64,
+    ) -> std::result::Result<CaptureFormat, String> {
+        let name = attr_string(dwarf, unit, ty, gimli::DW_AT_name).unwrap_or_default();
+        let unsupported = || format!("cannot capture {}", name);
+        let field = |field: &str| {
+            member(dwarf, unit, ty, field)
+                .map(|(offset, _)| offset)
+                .ok_or_else(unsupported)
+        };
+
+        match ty.tag() {
+            gimli::DW_TAG_base_type => {
+                let format = match ty.attr_value(gimli::DW_AT_encoding) {
+                    Ok(Some(AttributeValue::Encoding(gimli::DW_ATE_boolean))) => {
+                        CaptureFormat::Bool
+                    }
+                    Ok(Some(AttributeValue::Encoding(
+                        gimli::DW_ATE_signed | gimli::DW_ATE_signed_char,
+                    ))) => CaptureFormat::Signed,
+                    Ok(Some(AttributeValue::Encoding(
+                        gimli::DW_ATE_unsigned | gimli::DW_ATE_unsigned_char | gimli::DW_ATE_UTF,
+                    ))) => CaptureFormat::Unsigned,
+                    _ => return Err(unsupported()),
+                };
+                recipe.kind = CAPTURE_INT;
+                recipe.size = integer_size(ty).ok_or_else(unsupported)?;
+                Ok(format)
+            }
+            gimli::DW_TAG_enumeration_type => {
+                let variants = children(unit, ty)
+                    .into_iter()
+                    .filter(|child| child.tag() == gimli::DW_TAG_enumerator)
+                    .filter_map(|enumerator| {
+                        let value = attr_const(&enumerator, gimli::DW_AT_const_value)?;
+                        Some((
+                            value,
+                            attr_string(dwarf, unit, &enumerator, gimli::DW_AT_name)?,
+                        ))
+                    })
+                    .collect();
+                recipe.kind = CAPTURE_INT;
+                recipe.size = integer_size(ty).ok_or_else(unsupported)?;
+                Ok(CaptureFormat::Variant(variants, None))
+            }
+            gimli::DW_TAG_structure_type if name == "&str" => {
+                recipe.kind = CAPTURE_STR;
+                recipe.ptr_offset = field("data_ptr")?;
+                recipe.len_offset = field("length")?;
+                Ok(CaptureFormat::Str)
+            }
+            gimli::DW_TAG_structure_type if name.starts_with("&[") => {
+                recipe.kind = CAPTURE_LEN;
+                recipe.len_offset = field("length")?;
+                Ok(CaptureFormat::Len)
+            }
+            gimli::DW_TAG_structure_type if name == "String" => {
+                let (vec_offset, vec) = member(dwarf, unit, ty, "vec").ok_or_else(unsupported)?;
+                let (len_offset, _) = member(dwarf, unit, &vec, "len").ok_or_else(unsupported)?;
+                recipe.kind = CAPTURE_STR;
+                recipe.ptr_offset =
+                    vec_offset + first_pointer(unit, &vec, 6).ok_or_else(unsupported)?;
+                recipe.len_offset = vec_offset + len_offset;
+                Ok(CaptureFormat::Str)
+            }
+            gimli::DW_TAG_structure_type if name.starts_with("Vec<") => {
+                recipe.kind = CAPTURE_LEN;
+                recipe.len_offset = field("len")?;
+                Ok(CaptureFormat::Len)
+            }
+            gimli::DW_TAG_structure_type => {
+                // Rust enums with fields are a struct with a variant part.
+                let discriminant = discriminant(dwarf, unit, ty).ok_or_else(unsupported)?;
+                recipe.kind = CAPTURE_INT;
+                recipe.size = discriminant.size;
+                *offset += discriminant.offset as i64;
+                Ok(CaptureFormat::Variant(
+                    discriminant.variants,
+                    discriminant.niche_variant,
+                ))
+            }
+            _ => Err(unsupported()),
+        }
+    }
+
+    fn result_recipe<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+    ) -> std::result::Result<ResultRecipe, String> {
+        let name = attr_string(dwarf, unit, ty, gimli::DW_AT_name).unwrap_or_default();
+        if !name.starts_with("Result<") {
+            return Err(format!("returns {}", name));
+        }
+        let unsupported = || format!("cannot read the variant of {}", name);
+        let discriminant = discriminant(dwarf, unit, ty).ok_or_else(unsupported)?;
+        let variant = |wanted: &str| {
+            discriminant
+                .variants
+                .iter()
+                .find(|(_, variant)| variant == wanted)
+                .map(|(value, _)| *value)
+        };
+        // One of the two has no value of its own when the result is niche
+        // encoded, e.g. Ok for `Result<&T, E>`.
+        let (value, err_is_value) = match (variant("Err"), variant("Ok")) {
+            (Some(err), _) => (err, true),
+            (None, Some(ok)) => (ok, false),
+            _ => return Err(unsupported()),
+        };
+        let mask = u64::MAX >> (64 - discriminant.size * 8);
+
+        let mut recipe = ResultRecipe {
+            size: discriminant.size,
+            offset: discriminant.offset,
+            value: value & mask,
+            err_is_value: err_is_value as u32,
+            ..Default::default()
+        };
+        if byte_size(ty).ok_or_else(unsupported)? > 16 {
+            recipe.location = RESULT_IN_MEMORY;
+            recipe.reg = RETURN_POINTER;
+        } else {
+            recipe.location = RESULT_IN_REGISTER;
+            recipe.reg = (recipe.offset / 8) as u16;
+            recipe.offset %= 8;
+        }
+        Ok(recipe)
+    }
+
+    struct Discriminant {
+        offset: u64,
+        size: u32,
+        variants: Vec<(u64, String)>,
+        /// The variant holding every value not listed, for niche-encoded
+        /// enums such as `Option<&T>`.
+        niche_variant: Option<String>,
+    }
+
+    fn discriminant<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        ty: &gimli::DebuggingInformationEntry<R>,
+    ) -> Option<Discriminant> {
+        let variant_part = children(unit, ty)
+            .into_iter()
+            .find(|child| child.tag() == gimli::DW_TAG_variant_part)?;
+        let Ok(Some(AttributeValue::UnitRef(discr))) = variant_part.attr_value(gimli::DW_AT_discr)
+        else {
+            return None;
+        };
+        let discr = unit.entry(discr).ok()?;
+
+        let mut variants = Vec::new();
+        let mut niche_variant = None;
+        for variant in children(unit, &variant_part) {
+            if variant.tag() != gimli::DW_TAG_variant {
+                continue;
+            }
+            let Some(name) = children(unit, &variant)
+                .iter()
+                .find_map(|member| attr_string(dwarf, unit, member, gimli::DW_AT_name))
+            else {
+                continue;
+            };
+            match attr_const(&variant, gimli::DW_AT_discr_value) {
+                Some(value) => variants.push((value, name)),
+                None => niche_variant = Some(name),
+            }
+        }
+
+        Some(Discriminant {
+            offset: attr_udata(&discr, gimli::DW_AT_data_member_location)?,
+            size: integer_size(&origin_entry(unit, &discr, gimli::DW_AT_type)?)?,
+            variants,
+            niche_variant,
+        })
+    }
+
+    /// Offset and size of the discriminant of a state machine's variant part.
+    fn state_member<R: gimli::Reader>(
+        unit: &gimli::Unit<R>,
+        node: gimli::EntriesTreeNode<R>,
+    ) -> gimli::Result<Option<(u64, u8)>> {
+        let mut children = node.children();
+        while let Some(child) = children.next()? {
+            let entry = child.entry();
+            if entry.tag() != gimli::DW_TAG_variant_part {
+                continue;
+            }
+            let Some(AttributeValue::UnitRef(offset)) = entry.attr_value(gimli::DW_AT_discr)?
+            else {
+                continue;
+            };
+            let member = unit.entry(offset)?;
+            let location = member
+                .attr_value(gimli::DW_AT_data_member_location)?
+                .and_then(|value| value.udata_value());
+            let size = type_size(unit, &member);
+            if let (Some(location), Some(size @ (1 | 2 | 4))) = (location, size) {
+                return Ok(Some((location, size as u8)));
+            }
+        }
+        Ok(None)
+    }
+
+    fn attr_string<R: gimli::Reader>(
+        dwarf: &gimli::Dwarf<R>,
+        unit: &gimli::Unit<R>,
+        entry: &gimli::DebuggingInformationEntry<R>,
+        name: gimli::DwAt,
+    ) -> Option<String> {
+        let value = entry.attr_value(name).ok()??;
+        let string = dwarf.attr_string(unit, value).ok()?;
+        Some(string.to_string_lossy().ok()?.into_owned())
+    }
+
+    fn type_size<R: gimli::Reader>(
+        unit: &gimli::Unit<R>,
+        entry: &gimli::DebuggingInformationEntry<R>,
+    ) -> Option<u64> {
+        let Some(AttributeValue::UnitRef(offset)) = entry.attr_value(gimli::DW_AT_type).ok()?
+        else {
+            return None;
+        };
+        byte_size(&unit.entry(offset).ok()?)
+    }
+
+    fn byte_size<R: gimli::Reader>(ty: &gimli::DebuggingInformationEntry<R>) -> Option<u64> {
+        attr_udata(ty, gimli::DW_AT_byte_size)
+    }
+
+    /// Size of an integer type the probe can read.
+    fn integer_size<R: gimli::Reader>(ty: &gimli::DebuggingInformationEntry<R>) -> Option<u32> {
+        match byte_size(ty)? {
+            size @ (1 | 2 | 4 | 8) => Some(size as u32),
+            _ => None,
+        }
+    }
+
+    fn attr_udata<R: gimli::Reader>(
+        entry: &gimli::DebuggingInformationEntry<R>,
+        name: gimli::DwAt,
+    ) -> Option<u64> {
+        entry.attr_value(name).ok()??.udata_value()
+    }
+
+    /// A constant as the probe reads it, with signed values in two's
+    /// complement.
+    fn attr_const<R: gimli::Reader>(
+        entry: &gimli::DebuggingInformationEntry<R>,
+        name: gimli::DwAt,
+    ) -> Option<u64> {
+        let value = entry.attr_value(name).ok()??;
+        value
+            .udata_value()
+            .or_else(|| value.sdata_value().map(|value| value as u64))
+    }
+}
+
+mod path_normalizer {
+    use super::instrumentors::route_hash;
+    use std::collections::hash_map::Entry;
+    use std::collections::HashMap;
+    use std::hash::Hash;
+    use std::sync::{Arc, Mutex, RwLock};
+
+    /// Literal children a trie node may have before further new literals at
+    /// that position are treated as a parameter.
+    const MAX_LITERAL_CHILDREN: usize = 32;
+    const MAX_CACHED_PATHS: usize = 65536;
+    const PARAM: &str = "{param}";
+    const OVERFLOW_ROUTE: &str = "/{other}";
+
+    #[derive(Default)]
+    struct Node {
+        literals: HashMap<String, Node>,
+        placeholders: HashMap<&'static str, Node>,
+        terminal: bool,
+        /// Every literal at this position is a `{param}`.
+        collapsed: bool,
+    }
+
+    impl Node {
+        /// Collapses this position into `{param}`, folding the literal
+        /// children learnt so far into it. Returns how many routes were
+        /// merged away.
+        fn collapse(&mut self) -> usize {
+            self.collapsed = true;
+            let literals = std::mem::take(&mut self.literals);
+            let param = self.placeholders.entry(PARAM).or_default();
+            literals.into_values().map(|child| param.merge(child)).sum()
+        }
+
+        /// Merges `other` into this node and returns how many routes the
+        /// two had in common.
+        fn merge(&mut self, other: Node) -> usize {
+            let mut merged = usize::from(self.terminal && other.terminal);
+            self.terminal |= other.terminal;
+            self.collapsed |= other.collapsed;
+            merged += merge_children(&mut self.literals, other.literals);
+            merged += merge_children(&mut self.placeholders, other.placeholders);
+            if self.collapsed && !self.literals.is_empty() {
+                merged += self.collapse();
+            }
+            merged
+        }
+    }
+
+    fn merge_children<K: Eq + Hash>(into: &mut HashMap<K, Node>, from: HashMap<K, Node>) -> usize {
+        let mut merged = 0;
+        for (key, child) in from {
+            match into.entry(key) {
+                Entry::Occupied(mut entry) => merged += entry.get_mut().merge(child),
+                Entry::Vacant(entry) => {
+                    entry.insert(child);
+                }
+            }
+        }
+        merged
+    }
+
+    /// Learns route templates from raw request paths, for servers with no
+    /// router to read a template from.
+    ///
+    /// Segments that look like IDs (numbers, UUIDs, hex and base64 tokens)
+    /// become placeholders straight away. The remaining segments are
+    /// inserted into a trie, and a position that keeps seeing new literals
+    /// is collapsed into `{param}`, together with the literals it saw
+    /// before, so they stop being routes of their own. Once `max_routes`
+    /// templates are known,
+    /// paths that would add another map to `/{other}`. Results are cached by
+    /// the path's hash, so a path seen before costs one lookup.
+    pub struct PathNormalizer {
+        max_routes: usize,
+        cache: RwLock<HashMap<u64, Arc<str>>>,
+        trie: Mutex<(Node, usize)>,
+    }
+
+    impl PathNormalizer {
+        pub fn new(max_routes: usize) -> Self {
+            Self {
+                max_routes,
+                cache: RwLock::new(HashMap::new()),
+                trie: Mutex::new((Node::default(), 0)),
+            }
+        }
+
+        pub fn normalize(&self, path: &str) -> Arc<str> {
+            let path = path.split(['?', '#']).next().unwrap_or_default();
+            let hash = route_hash(path);
+            if let Some(route) = self.cache.read().ok().and_then(|c| c.get(&hash).cloned()) {
+                return route;
+            }
+
+            let route: Arc<str> = self.learn(path).into();
+            if let Ok(mut cache) = self.cache.write() {
+                if cache.len() >= MAX_CACHED_PATHS {
+                    cache.clear();
+                }
+                cache.insert(hash, Arc::clone(&route));
+            }
+            route
+        }
+
+        fn learn(&self, path: &str) -> String {
+            let Ok(mut trie) = self.trie.lock() else {
+                return OVERFLOW_ROUTE.to_string();
+            };
+            let (root, routes) = &mut *trie;
+            let full = *routes >= self.max_routes;
+
+            let mut node = root;
+            let mut route = String::new();
+            for segment in path.split('/').filter(|s| !s.is_empty()) {
+                let placeholder = classify_segment(segment).or_else(|| {
+                    let known = node.literals.contains_key(segment);
+                    (node.collapsed || (!known && node.literals.len() >= MAX_LITERAL_CHILDREN))
+                        .then_some(PARAM)
+                });
+                if placeholder == Some(PARAM) && !node.collapsed {
+                    *routes -= node.collapse();
+                    // Paths cached under the folded literals now map to
+                    // the template.
+                    if let Ok(mut cache) = self.cache.write() {
+                        cache.clear();
+                    }
+                }
+
+                let next = match placeholder {
+                    Some(p) if full && !node.placeholders.contains_key(p) => None,
+                    Some(p) => Some((p, node.placeholders.entry(p).or_default())),
+                    None if full && !node.literals.contains_key(segment) => None,
+                    None => Some((
+                        segment,
+                        node.literals.entry(segment.to_string()).or_default(),
+                    )),
+                };
+                let Some((name, child)) = next else {
+                    return OVERFLOW_ROUTE.to_string();
+                };
+
+                route.push('/');
+                route.push_str(name);
+                node = child;
+            }
+
+            if !node.terminal {
+                if full {
+                    return OVERFLOW_ROUTE.to_string();
+                }
+                node.terminal = true;
+                *routes += 1;
+            }
+
+            if route.is_empty() {
+                route.push('/');
+            }
+            route
+        }
+    }
+
+    /// Placeholder for segments that are clearly identifiers.
+    fn classify_segment(segment: &str) -> Option<&'static str> {
+        let bytes = segment.as_bytes();
+        if bytes.iter().all(u8::is_ascii_digit) {
+            return Some("{id}");
+        }
+        if is_uuid(bytes) {
+            return Some("{uuid}");
+        }
+        let has_digit = bytes.iter().any(u8::is_ascii_digit);
+        if bytes.len() >= 8 && has_digit && bytes.iter().all(u8::is_ascii_hexdigit) {
+            return Some("{hex}");
+        }
+        if bytes.len() >= 16
+            && has_digit
+            && bytes.iter().any(u8::is_ascii_alphabetic)
+            && bytes
+                .iter()
+                .all(|b| b.is_ascii_alphanumeric() || matches!(b, b'-' | b'_' | b'+' | b'='))
+        {
+            return Some("{token}");
+        }
+        None
+    }
+
+    fn is_uuid(bytes: &[u8]) -> bool {
+        bytes.len() == 36
+            && bytes.iter().enumerate().all(|(i, b)| match i {
+                8 | 13 | 18 | 23 => *b == b'-',
+                _ => b.is_ascii_hexdigit(),
+            })
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+
+        #[test]
+        fn identifiers_become_placeholders() {
+            let normalizer = PathNormalizer::new(100);
+            assert_eq!(&*normalizer.normalize("/users/42"), "/users/{id}");
+            assert_eq!(&*normalizer.normalize("/users/7/"), "/users/{id}");
+            assert_eq!(
+                &*normalizer.normalize("/orders/123e4567-e89b-12d3-a456-426614174000"),
+                "/orders/{uuid}"
+            );
+            assert_eq!(&*normalizer.normalize("/blobs/deadbeef1"), "/blobs/{hex}");
+            // Hex without a digit, or shorter than 8, is a word.
+            assert_eq!(&*normalizer.normalize("/blobs/deadbeef"), "/blobs/deadbeef");
+            assert_eq!(&*normalizer.normalize("/blobs/abc1234"), "/blobs/abc1234");
+            assert_eq!(
+                &*normalizer.normalize("/s/aGVsbG8gd29ybGQ9PQ1"),
+                "/s/{token}"
+            );
+        }
+
+        #[test]
+        fn root_query_and_fragment() {
+            let normalizer = PathNormalizer::new(100);
+            assert_eq!(&*normalizer.normalize(""), "/");
+            assert_eq!(&*normalizer.normalize("/"), "/");
+            assert_eq!(&*normalizer.normalize("//"), "/");
+            assert_eq!(&*normalizer.normalize("/?page=2"), "/");
+            assert_eq!(&*normalizer.normalize("/users/1?x=/2#top"), "/users/{id}");
+        }
+
+        #[test]
+        fn many_literals_collapse_into_param() {
+            let normalizer = PathNormalizer::new(100);
+            for i in 0..MAX_LITERAL_CHILDREN {
+                let path = format!("/items/name{}x", (b'a' + i as u8) as char);
+                assert_eq!(&*normalizer.normalize(&path), path);
+            }
+            assert_eq!(&*normalizer.normalize("/items/one_more"), "/items/{param}");
+            // Literals learnt before the collapse are folded in too.
+            assert_eq!(&*normalizer.normalize("/items/nameax"), "/items/{param}");
+            assert_eq!(&*normalizer.normalize("/items/another"), "/items/{param}");
+            // The folded routes no longer count against the limit.
+            let (_, routes) = &*normalizer.trie.lock().unwrap();
+            assert_eq!(*routes, 1);
+        }
+
+        #[test]
+        fn route_limit_maps_new_routes_to_overflow() {
+            let normalizer = PathNormalizer::new(2);
+            assert_eq!(&*normalizer.normalize("/a"), "/a");
+            assert_eq!(&*normalizer.normalize("/users/1"), "/users/{id}");
+            assert_eq!(&*normalizer.normalize("/b"), OVERFLOW_ROUTE);
+            assert_eq!(&*normalizer.normalize("/a/b"), OVERFLOW_ROUTE);
+            assert_eq!(&*normalizer.normalize("/"), OVERFLOW_ROUTE);
+            // Known templates still match once the limit is reached.
+            assert_eq!(&*normalizer.normalize("/a"), "/a");
+            assert_eq!(&*normalizer.normalize("/users/2"), "/users/{id}");
+        }
+
+        #[test]
+        fn zero_routes() {
+            let normalizer = PathNormalizer::new(0);
+            assert_eq!(&*normalizer.normalize("/a"), OVERFLOW_ROUTE);
+            assert_eq!(&*normalizer.normalize("/"), OVERFLOW_ROUTE);
+        }
+    }
+}
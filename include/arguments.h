@@ -38,5 +38,76 @@ static __always_inline void* get_argument_by_stack(struct pt_regs *ctx, int pos)
     return ptr;
 }
 
+#define ARG_LOC_ABI 0
+#define ARG_LOC_REGISTER 1
+#define ARG_LOC_MEMORY 2
+
+// Where a function finds an argument at entry, resolved by the agent from
+// the DWARF location of the parameter and set as a load-time constant.
+// The Rust ABI is unstable, so positions assumed by a probe can be wrong
+// for a given build; ARG_LOC_ABI keeps the probe's assumption.
+struct arg_loc {
+    u16 kind;
+    // DWARF register number.
+    u16 reg;
+    // ARG_LOC_MEMORY: the data is at reg + offset, or a pointer to it is
+    // when deref is set.
+    u32 deref;
+    s64 offset;
+};
+
+static __always_inline void* get_register(struct pt_regs *ctx, u32 reg) {
+#if defined(__x86_64__)
+    switch (reg) {
+        case 0: return (void*)ctx->ax;
+        case 1: return (void*)ctx->dx;
+        case 2: return (void*)ctx->cx;
+        case 3: return (void*)ctx->bx;
+        case 4: return (void*)ctx->si;
+        case 5: return (void*)ctx->di;
+        case 6: return (void*)ctx->bp;
+        case 7: return (void*)ctx->sp;
+        case 8: return (void*)ctx->r8;
+        case 9: return (void*)ctx->r9;
+        case 10: return (void*)ctx->r10;
+        case 11: return (void*)ctx->r11;
+        case 12: return (void*)ctx->r12;
+        case 13: return (void*)ctx->r13;
+        case 14: return (void*)ctx->r14;
+        case 15: return (void*)ctx->r15;
+        default: return NULL;
+    }
+#elif defined(__aarch64__)
+    if (reg < 31) {
+        return (void*)ctx->regs[reg];
+    }
+    if (reg == 31) {
+        return (void*)ctx->sp;
+    }
+    return NULL;
+#else
+#error "Unsupported architecture"
+#endif
+}
+
+static __always_inline void* get_argument_at(struct pt_regs *ctx, volatile const struct arg_loc *loc,
+                                             int default_pos) {
+    switch (loc->kind) {
+        case ARG_LOC_REGISTER:
+            return get_register(ctx, loc->reg);
+        case ARG_LOC_MEMORY: {
+            void* addr = get_register(ctx, loc->reg) + loc->offset;
+            if (!loc->deref) {
+                return addr;
+            }
+            void* ptr = NULL;
+            bpf_probe_read(&ptr, sizeof(ptr), addr);
+            return ptr;
+        }
+        default:
+            return get_argument(ctx, default_pos);
+    }
+}
+
 #endif /* __ARGUMENTS_H__ */
 
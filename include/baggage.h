@@ -0,0 +1,246 @@
+#ifndef __BAGGAGE_H__
+#define __BAGGAGE_H__
+
+#include "common.h"
+#include "span_context.h"
+#include "span_errors.h"
+#include "header_map.h"
+#include "string_intern.h"
+
+#define MAX_BAGGAGE_SIZE MAX_HEADER_SIZE
+#define MAX_BAGGAGE_TRACES 4096
+#define MAX_BAGGAGE_KEYS 64
+
+// Set by the agent when baggage is captured and propagated.
+volatile const u8 baggage_enabled;
+
+// The W3C `baggage` header a request arrived with, cut to whole entries
+// that fit MAX_BAGGAGE_SIZE, and the interned subset of its entries whose
+// keys are recorded as span attributes.
+struct baggage_t {
+    u64 attributes_id;
+    u32 len;
+    u32 padding;
+    char value[MAX_BAGGAGE_SIZE];
+};
+
+// Baggage of requests being served, keyed by their server span like
+// trace_errors. Server probes store it when a request arrives, client
+// probes in the tasks serving the request inject it into outgoing
+// requests, and the probe ending the server span takes it.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct server_span_key);
+    __type(value, struct baggage_t);
+    __uint(max_entries, MAX_BAGGAGE_TRACES);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} trace_baggage SEC(".maps");
+
+// FNV-1a hashes of the keys recorded as attributes, filled in by the agent.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, u8);
+    __uint(max_entries, MAX_BAGGAGE_KEYS);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} baggage_keys SEC(".maps");
+
+struct baggage_scratch_t {
+    struct baggage_t baggage;
+    struct string_definition_t attributes;
+    char header[MAX_BAGGAGE_SIZE];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct baggage_scratch_t);
+    __uint(max_entries, 1);
+} baggage_scratch SEC(".maps");
+
+static __always_inline int is_baggage_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Walks the entries of baggage->value once. Entries past the last comma of
+// a header that did not fit are dropped, so baggage->len ends on an entry
+// boundary. The `key=value` of entries with an allowlisted key are copied
+// to attributes, comma-separated and without whitespace or properties;
+// entries that do not fit are left out whole.
+static __always_inline void filter_baggage(struct baggage_t* baggage, char* attributes, int truncated) {
+    u64 hash = FNV_OFFSET_BASIS;
+    u32 out = 0, entry_start = 0, last_comma = 0;
+    u8 in_key = 1, in_properties = 0, overflow = 0;
+
+    for (u32 i = 0; i <= MAX_BAGGAGE_SIZE; i++) {
+        char c = ',';
+        if (i < baggage->len && i < MAX_BAGGAGE_SIZE) {
+            c = baggage->value[i];
+        } else if (truncated) {
+            // The last entry was cut short.
+            out = entry_start;
+            baggage->len = last_comma;
+            break;
+        }
+
+        if (c == ',') {
+            if (in_key || overflow || !bpf_map_lookup_elem(&baggage_keys, &hash)) {
+                out = entry_start;
+            }
+            if (i >= baggage->len || i >= MAX_BAGGAGE_SIZE) {
+                break;
+            }
+            last_comma = i;
+            entry_start = out;
+            hash = FNV_OFFSET_BASIS;
+            in_key = 1;
+            in_properties = 0;
+            overflow = 0;
+            continue;
+        }
+        if (is_baggage_space(c) || in_properties) {
+            continue;
+        }
+        if (c == ';') {
+            in_properties = 1;
+            continue;
+        }
+        if (in_key) {
+            if (c == '=') {
+                in_key = 0;
+            } else {
+                hash ^= (u8)c;
+                hash *= FNV_PRIME;
+            }
+        }
+
+        // Separate from the previous kept entry on the first character.
+        if (out == entry_start && out > 0) {
+            if (out >= MAX_INTERNED_STRING_SIZE - 1) {
+                overflow = 1;
+                continue;
+            }
+            attributes[out & (MAX_INTERNED_STRING_SIZE - 1)] = ',';
+            out++;
+        }
+        if (out >= MAX_INTERNED_STRING_SIZE - 1) {
+            overflow = 1;
+            continue;
+        }
+        attributes[out & (MAX_INTERNED_STRING_SIZE - 1)] = c;
+        out++;
+    }
+
+    attributes[out & (MAX_INTERNED_STRING_SIZE - 1)] = 0;
+}
+
+// Stores the `baggage` header of an incoming request for its server span
+// sc.
+static __always_inline void capture_baggage(void* ctx, void* header_map, struct span_context* sc) {
+    if (!baggage_enabled) {
+        return;
+    }
+    struct rust_bytes header = {};
+    if (find_header_value(header_map, "baggage", 7, &header) != 0 || !header.ptr || !header.len) {
+        return;
+    }
+
+    u32 zero = 0;
+    struct baggage_scratch_t* scratch = bpf_map_lookup_elem(&baggage_scratch, &zero);
+    if (!scratch) {
+        return;
+    }
+    struct baggage_t* baggage = &scratch->baggage;
+    __builtin_memset(baggage, 0, sizeof(*baggage));
+    __builtin_memset(&scratch->attributes, 0, sizeof(scratch->attributes));
+
+    u64 size = MAX_BAGGAGE_SIZE;
+    size = size < header.len ? size : header.len;
+    if (bpf_probe_read(baggage->value, size, header.ptr) != 0) {
+        return;
+    }
+    baggage->len = size;
+
+    filter_baggage(baggage, scratch->attributes.value, header.len > MAX_BAGGAGE_SIZE);
+    if (!baggage->len) {
+        return;
+    }
+    if (scratch->attributes.value[0]) {
+        baggage->attributes_id = define_string(ctx, &scratch->attributes);
+    }
+
+    struct server_span_key key = {};
+    server_span_key(sc, &key);
+    bpf_map_update_elem(&trace_baggage, &key, baggage, 0);
+}
+
+// Writes the baggage of the request the current task serves into the
+// pre-reserved `baggage` header of an outgoing request. Like traceparent
+// the slot keeps its length: the baggage is cut to the entries that fit
+// and padded with trailing whitespace.
+static __always_inline void inject_baggage(void* header_map) {
+    if (!baggage_enabled) {
+        return;
+    }
+    struct server_span_key* server = current_server_span();
+    if (!server) {
+        return;
+    }
+    struct server_span_key key = *server;
+    struct baggage_t* baggage = bpf_map_lookup_elem(&trace_baggage, &key);
+    if (!baggage) {
+        return;
+    }
+
+    struct rust_bytes slot = {};
+    if (find_writable_header_value(header_map, "baggage", 7, &slot) != 0 ||
+        !slot.len || slot.len > MAX_BAGGAGE_SIZE) {
+        return;
+    }
+
+    u32 zero = 0;
+    struct baggage_scratch_t* scratch = bpf_map_lookup_elem(&baggage_scratch, &zero);
+    if (!scratch) {
+        return;
+    }
+
+    u32 len = baggage->len;
+    if (len > slot.len) {
+        // Cut at the last comma that fits.
+        len = 0;
+        for (u32 i = 0; i < MAX_BAGGAGE_SIZE; i++) {
+            if (i > slot.len) {
+                break;
+            }
+            if (baggage->value[i] == ',') {
+                len = i;
+            }
+        }
+    }
+    for (u32 i = 0; i < MAX_BAGGAGE_SIZE; i++) {
+        scratch->header[i] = i < len ? baggage->value[i] : ' ';
+    }
+
+    u64 size = MAX_BAGGAGE_SIZE;
+    size = size < slot.len ? size : slot.len;
+    bpf_probe_write_user(slot.ptr, scratch->header, size);
+}
+
+// Forgets the baggage of the request whose server span sc ends and
+// returns the ID of the span's baggage attributes.
+static __always_inline u64 take_trace_baggage(struct span_context* sc) {
+    if (!baggage_enabled) {
+        return 0;
+    }
+    struct server_span_key key = {};
+    server_span_key(sc, &key);
+    struct baggage_t* baggage = bpf_map_lookup_elem(&trace_baggage, &key);
+    if (!baggage) {
+        return 0;
+    }
+    u64 attributes_id = baggage->attributes_id;
+    bpf_map_delete_elem(&trace_baggage, &key);
+    return attributes_id;
+}
+
+#endif /* __BAGGAGE_H__ */
@@ -0,0 +1,90 @@
+#ifndef __CAPTURES_H__
+#define __CAPTURES_H__
+
+#include "common.h"
+#include "arguments.h"
+
+#define MAX_CAPTURE_DEREFS 3
+#define MAX_CAPTURE_STR_SIZE 64
+
+#define CAPTURE_REGISTER 1
+#define CAPTURE_INT 2
+#define CAPTURE_STR 3
+#define CAPTURE_LEN 4
+// A slice passed by value, split across two registers.
+#define CAPTURE_REGISTER_STR 5
+#define CAPTURE_REGISTER_LEN 6
+
+// How to read one value, or a field reached from it. The agent resolves
+// these from DWARF types: where the value is, the pointers to follow with
+// the offset of each within the current value, and the final field's
+// offset and kind.
+struct capture_recipe {
+    // Function arguments only.
+    struct arg_loc loc;
+    u32 kind;
+    // CAPTURE_REGISTER, CAPTURE_INT: width of the integer.
+    u32 size;
+    u32 derefs;
+    u32 padding;
+    s64 offsets[MAX_CAPTURE_DEREFS + 1];
+    // CAPTURE_STR: data pointer within the final field.
+    // CAPTURE_REGISTER_STR: register holding the data pointer.
+    u64 ptr_offset;
+    // CAPTURE_STR, CAPTURE_LEN: length within the final field.
+    // CAPTURE_REGISTER_STR, CAPTURE_REGISTER_LEN: register holding it.
+    u64 len_offset;
+};
+
+// An integer, a length, or a string's length and leading bytes.
+struct captured_value {
+    u64 value;
+    char str[MAX_CAPTURE_STR_SIZE];
+};
+
+static __always_inline void read_capture_str(char* data, struct captured_value* out) {
+    u64 size = out->value < MAX_CAPTURE_STR_SIZE ? out->value : MAX_CAPTURE_STR_SIZE;
+    if (data && size > 0) {
+        bpf_probe_read(out->str, size, data);
+    }
+}
+
+// Reads the value in memory at addr as described by a recipe of kind
+// CAPTURE_INT, CAPTURE_LEN or CAPTURE_STR.
+static __always_inline void read_capture(void* addr, struct capture_recipe* recipe,
+                                         struct captured_value* out) {
+    for (u32 i = 0; i < MAX_CAPTURE_DEREFS; i++) {
+        if (i >= recipe->derefs) {
+            break;
+        }
+        void* next = NULL;
+        if (bpf_probe_read(&next, sizeof(next), addr + recipe->offsets[i]) || !next) {
+            return;
+        }
+        addr = next;
+    }
+    u32 last = recipe->derefs < MAX_CAPTURE_DEREFS ? recipe->derefs : MAX_CAPTURE_DEREFS;
+    void* field = addr + recipe->offsets[last];
+
+    switch (recipe->kind) {
+        case CAPTURE_INT: {
+            u32 size = recipe->size;
+            if (size > 0 && size <= sizeof(out->value)) {
+                bpf_probe_read(&out->value, size, field);
+            }
+            break;
+        }
+        case CAPTURE_LEN:
+            bpf_probe_read(&out->value, sizeof(out->value), field + recipe->len_offset);
+            break;
+        case CAPTURE_STR: {
+            char* data = NULL;
+            bpf_probe_read(&data, sizeof(data), field + recipe->ptr_offset);
+            bpf_probe_read(&out->value, sizeof(out->value), field + recipe->len_offset);
+            read_capture_str(data, out);
+            break;
+        }
+    }
+}
+
+#endif /* __CAPTURES_H__ */
@@ -12,7 +12,10 @@
 
 #define MAX_PATH_SIZE 256
 #define MAX_METHOD_SIZE 16
+#define MAX_HOST_SIZE 64
 #define MAX_HEADER_SIZE 256
+#define MAX_HEADER_NAME_SIZE 32
+#define MAX_HEADER_ENTRIES 16
 
 typedef unsigned char u8;
 typedef unsigned short u16;
@@ -0,0 +1,139 @@
+#ifndef __DB_QUERY_H__
+#define __DB_QUERY_H__
+
+#include "common.h"
+#include "utils.h"
+#include "span_context.h"
+#include "string_intern.h"
+
+#define MAX_STATEMENT_SIZE 512
+
+// A statement executed by a database client, as a client span under the
+// span active in the task that ran it.
+struct db_query_t {
+    u64 start_time;
+    u64 end_time;
+    // Fingerprint of the statement, which is also the ID its normalized
+    // text is interned under.
+    u64 statement_id;
+    u64 rows_affected;
+    u64 rows_returned;
+    u32 error;
+    u32 padding;
+    struct span_context sc;
+    struct span_context psc;
+};
+
+struct statement_scratch_t {
+    char raw[MAX_STATEMENT_SIZE];
+    struct string_definition_t text;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct statement_scratch_t);
+    __uint(max_entries, 1);
+} statement_scratch SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} db_events SEC(".maps");
+
+static __always_inline int is_identifier_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || c == '$';
+}
+
+static __always_inline int is_statement_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Returns the fingerprint of the len-byte statement at ptr, or 0 if it
+// could not be read. The first MAX_STATEMENT_SIZE bytes are normalized in
+// one pass: string and numeric literals become `?` and runs of whitespace
+// a single space, so statements that only differ in their literals share a
+// fingerprint. The fingerprint is the FNV-1a hash of the normalized text,
+// which is interned under it cut to MAX_INTERNED_STRING_SIZE - 1 bytes, so
+// the text is sent once per fingerprint. Placeholders such as `$1` are
+// kept.
+static __always_inline u64 fingerprint_statement(void* ctx, void* ptr, u64 len) {
+    u32 zero = 0;
+    struct statement_scratch_t* scratch = bpf_map_lookup_elem(&statement_scratch, &zero);
+    if (!scratch) {
+        return 0;
+    }
+    u64 size = MAX_STATEMENT_SIZE;
+    size = size < len ? size : len;
+    if (!ptr || !size || bpf_probe_read(scratch->raw, size, ptr) != 0) {
+        return 0;
+    }
+
+    u64 hash = FNV_OFFSET_BASIS;
+    u32 out = 0;
+    u8 in_string = 0, in_number = 0;
+    // Last character kept; leading whitespace is dropped.
+    char prev = ' ';
+    for (u32 i = 0; i < MAX_STATEMENT_SIZE; i++) {
+        if (i >= size) {
+            break;
+        }
+        char c = scratch->raw[i];
+        if (in_string) {
+            // An escaped quote, '', ends up as two literals.
+            if (c == '\'') {
+                in_string = 0;
+            }
+            continue;
+        }
+        if (in_number) {
+            if ((c >= '0' && c <= '9') || c == '.') {
+                continue;
+            }
+            in_number = 0;
+        }
+
+        if (c == '\'') {
+            in_string = 1;
+            c = '?';
+        } else if (c >= '0' && c <= '9' && !is_identifier_char(prev)) {
+            in_number = 1;
+            c = '?';
+        } else if (is_statement_space(c)) {
+            if (prev == ' ') {
+                continue;
+            }
+            c = ' ';
+        }
+        prev = c;
+
+        hash ^= (u8)c;
+        hash *= FNV_PRIME;
+        if (out < MAX_INTERNED_STRING_SIZE - 1) {
+            scratch->text.value[out & (MAX_INTERNED_STRING_SIZE - 1)] = c;
+            out++;
+        }
+    }
+    if (!out) {
+        return 0;
+    }
+
+    scratch->text.value[out & (MAX_INTERNED_STRING_SIZE - 1)] = 0;
+    scratch->text.id = hash;
+    return define_string_as(ctx, &scratch->text);
+}
+
+// Fills in the span of a query of statement_id run by the current task.
+// Only queries run under an active span are recorded, as its children.
+static __always_inline int init_db_query(struct db_query_t* query, u64 statement_id) {
+    struct span_context* parent = get_current_span_context();
+    if (!parent || !statement_id) {
+        return -1;
+    }
+    query->statement_id = statement_id;
+    query->psc = *parent;
+    query->sc = generate_child_span_context(parent);
+    return 0;
+}
+
+#endif /* __DB_QUERY_H__ */
@@ -0,0 +1,195 @@
+#ifndef __HEADER_MAP_H__
+#define __HEADER_MAP_H__
+
+#include "common.h"
+
+// Layout of http::HeaderMap, shared by hyper and tonic (MetadataMap wraps a
+// HeaderMap). Set by the agent from offset_results.json.
+//
+// actix-http keeps its headers in a hashbrown table of (HeaderName, Value)
+// instead. With header_map_kind set to HEADER_MAP_HASHBROWN the entries
+// constants locate the table's control bytes and bucket mask, and the value
+// is the first of the header's values.
+#define HEADER_MAP_HTTP 0
+#define HEADER_MAP_HASHBROWN 1
+volatile const u8 header_map_kind;
+volatile const u64 header_entries_ptr_pos;
+volatile const u64 header_entries_len_pos;
+volatile const u64 header_bucket_size;
+volatile const u64 header_bucket_key_pos;
+volatile const u64 header_bucket_value_pos;
+
+// Runtime addresses of the `clone` functions of the bytes crate's
+// promotable and shared Bytes vtables, set by the agent from the symbol
+// table. They tell apart the buffers a header value may be written to;
+// left at 0, no header is written.
+volatile const u64 bytes_promotable_even_clone;
+volatile const u64 bytes_promotable_odd_clone;
+volatile const u64 bytes_shared_clone;
+
+// Both custom HeaderName and HeaderValue are backed by bytes::Bytes, which
+// starts with its data pointer followed by its length.
+struct rust_bytes {
+    char* ptr;
+    u64 len;
+};
+
+// The whole bytes::Bytes: the owner of the buffer and the vtable that
+// knows its kind follow the slice.
+struct rust_bytes_repr {
+    char* ptr;
+    u64 len;
+    void* data;
+    void* vtable;
+};
+
+// Promotable Bytes tag `data` while they still own their Vec alone;
+// otherwise, like shared Bytes, `data` points to a Shared whose reference
+// count follows the buffer pointer and capacity.
+#define BYTES_KIND_VEC 0x1
+#define BYTES_SHARED_REF_CNT_POS 16
+
+// Whether the buffer of a Bytes is heap memory no other Bytes can see, so
+// that writing to it changes only this value. Static Bytes, such as
+// HeaderValue::from_static, and buffers of unknown kind are never written.
+static __always_inline int bytes_uniquely_owned(struct rust_bytes_repr* bytes) {
+    u64 clone = 0;
+    if (!bytes->vtable || bpf_probe_read(&clone, sizeof(clone), bytes->vtable) != 0 || !clone) {
+        return 0;
+    }
+    if (clone == bytes_promotable_even_clone || clone == bytes_promotable_odd_clone) {
+        if ((u64)bytes->data & BYTES_KIND_VEC) {
+            return 1;
+        }
+    } else if (clone != bytes_shared_clone) {
+        return 0;
+    }
+    u64 ref_cnt = 0;
+    if (!bytes->data ||
+        bpf_probe_read(&ref_cnt, sizeof(ref_cnt), (void*)(bytes->data + BYTES_SHARED_REF_CNT_POS)) != 0) {
+        return 0;
+    }
+    return ref_cnt == 1;
+}
+
+static __always_inline int header_name_equals(void* name_ptr, const char* name, u32 name_len) {
+    char buf[MAX_HEADER_NAME_SIZE] = {};
+    if (name_len == 0 || name_len > MAX_HEADER_NAME_SIZE) {
+        return 0;
+    }
+    if (bpf_probe_read(buf, name_len, name_ptr) != 0) {
+        return 0;
+    }
+    for (u32 i = 0; i < MAX_HEADER_NAME_SIZE; i++) {
+        if (i >= name_len) {
+            break;
+        }
+        if (buf[i] != name[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Address of the i-th bucket of the header map whose entries start at
+// entries, or NULL if it holds no header. A hashbrown table stores its
+// buckets in reverse below the control bytes, and a control byte with the
+// top bit clear marks a full bucket; request heads are pooled, so the
+// other buckets may still hold headers of an earlier request.
+static __always_inline void* header_bucket(void* entries, u32 i) {
+    if (header_map_kind != HEADER_MAP_HASHBROWN) {
+        return entries + (i * header_bucket_size);
+    }
+    u8 ctrl = 0;
+    if (bpf_probe_read(&ctrl, sizeof(ctrl), (void*)(entries + i)) != 0 || (ctrl & 0x80)) {
+        return NULL;
+    }
+    return entries - ((i + 1) * header_bucket_size);
+}
+
+// Looks up a header by its lowercase name and returns the address of its
+// HeaderValue, or NULL. Only the first MAX_HEADER_ENTRIES entries, or
+// buckets of a hashbrown table, are scanned.
+static __always_inline void* find_header(void* header_map, const char* name, u32 name_len) {
+    void* entries = NULL;
+    u64 entries_len = 0;
+    bpf_probe_read(&entries, sizeof(entries), (void*)(header_map + header_entries_ptr_pos));
+    bpf_probe_read(&entries_len, sizeof(entries_len), (void*)(header_map + header_entries_len_pos));
+    if (!entries) {
+        return NULL;
+    }
+    if (header_map_kind == HEADER_MAP_HASHBROWN) {
+        // A table of bucket mask + 1 buckets.
+        entries_len += 1;
+    }
+
+    for (u32 i = 0; i < MAX_HEADER_ENTRIES; i++) {
+        if (i >= entries_len) {
+            break;
+        }
+        void* bucket = header_bucket(entries, i);
+        if (!bucket) {
+            continue;
+        }
+
+        struct rust_bytes key = {};
+        bpf_probe_read(&key, sizeof(key), (void*)(bucket + header_bucket_key_pos));
+        if (key.len != name_len || !key.ptr) {
+            continue;
+        }
+        if (!header_name_equals(key.ptr, name, name_len)) {
+            continue;
+        }
+
+        return (void*)(bucket + header_bucket_value_pos);
+    }
+
+    return NULL;
+}
+
+// Looks up a header by its lowercase name and returns the location of its
+// value bytes.
+static __always_inline int find_header_value(void* header_map, const char* name, u32 name_len,
+                                             struct rust_bytes* value) {
+    void* header = find_header(header_map, name, name_len);
+    if (!header) {
+        return -1;
+    }
+    return bpf_probe_read(value, sizeof(*value), header);
+}
+
+// Looks up the value of a header that may be overwritten in place: one the
+// request owns alone, so the write cannot reach read-only memory or other
+// requests sharing its buffer. The header acts as a pre-reserved slot and
+// must be created with e.g. HeaderValue::from_str, not from_static.
+static __always_inline int find_writable_header_value(void* header_map, const char* name, u32 name_len,
+                                                      struct rust_bytes* value) {
+    void* header = find_header(header_map, name, name_len);
+    struct rust_bytes_repr bytes = {};
+    if (!header || bpf_probe_read(&bytes, sizeof(bytes), header) != 0) {
+        return -1;
+    }
+    if (!bytes.ptr || !bytes_uniquely_owned(&bytes)) {
+        return -1;
+    }
+    value->ptr = bytes.ptr;
+    value->len = bytes.len;
+    return 0;
+}
+
+// Overwrites the value of an existing, writable header in place. The write
+// only happens when the slot is exactly as long as the new value, so the
+// HeaderMap never changes shape.
+static __always_inline int inject_header_value(void* header_map, const char* name, u32 name_len,
+                                               char* value, u32 value_len) {
+    struct rust_bytes slot = {};
+    if (find_writable_header_value(header_map, name, name_len, &slot) != 0) {
+        return -1;
+    }
+    if (slot.len != value_len || value_len > MAX_HEADER_SIZE) {
+        return -1;
+    }
+    return bpf_probe_write_user(slot.ptr, value, value_len);
+}
+
+#endif /* __HEADER_MAP_H__ */
@@ -0,0 +1,67 @@
+#ifndef __HTTP_REQUEST_H__
+#define __HTTP_REQUEST_H__
+
+#include "common.h"
+
+// Layout of http::Request and http::Response, shared by the hyper server
+// and client probes. Set by the agent from offset_results.json.
+volatile const u64 method_ptr_pos;
+volatile const u64 uri_ptr_pos;
+volatile const u64 path_ptr_pos;
+volatile const u64 authority_ptr_pos;
+volatile const u64 request_headers_pos;
+volatile const u64 response_status_pos;
+
+// Reads the http::Method at method_field into method.
+static __always_inline void read_method(void* method_field, char* method) {
+    void* method_ptr = NULL;
+    bpf_probe_read(&method_ptr, sizeof(method_ptr), method_field);
+    if (!method_ptr) {
+        return;
+    }
+    u64 method_len = 0;
+    bpf_probe_read(&method_len, sizeof(method_len), (void*)(method_field + 8));
+    u64 method_size = MAX_METHOD_SIZE;
+    method_size = method_size < method_len ? method_size : method_len;
+    bpf_probe_read(method, method_size, method_ptr);
+}
+
+static __always_inline void read_request_method(void* request_ptr, char* method) {
+    read_method((void*)(request_ptr + method_ptr_pos), method);
+}
+
+// Reads the Bytes-backed component at pos of the http::Uri at uri_ptr into
+// buf.
+static __always_inline void read_uri_field(void* uri_ptr, u64 pos, char* buf, u64 buf_size) {
+    void* part_ptr = NULL;
+    bpf_probe_read(&part_ptr, sizeof(part_ptr), (void*)(uri_ptr + pos));
+    if (!part_ptr) {
+        return;
+    }
+    u64 part_len = 0;
+    bpf_probe_read(&part_len, sizeof(part_len), (void*)(uri_ptr + pos + 8));
+    u64 part_size = buf_size < part_len ? buf_size : part_len;
+    bpf_probe_read(buf, part_size, part_ptr);
+}
+
+// Reads the Bytes-backed Uri component at pos into buf.
+static __always_inline void read_uri_part(void* request_ptr, u64 pos, char* buf, u64 buf_size) {
+    read_uri_field((void*)(request_ptr + uri_ptr_pos), pos, buf, buf_size);
+}
+
+// Status of the Response in a Poll<Result<Response<_>, _>> returned by a
+// response future, or 0. Only Poll::Ready(Ok(response)) leaves a valid
+// status code where the Response's status lives.
+static __always_inline u16 read_ready_response_status(void* poll_ptr) {
+    u16 status_code = 0;
+    if (!poll_ptr) {
+        return 0;
+    }
+    bpf_probe_read(&status_code, sizeof(status_code), (void*)(poll_ptr + response_status_pos));
+    if (status_code < 100 || status_code > 599) {
+        return 0;
+    }
+    return status_code;
+}
+
+#endif /* __HTTP_REQUEST_H__ */
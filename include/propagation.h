@@ -0,0 +1,250 @@
+#ifndef __PROPAGATION_H__
+#define __PROPAGATION_H__
+
+#include "common.h"
+#include "span_context.h"
+#include "header_map.h"
+
+// Header formats span contexts are read from and written in.
+#define PROPAGATOR_W3C 0x1
+#define PROPAGATOR_B3_SINGLE 0x2
+#define PROPAGATOR_B3_MULTI 0x4
+#define PROPAGATOR_JAEGER 0x8
+
+// The formats in use, set by the agent. Since it is a load-time constant,
+// the verifier prunes the branches of the other formats before the program
+// runs, so they cost nothing per request.
+volatile const u32 propagators = PROPAGATOR_W3C;
+
+// Long enough for every ID-carrying prefix of the supported headers.
+#define PROPAGATION_VALUE_SIZE 64
+
+// `b3: {trace-id}-{span-id}-1`
+#define B3_STRING_SIZE 51
+// `uber-trace-id: {trace-id}:{span-id}:0:1`
+#define JAEGER_STRING_SIZE 53
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, char[PROPAGATION_VALUE_SIZE]);
+    __uint(max_entries, 1);
+} propagation_scratch SEC(".maps");
+
+static __always_inline s32 hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Parses the len hex digits at buf[start] into an ID of out_size bytes.
+// Shorter IDs are zero-extended on the left, as B3 and Jaeger allow. Fails
+// on any other character and on the all-zero ID, invalid in every format.
+static __always_inline int parse_hex_id(char* buf, u32 start, u32 len, unsigned char* out, u32 out_size) {
+    u32 digits = out_size * 2;
+    if (len == 0 || len > digits) {
+        return -1;
+    }
+    u32 pad = digits - len;
+    u8 nonzero = 0;
+    for (u32 i = 0; i < TRACE_ID_STRING_SIZE; i++) {
+        if (i >= digits) {
+            break;
+        }
+        u8 nibble = 0;
+        if (i >= pad) {
+            s32 value = hex_digit(buf[(start + i - pad) & (PROPAGATION_VALUE_SIZE - 1)]);
+            if (value < 0) {
+                return -1;
+            }
+            nibble = value;
+        }
+        nonzero |= nibble;
+        if (i % 2 == 0) {
+            out[i / 2] = nibble << 4;
+        } else {
+            out[i / 2] |= nibble;
+        }
+    }
+    return nonzero ? 0 : -1;
+}
+
+// Reads the start of a header's value into buf and returns the full length
+// of the value, or -1 when the header is absent.
+static __always_inline s64 read_header(void* header_map, const char* name, u32 name_len, char* buf) {
+    struct rust_bytes value = {};
+    if (find_header_value(header_map, name, name_len, &value) != 0 || !value.ptr) {
+        return -1;
+    }
+    u64 size = PROPAGATION_VALUE_SIZE;
+    size = size < value.len ? size : value.len;
+    if (bpf_probe_read(buf, size, value.ptr) != 0) {
+        return -1;
+    }
+    return value.len;
+}
+
+// traceparent: {version}-{trace-id}-{parent-id}-{flags}
+static __always_inline int extract_w3c(void* header_map, char* buf, struct span_context* sc) {
+    s64 len = read_header(header_map, "traceparent", 11, buf);
+    if (len < SPAN_CONTEXT_STRING_SIZE || buf[2] != '-' || buf[35] != '-' || buf[52] != '-') {
+        return -1;
+    }
+    // Later versions may append fields; version ff is invalid.
+    if (buf[0] == 'f' && buf[1] == 'f') {
+        return -1;
+    }
+    if (buf[0] == '0' && buf[1] == '0' && len != SPAN_CONTEXT_STRING_SIZE) {
+        return -1;
+    }
+    if (parse_hex_id(buf, 3, TRACE_ID_STRING_SIZE, sc->TraceID, TRACE_ID_SIZE) != 0) {
+        return -1;
+    }
+    return parse_hex_id(buf, 36, SPAN_ID_STRING_SIZE, sc->SpanID, SPAN_ID_SIZE);
+}
+
+// b3: {trace-id}-{span-id}[-{sampling}[-{parent-span-id}]], with a 64 or
+// 128-bit trace ID. A lone sampling decision carries no context.
+static __always_inline int extract_b3_single(void* header_map, char* buf, struct span_context* sc) {
+    s64 len = read_header(header_map, "b3", 2, buf);
+    if (len < 16 + 1 + SPAN_ID_STRING_SIZE) {
+        return -1;
+    }
+    u32 trace_len = 0;
+    if (len >= TRACE_ID_STRING_SIZE + 1 + SPAN_ID_STRING_SIZE && buf[TRACE_ID_STRING_SIZE] == '-') {
+        trace_len = TRACE_ID_STRING_SIZE;
+    } else if (buf[16] == '-') {
+        trace_len = 16;
+    } else {
+        return -1;
+    }
+    u32 span_end = trace_len + 1 + SPAN_ID_STRING_SIZE;
+    if (len > span_end && buf[span_end & (PROPAGATION_VALUE_SIZE - 1)] != '-') {
+        return -1;
+    }
+    if (parse_hex_id(buf, 0, trace_len, sc->TraceID, TRACE_ID_SIZE) != 0) {
+        return -1;
+    }
+    return parse_hex_id(buf, trace_len + 1, SPAN_ID_STRING_SIZE, sc->SpanID, SPAN_ID_SIZE);
+}
+
+// X-B3-TraceId and X-B3-SpanId; HeaderMap keeps names lowercase.
+static __always_inline int extract_b3_multi(void* header_map, char* buf, struct span_context* sc) {
+    s64 len = read_header(header_map, "x-b3-traceid", 12, buf);
+    if (len != 16 && len != TRACE_ID_STRING_SIZE) {
+        return -1;
+    }
+    if (parse_hex_id(buf, 0, len, sc->TraceID, TRACE_ID_SIZE) != 0) {
+        return -1;
+    }
+    len = read_header(header_map, "x-b3-spanid", 11, buf);
+    if (len != SPAN_ID_STRING_SIZE) {
+        return -1;
+    }
+    return parse_hex_id(buf, 0, SPAN_ID_STRING_SIZE, sc->SpanID, SPAN_ID_SIZE);
+}
+
+// uber-trace-id: {trace-id}:{span-id}:{parent-span-id}:{flags}, where the
+// IDs may drop leading zeros.
+static __always_inline int extract_jaeger(void* header_map, char* buf, struct span_context* sc) {
+    s64 len = read_header(header_map, "uber-trace-id", 13, buf);
+    if (len < 3) {
+        return -1;
+    }
+    u32 first = 0, second = 0;
+    for (u32 i = 1; i < PROPAGATION_VALUE_SIZE; i++) {
+        if (i >= len) {
+            break;
+        }
+        if (buf[i] != ':') {
+            continue;
+        }
+        if (!first) {
+            first = i;
+        } else {
+            second = i;
+            break;
+        }
+    }
+    if (!first || !second) {
+        return -1;
+    }
+    if (parse_hex_id(buf, 0, first, sc->TraceID, TRACE_ID_SIZE) != 0) {
+        return -1;
+    }
+    return parse_hex_id(buf, first + 1, second - first - 1, sc->SpanID, SPAN_ID_SIZE);
+}
+
+// Reads the caller's span context from an incoming request, trying the
+// formats in use in the order W3C, B3 single, B3 multi, Jaeger.
+static __always_inline int extract_span_context(void* header_map, struct span_context* sc) {
+    u32 zero = 0;
+    char* buf = bpf_map_lookup_elem(&propagation_scratch, &zero);
+    if (!buf) {
+        return -1;
+    }
+    if ((propagators & PROPAGATOR_W3C) && extract_w3c(header_map, buf, sc) == 0) {
+        return 0;
+    }
+    if ((propagators & PROPAGATOR_B3_SINGLE) && extract_b3_single(header_map, buf, sc) == 0) {
+        return 0;
+    }
+    if ((propagators & PROPAGATOR_B3_MULTI) && extract_b3_multi(header_map, buf, sc) == 0) {
+        return 0;
+    }
+    if ((propagators & PROPAGATOR_JAEGER) && extract_jaeger(header_map, buf, sc) == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+// Writes sc into the pre-reserved headers of every format in use. As with
+// inject_header_value, a header is only written when the request already
+// has it with exactly the length of the new value.
+static __always_inline void inject_span_context(void* header_map, struct span_context* sc) {
+    u32 zero = 0;
+    char* buf = bpf_map_lookup_elem(&propagation_scratch, &zero);
+    if (!buf) {
+        return;
+    }
+
+    if (propagators & PROPAGATOR_W3C) {
+        span_context_to_w3c_string(sc, buf);
+        inject_header_value(header_map, "traceparent", 11, buf, SPAN_CONTEXT_STRING_SIZE);
+    }
+    if (propagators & PROPAGATOR_B3_SINGLE) {
+        bytes_to_hex_string(sc->TraceID, TRACE_ID_SIZE, buf);
+        buf[TRACE_ID_STRING_SIZE] = '-';
+        bytes_to_hex_string(sc->SpanID, SPAN_ID_SIZE, buf + TRACE_ID_STRING_SIZE + 1);
+        buf[B3_STRING_SIZE - 2] = '-';
+        buf[B3_STRING_SIZE - 1] = '1';
+        inject_header_value(header_map, "b3", 2, buf, B3_STRING_SIZE);
+    }
+    if (propagators & PROPAGATOR_B3_MULTI) {
+        bytes_to_hex_string(sc->TraceID, TRACE_ID_SIZE, buf);
+        inject_header_value(header_map, "x-b3-traceid", 12, buf, TRACE_ID_STRING_SIZE);
+        bytes_to_hex_string(sc->SpanID, SPAN_ID_SIZE, buf);
+        inject_header_value(header_map, "x-b3-spanid", 11, buf, SPAN_ID_STRING_SIZE);
+        buf[0] = '1';
+        inject_header_value(header_map, "x-b3-sampled", 12, buf, 1);
+    }
+    if (propagators & PROPAGATOR_JAEGER) {
+        bytes_to_hex_string(sc->TraceID, TRACE_ID_SIZE, buf);
+        buf[TRACE_ID_STRING_SIZE] = ':';
+        bytes_to_hex_string(sc->SpanID, SPAN_ID_SIZE, buf + TRACE_ID_STRING_SIZE + 1);
+        buf[JAEGER_STRING_SIZE - 4] = ':';
+        buf[JAEGER_STRING_SIZE - 3] = '0';
+        buf[JAEGER_STRING_SIZE - 2] = ':';
+        buf[JAEGER_STRING_SIZE - 1] = '1';
+        inject_header_value(header_map, "uber-trace-id", 13, buf, JAEGER_STRING_SIZE);
+    }
+}
+
+#endif /* __PROPAGATION_H__ */
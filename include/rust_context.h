@@ -3,16 +3,39 @@
 
 #include "common.h"
 #include "span_context.h"
+#include "task_context.h"
+#include "stack_trace.h"
+#include "span_errors.h"
 
 #define MAX_CONCURRENT_REQUESTS 50
 
+// Interned route template matched by a framework router (see
+// string_intern.h), keyed by the task serving the request.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, u64);
+    __uint(max_entries, MAX_TRACKED_TASKS);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} task_routes SEC(".maps");
+
 struct http_request_t {
     u64 start_time;
     u64 end_time;
     char method[MAX_METHOD_SIZE];
     char path[MAX_PATH_SIZE];
     u16 status_code;
+    u64 route_id;
     struct span_context sc;
+    // The caller's span, when the request carried one.
+    struct span_context psc;
+    struct poll_stats polls;
+    s64 entry_stack_id;
+    s64 return_stack_id;
+    // SPAN_ERROR_* marks taken from trace_errors when the span ends.
+    u32 errors;
+    // Interned allowlisted baggage entries, taken from trace_baggage.
+    u64 baggage_id;
 };
 
 struct grpc_request_t {
@@ -22,6 +45,43 @@ struct grpc_request_t {
     char method[MAX_METHOD_SIZE];
     u32 status_code;
     struct span_context sc;
+    struct span_context psc;
+    struct poll_stats polls;
+    s64 entry_stack_id;
+    s64 return_stack_id;
+    u32 errors;
+    // Interned allowlisted baggage entries, taken from trace_baggage.
+    u64 baggage_id;
+};
+
+#define POOL_OUTCOME_UNKNOWN 0
+#define POOL_OUTCOME_HIT 1
+#define POOL_OUTCOME_MISS 2
+
+// How a client request got its connection, for clients with a pool.
+struct pool_timings {
+    u64 wait_ns;
+    u64 connect_ns;
+    u8 outcome;
+};
+
+// Why a client request ended without a response.
+#define CLIENT_REQUEST_CANCELLED 0x1
+#define CLIENT_REQUEST_FAILED 0x2
+
+struct http_client_request_t {
+    u64 start_time;
+    u64 end_time;
+    char method[MAX_METHOD_SIZE];
+    char host[MAX_HOST_SIZE];
+    char path[MAX_PATH_SIZE];
+    u16 status_code;
+    struct span_context sc;
+    struct span_context psc;
+    struct pool_timings pool;
+    // CLIENT_REQUEST_*, set when the request future is dropped before a
+    // response was built.
+    u32 error;
 };
 
 static __always_inline void* get_argument_system_v(struct pt_regs *ctx, int pos) {
@@ -2,9 +2,10 @@
 #define __SPAN_CONTEXT_H__
 
 #include "utils.h"
+#include "task_context.h"
 
 #define SPAN_CONTEXT_STRING_SIZE 55
-#define MAX_CONCURRENT_SPANS 100
+#define MAX_CONCURRENT_SPANS 10240
 
 struct span_context {
     unsigned char TraceID[TRACE_ID_SIZE];
@@ -19,6 +20,23 @@ struct {
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } spans_in_progress SEC(".maps");
 
+// Key under which the span active on the current execution context is
+// stored in spans_in_progress, so probes in other libraries can find it.
+// Inside a tokio task this is the task itself, since async work migrates
+// between worker threads; otherwise it is the current thread.
+static __always_inline void* get_task_key() {
+    void* task = get_current_task();
+    if (task) {
+        return task;
+    }
+    return (void*)bpf_get_current_pid_tgid();
+}
+
+static __always_inline struct span_context* get_current_span_context() {
+    void* key = get_task_key();
+    return bpf_map_lookup_elem(&spans_in_progress, &key);
+}
+
 static __always_inline struct span_context generate_span_context() {
     struct span_context context = {};
     generate_random_bytes(context.TraceID, TRACE_ID_SIZE);
@@ -26,6 +44,19 @@ static __always_inline struct span_context generate_span_context() {
     return context;
 }
 
+static __always_inline struct span_context generate_child_span_context(struct span_context *parent) {
+    struct span_context context = {};
+    __builtin_memcpy(context.TraceID, parent->TraceID, TRACE_ID_SIZE);
+    generate_random_bytes(context.SpanID, SPAN_ID_SIZE);
+    return context;
+}
+
+static __always_inline int span_context_is_valid(struct span_context *ctx) {
+    u64 span_id = 0;
+    __builtin_memcpy(&span_id, ctx->SpanID, SPAN_ID_SIZE);
+    return span_id != 0;
+}
+
 static __always_inline void span_context_to_w3c_string(struct span_context *ctx, char* buff) {
     char *out = buff;
 
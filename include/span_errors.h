@@ -0,0 +1,88 @@
+#ifndef __SPAN_ERRORS_H__
+#define __SPAN_ERRORS_H__
+
+#include "common.h"
+#include "span_context.h"
+
+#define MAX_ERRORED_TRACES 4096
+
+// Why a request failed, as seen by probes below the server span.
+#define SPAN_ERROR_PANIC 0x1
+#define SPAN_ERROR_RESULT 0x2
+
+// Requests of one trace can be served concurrently, for example when the
+// caller fans out, so state about a request is keyed by its server span.
+struct server_span_key {
+    unsigned char SpanID[SPAN_ID_SIZE];
+};
+
+// The server span each task is serving, set by the server probes for the
+// task that runs the handler and inherited by the tasks it spawns. Probes
+// below the server span find it here.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct server_span_key);
+    __uint(max_entries, MAX_TRACKED_TASKS);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} task_server_spans SEC(".maps");
+
+// Errors raised while serving a request, keyed by its server span. Any
+// probe can mark the request its task serves; the server probe that ends
+// the request span takes the marks, so the decision to keep an errored
+// trace is available in-kernel when the span is reported. Marks of
+// requests whose server span is not traced here are evicted by the LRU.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct server_span_key);
+    __type(value, u32);
+    __uint(max_entries, MAX_ERRORED_TRACES);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} trace_errors SEC(".maps");
+
+static __always_inline void server_span_key(struct span_context* sc, struct server_span_key* key) {
+    __builtin_memcpy(key->SpanID, sc->SpanID, SPAN_ID_SIZE);
+}
+
+// Makes sc the server span of the task serving its request.
+static __always_inline void set_server_span(void* task_key, struct span_context* sc) {
+    struct server_span_key key = {};
+    server_span_key(sc, &key);
+    bpf_map_update_elem(&task_server_spans, &task_key, &key, 0);
+}
+
+// The server span the current task serves, or NULL.
+static __always_inline struct server_span_key* current_server_span() {
+    void* task_key = get_task_key();
+    return bpf_map_lookup_elem(&task_server_spans, &task_key);
+}
+
+// Marks the request the current task serves as failed.
+static __always_inline void mark_trace_error(u32 error) {
+    struct server_span_key* server = current_server_span();
+    if (!server) {
+        return;
+    }
+    struct server_span_key key = *server;
+    u32* errors = bpf_map_lookup_elem(&trace_errors, &key);
+    if (errors) {
+        *errors |= error;
+        return;
+    }
+    bpf_map_update_elem(&trace_errors, &key, &error, BPF_NOEXIST);
+}
+
+// Takes the marks of the request whose server span sc ends.
+static __always_inline u32 take_trace_errors(struct span_context* sc) {
+    struct server_span_key key = {};
+    server_span_key(sc, &key);
+    u32* errors = bpf_map_lookup_elem(&trace_errors, &key);
+    if (!errors) {
+        return 0;
+    }
+    u32 taken = *errors;
+    bpf_map_delete_elem(&trace_errors, &key);
+    return taken;
+}
+
+#endif /* __SPAN_ERRORS_H__ */
@@ -0,0 +1,72 @@
+#ifndef __STACK_TRACE_H__
+#define __STACK_TRACE_H__
+
+#include "common.h"
+
+#define MAX_STACK_DEPTH 127
+#define MAX_STACK_TRACES 16384
+
+// User stacks captured by any probe. Events carry the stack ID and the agent
+// resolves the frames against the target's symbol table.
+struct {
+    __uint(type, BPF_MAP_TYPE_STACK_TRACE);
+    __type(key, u32);
+    __uint(value_size, MAX_STACK_DEPTH * sizeof(u64));
+    __uint(max_entries, MAX_STACK_TRACES);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} user_stacks SEC(".maps");
+
+#define MAX_ROUTE_THRESHOLDS 1024
+
+// Slow-request stack snapshots: when enabled, server and client probes
+// capture the user stack at entry and, if the request turns out slower than
+// its route's threshold, again at return.
+volatile const u8 slow_request_capture_enabled;
+volatile const u64 slow_request_threshold_ns;
+
+// Per-route overrides of slow_request_threshold_ns, keyed by the FNV-1a
+// hash of the route.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, u64);
+    __uint(max_entries, MAX_ROUTE_THRESHOLDS);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} slow_request_thresholds SEC(".maps");
+
+static __always_inline s64 get_user_stack_id(void* ctx) {
+    return bpf_get_stackid(ctx, &user_stacks, BPF_F_USER_STACK);
+}
+
+static __always_inline s64 get_entry_stack_id(void* ctx) {
+    if (!slow_request_capture_enabled) {
+        return -1;
+    }
+    return get_user_stack_id(ctx);
+}
+
+static __always_inline int is_slow_request(u64 route_hash, u64 duration) {
+    u64 threshold = slow_request_threshold_ns;
+    u64* route_threshold = bpf_map_lookup_elem(&slow_request_thresholds, &route_hash);
+    if (route_threshold) {
+        threshold = *route_threshold;
+    }
+    return threshold > 0 && duration > threshold;
+}
+
+// Takes the return-time stack of a slow request, or drops the entry-time
+// stack of a fast one.
+static __always_inline void capture_slow_request_stacks(void* ctx, u64 route_hash, u64 duration,
+                                                        s64* entry_stack_id, s64* return_stack_id) {
+    *return_stack_id = -1;
+    if (!slow_request_capture_enabled) {
+        return;
+    }
+    if (!is_slow_request(route_hash, duration)) {
+        *entry_stack_id = -1;
+        return;
+    }
+    *return_stack_id = get_user_stack_id(ctx);
+}
+
+#endif /* __STACK_TRACE_H__ */
@@ -0,0 +1,72 @@
+#ifndef __STRING_INTERN_H__
+#define __STRING_INTERN_H__
+
+#include "common.h"
+#include "utils.h"
+
+#define MAX_INTERNED_STRING_SIZE 128
+#define MAX_INTERNED_STRINGS 4096
+
+// Low-cardinality strings such as route templates are sent to the agent
+// once, as a definition, and afterwards referred to by their ID. The ID is
+// the FNV-1a hash of the string, so the agent can also compute it.
+struct string_definition_t {
+    u64 id;
+    char value[MAX_INTERNED_STRING_SIZE];
+};
+
+// IDs this probe has defined to the agent. The map is not pinned: it lives
+// as long as the agent that received the definitions, so a restarted agent
+// is sent every string again. Each probe defines the strings it sees once,
+// and the agent keeps the first definition of an ID.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, u8);
+    __uint(max_entries, MAX_INTERNED_STRINGS);
+} interned_strings SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} string_definitions SEC(".maps");
+
+// Sends def to the agent unless its ID was defined before, for strings
+// identified by something other than their own hash. A definition the
+// perf buffer had no room for is not marked, so it is sent again the next
+// time the string is seen.
+static __always_inline u64 define_string_as(void* ctx, struct string_definition_t* def) {
+    if (bpf_map_lookup_elem(&interned_strings, &def->id)) {
+        return def->id;
+    }
+
+    u8 defined = 1;
+    if (bpf_map_update_elem(&interned_strings, &def->id, &defined, BPF_NOEXIST) != 0) {
+        // Defined concurrently on another CPU.
+        return def->id;
+    }
+    if (bpf_perf_event_output(ctx, &string_definitions, BPF_F_CURRENT_CPU, def, sizeof(*def)) != 0) {
+        bpf_map_delete_elem(&interned_strings, &def->id);
+    }
+    return def->id;
+}
+
+// Interns the NUL-terminated string in def->value, which may live in map
+// memory when the caller has no stack to spare, and returns its ID.
+static __always_inline u64 define_string(void* ctx, struct string_definition_t* def) {
+    def->id = fnv1a_update(FNV_OFFSET_BASIS, def->value, MAX_INTERNED_STRING_SIZE);
+    return define_string_as(ctx, def);
+}
+
+// Interns len bytes at ptr in user memory and returns the string's ID, or 0
+// if it could not be read.
+static __always_inline u64 intern_string(void* ctx, void* ptr, u64 len) {
+    struct string_definition_t def = {};
+    u64 size = sizeof(def.value) - 1;
+    size = size < len ? size : len;
+    if (!ptr || bpf_probe_read(def.value, size, ptr) != 0) {
+        return 0;
+    }
+    return define_string(ctx, &def);
+}
+
+#endif /* __STRING_INTERN_H__ */
@@ -0,0 +1,188 @@
+#ifndef __TASK_CONTEXT_H__
+#define __TASK_CONTEXT_H__
+
+#include "common.h"
+
+#define MAX_TRACKED_THREADS 4096
+#define MAX_TRACKED_TASKS 10240
+
+struct current_task_t {
+    u64 pid_tgid;
+    void* task;
+    u64 poll_start;
+    u64 cpu_ns;
+};
+
+// The tokio task being polled by a worker thread, keyed by pid_tgid.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, struct current_task_t);
+    __uint(max_entries, MAX_TRACKED_THREADS);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} current_task_by_thread SEC(".maps");
+
+// Per-CPU copy of the poll running on this CPU, so that lookups on the hot
+// path are a single per-CPU read. The copy is invalidated when its thread
+// is switched out, which keeps a thread that migrates mid-poll from leaving
+// a stale copy behind. That invalidation comes from the sched_switch
+// tracepoint, so the copy is only used when task_cache_enabled is set.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct current_task_t);
+    __uint(max_entries, 1);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} current_task_cache SEC(".maps");
+
+// Set by the agent while the tokio probe's sched_switch tracepoint is
+// attached. Without it, the current task is looked up in the hash map.
+volatile const u8 task_cache_enabled;
+
+// Polls of tasks serving an in-flight request, accumulated between the
+// server entry and return probes.
+struct poll_stats {
+    u64 polls;
+    u64 busy_ns;
+    u64 max_poll_ns;
+    u64 cpu_ns;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, void*);
+    __type(value, struct poll_stats);
+    __uint(max_entries, MAX_TRACKED_TASKS);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} task_poll_stats SEC(".maps");
+
+// When on-CPU accounting is enabled, the time each tracked thread was last
+// switched in by the scheduler (0 while it is switched out).
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u32);
+    __type(value, u64);
+    __uint(max_entries, MAX_TRACKED_THREADS);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} thread_oncpu_since SEC(".maps");
+
+static __always_inline void set_current_task(void* task) {
+    struct current_task_t current = {};
+    current.pid_tgid = bpf_get_current_pid_tgid();
+    current.task = task;
+    current.poll_start = bpf_ktime_get_ns();
+    bpf_map_update_elem(&current_task_by_thread, &current.pid_tgid, &current, 0);
+
+    u32 zero = 0;
+    struct current_task_t* cached = bpf_map_lookup_elem(&current_task_cache, &zero);
+    if (cached) {
+        *cached = current;
+    }
+}
+
+static __always_inline struct current_task_t* lookup_current_task() {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    if (task_cache_enabled) {
+        u32 zero = 0;
+        struct current_task_t* cached = bpf_map_lookup_elem(&current_task_cache, &zero);
+        if (cached && cached->pid_tgid == pid_tgid) {
+            return cached;
+        }
+    }
+    return bpf_map_lookup_elem(&current_task_by_thread, &pid_tgid);
+}
+
+static __always_inline void* get_current_task() {
+    struct current_task_t* current = lookup_current_task();
+    if (!current) {
+        return NULL;
+    }
+    return current->task;
+}
+
+// On-CPU time of the current poll since the thread was last switched in.
+// Always 0 for threads that are not tracked by the scheduler probe.
+static __always_inline u64 oncpu_time_in_poll(struct current_task_t* current, u64 now) {
+    u32 tid = (u32)current->pid_tgid;
+    u64* since = bpf_map_lookup_elem(&thread_oncpu_since, &tid);
+    if (!since || *since == 0) {
+        return 0;
+    }
+    u64 start = *since > current->poll_start ? *since : current->poll_start;
+    return now > start ? now - start : 0;
+}
+
+// Charges the poll that is finishing on this thread to its task, if that
+// task is serving a request.
+static __always_inline void account_poll(struct current_task_t* current, u64 duration) {
+    void* task = current->task;
+    struct poll_stats* stats = bpf_map_lookup_elem(&task_poll_stats, &task);
+    if (!stats) {
+        return;
+    }
+
+    stats->polls++;
+    stats->busy_ns += duration;
+    stats->cpu_ns += current->cpu_ns + oncpu_time_in_poll(current, current->poll_start + duration);
+    if (duration > stats->max_poll_ns) {
+        stats->max_poll_ns = duration;
+    }
+}
+
+static __always_inline void clear_current_task() {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_delete_elem(&current_task_by_thread, &pid_tgid);
+
+    u32 zero = 0;
+    struct current_task_t* cached = bpf_map_lookup_elem(&current_task_cache, &zero);
+    if (cached && cached->pid_tgid == pid_tgid) {
+        cached->pid_tgid = 0;
+        cached->task = NULL;
+    }
+}
+
+// Called from sched_switch for every thread that leaves this CPU. The
+// thread may resume elsewhere, so its copy here is dropped and the hash map
+// answers its lookups until its next poll starts.
+static __always_inline void invalidate_cached_task() {
+    u32 zero = 0;
+    struct current_task_t* cached = bpf_map_lookup_elem(&current_task_cache, &zero);
+    if (cached && cached->pid_tgid) {
+        cached->pid_tgid = 0;
+        cached->task = NULL;
+    }
+}
+
+// Called when a tracked thread is switched out: banks the on-CPU time of the
+// poll it is running. Only the hash map entry is updated, as the per-CPU
+// copy is invalidated on the same switch.
+static __always_inline void pause_poll_accounting(u64 now) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct current_task_t* current = bpf_map_lookup_elem(&current_task_by_thread, &pid_tgid);
+    if (!current) {
+        return;
+    }
+    current->cpu_ns += oncpu_time_in_poll(current, now);
+}
+
+static __always_inline void start_poll_accounting(void* task) {
+    struct poll_stats stats = {};
+    bpf_map_update_elem(&task_poll_stats, &task, &stats, 0);
+}
+
+// Also charges the part of the poll in which the request finishes.
+static __always_inline void finish_poll_accounting(void* task, struct poll_stats* out) {
+    struct current_task_t* current = lookup_current_task();
+    if (current && current->task == task) {
+        account_poll(current, bpf_ktime_get_ns() - current->poll_start);
+    }
+
+    struct poll_stats* stats = bpf_map_lookup_elem(&task_poll_stats, &task);
+    if (!stats) {
+        return;
+    }
+    *out = *stats;
+    bpf_map_delete_elem(&task_poll_stats, &task);
+}
+
+#endif /* __TASK_CONTEXT_H__ */
@@ -3,6 +3,22 @@
 
 #include "common.h"
 
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// FNV-1a over a NUL-terminated buffer of at most size bytes. The agent
+// computes the same hash to key per-route settings.
+static __always_inline u64 fnv1a_update(u64 hash, const char *buf, u32 size) {
+    for (u32 i = 0; i < size; i++) {
+        if (buf[i] == 0) {
+            break;
+        }
+        hash ^= (u8)buf[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
 static __always_inline void generate_random_bytes(unsigned char *buff, u32 size) {
     for (u32 i = 0; i < size; i++) {
         buff[i] = bpf_get_prandom_u32() & 0xFF;
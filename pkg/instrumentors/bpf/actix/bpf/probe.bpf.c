@@ -0,0 +1,259 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+#include "http_request.h"
+#include "header_map.h"
+#include "propagation.h"
+#include "baggage.h"
+#include "string_intern.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 50
+
+// actix-http polls the service future inside the connection's dispatcher
+// future, so a request is served entirely on one task and requests in
+// flight are keyed by task.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct http_request_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} context_to_http_events SEC(".maps");
+
+// ResourceDefs being matched, by thread.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, void*);
+    __uint(max_entries, MAX_CONCURRENT);
+} resource_matches SEC(".maps");
+
+// The full pattern of the route being matched for a request: the patterns
+// of the scopes it is nested in followed by the resource's own, as
+// HttpRequest::match_pattern joins them. Each part is cut to
+// MAX_INTERNED_STRING_SIZE - 1 bytes, and the whole to the same size when
+// it is interned.
+struct route_pattern_t {
+    u32 len;
+    u32 padding;
+    char value[2 * MAX_INTERNED_STRING_SIZE];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct route_pattern_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} route_patterns SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct route_pattern_t);
+    __uint(max_entries, 1);
+} route_pattern_scratch SEC(".maps");
+
+// Requests are built in a per-CPU scratch slot, leaving the BPF stack to
+// the header lookups.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct http_request_t);
+    __uint(max_entries, 1);
+} server_request_scratch SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} events SEC(".maps");
+
+// The RequestHead behind actix_http::Request's Rc, and the status in the
+// ResponseHead a Response<()> boxes. method_ptr_pos, uri_ptr_pos and
+// request_headers_pos are relative to the RequestHead, whose HeaderMap is
+// a hashbrown table (see header_map.h). Read by the agent from DWARF.
+volatile const u64 request_head_pos;
+volatile const u64 rc_value_pos;
+volatile const u64 response_head_status_pos;
+
+// The pattern String of a single-pattern ResourceDef, and whether the
+// definition is a scope's prefix.
+volatile const u64 resource_pattern_ptr_pos;
+volatile const u64 resource_pattern_len_pos;
+volatile const u64 resource_is_prefix_pos;
+
+// Entry locations of the app service call's `req`,
+// capture_match_info_fn's `self` and send_response_inner's `res`.
+volatile const struct arg_loc request_arg_loc;
+volatile const struct arg_loc resource_arg_loc;
+volatile const struct arg_loc response_arg_loc;
+
+// <AppInitService<T, B> as Service<Request>>::call(&self, req: Request)
+SEC("uprobe/actix_app_call")
+int uprobe_actix_app_call(struct pt_regs *ctx) {
+    void* request_ptr = get_argument_at(ctx, &request_arg_loc, 2);
+    if (!request_ptr) {
+        return 0;
+    }
+
+    void* head_rc = NULL;
+    bpf_probe_read(&head_rc, sizeof(head_rc), (void*)(request_ptr + request_head_pos));
+    if (!head_rc) {
+        return 0;
+    }
+
+    u32 zero = 0;
+    struct http_request_t* httpReq = bpf_map_lookup_elem(&server_request_scratch, &zero);
+    if (!httpReq) {
+        return 0;
+    }
+    __builtin_memset(httpReq, 0, sizeof(*httpReq));
+    httpReq->start_time = bpf_ktime_get_ns();
+
+    void* head_ptr = (void*)(head_rc + rc_value_pos);
+    read_request_method(head_ptr, httpReq->method);
+    read_uri_part(head_ptr, path_ptr_pos, httpReq->path, sizeof(httpReq->path));
+
+    // The span joins the caller's trace when the request carries a context.
+    void* headers = (void*)(head_ptr + request_headers_pos);
+    if (extract_span_context(headers, &httpReq->psc) == 0) {
+        httpReq->sc = generate_child_span_context(&httpReq->psc);
+    } else {
+        __builtin_memset(&httpReq->psc, 0, sizeof(httpReq->psc));
+        httpReq->sc = generate_span_context();
+    }
+    capture_baggage(ctx, headers, &httpReq->sc);
+    httpReq->entry_stack_id = get_entry_stack_id(ctx);
+
+    void* task_key = get_task_key();
+    bpf_map_update_elem(&context_to_http_events, &task_key, httpReq, 0);
+    bpf_map_update_elem(&spans_in_progress, &task_key, &httpReq->sc, 0);
+    set_server_span(task_key, &httpReq->sc);
+    bpf_map_delete_elem(&task_routes, &task_key);
+    start_poll_accounting(task_key);
+
+    struct route_pattern_t* pattern = bpf_map_lookup_elem(&route_pattern_scratch, &zero);
+    if (pattern) {
+        pattern->len = 0;
+        bpf_map_update_elem(&route_patterns, &task_key, pattern, 0);
+    }
+
+    return 0;
+}
+
+// ResourceDef::capture_match_info_fn(&self, resource, check_fn) -> bool
+//
+// Called for each candidate scope and resource while routing, with a
+// check_fn that runs the candidate's guards, so it only returns true for
+// the definition routed to. A scope's router then matches the rest of the
+// path against its own definitions, down to the resource serving the
+// request; their patterns joined are the route template.
+SEC("uprobe/actix_resource_match")
+int uprobe_actix_resource_match(struct pt_regs *ctx) {
+    void* resource_def = get_argument_at(ctx, &resource_arg_loc, 1);
+    if (!resource_def) {
+        return 0;
+    }
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&resource_matches, &pid_tgid, &resource_def, 0);
+
+    return 0;
+}
+
+SEC("uprobe/actix_resource_match_return")
+int uprobe_actix_resource_match_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    void** resource_def_ptr = bpf_map_lookup_elem(&resource_matches, &pid_tgid);
+    if (!resource_def_ptr) {
+        return 0;
+    }
+    void* resource_def = *resource_def_ptr;
+    bpf_map_delete_elem(&resource_matches, &pid_tgid);
+
+    if (((u64)get_return_value(ctx) & 0xff) == 0) {
+        return 0;
+    }
+
+    void* task_key = get_task_key();
+    struct route_pattern_t* pattern = bpf_map_lookup_elem(&route_patterns, &task_key);
+    if (!pattern) {
+        return 0;
+    }
+
+    void* pattern_ptr = NULL;
+    u64 pattern_len = 0;
+    bpf_probe_read(&pattern_ptr, sizeof(pattern_ptr), (void*)(resource_def + resource_pattern_ptr_pos));
+    bpf_probe_read(&pattern_len, sizeof(pattern_len), (void*)(resource_def + resource_pattern_len_pos));
+    u32 offset = pattern->len;
+    u64 size = MAX_INTERNED_STRING_SIZE - 1;
+    size = size < pattern_len ? size : pattern_len;
+    if (offset < MAX_INTERNED_STRING_SIZE && pattern_ptr && size &&
+        bpf_probe_read(&pattern->value[offset], size, pattern_ptr) == 0) {
+        pattern->len = offset + size;
+    }
+
+    u8 is_prefix = 0;
+    bpf_probe_read(&is_prefix, sizeof(is_prefix), (void*)(resource_def + resource_is_prefix_pos));
+    if (is_prefix || !pattern->len) {
+        return 0;
+    }
+
+    struct string_definition_t def = {};
+    u32 len = pattern->len;
+    if (len > MAX_INTERNED_STRING_SIZE - 1) {
+        len = MAX_INTERNED_STRING_SIZE - 1;
+    }
+    bpf_probe_read(def.value, len, pattern->value);
+    u64 route_id = define_string(ctx, &def);
+    bpf_map_update_elem(&task_routes, &task_key, &route_id, 0);
+
+    return 0;
+}
+
+// InnerDispatcher<T, S, B, X, U>::send_response_inner(self: Pin<&mut Self>,
+//     res: Response<()>, body: &B)
+SEC("uprobe/actix_send_response")
+int uprobe_actix_send_response(struct pt_regs *ctx) {
+    void* task_key = get_task_key();
+    void* httpReq_ptr = bpf_map_lookup_elem(&context_to_http_events, &task_key);
+    if (!httpReq_ptr) {
+        return 0;
+    }
+
+    struct http_request_t httpReq = {};
+    bpf_probe_read(&httpReq, sizeof(httpReq), httpReq_ptr);
+    httpReq.end_time = bpf_ktime_get_ns();
+
+    // Response<()> is only its BoxedResponseHead, so `res` is passed as
+    // the ResponseHead pointer.
+    void* response_head = get_argument_at(ctx, &response_arg_loc, 2);
+    if (response_head) {
+        bpf_probe_read(&httpReq.status_code, sizeof(httpReq.status_code),
+                       (void*)(response_head + response_head_status_pos));
+    }
+
+    u64* route_id = bpf_map_lookup_elem(&task_routes, &task_key);
+    if (route_id) {
+        httpReq.route_id = *route_id;
+        bpf_map_delete_elem(&task_routes, &task_key);
+    }
+
+    u64 route_hash = httpReq.route_id;
+    if (!route_hash) {
+        route_hash = fnv1a_update(FNV_OFFSET_BASIS, httpReq.path, MAX_PATH_SIZE);
+    }
+    capture_slow_request_stacks(ctx, route_hash, httpReq.end_time - httpReq.start_time,
+                                &httpReq.entry_stack_id, &httpReq.return_stack_id);
+
+    finish_poll_accounting(task_key, &httpReq.polls);
+    httpReq.errors = take_trace_errors(&httpReq.sc);
+    httpReq.baggage_id = take_trace_baggage(&httpReq.sc);
+
+    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, &httpReq, sizeof(httpReq));
+    bpf_map_delete_elem(&context_to_http_events, &task_key);
+    bpf_map_delete_elem(&spans_in_progress, &task_key);
+    bpf_map_delete_elem(&task_server_spans, &task_key);
+    bpf_map_delete_elem(&route_patterns, &task_key);
+
+    return 0;
+}
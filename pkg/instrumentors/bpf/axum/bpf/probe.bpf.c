@@ -0,0 +1,48 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+#include "string_intern.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+// Offsets of the fat Arc<str> pointer to the matched route template, and of
+// the string data inside the ArcInner (after the strong and weak counts).
+volatile const u64 matched_path_ptr_pos;
+volatile const u64 matched_path_len_pos;
+volatile const u64 arc_data_pos;
+
+// Entry location of append_nested_matched_path's `matched_path`.
+volatile const struct arg_loc matched_path_arg_loc;
+
+// axum::extract::matched_path::append_nested_matched_path(
+//     matched_path: &Arc<str>, extensions: &http::Extensions) -> Arc<str>
+//
+// Called by the router once the request matched a route, with the route's
+// template (e.g. "/users/:id/orders"). It runs on the task serving the
+// request, so the template ID is attached to that task for the server
+// probe to pick up.
+SEC("uprobe/axum_matched_path")
+int uprobe_axum_matched_path(struct pt_regs *ctx) {
+    void* matched_path = get_argument_at(ctx, &matched_path_arg_loc, 1);
+    if (!matched_path) {
+        return 0;
+    }
+
+    void* arc_ptr = NULL;
+    u64 len = 0;
+    bpf_probe_read(&arc_ptr, sizeof(arc_ptr), (void*)(matched_path + matched_path_ptr_pos));
+    bpf_probe_read(&len, sizeof(len), (void*)(matched_path + matched_path_len_pos));
+    if (!arc_ptr) {
+        return 0;
+    }
+
+    u64 route_id = intern_string(ctx, (void*)(arc_ptr + arc_data_pos), len);
+    if (!route_id) {
+        return 0;
+    }
+
+    void* task_key = get_task_key();
+    bpf_map_update_elem(&task_routes, &task_key, &route_id, 0);
+
+    return 0;
+}
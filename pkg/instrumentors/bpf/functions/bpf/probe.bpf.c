@@ -0,0 +1,476 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+#include "captures.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 1024
+#define MAX_TRACED_FUNCTIONS 1024
+#define MAX_ASYNC_FUTURES 10240
+#define RATE_WINDOW_NS 1000000000ULL
+
+#define MAX_CAPTURES 4
+
+// Where a returned Result's discriminant is found.
+#define RESULT_IN_REGISTER 1
+#define RESULT_IN_MEMORY 2
+
+// Generic entry/exit timing for user-selected functions. The agent
+// attaches these programs to every matching symbol, with the function's
+// index as the BPF cookie.
+//
+// An async fn body is a state machine whose poll function runs once per
+// wake-up, so it gets its own pair of programs. Their cookie also carries
+// the layout of the state machine, read by the agent from DWARF: the
+// function's index in bits 0-15, the offset of the state discriminant in
+// bits 16-47, the discriminant's size in bits 48-55 and the argument that
+// holds the future in bits 56-63.
+#define ASYNC_COOKIE_FUNCTION_ID(cookie) ((cookie) & 0xffff)
+#define ASYNC_COOKIE_STATE_POS(cookie) (((cookie) >> 16) & 0xffffffff)
+#define ASYNC_COOKIE_STATE_SIZE(cookie) (((cookie) >> 48) & 0xff)
+#define ASYNC_COOKIE_SELF_ARG(cookie) ((cookie) >> 56)
+
+// Discriminants rustc reserves in every coroutine; suspend points are
+// numbered from 3.
+#define ASYNC_STATE_UNRESUMED 0
+#define ASYNC_STATE_RETURNED 1
+
+// Calls traced per function, per CPU and per second. Calls beyond it are
+// not timed, bounding the per-call overhead of hot functions.
+volatile const u64 max_calls_per_sec;
+// Calls shorter than this are not reported.
+volatile const u64 min_duration_ns;
+
+// Arguments read at function entry, see captures.h.
+struct function_captures_t {
+    u32 count;
+    u32 padding;
+    struct capture_recipe recipes[MAX_CAPTURES];
+};
+
+// How to tell whether a function returning a Result returned Err. Small
+// results come back in registers; larger ones are written through a
+// pointer the caller passes in a register, which is saved at entry.
+struct result_recipe {
+    u16 location;
+    // RESULT_IN_REGISTER: register holding the discriminant.
+    // RESULT_IN_MEMORY: register holding the return pointer at entry.
+    u16 reg;
+    u32 size;
+    // Byte offset of the discriminant in the register or in memory.
+    u64 offset;
+    u64 value;
+    // Err is the variant with this discriminant value, or, for niche
+    // encoded results, every value other than Ok's.
+    u32 err_is_value;
+    u32 padding;
+};
+
+struct function_span_t {
+    u64 start_time;
+    u64 end_time;
+    u64 function_id;
+    // Async functions only.
+    u64 polls;
+    u64 busy_ns;
+    u64 max_poll_ns;
+    // SPAN_ERROR_* of this call.
+    u32 errors;
+    u32 padding;
+    struct span_context sc;
+    struct span_context psc;
+    // Synchronous functions only.
+    struct captured_value captures[MAX_CAPTURES];
+};
+
+struct function_call_t {
+    u64 start;
+    void* result_ptr;
+    struct captured_value captures[MAX_CAPTURES];
+};
+
+struct function_call_key {
+    u64 pid_tgid;
+    u64 function_id;
+};
+
+struct rate_window_t {
+    u64 start;
+    u64 calls;
+};
+
+struct async_poll_t {
+    void* future;
+    u64 start;
+};
+
+// Calls in progress. A recursive call replaces its caller's entry, so only
+// the innermost level of a recursion is timed.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct function_call_key);
+    __type(value, struct function_call_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} function_calls SEC(".maps");
+
+// Arguments to capture, by function ID. Filled in by the agent.
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, u32);
+    __type(value, struct function_captures_t);
+    __uint(max_entries, MAX_TRACED_FUNCTIONS);
+} function_captures SEC(".maps");
+
+// Results checked for Err on return, by function ID. Filled in by the
+// agent for the functions selected for error tracking.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u32);
+    __type(value, struct result_recipe);
+    __uint(max_entries, MAX_TRACED_FUNCTIONS);
+} function_results SEC(".maps");
+
+// Calls and spans carry their captures and do not fit on the BPF stack.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct function_call_t);
+    __uint(max_entries, 1);
+} function_call_scratch SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct function_span_t);
+    __uint(max_entries, 1);
+} function_span_scratch SEC(".maps");
+
+// Spans of traced async fn futures, keyed by the pinned future's address,
+// which is stable from the first poll until it completes. Futures dropped
+// before completing are evicted by the LRU.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct function_span_t);
+    __uint(max_entries, MAX_ASYNC_FUTURES);
+} async_function_spans SEC(".maps");
+
+// Polls in progress. An async fn polls the futures it awaits, so polls
+// nest on a thread and are keyed by function as well.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, struct function_call_key);
+    __type(value, struct async_poll_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} async_function_polls SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct rate_window_t);
+    __uint(max_entries, MAX_TRACED_FUNCTIONS);
+} function_rates SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} function_events SEC(".maps");
+
+static __always_inline int take_call_budget(u32 function_id, u64 now) {
+    struct rate_window_t* window = bpf_map_lookup_elem(&function_rates, &function_id);
+    if (!window) {
+        return 0;
+    }
+    if (now - window->start > RATE_WINDOW_NS) {
+        window->start = now;
+        window->calls = 0;
+    }
+    if (max_calls_per_sec && window->calls >= max_calls_per_sec) {
+        return 0;
+    }
+    window->calls++;
+    return 1;
+}
+
+static __always_inline void capture_value(struct pt_regs *ctx, struct capture_recipe* recipe,
+                                          struct captured_value* out) {
+    switch (recipe->kind) {
+        case CAPTURE_REGISTER:
+            out->value = (u64)get_register(ctx, recipe->loc.reg);
+            return;
+        case CAPTURE_REGISTER_LEN:
+            out->value = (u64)get_register(ctx, recipe->len_offset);
+            return;
+        case CAPTURE_REGISTER_STR:
+            out->value = (u64)get_register(ctx, recipe->len_offset);
+            read_capture_str(get_register(ctx, recipe->ptr_offset), out);
+            return;
+    }
+
+    void* addr = get_argument_at(ctx, &recipe->loc, 0);
+    if (addr) {
+        read_capture(addr, recipe, out);
+    }
+}
+
+static __always_inline int returned_err(struct pt_regs *ctx, struct result_recipe* recipe,
+                                        void* result_ptr) {
+    u64 discriminant = 0;
+    u32 size = recipe->size;
+    if (size == 0 || size > sizeof(discriminant)) {
+        return 0;
+    }
+    if (recipe->location == RESULT_IN_REGISTER) {
+        discriminant = (u64)get_register(ctx, recipe->reg) >> (recipe->offset * 8);
+    } else if (recipe->location == RESULT_IN_MEMORY && result_ptr) {
+        if (bpf_probe_read(&discriminant, size, result_ptr + recipe->offset)) {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+    if (size < sizeof(discriminant)) {
+        discriminant &= (1ULL << (size * 8)) - 1;
+    }
+    return recipe->err_is_value ? discriminant == recipe->value : discriminant != recipe->value;
+}
+
+SEC("uprobe/function_entry")
+int uprobe_function_entry(struct pt_regs *ctx) {
+    u64 now = bpf_ktime_get_ns();
+    struct function_call_key key = {};
+    key.pid_tgid = bpf_get_current_pid_tgid();
+    key.function_id = bpf_get_attach_cookie(ctx);
+
+    if (!take_call_budget((u32)key.function_id, now)) {
+        return 0;
+    }
+
+    u32 zero = 0;
+    struct function_call_t* call = bpf_map_lookup_elem(&function_call_scratch, &zero);
+    if (!call) {
+        return 0;
+    }
+    __builtin_memset(call, 0, sizeof(*call));
+    call->start = now;
+
+    // Arguments are only where DWARF says at entry, so they are captured
+    // here rather than when the call is reported.
+    u32 function_id = key.function_id;
+    struct function_captures_t* captures = bpf_map_lookup_elem(&function_captures, &function_id);
+    if (captures) {
+        for (u32 i = 0; i < MAX_CAPTURES; i++) {
+            if (i >= captures->count) {
+                break;
+            }
+            capture_value(ctx, &captures->recipes[i], &call->captures[i]);
+        }
+    }
+
+    struct result_recipe* result = bpf_map_lookup_elem(&function_results, &function_id);
+    if (result && result->location == RESULT_IN_MEMORY) {
+        call->result_ptr = get_register(ctx, result->reg);
+    }
+
+    bpf_map_update_elem(&function_calls, &key, call, 0);
+
+    return 0;
+}
+
+SEC("uprobe/function_return")
+int uprobe_function_return(struct pt_regs *ctx) {
+    struct function_call_key key = {};
+    key.pid_tgid = bpf_get_current_pid_tgid();
+    key.function_id = bpf_get_attach_cookie(ctx);
+
+    struct function_call_t* call = bpf_map_lookup_elem(&function_calls, &key);
+    if (!call) {
+        return 0;
+    }
+
+    u64 end_time = bpf_ktime_get_ns();
+    u32 function_id = key.function_id;
+    struct result_recipe* result = bpf_map_lookup_elem(&function_results, &function_id);
+    u32 errors = result && returned_err(ctx, result, call->result_ptr) ? SPAN_ERROR_RESULT : 0;
+
+    // Failed calls are reported however short they were.
+    if (!errors && end_time - call->start < min_duration_ns) {
+        bpf_map_delete_elem(&function_calls, &key);
+        return 0;
+    }
+
+    u32 zero = 0;
+    struct function_span_t* span = bpf_map_lookup_elem(&function_span_scratch, &zero);
+    if (!span) {
+        return 0;
+    }
+    __builtin_memset(span, 0, sizeof(*span));
+    span->start_time = call->start;
+    span->end_time = end_time;
+    span->function_id = key.function_id;
+    span->errors = errors;
+    __builtin_memcpy(span->captures, call->captures, sizeof(span->captures));
+    bpf_map_delete_elem(&function_calls, &key);
+
+    struct span_context* parent = get_current_span_context();
+    if (parent) {
+        span->psc = *parent;
+        span->sc = generate_child_span_context(parent);
+    } else {
+        span->sc = generate_span_context();
+    }
+    if (errors) {
+        mark_trace_error(errors);
+    }
+
+    bpf_perf_event_output(ctx, &function_events, BPF_F_CURRENT_CPU, span, sizeof(*span));
+
+    return 0;
+}
+
+static __always_inline int read_async_state(void* future, u64 cookie, u32* state) {
+    void* state_ptr = future + ASYNC_COOKIE_STATE_POS(cookie);
+    switch (ASYNC_COOKIE_STATE_SIZE(cookie)) {
+        case 1: {
+            u8 value = 0;
+            if (bpf_probe_read(&value, sizeof(value), state_ptr)) {
+                return -1;
+            }
+            *state = value;
+            return 0;
+        }
+        case 2: {
+            u16 value = 0;
+            if (bpf_probe_read(&value, sizeof(value), state_ptr)) {
+                return -1;
+            }
+            *state = value;
+            return 0;
+        }
+        case 4:
+            return bpf_probe_read(state, sizeof(*state), state_ptr) ? -1 : 0;
+        default:
+            return -1;
+    }
+}
+
+// <{async_fn_env} as Future>::poll(self: Pin<&mut Self>, cx)
+SEC("uprobe/async_function_poll")
+int uprobe_async_function_poll(struct pt_regs *ctx) {
+    u64 cookie = bpf_get_attach_cookie(ctx);
+    void* future = get_argument(ctx, ASYNC_COOKIE_SELF_ARG(cookie));
+    if (!future) {
+        return 0;
+    }
+
+    u64 now = bpf_ktime_get_ns();
+    u64 function_id = ASYNC_COOKIE_FUNCTION_ID(cookie);
+    void* task_key = get_task_key();
+
+    // Only a future that was never polled starts a span; one that was
+    // already running when the agent attached, or was not sampled, is left
+    // alone until it completes. A span already recorded at the address of
+    // an unresumed future belongs to one that was dropped before it
+    // returned, and whose memory was reused, so it is discarded.
+    u32 state = 0;
+    if (read_async_state(future, cookie, &state)) {
+        return 0;
+    }
+    struct function_span_t* span = NULL;
+    if (state == ASYNC_STATE_UNRESUMED) {
+        bpf_map_delete_elem(&async_function_spans, &future);
+    } else {
+        span = bpf_map_lookup_elem(&async_function_spans, &future);
+        if (!span) {
+            return 0;
+        }
+    }
+    if (!span) {
+        if (!take_call_budget((u32)function_id, now)) {
+            return 0;
+        }
+
+        u32 zero = 0;
+        struct function_span_t* new_span = bpf_map_lookup_elem(&function_span_scratch, &zero);
+        if (!new_span) {
+            return 0;
+        }
+        __builtin_memset(new_span, 0, sizeof(*new_span));
+        new_span->start_time = now;
+        new_span->function_id = function_id;
+        struct span_context* parent = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+        if (parent) {
+            new_span->psc = *parent;
+            new_span->sc = generate_child_span_context(parent);
+        } else {
+            new_span->sc = generate_span_context();
+        }
+        bpf_map_update_elem(&async_function_spans, &future, new_span, 0);
+        span = bpf_map_lookup_elem(&async_function_spans, &future);
+        if (!span) {
+            return 0;
+        }
+    }
+
+    // While the body runs it is the task's active span, so work it awaits
+    // is parented to the logical call rather than the request.
+    bpf_map_update_elem(&spans_in_progress, &task_key, &span->sc, 0);
+
+    struct function_call_key poll_key = {};
+    poll_key.pid_tgid = bpf_get_current_pid_tgid();
+    poll_key.function_id = function_id;
+    struct async_poll_t poll = {};
+    poll.future = future;
+    poll.start = now;
+    bpf_map_update_elem(&async_function_polls, &poll_key, &poll, 0);
+
+    return 0;
+}
+
+SEC("uprobe/async_function_poll_return")
+int uprobe_async_function_poll_return(struct pt_regs *ctx) {
+    u64 cookie = bpf_get_attach_cookie(ctx);
+    struct function_call_key poll_key = {};
+    poll_key.pid_tgid = bpf_get_current_pid_tgid();
+    poll_key.function_id = ASYNC_COOKIE_FUNCTION_ID(cookie);
+
+    struct async_poll_t* poll = bpf_map_lookup_elem(&async_function_polls, &poll_key);
+    if (!poll) {
+        return 0;
+    }
+    void* future = poll->future;
+    u64 now = bpf_ktime_get_ns();
+    u64 poll_ns = now - poll->start;
+    bpf_map_delete_elem(&async_function_polls, &poll_key);
+
+    struct function_span_t* span = bpf_map_lookup_elem(&async_function_spans, &future);
+    if (!span) {
+        return 0;
+    }
+    span->polls++;
+    span->busy_ns += poll_ns;
+    if (poll_ns > span->max_poll_ns) {
+        span->max_poll_ns = poll_ns;
+    }
+
+    void* task_key = get_task_key();
+    if (span_context_is_valid(&span->psc)) {
+        bpf_map_update_elem(&spans_in_progress, &task_key, &span->psc, 0);
+    } else {
+        bpf_map_delete_elem(&spans_in_progress, &task_key);
+    }
+
+    // The body moves to Returned in the same poll that produces Ready.
+    u32 state = 0;
+    if (read_async_state(future, cookie, &state) || state != ASYNC_STATE_RETURNED) {
+        return 0;
+    }
+
+    span->end_time = now;
+    if (span->end_time - span->start_time >= min_duration_ns) {
+        bpf_perf_event_output(ctx, &function_events, BPF_F_CURRENT_CPU, span, sizeof(*span));
+    }
+    bpf_map_delete_elem(&async_function_spans, &future);
+
+    return 0;
+}
@@ -1,10 +1,15 @@
 #include "arguments.h"
 #include "span_context.h"
 #include "rust_context.h"
+#include "header_map.h"
+#include "http_request.h"
+#include "propagation.h"
+#include "baggage.h"
 
 char __license[] SEC("license") = "Dual MIT/GPL";
 
 #define MAX_CONCURRENT 50
+#define MAX_CONCURRENT_STREAMS 16384
 
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
@@ -17,114 +22,511 @@ struct {
     __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
 } events SEC(".maps");
 
-volatile const u64 method_ptr_pos;
-volatile const u64 uri_ptr_pos;
-volatile const u64 path_ptr_pos;
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} http_client_events SEC(".maps");
 
-SEC("uprobe/hyper_serve_connection")
-int uprobe_hyper_serve_connection(struct pt_regs *ctx) {
-    struct http_request_t httpReq = {};
-    httpReq.start_time = bpf_ktime_get_ns();
+// HTTP/2 multiplexes many streams over one connection, so h2 requests are
+// keyed by the connection's shared stream store and the stream ID.
+struct h2_stream_key {
+    void* conn;
+    u32 stream_id;
+    u32 pad;
+};
 
-    void* self_ptr = get_argument(ctx, 1);
-    if (!self_ptr) {
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct h2_stream_key);
+    __type(value, struct http_request_t);
+    __uint(max_entries, MAX_CONCURRENT_STREAMS);
+} h2_server_streams SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct h2_stream_key);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, MAX_CONCURRENT_STREAMS);
+} h2_client_streams SEC(".maps");
+
+// State carried from the entry to the return probe of the same call.
+struct h2_call_t {
+    void* ret_ptr;
+    struct h2_stream_key key;
+    u64 start_time;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, struct h2_call_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} h2_calls SEC(".maps");
+
+// Client requests between send_request and its return, by thread. They are
+// too large for the BPF stack, so they are built in a per-CPU scratch slot.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} h2_pending_requests SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, 1);
+} h2_request_scratch SEC(".maps");
+
+// Likewise for server requests, built next to header extraction.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct http_request_t);
+    __uint(max_entries, 1);
+} server_request_scratch SEC(".maps");
+
+// The HTTP/1 dispatcher each thread last polled for a response, until the
+// response head is encoded.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, void*);
+    __uint(max_entries, MAX_CONCURRENT);
+} h1_polled_dispatchers SEC(".maps");
+
+// The h2 server connection being polled by each thread.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, void*);
+    __uint(max_entries, MAX_CONCURRENT);
+} h2_current_conn SEC(".maps");
+
+// h2 layout: the stream store Arc inside a server connection, and the
+// OpaqueStreamRef (store Arc plus stream key) held by SendResponse and
+// ResponseFuture.
+volatile const u64 h2_conn_streams_pos;
+volatile const u64 h2_send_response_stream_ref_pos;
+volatile const u64 h2_response_future_stream_ref_pos;
+volatile const u64 h2_stream_ref_inner_pos;
+volatile const u64 h2_stream_ref_stream_id_pos;
+
+// HTTP/1 layout, read by the agent from DWARF: the method, URI and
+// headers of the request head in recv_msg's `msg`, the response head in
+// an Encode, and the status in a response head.
+volatile const u64 recv_msg_method_pos;
+volatile const u64 recv_msg_uri_pos;
+volatile const u64 recv_msg_headers_pos;
+volatile const u64 encode_head_pos;
+volatile const u64 response_head_status_pos;
+
+// Entry locations of recv_msg's `self` and `msg`, poll_msg's `self` and
+// encode's `msg`.
+volatile const struct arg_loc dispatcher_arg_loc;
+volatile const struct arg_loc recv_msg_arg_loc;
+volatile const struct arg_loc poll_msg_arg_loc;
+volatile const struct arg_loc encode_arg_loc;
+
+// Entry locations of the h2 arguments: poll_accept's `self`,
+// convert_poll_message's `stream_id`, send_response's `self` and
+// `response`, send_request's `request` and the client ResponseFuture
+// poll's `self`. Hidden return pointers are not described by DWARF and
+// stay at their ABI position.
+volatile const struct arg_loc poll_accept_arg_loc;
+volatile const struct arg_loc stream_id_arg_loc;
+volatile const struct arg_loc send_response_arg_loc;
+volatile const struct arg_loc response_arg_loc;
+volatile const struct arg_loc send_request_arg_loc;
+volatile const struct arg_loc response_future_arg_loc;
+
+static __always_inline int read_stream_key(void* stream_ref, struct h2_stream_key* key) {
+    bpf_probe_read(&key->conn, sizeof(key->conn), (void*)(stream_ref + h2_stream_ref_inner_pos));
+    bpf_probe_read(&key->stream_id, sizeof(key->stream_id), (void*)(stream_ref + h2_stream_ref_stream_id_pos));
+    return key->conn && key->stream_id ? 0 : -1;
+}
+
+// <hyper::proto::h1::dispatch::Server<S, B> as Dispatch>::recv_msg(&mut self, msg)
+//
+// Hands a parsed request to the service and keeps the future its call
+// returns, which poll_msg then polls until the response is ready. An
+// HTTP/1 connection serves one request at a time, so the request is keyed
+// by its dispatcher, and the polls of the task in between are the
+// request's. The span joins the caller's trace when the request carries a
+// context, and its baggage is captured before anything is keyed by it.
+SEC("uprobe/hyper_h1_recv_msg")
+int uprobe_hyper_h1_recv_msg(struct pt_regs *ctx) {
+    void* dispatcher = get_argument_at(ctx, &dispatcher_arg_loc, 1);
+    void* msg = get_argument_at(ctx, &recv_msg_arg_loc, 2);
+    if (!dispatcher || !msg) {
         return 0;
     }
 
-    httpReq.sc = generate_span_context();
-    bpf_map_update_elem(&context_to_http_events, &self_ptr, &httpReq, 0);
-    bpf_map_update_elem(&spans_in_progress, &self_ptr, &httpReq.sc, 0);
+    u32 zero = 0;
+    struct http_request_t* httpReq = bpf_map_lookup_elem(&server_request_scratch, &zero);
+    if (!httpReq) {
+        return 0;
+    }
+    __builtin_memset(httpReq, 0, sizeof(*httpReq));
+    httpReq->start_time = bpf_ktime_get_ns();
+    read_method((void*)(msg + recv_msg_method_pos), httpReq->method);
+    read_uri_field((void*)(msg + recv_msg_uri_pos), path_ptr_pos, httpReq->path, sizeof(httpReq->path));
+
+    void* headers = (void*)(msg + recv_msg_headers_pos);
+    if (extract_span_context(headers, &httpReq->psc) == 0) {
+        httpReq->sc = generate_child_span_context(&httpReq->psc);
+    } else {
+        __builtin_memset(&httpReq->psc, 0, sizeof(httpReq->psc));
+        httpReq->sc = generate_span_context();
+    }
+    capture_baggage(ctx, headers, &httpReq->sc);
+    httpReq->entry_stack_id = get_entry_stack_id(ctx);
+    bpf_map_update_elem(&context_to_http_events, &dispatcher, httpReq, 0);
+
+    void* task_key = get_task_key();
+    bpf_map_update_elem(&spans_in_progress, &task_key, &httpReq->sc, 0);
+    set_server_span(task_key, &httpReq->sc);
+    bpf_map_delete_elem(&task_routes, &task_key);
+    start_poll_accounting(task_key);
 
     return 0;
 }
 
-SEC("uprobe/hyper_serve_connection_return")
-int uprobe_hyper_serve_connection_return(struct pt_regs *ctx) {
-    void* self_ptr = get_argument_by_stack(ctx, 1);
-    if (!self_ptr) {
+// <hyper::proto::h1::dispatch::Server<S, B> as Dispatch>::poll_msg(self, cx)
+//
+// Polls the service's future. When it is ready, the dispatcher encodes the
+// response head right after, on the same thread.
+SEC("uprobe/hyper_h1_poll_msg")
+int uprobe_hyper_h1_poll_msg(struct pt_regs *ctx) {
+    void* dispatcher = get_argument_at(ctx, &poll_msg_arg_loc, 2);
+    if (!dispatcher || !bpf_map_lookup_elem(&context_to_http_events, &dispatcher)) {
         return 0;
     }
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&h1_polled_dispatchers, &pid_tgid, &dispatcher, 0);
+    return 0;
+}
+
+// <hyper::proto::h1::role::Server as Http1Transaction>::encode(msg, dst)
+//
+// Encodes the head of the response to the request of the dispatcher this
+// thread just polled, which ends its span.
+SEC("uprobe/hyper_h1_encode")
+int uprobe_hyper_h1_encode(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    void** polled = bpf_map_lookup_elem(&h1_polled_dispatchers, &pid_tgid);
+    if (!polled) {
+        return 0;
+    }
+    void* dispatcher = *polled;
+    bpf_map_delete_elem(&h1_polled_dispatchers, &pid_tgid);
 
-    void* httpReq_ptr = bpf_map_lookup_elem(&context_to_http_events, &self_ptr);
+    void* httpReq_ptr = bpf_map_lookup_elem(&context_to_http_events, &dispatcher);
     if (!httpReq_ptr) {
         return 0;
     }
+    u32 zero = 0;
+    struct http_request_t* httpReq = bpf_map_lookup_elem(&server_request_scratch, &zero);
+    if (!httpReq) {
+        return 0;
+    }
+    bpf_probe_read(httpReq, sizeof(*httpReq), httpReq_ptr);
+    httpReq->end_time = bpf_ktime_get_ns();
 
-    struct http_request_t httpReq = {};
-    bpf_probe_read(&httpReq, sizeof(httpReq), httpReq_ptr);
-    httpReq.end_time = bpf_ktime_get_ns();
+    void* msg = get_argument_at(ctx, &encode_arg_loc, 2);
+    void* head = NULL;
+    if (msg && bpf_probe_read(&head, sizeof(head), (void*)(msg + encode_head_pos)) == 0 && head) {
+        bpf_probe_read(&httpReq->status_code, sizeof(httpReq->status_code),
+                       (void*)(head + response_head_status_pos));
+    }
 
-    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, &httpReq, sizeof(httpReq));
-    bpf_map_delete_elem(&context_to_http_events, &self_ptr);
-    bpf_map_delete_elem(&spans_in_progress, &self_ptr);
+    void* task_key = get_task_key();
+    u64* route_id = bpf_map_lookup_elem(&task_routes, &task_key);
+    if (route_id) {
+        httpReq->route_id = *route_id;
+        bpf_map_delete_elem(&task_routes, &task_key);
+    }
+
+    // Route IDs are the hash of the template, so per-route thresholds can
+    // be given for templates as well as for raw paths.
+    u64 route_hash = httpReq->route_id;
+    if (!route_hash) {
+        route_hash = fnv1a_update(FNV_OFFSET_BASIS, httpReq->path, MAX_PATH_SIZE);
+    }
+    capture_slow_request_stacks(ctx, route_hash, httpReq->end_time - httpReq->start_time,
+                                &httpReq->entry_stack_id, &httpReq->return_stack_id);
+
+    finish_poll_accounting(task_key, &httpReq->polls);
+    httpReq->errors = take_trace_errors(&httpReq->sc);
+    httpReq->baggage_id = take_trace_baggage(&httpReq->sc);
+
+    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, httpReq, sizeof(*httpReq));
+    bpf_map_delete_elem(&context_to_http_events, &dispatcher);
+    bpf_map_delete_elem(&spans_in_progress, &task_key);
+    bpf_map_delete_elem(&task_server_spans, &task_key);
+
+    return 0;
+}
+
+// h2::server::Connection<T, B>::poll_accept(&mut self, cx)
+//
+// New streams are decoded while the connection is polled, so remember
+// which connection this thread is polling for convert_poll_message.
+SEC("uprobe/h2_server_poll_accept")
+int uprobe_h2_server_poll_accept(struct pt_regs *ctx) {
+    void* conn_ptr = get_argument_at(ctx, &poll_accept_arg_loc, 2);
+    if (!conn_ptr) {
+        return 0;
+    }
+
+    void* streams = NULL;
+    bpf_probe_read(&streams, sizeof(streams), (void*)(conn_ptr + h2_conn_streams_pos));
+    if (!streams) {
+        return 0;
+    }
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&h2_current_conn, &pid_tgid, &streams, 0);
 
     return 0;
 }
 
-SEC("uprobe/hyper_request_method")
-int uprobe_hyper_request_method(struct pt_regs *ctx) {
-    void* request_ptr = get_argument(ctx, 1);
+SEC("uprobe/h2_server_poll_accept_return")
+int uprobe_h2_server_poll_accept_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_delete_elem(&h2_current_conn, &pid_tgid);
+    return 0;
+}
+
+// <h2::server::Peer as h2::proto::peer::Peer>::convert_poll_message(
+//     pseudo, fields, stream_id) -> Result<Request<()>, Error>
+//
+// Builds the request of a new incoming stream. The result is returned
+// through a hidden pointer in the first argument.
+SEC("uprobe/h2_server_convert_poll_message")
+int uprobe_h2_server_convert_poll_message(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    void** conn = bpf_map_lookup_elem(&h2_current_conn, &pid_tgid);
+    if (!conn) {
+        return 0;
+    }
+
+    struct h2_call_t call = {};
+    call.ret_ptr = get_argument(ctx, 1);
+    call.key.conn = *conn;
+    call.key.stream_id = (u32)(u64)get_argument_at(ctx, &stream_id_arg_loc, 4);
+    call.start_time = bpf_ktime_get_ns();
+    bpf_map_update_elem(&h2_calls, &pid_tgid, &call, 0);
+
+    return 0;
+}
+
+SEC("uprobe/h2_server_convert_poll_message_return")
+int uprobe_h2_server_convert_poll_message_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct h2_call_t* call = bpf_map_lookup_elem(&h2_calls, &pid_tgid);
+    if (!call) {
+        return 0;
+    }
+
+    void* request_ptr = call->ret_ptr;
+    struct h2_stream_key key = call->key;
+    u64 start_time = call->start_time;
+    bpf_map_delete_elem(&h2_calls, &pid_tgid);
     if (!request_ptr) {
         return 0;
     }
 
-    void* method_ptr = NULL;
-    bpf_probe_read(&method_ptr, sizeof(method_ptr), (void*)(request_ptr + method_ptr_pos));
-    if (!method_ptr) {
+    u32 zero = 0;
+    struct http_request_t* httpReq = bpf_map_lookup_elem(&server_request_scratch, &zero);
+    if (!httpReq) {
+        return 0;
+    }
+    __builtin_memset(httpReq, 0, sizeof(*httpReq));
+    httpReq->start_time = start_time;
+
+    read_request_method(request_ptr, httpReq->method);
+    read_uri_part(request_ptr, path_ptr_pos, httpReq->path, sizeof(httpReq->path));
+
+    void* headers = (void*)(request_ptr + request_headers_pos);
+    if (extract_span_context(headers, &httpReq->psc) == 0) {
+        httpReq->sc = generate_child_span_context(&httpReq->psc);
+    } else {
+        __builtin_memset(&httpReq->psc, 0, sizeof(httpReq->psc));
+        httpReq->sc = generate_span_context();
+    }
+    httpReq->entry_stack_id = -1;
+    httpReq->return_stack_id = -1;
+    capture_baggage(ctx, headers, &httpReq->sc);
+    bpf_map_update_elem(&h2_server_streams, &key, httpReq, 0);
+
+    return 0;
+}
+
+// h2::server::SendResponse<B>::send_response(&mut self, response, end_of_stream)
+//
+// Ends the server span of the stream. Streams reset before a response is
+// sent are evicted from the LRU.
+SEC("uprobe/h2_server_send_response")
+int uprobe_h2_server_send_response(struct pt_regs *ctx) {
+    void* self_ptr = get_argument_at(ctx, &send_response_arg_loc, 1);
+    void* response_ptr = get_argument_at(ctx, &response_arg_loc, 2);
+    if (!self_ptr || !response_ptr) {
         return 0;
     }
 
-    void* httpReq_ptr = bpf_map_lookup_elem(&context_to_http_events, &request_ptr);
+    struct h2_stream_key key = {};
+    if (read_stream_key((void*)(self_ptr + h2_send_response_stream_ref_pos), &key) != 0) {
+        return 0;
+    }
+
+    void* httpReq_ptr = bpf_map_lookup_elem(&h2_server_streams, &key);
     if (!httpReq_ptr) {
         return 0;
     }
 
     struct http_request_t httpReq = {};
     bpf_probe_read(&httpReq, sizeof(httpReq), httpReq_ptr);
+    httpReq.end_time = bpf_ktime_get_ns();
+    bpf_probe_read(&httpReq.status_code, sizeof(httpReq.status_code),
+                   (void*)(response_ptr + response_status_pos));
+    httpReq.errors = take_trace_errors(&httpReq.sc);
+    httpReq.baggage_id = take_trace_baggage(&httpReq.sc);
 
-    u64 method_len = 0;
-    bpf_probe_read(&method_len, sizeof(method_len), (void*)(request_ptr + method_ptr_pos + 8));
-    u64 method_size = sizeof(httpReq.method);
-    method_size = method_size < method_len ? method_size : method_len;
-    bpf_probe_read(&httpReq.method, method_size, method_ptr);
-
-    bpf_map_update_elem(&context_to_http_events, &request_ptr, &httpReq, 0);
+    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, &httpReq, sizeof(httpReq));
+    bpf_map_delete_elem(&h2_server_streams, &key);
 
     return 0;
 }
 
-SEC("uprobe/hyper_request_uri")
-int uprobe_hyper_request_uri(struct pt_regs *ctx) {
-    void* request_ptr = get_argument(ctx, 1);
+// h2::client::SendRequest<B>::send_request(&mut self, request, end_of_stream)
+//     -> Result<(ResponseFuture, SendStream<B>), Error>
+//
+// The stream ID is only assigned inside the call, so the client span is
+// keyed once the returned ResponseFuture is available.
+SEC("uprobe/h2_client_send_request")
+int uprobe_h2_client_send_request(struct pt_regs *ctx) {
+    void* request_ptr = get_argument_at(ctx, &send_request_arg_loc, 3);
     if (!request_ptr) {
         return 0;
     }
 
-    void* uri_ptr = NULL;
-    bpf_probe_read(&uri_ptr, sizeof(uri_ptr), (void*)(request_ptr + uri_ptr_pos));
-    if (!uri_ptr) {
+    u32 zero = 0;
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&h2_request_scratch, &zero);
+    if (!clientReq) {
         return 0;
     }
+    __builtin_memset(clientReq, 0, sizeof(*clientReq));
+    clientReq->start_time = bpf_ktime_get_ns();
+    read_request_method(request_ptr, clientReq->method);
+    read_uri_part(request_ptr, authority_ptr_pos, clientReq->host, sizeof(clientReq->host));
+    read_uri_part(request_ptr, path_ptr_pos, clientReq->path, sizeof(clientReq->path));
 
-    void* httpReq_ptr = bpf_map_lookup_elem(&context_to_http_events, &request_ptr);
-    if (!httpReq_ptr) {
+    // A request built by a client above h2, such as tonic or the
+    // application's own SDK, may already carry the caller's context. The
+    // stream's span is its child, so the trace stays connected when the
+    // header is replaced with the stream's context.
+    void* headers = (void*)(request_ptr + request_headers_pos);
+    struct span_context upstream = {};
+    struct span_context* parent = get_current_span_context();
+    if (extract_span_context(headers, &upstream) == 0) {
+        clientReq->psc = upstream;
+        clientReq->sc = generate_child_span_context(&upstream);
+    } else if (parent) {
+        clientReq->psc = *parent;
+        clientReq->sc = generate_child_span_context(parent);
+    } else {
+        clientReq->sc = generate_span_context();
+    }
+
+    inject_span_context(headers, &clientReq->sc);
+    inject_baggage(headers);
+
+    struct h2_call_t call = {};
+    call.ret_ptr = get_argument(ctx, 1);
+    call.start_time = clientReq->start_time;
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&h2_pending_requests, &pid_tgid, clientReq, 0);
+    bpf_map_update_elem(&h2_calls, &pid_tgid, &call, 0);
+
+    return 0;
+}
+
+SEC("uprobe/h2_client_send_request_return")
+int uprobe_h2_client_send_request_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct h2_call_t* call = bpf_map_lookup_elem(&h2_calls, &pid_tgid);
+    if (!call) {
         return 0;
     }
 
-    struct http_request_t httpReq = {};
-    bpf_probe_read(&httpReq, sizeof(httpReq), httpReq_ptr);
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&h2_pending_requests, &pid_tgid);
+    struct h2_stream_key key = {};
+    if (clientReq && call->ret_ptr &&
+        read_stream_key((void*)(call->ret_ptr + h2_response_future_stream_ref_pos), &key) == 0) {
+        bpf_map_update_elem(&h2_client_streams, &key, clientReq, 0);
+    }
+    bpf_map_delete_elem(&h2_pending_requests, &pid_tgid);
+    bpf_map_delete_elem(&h2_calls, &pid_tgid);
 
-    void* path_ptr = NULL;
-    bpf_probe_read(&path_ptr, sizeof(path_ptr), (void*)(uri_ptr + path_ptr_pos));
+    return 0;
+}
 
-    u64 path_len = 0;
-    bpf_probe_read(&path_len, sizeof(path_len), (void*)(uri_ptr + path_ptr_pos + 8));
-    u64 path_size = sizeof(httpReq.path);
-    path_size = path_size < path_len ? path_size : path_len;
-    bpf_probe_read(&httpReq.path, path_size, path_ptr);
+// <h2::client::ResponseFuture as Future>::poll(self: Pin<&mut Self>, cx)
+//     -> Poll<Result<Response<RecvStream>, Error>>
+SEC("uprobe/h2_client_response_poll")
+int uprobe_h2_client_response_poll(struct pt_regs *ctx) {
+    void* self_ptr = get_argument_at(ctx, &response_future_arg_loc, 2);
+    if (!self_ptr) {
+        return 0;
+    }
 
-    bpf_map_update_elem(&context_to_http_events, &request_ptr, &httpReq, 0);
+    struct h2_call_t call = {};
+    call.ret_ptr = get_argument(ctx, 1);
+    if (read_stream_key((void*)(self_ptr + h2_response_future_stream_ref_pos), &call.key) != 0) {
+        return 0;
+    }
+    if (!bpf_map_lookup_elem(&h2_client_streams, &call.key)) {
+        return 0;
+    }
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&h2_calls, &pid_tgid, &call, 0);
 
     return 0;
 }
 
+SEC("uprobe/h2_client_response_poll_return")
+int uprobe_h2_client_response_poll_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct h2_call_t* call = bpf_map_lookup_elem(&h2_calls, &pid_tgid);
+    if (!call) {
+        return 0;
+    }
+
+    void* ret_ptr = call->ret_ptr;
+    struct h2_stream_key key = call->key;
+    bpf_map_delete_elem(&h2_calls, &pid_tgid);
+
+    // Pending streams are polled again; failed ones are evicted.
+    u16 status_code = read_ready_response_status(ret_ptr);
+    if (!status_code) {
+        return 0;
+    }
+
+    void* clientReq_ptr = bpf_map_lookup_elem(&h2_client_streams, &key);
+    if (!clientReq_ptr) {
+        return 0;
+    }
+
+    struct http_client_request_t clientReq = {};
+    bpf_probe_read(&clientReq, sizeof(clientReq), clientReq_ptr);
+    clientReq.end_time = bpf_ktime_get_ns();
+    clientReq.status_code = status_code;
+
+    bpf_perf_event_output(ctx, &http_client_events, BPF_F_CURRENT_CPU, &clientReq, sizeof(clientReq));
+    bpf_map_delete_elem(&h2_client_streams, &key);
+
+    return 0;
+}
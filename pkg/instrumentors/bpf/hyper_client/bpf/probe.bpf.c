@@ -0,0 +1,327 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+#include "header_map.h"
+#include "http_request.h"
+#include "propagation.h"
+#include "baggage.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 50
+
+// A task can await several requests at once, so requests are keyed by the
+// future that carries them rather than by task. Client::request returns a
+// ResponseFuture holding a single boxed `dyn Future` that runs the whole
+// request: pool checkout, connecting and sending all happen while it is
+// polled. The Box's address is stable however the ResponseFuture is moved,
+// so it is the key from Client::request until the future is dropped.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} context_to_http_client_events SEC(".maps");
+
+// The request Client::request is building on a thread, until it returns
+// the future's key.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} new_requests SEC(".maps");
+
+// http_client_request_t does not fit on the BPF stack next to the header
+// injection state, so it is built in a per-CPU scratch slot.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, 1);
+} client_request_scratch SEC(".maps");
+
+// Pool activity of a request before it is sent, keyed like the request. A
+// connect that loses the race against an idle connection finishes on a
+// spawned task and is not charged to the request.
+struct pool_checkout_t {
+    u64 start;
+    u64 connect_start;
+    u64 connect_ns;
+    u8 outcome;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct pool_checkout_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} pool_checkouts SEC(".maps");
+
+// The ResponseFuture a thread is polling: where its Poll is returned, the
+// key of its request and the span the task had active before the poll.
+struct response_poll_t {
+    void* ret_ptr;
+    void* request;
+    struct span_context psc;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, struct response_poll_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} response_polls SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} http_client_events SEC(".maps");
+
+// Entry locations of Client::request's `req` and of ResponseFuture::poll's
+// `self`.
+volatile const struct arg_loc request_arg_loc;
+volatile const struct arg_loc response_future_arg_loc;
+
+// Client<C, B>::request(&self, req: Request<B>) -> ResponseFuture
+SEC("uprobe/hyper_client_request")
+int uprobe_hyper_client_request(struct pt_regs *ctx) {
+    void* request_ptr = get_argument_at(ctx, &request_arg_loc, 2);
+    if (!request_ptr) {
+        return 0;
+    }
+
+    u32 zero = 0;
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&client_request_scratch, &zero);
+    if (!clientReq) {
+        return 0;
+    }
+    __builtin_memset(clientReq, 0, sizeof(*clientReq));
+    clientReq->start_time = bpf_ktime_get_ns();
+
+    read_request_method(request_ptr, clientReq->method);
+    read_uri_part(request_ptr, authority_ptr_pos, clientReq->host, sizeof(clientReq->host));
+    read_uri_part(request_ptr, path_ptr_pos, clientReq->path, sizeof(clientReq->path));
+
+    struct span_context* parent = get_current_span_context();
+    if (parent) {
+        clientReq->psc = *parent;
+        clientReq->sc = generate_child_span_context(parent);
+    } else {
+        clientReq->sc = generate_span_context();
+    }
+
+    inject_span_context((void*)(request_ptr + request_headers_pos), &clientReq->sc);
+    inject_baggage((void*)(request_ptr + request_headers_pos));
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&new_requests, &pid_tgid, clientReq, 0);
+
+    return 0;
+}
+
+// The ResponseFuture is returned in registers; its first word is the Box.
+SEC("uprobe/hyper_client_request_return")
+int uprobe_hyper_client_request_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&new_requests, &pid_tgid);
+    if (!clientReq) {
+        return 0;
+    }
+    void* request = get_return_value(ctx);
+    if (request) {
+        bpf_map_update_elem(&context_to_http_client_events, &request, clientReq, 0);
+    }
+    bpf_map_delete_elem(&new_requests, &pid_tgid);
+    return 0;
+}
+
+// The key of the request whose ResponseFuture this thread is polling.
+static __always_inline void* polled_request() {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct response_poll_t* poll = bpf_map_lookup_elem(&response_polls, &pid_tgid);
+    return poll ? poll->request : NULL;
+}
+
+// Pool<T>::checkout(&self, key) -> Checkout<T>
+SEC("uprobe/hyper_pool_checkout")
+int uprobe_hyper_pool_checkout(struct pt_regs *ctx) {
+    void* request = polled_request();
+    if (!request) {
+        return 0;
+    }
+
+    struct pool_checkout_t checkout = {};
+    checkout.start = bpf_ktime_get_ns();
+    bpf_map_update_elem(&pool_checkouts, &request, &checkout, 0);
+
+    return 0;
+}
+
+// Pool<T>::reuse(&self, key, value) -> Pooled<T>: an idle connection was
+// taken from the pool.
+SEC("uprobe/hyper_pool_reuse")
+int uprobe_hyper_pool_reuse(struct pt_regs *ctx) {
+    void* request = polled_request();
+    struct pool_checkout_t* checkout = bpf_map_lookup_elem(&pool_checkouts, &request);
+    if (!checkout) {
+        return 0;
+    }
+
+    checkout->outcome = POOL_OUTCOME_HIT;
+
+    return 0;
+}
+
+// Pool<T>::connecting(&self, key, ver) -> Option<Connecting<T>>: no idle
+// connection, a new one is being established.
+SEC("uprobe/hyper_pool_connecting")
+int uprobe_hyper_pool_connecting(struct pt_regs *ctx) {
+    void* request = polled_request();
+    struct pool_checkout_t* checkout = bpf_map_lookup_elem(&pool_checkouts, &request);
+    if (!checkout) {
+        return 0;
+    }
+
+    checkout->outcome = POOL_OUTCOME_MISS;
+    checkout->connect_start = bpf_ktime_get_ns();
+
+    return 0;
+}
+
+// Pool<T>::pooled(&self, connecting, value) -> Pooled<T>: the new
+// connection is ready.
+SEC("uprobe/hyper_pool_pooled")
+int uprobe_hyper_pool_pooled(struct pt_regs *ctx) {
+    void* request = polled_request();
+    struct pool_checkout_t* checkout = bpf_map_lookup_elem(&pool_checkouts, &request);
+    if (!checkout || !checkout->connect_start) {
+        return 0;
+    }
+
+    checkout->connect_ns = bpf_ktime_get_ns() - checkout->connect_start;
+
+    return 0;
+}
+
+// PoolClient<B>::send_request_retryable(&mut self, req: Request<B>) in
+// hyper 0.14, PoolClient<B>::try_send_request in hyper-util's legacy client:
+// the request got its connection.
+SEC("uprobe/hyper_client_send_request")
+int uprobe_hyper_client_send_request(struct pt_regs *ctx) {
+    void* request = polled_request();
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&context_to_http_client_events, &request);
+    struct pool_checkout_t* checkout = bpf_map_lookup_elem(&pool_checkouts, &request);
+    if (!clientReq || !checkout) {
+        return 0;
+    }
+
+    clientReq->pool.wait_ns = bpf_ktime_get_ns() - checkout->start;
+    clientReq->pool.connect_ns = checkout->connect_ns;
+    clientReq->pool.outcome = checkout->outcome;
+    bpf_map_delete_elem(&pool_checkouts, &request);
+
+    return 0;
+}
+
+// hyper::error::Error::new(kind), and the HttpConnector's ConnectError::new
+// for hyper-util, which builds its own errors: the request being polled
+// failed, and ends when its ResponseFuture is dropped.
+SEC("uprobe/hyper_client_error_new")
+int uprobe_hyper_client_error_new(struct pt_regs *ctx) {
+    void* request = polled_request();
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&context_to_http_client_events, &request);
+    if (clientReq) {
+        clientReq->error = CLIENT_REQUEST_FAILED;
+    }
+    return 0;
+}
+
+static __always_inline void end_client_request(void* ctx, void* request, struct http_client_request_t* clientReq) {
+    clientReq->end_time = bpf_ktime_get_ns();
+    bpf_perf_event_output(ctx, &http_client_events, BPF_F_CURRENT_CPU, clientReq, sizeof(*clientReq));
+    bpf_map_delete_elem(&context_to_http_client_events, &request);
+    bpf_map_delete_elem(&pool_checkouts, &request);
+}
+
+// <ResponseFuture as Future>::poll(self: Pin<&mut Self>, cx)
+//     -> Poll<Result<Response<Body>, Error>>
+// While it runs, the request's span is the task's active span.
+SEC("uprobe/hyper_client_response_poll")
+int uprobe_hyper_client_response_poll(struct pt_regs *ctx) {
+    void* self_ptr = get_argument_at(ctx, &response_future_arg_loc, 2);
+    struct response_poll_t poll = {};
+    if (!self_ptr || bpf_probe_read(&poll.request, sizeof(poll.request), self_ptr) != 0) {
+        return 0;
+    }
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&context_to_http_client_events, &poll.request);
+    if (!clientReq) {
+        return 0;
+    }
+
+    poll.ret_ptr = get_argument(ctx, 1);
+    void* task_key = get_task_key();
+    struct span_context* active = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+    if (active) {
+        poll.psc = *active;
+    }
+    bpf_map_update_elem(&spans_in_progress, &task_key, &clientReq->sc, 0);
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&response_polls, &pid_tgid, &poll, 0);
+
+    return 0;
+}
+
+SEC("uprobe/hyper_client_response_poll_return")
+int uprobe_hyper_client_response_poll_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct response_poll_t* poll = bpf_map_lookup_elem(&response_polls, &pid_tgid);
+    if (!poll) {
+        return 0;
+    }
+    void* request = poll->request;
+    u16 status_code = read_ready_response_status(poll->ret_ptr);
+
+    // Hand the task back to the span that was active before the poll.
+    void* task_key = get_task_key();
+    if (span_context_is_valid(&poll->psc)) {
+        bpf_map_update_elem(&spans_in_progress, &task_key, &poll->psc, 0);
+    } else {
+        bpf_map_delete_elem(&spans_in_progress, &task_key);
+    }
+    bpf_map_delete_elem(&response_polls, &pid_tgid);
+
+    // Pending requests are polled again; failed ones end when dropped.
+    if (!status_code) {
+        return 0;
+    }
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&context_to_http_client_events, &request);
+    if (!clientReq) {
+        return 0;
+    }
+    clientReq->status_code = status_code;
+    clientReq->error = 0;
+    end_client_request(ctx, request, clientReq);
+
+    return 0;
+}
+
+// core::ptr::drop_in_place::<ResponseFuture>(self): a request without a
+// response either failed or was given up on by its caller.
+SEC("uprobe/hyper_client_response_drop")
+int uprobe_hyper_client_response_drop(struct pt_regs *ctx) {
+    void* self_ptr = get_argument(ctx, 1);
+    void* request = NULL;
+    if (!self_ptr || bpf_probe_read(&request, sizeof(request), self_ptr) != 0) {
+        return 0;
+    }
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&context_to_http_client_events, &request);
+    if (!clientReq) {
+        return 0;
+    }
+    if (!clientReq->error) {
+        clientReq->error = CLIENT_REQUEST_CANCELLED;
+    }
+    end_client_request(ctx, request, clientReq);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 1024
+#define MAX_SDK_SPANS 10240
+
+// Joins spans created with the OpenTelemetry SDK in the target to the
+// agent's traces. A span the SDK starts as a root while a probed span is
+// active is rewritten in place to be that span's child, and until it ends
+// it is the task's active span, so probed spans below it become its
+// children. The SDK keeps exporting its own spans.
+
+// Layout of opentelemetry_sdk::trace::Span, read by the agent from DWARF:
+// the IDs in its SpanContext and the parent span ID in its SpanData.
+volatile const u64 span_trace_id_pos;
+volatile const u64 span_span_id_pos;
+volatile const u64 span_parent_span_id_pos;
+
+// Register holding the pointer build_with_context returns the Span through.
+volatile const u32 return_pointer_reg;
+
+struct sdk_span_t {
+    struct span_context sc;
+    // The task's active span before this one started.
+    struct span_context prev;
+};
+
+// build_with_context calls in progress, by thread, with the Span's address.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, void*);
+    __uint(max_entries, MAX_CONCURRENT);
+} sdk_build_calls SEC(".maps");
+
+// Spans started while the agent was attached, by the SDK's span ID. Spans
+// the application leaks are evicted by the LRU.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, struct sdk_span_t);
+    __uint(max_entries, MAX_SDK_SPANS);
+} sdk_spans SEC(".maps");
+
+// The SDK keeps IDs as native integers, u128 and u64; span contexts hold
+// them in W3C byte order.
+static __always_inline void reverse_bytes(unsigned char* dst, unsigned char* src, int size) {
+    for (int i = 0; i < TRACE_ID_SIZE; i++) {
+        if (i >= size) {
+            break;
+        }
+        dst[i] = src[size - 1 - i];
+    }
+}
+
+// <opentelemetry_sdk::trace::tracer::SdkTracer as opentelemetry::trace::Tracer>
+//     ::build_with_context(&self, builder: SpanBuilder, parent_cx: &Context) -> Span
+SEC("uprobe/sdk_build_with_context")
+int uprobe_sdk_build_with_context(struct pt_regs *ctx) {
+    void* span = get_register(ctx, return_pointer_reg);
+    if (!span) {
+        return 0;
+    }
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&sdk_build_calls, &pid_tgid, &span, 0);
+    return 0;
+}
+
+SEC("uprobe/sdk_build_with_context_return")
+int uprobe_sdk_build_with_context_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    void** span_ptr = bpf_map_lookup_elem(&sdk_build_calls, &pid_tgid);
+    if (!span_ptr) {
+        return 0;
+    }
+    void* span = *span_ptr;
+    bpf_map_delete_elem(&sdk_build_calls, &pid_tgid);
+
+    unsigned char trace_id[TRACE_ID_SIZE] = {};
+    u64 span_id = 0, parent_span_id = 0;
+    if (bpf_probe_read(trace_id, sizeof(trace_id), span + span_trace_id_pos) ||
+        bpf_probe_read(&span_id, sizeof(span_id), span + span_span_id_pos) || !span_id) {
+        return 0;
+    }
+    bpf_probe_read(&parent_span_id, sizeof(parent_span_id), span + span_parent_span_id_pos);
+
+    struct sdk_span_t sdk_span = {};
+    reverse_bytes(sdk_span.sc.TraceID, trace_id, TRACE_ID_SIZE);
+    reverse_bytes(sdk_span.sc.SpanID, (unsigned char*)&span_id, SPAN_ID_SIZE);
+
+    void* task_key = get_task_key();
+    struct span_context* active = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+    if (active) {
+        sdk_span.prev = *active;
+        // Roots are re-parented; a span with an SDK parent already has the
+        // trace of that parent, which was re-parented when it started.
+        if (!parent_span_id) {
+            unsigned char native_trace_id[TRACE_ID_SIZE];
+            unsigned char native_span_id[SPAN_ID_SIZE];
+            reverse_bytes(native_trace_id, active->TraceID, TRACE_ID_SIZE);
+            reverse_bytes(native_span_id, active->SpanID, SPAN_ID_SIZE);
+            bpf_probe_write_user(span + span_trace_id_pos, native_trace_id, sizeof(native_trace_id));
+            bpf_probe_write_user(span + span_parent_span_id_pos, native_span_id, sizeof(native_span_id));
+            __builtin_memcpy(sdk_span.sc.TraceID, active->TraceID, TRACE_ID_SIZE);
+        }
+    }
+
+    bpf_map_update_elem(&sdk_spans, &span_id, &sdk_span, 0);
+    bpf_map_update_elem(&spans_in_progress, &task_key, &sdk_span.sc, 0);
+    return 0;
+}
+
+// opentelemetry_sdk::trace::span::Span::ensure_ended_and_exported(&mut self, ..),
+// reached from both Span::end_with_timestamp and Drop. Ending twice is a
+// no-op since the span is forgotten the first time.
+SEC("uprobe/sdk_span_end")
+int uprobe_sdk_span_end(struct pt_regs *ctx) {
+    void* span = get_argument(ctx, 1);
+    u64 span_id = 0;
+    if (!span || bpf_probe_read(&span_id, sizeof(span_id), span + span_span_id_pos)) {
+        return 0;
+    }
+    struct sdk_span_t* sdk_span = bpf_map_lookup_elem(&sdk_spans, &span_id);
+    if (!sdk_span) {
+        return 0;
+    }
+
+    // Only hand the task back if nothing else became active meanwhile.
+    void* task_key = get_task_key();
+    struct span_context* active = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+    u64 active_span_id = 0, own_span_id = 0;
+    if (active) {
+        __builtin_memcpy(&active_span_id, active->SpanID, SPAN_ID_SIZE);
+        __builtin_memcpy(&own_span_id, sdk_span->sc.SpanID, SPAN_ID_SIZE);
+    }
+    if (active && active_span_id == own_span_id) {
+        if (span_context_is_valid(&sdk_span->prev)) {
+            bpf_map_update_elem(&spans_in_progress, &task_key, &sdk_span->prev, 0);
+        } else {
+            bpf_map_delete_elem(&spans_in_progress, &task_key);
+        }
+    }
+    bpf_map_delete_elem(&sdk_spans, &span_id);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_PANIC_FILE_SIZE 128
+
+struct panic_event_t {
+    u64 time;
+    s64 stack_id;
+    u32 line;
+    u32 column;
+    char file[MAX_PANIC_FILE_SIZE];
+    struct span_context sc;
+    struct span_context psc;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct panic_event_t);
+    __uint(max_entries, 1);
+} panic_scratch SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} panic_events SEC(".maps");
+
+// Entry location of rust_panic_with_hook's `location`.
+volatile const struct arg_loc location_arg_loc;
+
+// Layout of core::panic::Location: the file name &str and line and column.
+volatile const u64 location_file_pos;
+volatile const u64 location_line_pos;
+volatile const u64 location_col_pos;
+
+// std::panicking::rust_panic_with_hook(payload: &mut dyn PanicPayload,
+//     location: &Location<'_>, can_unwind: bool, force_no_backtrace: bool) -> !
+//
+// Every panic goes through here before the hook runs and unwinding
+// starts, whether it came from panic!, an unwrap or core. The panic is
+// reported as a span under the active span, and the trace is marked so the
+// request that was being served ends up errored even if the panic is
+// caught, as tokio does for spawned tasks.
+SEC("uprobe/rust_panic_with_hook")
+int uprobe_rust_panic_with_hook(struct pt_regs *ctx) {
+    u32 zero = 0;
+    struct panic_event_t* event = bpf_map_lookup_elem(&panic_scratch, &zero);
+    if (!event) {
+        return 0;
+    }
+    __builtin_memset(event, 0, sizeof(*event));
+    event->time = bpf_ktime_get_ns();
+    event->stack_id = get_user_stack_id(ctx);
+
+    // The payload is a trait object and takes the first two registers.
+    void* location = get_argument_at(ctx, &location_arg_loc, 3);
+    if (location) {
+        char* file = NULL;
+        u64 file_len = 0;
+        bpf_probe_read(&file, sizeof(file), (void*)(location + location_file_pos));
+        bpf_probe_read(&file_len, sizeof(file_len), (void*)(location + location_file_pos + 8));
+        u64 file_size = file_len < sizeof(event->file) ? file_len : sizeof(event->file);
+        if (file && file_size > 0) {
+            bpf_probe_read(event->file, file_size, file);
+        }
+        bpf_probe_read(&event->line, sizeof(event->line), (void*)(location + location_line_pos));
+        bpf_probe_read(&event->column, sizeof(event->column), (void*)(location + location_col_pos));
+    }
+
+    struct span_context* parent = get_current_span_context();
+    if (parent) {
+        event->psc = *parent;
+        event->sc = generate_child_span_context(parent);
+    } else {
+        event->sc = generate_span_context();
+    }
+    mark_trace_error(SPAN_ERROR_PANIC);
+
+    bpf_perf_event_output(ctx, &panic_events, BPF_F_CURRENT_CPU, event, sizeof(*event));
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "span_context.h"
+#include "stack_trace.h"
+#include "rust_context.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_TARGET_PIDS 64
+#define MAX_PROFILE_KEYS 65536
+
+// Processes being profiled, filled in by the agent.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u32);
+    __type(value, u8);
+    __uint(max_entries, MAX_TARGET_PIDS);
+} target_pids SEC(".maps");
+
+// Samples are aggregated per stack and route, so the number of keys stays
+// bounded by the code paths rather than growing with every request.
+struct profile_key_t {
+    u32 pid;
+    s32 user_stack_id;
+    // Interned template of the route the sampled task is serving, as set
+    // by a framework router in task_routes, or 0.
+    u64 route_id;
+};
+
+// The span of the last sample of a key is kept as an exemplar.
+struct profile_value_t {
+    u64 count;
+    struct span_context sc;
+};
+
+// Sample counts aggregated in-kernel, drained periodically by the agent.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, struct profile_key_t);
+    __type(value, struct profile_value_t);
+    __uint(max_entries, MAX_PROFILE_KEYS);
+} stack_counts SEC(".maps");
+
+SEC("perf_event")
+int perf_event_profile_cpu(void *ctx) {
+    u32 pid = bpf_get_current_pid_tgid() >> 32;
+    if (!bpf_map_lookup_elem(&target_pids, &pid)) {
+        return 0;
+    }
+
+    struct profile_key_t key = {};
+    key.pid = pid;
+    key.user_stack_id = get_user_stack_id(ctx);
+    if (key.user_stack_id < 0) {
+        return 0;
+    }
+
+    void* task_key = get_task_key();
+    u64* route_id = bpf_map_lookup_elem(&task_routes, &task_key);
+    if (route_id) {
+        key.route_id = *route_id;
+    }
+    struct span_context* current = get_current_span_context();
+
+    struct profile_value_t* value = bpf_map_lookup_elem(&stack_counts, &key);
+    if (value) {
+        __sync_fetch_and_add(&value->count, 1);
+        if (current) {
+            value->sc = *current;
+        }
+        return 0;
+    }
+
+    struct profile_value_t first = {};
+    first.count = 1;
+    if (current) {
+        first.sc = *current;
+    }
+    bpf_map_update_elem(&stack_counts, &key, &first, BPF_NOEXIST);
+
+    return 0;
+}
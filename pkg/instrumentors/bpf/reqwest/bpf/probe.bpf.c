@@ -0,0 +1,361 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+#include "header_map.h"
+#include "propagation.h"
+#include "baggage.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 50
+
+// A task can await several requests at once, so requests are keyed by the
+// future that carries them rather than by task. The Pending future
+// execute_request returns is moved before it is first polled, but the
+// hyper ResponseFuture it wraps boxes its state: execute_request creates
+// it through hyper's Client::request, and the Box's address identifies the
+// request until the Pending is dropped. Redirects replace the hyper future
+// but not the key.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} context_to_http_client_events SEC(".maps");
+
+// The request being built by execute_request on a thread, until hyper
+// returns its future.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} executing_requests SEC(".maps");
+
+// The span the task had active when execute_request started on a thread.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, struct span_context);
+    __uint(max_entries, MAX_CONCURRENT);
+} executing_parents SEC(".maps");
+
+// The key of the request each Pending future carries, learnt the first
+// time the Pending polls its hyper future.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, void*);
+    __uint(max_entries, MAX_CONCURRENT);
+} pending_requests SEC(".maps");
+
+// The Pending future a thread is polling, the key of its request and the
+// span the task had active before the poll.
+struct pending_poll_t {
+    void* pending;
+    void* request;
+    struct span_context psc;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, struct pending_poll_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} pending_polls SEC(".maps");
+
+// http_client_request_t does not fit on the BPF stack next to the header
+// injection state, so it is built in a per-CPU scratch slot.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct http_client_request_t);
+    __uint(max_entries, 1);
+} client_request_scratch SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} http_client_events SEC(".maps");
+
+volatile const u64 method_ptr_pos;
+volatile const u64 url_pos;
+volatile const u64 headers_pos;
+volatile const u64 response_status_pos;
+
+// Entry locations of execute_request's `req`, Response::new's `res`, and
+// the `self` of Pending::poll and of hyper's ResponseFuture::poll.
+volatile const struct arg_loc request_arg_loc;
+volatile const struct arg_loc response_arg_loc;
+volatile const struct arg_loc pending_arg_loc;
+volatile const struct arg_loc response_future_arg_loc;
+
+// Layout of url::Url: its serialization String and the indices into it.
+volatile const u64 url_serialization_ptr_pos;
+volatile const u64 url_serialization_len_pos;
+volatile const u64 url_host_start_pos;
+volatile const u64 url_host_end_pos;
+volatile const u64 url_path_start_pos;
+
+static __always_inline void read_url(void* url_ptr, struct http_client_request_t* req) {
+    char* serialization = NULL;
+    u64 serialization_len = 0;
+    bpf_probe_read(&serialization, sizeof(serialization), (void*)(url_ptr + url_serialization_ptr_pos));
+    bpf_probe_read(&serialization_len, sizeof(serialization_len), (void*)(url_ptr + url_serialization_len_pos));
+    if (!serialization) {
+        return;
+    }
+
+    u32 host_start = 0, host_end = 0, path_start = 0;
+    bpf_probe_read(&host_start, sizeof(host_start), (void*)(url_ptr + url_host_start_pos));
+    bpf_probe_read(&host_end, sizeof(host_end), (void*)(url_ptr + url_host_end_pos));
+    bpf_probe_read(&path_start, sizeof(path_start), (void*)(url_ptr + url_path_start_pos));
+
+    if (host_end > host_start) {
+        u64 host_size = sizeof(req->host);
+        u64 host_len = host_end - host_start;
+        host_size = host_size < host_len ? host_size : host_len;
+        bpf_probe_read(&req->host, host_size, serialization + host_start);
+    }
+
+    if (serialization_len > path_start) {
+        u64 path_size = sizeof(req->path);
+        u64 path_len = serialization_len - path_start;
+        path_size = path_size < path_len ? path_size : path_len;
+        bpf_probe_read(&req->path, path_size, serialization + path_start);
+    }
+}
+
+// reqwest::async_impl::client::Client::execute_request(&self, req: Request)
+SEC("uprobe/reqwest_execute_request")
+int uprobe_reqwest_execute_request(struct pt_regs *ctx) {
+    void* request_ptr = get_argument_at(ctx, &request_arg_loc, 2);
+    if (!request_ptr) {
+        return 0;
+    }
+
+    u32 zero = 0;
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&client_request_scratch, &zero);
+    if (!clientReq) {
+        return 0;
+    }
+    __builtin_memset(clientReq, 0, sizeof(*clientReq));
+    clientReq->start_time = bpf_ktime_get_ns();
+
+    void* method_ptr = NULL;
+    bpf_probe_read(&method_ptr, sizeof(method_ptr), (void*)(request_ptr + method_ptr_pos));
+    if (method_ptr) {
+        u64 method_len = 0;
+        bpf_probe_read(&method_len, sizeof(method_len), (void*)(request_ptr + method_ptr_pos + 8));
+        u64 method_size = sizeof(clientReq->method);
+        method_size = method_size < method_len ? method_size : method_len;
+        bpf_probe_read(&clientReq->method, method_size, method_ptr);
+    }
+
+    read_url((void*)(request_ptr + url_pos), clientReq);
+
+    void* task_key = get_task_key();
+    struct span_context* parent = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+    if (parent) {
+        clientReq->psc = *parent;
+        clientReq->sc = generate_child_span_context(parent);
+    } else {
+        clientReq->sc = generate_span_context();
+    }
+
+    inject_span_context((void*)(request_ptr + headers_pos), &clientReq->sc);
+    inject_baggage((void*)(request_ptr + headers_pos));
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&executing_requests, &pid_tgid, clientReq, 0);
+    bpf_map_update_elem(&executing_parents, &pid_tgid, &clientReq->psc, 0);
+    // hyper's Client::request runs inside execute_request, so its span is
+    // parented to this one.
+    bpf_map_update_elem(&spans_in_progress, &task_key, &clientReq->sc, 0);
+
+    return 0;
+}
+
+// Hands the task back to the span it had active before psc's child.
+static __always_inline void restore_task_span(struct span_context* psc) {
+    void* task_key = get_task_key();
+    if (span_context_is_valid(psc)) {
+        bpf_map_update_elem(&spans_in_progress, &task_key, psc, 0);
+    } else {
+        bpf_map_delete_elem(&spans_in_progress, &task_key);
+    }
+}
+
+static __always_inline void end_client_request(void* ctx, struct http_client_request_t* clientReq, u32 error) {
+    clientReq->end_time = bpf_ktime_get_ns();
+    clientReq->error = error;
+    bpf_perf_event_output(ctx, &http_client_events, BPF_F_CURRENT_CPU, clientReq, sizeof(*clientReq));
+}
+
+// hyper's Client::request returns the ResponseFuture, a single boxed
+// `dyn Future`, in registers.
+SEC("uprobe/reqwest_hyper_request_return")
+int uprobe_reqwest_hyper_request_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&executing_requests, &pid_tgid);
+    void* request = get_return_value(ctx);
+    if (!clientReq || !request) {
+        return 0;
+    }
+    bpf_map_update_elem(&context_to_http_client_events, &request, clientReq, 0);
+    bpf_map_delete_elem(&executing_requests, &pid_tgid);
+    return 0;
+}
+
+SEC("uprobe/reqwest_execute_request_return")
+int uprobe_reqwest_execute_request_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    // A request rejected before it reached hyper, such as one with an
+    // unsupported scheme, returns a Pending that only holds the error.
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&executing_requests, &pid_tgid);
+    if (clientReq) {
+        end_client_request(ctx, clientReq, CLIENT_REQUEST_FAILED);
+        bpf_map_delete_elem(&executing_requests, &pid_tgid);
+    }
+
+    struct span_context* psc = bpf_map_lookup_elem(&executing_parents, &pid_tgid);
+    if (psc) {
+        restore_task_span(psc);
+        bpf_map_delete_elem(&executing_parents, &pid_tgid);
+    }
+    return 0;
+}
+
+// <Pending as Future>::poll(self: Pin<&mut Self>, cx) returns its Poll
+// through a hidden pointer in the first argument. While it runs, the
+// request's span is the task's active span.
+SEC("uprobe/reqwest_pending_poll")
+int uprobe_reqwest_pending_poll(struct pt_regs *ctx) {
+    void* pending = get_argument_at(ctx, &pending_arg_loc, 2);
+    if (!pending) {
+        return 0;
+    }
+
+    struct pending_poll_t poll = {};
+    poll.pending = pending;
+    void* task_key = get_task_key();
+    struct span_context* active = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+    if (active) {
+        poll.psc = *active;
+    }
+
+    void** request = bpf_map_lookup_elem(&pending_requests, &pending);
+    if (request) {
+        poll.request = *request;
+        struct http_client_request_t* clientReq =
+            bpf_map_lookup_elem(&context_to_http_client_events, request);
+        if (clientReq) {
+            bpf_map_update_elem(&spans_in_progress, &task_key, &clientReq->sc, 0);
+        }
+    }
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&pending_polls, &pid_tgid, &poll, 0);
+    return 0;
+}
+
+// <hyper ResponseFuture as Future>::poll(self: Pin<&mut Self>, cx), polled
+// by the Pending: links the Pending to its request on its first poll.
+SEC("uprobe/reqwest_response_future_poll")
+int uprobe_reqwest_response_future_poll(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct pending_poll_t* poll = bpf_map_lookup_elem(&pending_polls, &pid_tgid);
+    if (!poll || poll->request) {
+        return 0;
+    }
+
+    void* response_future = get_argument_at(ctx, &response_future_arg_loc, 2);
+    void* request = NULL;
+    if (!response_future || bpf_probe_read(&request, sizeof(request), response_future) != 0 || !request) {
+        return 0;
+    }
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&context_to_http_client_events, &request);
+    if (!clientReq) {
+        return 0;
+    }
+
+    poll->request = request;
+    bpf_map_update_elem(&pending_requests, &poll->pending, &request, 0);
+    void* task_key = get_task_key();
+    bpf_map_update_elem(&spans_in_progress, &task_key, &clientReq->sc, 0);
+    return 0;
+}
+
+// The request of the Pending this thread is polling, or NULL.
+static __always_inline struct http_client_request_t* polled_request(void** request) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct pending_poll_t* poll = bpf_map_lookup_elem(&pending_polls, &pid_tgid);
+    if (!poll || !poll->request) {
+        return NULL;
+    }
+    *request = poll->request;
+    return bpf_map_lookup_elem(&context_to_http_client_events, request);
+}
+
+SEC("uprobe/reqwest_pending_poll_return")
+int uprobe_reqwest_pending_poll_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct pending_poll_t* poll = bpf_map_lookup_elem(&pending_polls, &pid_tgid);
+    if (!poll) {
+        return 0;
+    }
+    restore_task_span(&poll->psc);
+    bpf_map_delete_elem(&pending_polls, &pid_tgid);
+    return 0;
+}
+
+// reqwest::async_impl::response::Response::new(res: hyper::Response<_>, url, ..)
+// returns the Response through a hidden pointer in the first argument.
+SEC("uprobe/reqwest_response_new")
+int uprobe_reqwest_response_new(struct pt_regs *ctx) {
+    void* request = NULL;
+    struct http_client_request_t* clientReq = polled_request(&request);
+    if (!clientReq) {
+        return 0;
+    }
+
+    void* response_ptr = get_argument_at(ctx, &response_arg_loc, 2);
+    if (response_ptr) {
+        bpf_probe_read(&clientReq->status_code, sizeof(clientReq->status_code),
+                       (void*)(response_ptr + response_status_pos));
+    }
+
+    end_client_request(ctx, clientReq, 0);
+    bpf_map_delete_elem(&context_to_http_client_events, &request);
+
+    return 0;
+}
+
+// reqwest::error::Error::new(kind, source): the request being polled
+// failed, and ends when its Pending is dropped.
+SEC("uprobe/reqwest_error_new")
+int uprobe_reqwest_error_new(struct pt_regs *ctx) {
+    void* request = NULL;
+    struct http_client_request_t* clientReq = polled_request(&request);
+    if (clientReq) {
+        clientReq->error = CLIENT_REQUEST_FAILED;
+    }
+    return 0;
+}
+
+// core::ptr::drop_in_place::<Pending>(self): a request without a response
+// either failed or was given up on by its caller.
+SEC("uprobe/reqwest_pending_drop")
+int uprobe_reqwest_pending_drop(struct pt_regs *ctx) {
+    void* pending = get_argument(ctx, 1);
+    void** request = bpf_map_lookup_elem(&pending_requests, &pending);
+    if (!request) {
+        return 0;
+    }
+    struct http_client_request_t* clientReq = bpf_map_lookup_elem(&context_to_http_client_events, request);
+    if (clientReq) {
+        end_client_request(ctx, clientReq, clientReq->error ? clientReq->error : CLIENT_REQUEST_CANCELLED);
+        bpf_map_delete_elem(&context_to_http_client_events, request);
+    }
+    bpf_map_delete_elem(&pending_requests, &pending);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "db_query.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 1024
+
+// Queries run through sqlx. Every query is wrapped in a QueryLogger, which
+// holds the statement, counts the rows and knows when the query started;
+// its finish() runs when the query is done, so a single probe there
+// reports the whole query. The statement is read at that point and the
+// start time taken from the logger's Instant.
+
+// Layout of sqlx_core::logger::QueryLogger, read by the agent from DWARF:
+// its `sql: &str`, the row counters and the CLOCK_MONOTONIC timespec of
+// its `start: Instant`.
+volatile const u64 sql_ptr_pos;
+volatile const u64 sql_len_pos;
+volatile const u64 rows_returned_pos;
+volatile const u64 rows_affected_pos;
+volatile const u64 start_secs_pos;
+volatile const u64 start_nanos_pos;
+
+// Entry location of QueryLogger::finish's `self`.
+volatile const struct arg_loc logger_arg_loc;
+
+#define ERROR_RESPONSE 'E'
+
+// Tasks that received an ErrorResponse since their last finished query.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, u8);
+    __uint(max_entries, MAX_CONCURRENT);
+} query_errors SEC(".maps");
+
+// sqlx_postgres::message::BackendMessageFormat::try_from_u8(v: u8), named
+// MessageFormat before sqlx 0.8, sees the type byte of every message the
+// server sends.
+SEC("uprobe/sqlx_message_format")
+int uprobe_sqlx_message_format(struct pt_regs *ctx) {
+    // The result is returned through a pointer, so `v` is the second
+    // argument.
+    u8 format = (u64)get_argument(ctx, 2);
+    if (format != ERROR_RESPONSE) {
+        return 0;
+    }
+    void* task_key = get_task_key();
+    u8 error = 1;
+    bpf_map_update_elem(&query_errors, &task_key, &error, 0);
+    return 0;
+}
+
+// sqlx_core::logger::QueryLogger::finish(&self), called when the logger
+// is dropped at the end of the query.
+SEC("uprobe/sqlx_query_finish")
+int uprobe_sqlx_query_finish(struct pt_regs *ctx) {
+    void* logger = get_argument_at(ctx, &logger_arg_loc, 1);
+    if (!logger) {
+        return 0;
+    }
+    void* task_key = get_task_key();
+    u8 error = bpf_map_lookup_elem(&query_errors, &task_key) != NULL;
+    if (error) {
+        bpf_map_delete_elem(&query_errors, &task_key);
+    }
+
+    void* sql = NULL;
+    u64 sql_len = 0;
+    bpf_probe_read(&sql, sizeof(sql), logger + sql_ptr_pos);
+    bpf_probe_read(&sql_len, sizeof(sql_len), logger + sql_len_pos);
+
+    struct db_query_t query = {};
+    if (init_db_query(&query, fingerprint_statement(ctx, sql, sql_len)) != 0) {
+        return 0;
+    }
+
+    u64 start_secs = 0;
+    u32 start_nanos = 0;
+    bpf_probe_read(&start_secs, sizeof(start_secs), logger + start_secs_pos);
+    bpf_probe_read(&start_nanos, sizeof(start_nanos), logger + start_nanos_pos);
+    query.end_time = bpf_ktime_get_ns();
+    query.start_time = start_secs * 1000000000ULL + start_nanos;
+    if (!start_secs || query.start_time > query.end_time) {
+        query.start_time = query.end_time;
+    }
+
+    bpf_probe_read(&query.rows_returned, sizeof(query.rows_returned), logger + rows_returned_pos);
+    bpf_probe_read(&query.rows_affected, sizeof(query.rows_affected), logger + rows_affected_pos);
+    query.error = error;
+    bpf_perf_event_output(ctx, &db_events, BPF_F_CURRENT_CPU, &query, sizeof(query));
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "task_context.h"
+#include "rust_context.h"
+#include "stack_trace.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+struct blocking_event_t {
+    u64 start_time;
+    u64 end_time;
+    u64 task;
+    s64 stack_id;
+    struct span_context sc;
+    struct span_context psc;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} blocking_events SEC(".maps");
+
+// JoinHandle<T> is a single RawTask pointer and is returned in a register.
+volatile const u64 join_handle_raw_pos;
+
+// Polls longer than this are reported as blocking the executor. 0 disables
+// the detector.
+volatile const u64 long_poll_threshold_ns;
+
+// Period of the perf_event sampler that catches long polls while they are
+// still running, set to half the threshold.
+volatile const u64 long_poll_sample_period_ns;
+
+// A user stack taken while a thread was inside the poll that started at
+// poll_start. The blocking frames are only on the stack while the poll
+// runs, so it is taken when the thread blocks in the kernel or is sampled
+// part-way through the poll, never at its return.
+struct poll_stack_t {
+    u64 poll_start;
+    s64 stack_id;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, struct poll_stack_t);
+    __uint(max_entries, MAX_TRACKED_THREADS);
+} poll_stacks SEC(".maps");
+
+// Enables per-request on-CPU accounting through the sched_switch
+// tracepoint. The tracepoint is attached when this is set or the long-poll
+// detector is on.
+volatile const u8 cpu_accounting_enabled;
+
+#define MAX_TARGET_PIDS 64
+
+// Processes being traced, filled in by the agent. sched_switch fires for
+// every thread on the host, so it checks this before anything else.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u32);
+    __type(value, u8);
+    __uint(max_entries, MAX_TARGET_PIDS);
+} target_pids SEC(".maps");
+
+// Layout of the sched:sched_switch tracepoint format.
+struct sched_switch_args {
+    u64 pad;
+    char prev_comm[16];
+    s32 prev_pid;
+    s32 prev_prio;
+    s64 prev_state;
+    char next_comm[16];
+    s32 next_pid;
+    s32 next_prio;
+};
+
+// Records the current thread's user stack for the poll it is running, if
+// that poll has already taken at least min_elapsed. The first stack taken
+// in a poll is kept.
+static __always_inline void capture_poll_stack(void* ctx, u64 min_elapsed) {
+    struct current_task_t* current = lookup_current_task();
+    if (!current) {
+        return;
+    }
+    u64 pid_tgid = current->pid_tgid;
+    u64 poll_start = current->poll_start;
+    if (bpf_ktime_get_ns() - poll_start < min_elapsed) {
+        return;
+    }
+    struct poll_stack_t* stored = bpf_map_lookup_elem(&poll_stacks, &pid_tgid);
+    if (stored && stored->poll_start == poll_start) {
+        return;
+    }
+    struct poll_stack_t stack = {};
+    stack.poll_start = poll_start;
+    stack.stack_id = get_user_stack_id(ctx);
+    bpf_map_update_elem(&poll_stacks, &pid_tgid, &stack, 0);
+}
+
+// The stack recorded during the poll that started at poll_start, or -1.
+static __always_inline s64 take_poll_stack(u64 poll_start) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct poll_stack_t* stored = bpf_map_lookup_elem(&poll_stacks, &pid_tgid);
+    if (!stored) {
+        return -1;
+    }
+    s64 stack_id = stored->poll_start == poll_start ? stored->stack_id : -1;
+    bpf_map_delete_elem(&poll_stacks, &pid_tgid);
+    return stack_id;
+}
+
+SEC("uprobe/tokio_task_poll")
+int uprobe_tokio_task_poll(struct pt_regs *ctx) {
+    void* task_ptr = get_argument(ctx, 1);
+    if (!task_ptr) {
+        return 0;
+    }
+
+    set_current_task(task_ptr);
+
+    if (cpu_accounting_enabled) {
+        u32 tid = (u32)bpf_get_current_pid_tgid();
+        u64 now = bpf_ktime_get_ns();
+        bpf_map_update_elem(&thread_oncpu_since, &tid, &now, BPF_NOEXIST);
+    }
+
+    return 0;
+}
+
+SEC("uprobe/tokio_task_poll_return")
+int uprobe_tokio_task_poll_return(struct pt_regs *ctx) {
+    struct current_task_t* current = lookup_current_task();
+    if (!current) {
+        return 0;
+    }
+
+    u64 end_time = bpf_ktime_get_ns();
+    u64 duration = end_time - current->poll_start;
+    account_poll(current, duration);
+
+    if (long_poll_threshold_ns > 0 && duration > long_poll_threshold_ns) {
+        struct blocking_event_t event = {};
+        event.start_time = current->poll_start;
+        event.end_time = end_time;
+        event.task = (u64)current->task;
+        event.stack_id = take_poll_stack(current->poll_start);
+
+        struct span_context* parent = get_current_span_context();
+        if (parent) {
+            event.psc = *parent;
+            event.sc = generate_child_span_context(parent);
+        } else {
+            event.sc = generate_span_context();
+        }
+
+        bpf_perf_event_output(ctx, &blocking_events, BPF_F_CURRENT_CPU, &event, sizeof(event));
+    }
+
+    clear_current_task();
+
+    return 0;
+}
+
+// Samples every CPU each long_poll_sample_period_ns, so a poll that spins
+// past half the threshold without blocking has its stack taken while its
+// frames are still live.
+SEC("perf_event")
+int perf_event_sample_long_poll(void *ctx) {
+    if (long_poll_threshold_ns > 0) {
+        capture_poll_stack(ctx, long_poll_threshold_ns / 2);
+    }
+    return 0;
+}
+
+// A spawned task inherits the span that was active where it was spawned,
+// and the request the spawning task serves.
+SEC("uprobe/tokio_spawn_return")
+int uprobe_tokio_spawn_return(struct pt_regs *ctx) {
+    struct span_context* parent = get_current_span_context();
+    if (!parent) {
+        return 0;
+    }
+
+    void* task_ptr = NULL;
+    if (join_handle_raw_pos == 0) {
+        task_ptr = get_return_value(ctx);
+    } else {
+        bpf_probe_read(&task_ptr, sizeof(task_ptr), (void*)(get_return_value(ctx) + join_handle_raw_pos));
+    }
+    if (!task_ptr) {
+        return 0;
+    }
+
+    struct span_context sc = *parent;
+    bpf_map_update_elem(&spans_in_progress, &task_ptr, &sc, 0);
+
+    struct server_span_key* server = current_server_span();
+    if (server) {
+        struct server_span_key key = *server;
+        bpf_map_update_elem(&task_server_spans, &task_ptr, &key, 0);
+    }
+
+    return 0;
+}
+
+SEC("uprobe/tokio_task_dealloc")
+int uprobe_tokio_task_dealloc(struct pt_regs *ctx) {
+    void* task_ptr = get_argument(ctx, 1);
+    if (!task_ptr) {
+        return 0;
+    }
+
+    bpf_map_delete_elem(&spans_in_progress, &task_ptr);
+    bpf_map_delete_elem(&task_server_spans, &task_ptr);
+    bpf_map_delete_elem(&task_poll_stats, &task_ptr);
+
+    return 0;
+}
+
+SEC("tracepoint/sched/sched_switch")
+int tracepoint_sched_switch(struct sched_switch_args *args) {
+    u32 prev_tgid = bpf_get_current_pid_tgid() >> 32;
+    int prev_traced = bpf_map_lookup_elem(&target_pids, &prev_tgid) != NULL;
+    // Only on-CPU accounting needs to see the target's threads switched
+    // in, and the format gives no process ID for those.
+    if (!prev_traced && !cpu_accounting_enabled) {
+        return 0;
+    }
+    u64 now = bpf_ktime_get_ns();
+
+    if (prev_traced) {
+        // A poll that sleeps in the kernel, on a lock or blocking I/O, is
+        // caught with the blocking call on its stack.
+        if (long_poll_threshold_ns > 0 && args->prev_state != 0) {
+            capture_poll_stack(args, 0);
+        }
+
+        u32 prev_tid = args->prev_pid;
+        u64* since = bpf_map_lookup_elem(&thread_oncpu_since, &prev_tid);
+        if (since && *since) {
+            pause_poll_accounting(now);
+            *since = 0;
+        }
+        invalidate_cached_task();
+    }
+
+    // Only threads that polled a task while accounting is on are in
+    // thread_oncpu_since.
+    u32 next_tid = args->next_pid;
+    u64* since = bpf_map_lookup_elem(&thread_oncpu_since, &next_tid);
+    if (since) {
+        *since = now;
+    }
+
+    return 0;
+}
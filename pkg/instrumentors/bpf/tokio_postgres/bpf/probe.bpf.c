@@ -0,0 +1,314 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "db_query.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_PREPARED_STATEMENTS 4096
+#define MAX_STATEMENT_NAME_SIZE 32
+#define MAX_COMMAND_TAG_SIZE 32
+#define MAX_PENDING_QUERIES 8
+#define MAX_QUERY_QUEUES 1024
+
+// Queries run through tokio-postgres. A query starts when its messages are
+// encoded, which happens in the task that awaits it, and ends when the
+// server's CommandComplete is parsed for the row count or its
+// ErrorResponse is turned into an error. Statements prepared by name are
+// fingerprinted when they are prepared; executing one looks the
+// fingerprint up by the statement's name.
+
+// Layout of the ArcInner<StatementInner> a Statement points to: the data
+// pointer and length of its `name: String`. Read by the agent from DWARF.
+volatile const u64 statement_name_ptr_pos;
+volatile const u64 statement_name_len_pos;
+// Layout of postgres_protocol's CommandCompleteBody: its `tag: Bytes`.
+volatile const u64 command_tag_ptr_pos;
+volatile const u64 command_tag_len_pos;
+
+// Entry locations of the `client` of the three encode functions, of
+// query::encode's `statement` and of extract_row_affected's `body`.
+volatile const struct arg_loc prepare_client_arg_loc;
+volatile const struct arg_loc query_client_arg_loc;
+volatile const struct arg_loc simple_query_client_arg_loc;
+volatile const struct arg_loc statement_arg_loc;
+volatile const struct arg_loc body_arg_loc;
+// Entry locations of the data pointer and length of prepare::encode's
+// `name` and `query` and of simple_query::encode's `query`, &strs passed in
+// two registers or in memory.
+volatile const struct arg_loc name_ptr_arg_loc;
+volatile const struct arg_loc name_len_arg_loc;
+volatile const struct arg_loc query_ptr_arg_loc;
+volatile const struct arg_loc query_len_arg_loc;
+volatile const struct arg_loc simple_query_ptr_arg_loc;
+volatile const struct arg_loc simple_query_len_arg_loc;
+
+// Fingerprints of prepared statements by the FNV-1a hash of their name.
+// The client names statements `s0`, `s1`, ... from a process-wide counter,
+// so names are unique across connections.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, u64);
+    __uint(max_entries, MAX_PREPARED_STATEMENTS);
+} prepared_statements SEC(".maps");
+
+#define QUERY_EXECUTE 0
+// Answered without a CommandComplete.
+#define QUERY_PREPARE 1
+// Also sent by batch_execute, which never reads the row count.
+#define QUERY_SIMPLE 2
+
+// The queries a task sent on a connection and has not seen answered,
+// oldest first. A connection answers its queries in the order they were
+// sent and hands each response to the task that sent the query, so the
+// next response a task reads belongs to the oldest of its queries on that
+// connection, however many it pipelines.
+struct query_queue_key {
+    void* conn;
+    void* task;
+};
+
+struct query_queue_t {
+    u32 head;
+    u32 len;
+    u8 kinds[MAX_PENDING_QUERIES];
+    struct db_query_t queries[MAX_PENDING_QUERIES];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct query_queue_key);
+    __type(value, struct query_queue_t);
+    __uint(max_entries, MAX_QUERY_QUEUES);
+} query_queues SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct query_queue_t);
+    __uint(max_entries, 1);
+} query_queue_scratch SEC(".maps");
+
+// The connection each task last sent a query on, which the responses it
+// reads next come from.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, void*);
+    __uint(max_entries, MAX_QUERY_QUEUES);
+} task_connections SEC(".maps");
+
+// The current task's queue on conn, created empty if create is set.
+static __always_inline struct query_queue_t* query_queue(void* conn, int create) {
+    void* task_key = get_task_key();
+    struct query_queue_key key = {.conn = conn, .task = task_key};
+    struct query_queue_t* queue = bpf_map_lookup_elem(&query_queues, &key);
+    if (queue || !create) {
+        return queue;
+    }
+    u32 zero = 0;
+    queue = bpf_map_lookup_elem(&query_queue_scratch, &zero);
+    if (!queue) {
+        return NULL;
+    }
+    queue->head = 0;
+    queue->len = 0;
+    bpf_map_update_elem(&query_queues, &key, queue, BPF_NOEXIST);
+    return bpf_map_lookup_elem(&query_queues, &key);
+}
+
+// Queues a query of statement_id the current task sends on conn. The
+// simple queries it sent last are dropped: batch_execute, which runs
+// BEGIN and COMMIT, never reads their row count, and one whose count was
+// read is no longer queued.
+static __always_inline void start_db_query(void* conn, u64 statement_id, u8 kind) {
+    struct db_query_t query = {};
+    if (!conn || init_db_query(&query, statement_id) != 0) {
+        return;
+    }
+    query.start_time = bpf_ktime_get_ns();
+
+    void* task_key = get_task_key();
+    bpf_map_update_elem(&task_connections, &task_key, &conn, 0);
+    struct query_queue_t* queue = query_queue(conn, 1);
+    if (!queue) {
+        return;
+    }
+    for (u32 i = 0; i < MAX_PENDING_QUERIES; i++) {
+        if (!queue->len) {
+            break;
+        }
+        u32 last = (queue->head + queue->len - 1) & (MAX_PENDING_QUERIES - 1);
+        if (queue->kinds[last] != QUERY_SIMPLE) {
+            break;
+        }
+        queue->len--;
+    }
+    // A full queue has lost track of its responses; drop the oldest.
+    if (queue->len >= MAX_PENDING_QUERIES) {
+        queue->head = (queue->head + 1) & (MAX_PENDING_QUERIES - 1);
+        queue->len = MAX_PENDING_QUERIES - 1;
+    }
+    u32 slot = (queue->head + queue->len) & (MAX_PENDING_QUERIES - 1);
+    queue->queries[slot] = query;
+    queue->kinds[slot] = kind;
+    queue->len++;
+}
+
+// Turns the last query the current task sent on conn into the execution
+// of statement_id when it only prepared that statement, so the query
+// covers both. Returns -1 when it did not.
+static __always_inline int execute_prepared_query(void* conn, u64 statement_id) {
+    struct query_queue_t* queue = query_queue(conn, 0);
+    if (!queue || !queue->len) {
+        return -1;
+    }
+    u32 last = (queue->head + queue->len - 1) & (MAX_PENDING_QUERIES - 1);
+    if (queue->kinds[last] != QUERY_PREPARE || queue->queries[last].statement_id != statement_id) {
+        return -1;
+    }
+    queue->kinds[last] = QUERY_EXECUTE;
+    void* task_key = get_task_key();
+    bpf_map_update_elem(&task_connections, &task_key, &conn, 0);
+    return 0;
+}
+
+// Reports the query answered by the response the current task just read
+// as finished now. Prepares ahead of the query a CommandComplete answers
+// were answered without one and are dropped; an error answers the oldest
+// query, whatever it is.
+static __always_inline void end_db_query(void* ctx, u64 rows_affected, u32 error) {
+    void* task_key = get_task_key();
+    void** conn = bpf_map_lookup_elem(&task_connections, &task_key);
+    if (!conn) {
+        return;
+    }
+    struct query_queue_t* queue = query_queue(*conn, 0);
+    if (!queue) {
+        return;
+    }
+    for (u32 i = 0; i < MAX_PENDING_QUERIES; i++) {
+        if (!queue->len) {
+            return;
+        }
+        u32 slot = queue->head & (MAX_PENDING_QUERIES - 1);
+        queue->head = (slot + 1) & (MAX_PENDING_QUERIES - 1);
+        queue->len--;
+        if (queue->kinds[slot] == QUERY_PREPARE && !error) {
+            continue;
+        }
+        struct db_query_t* query = &queue->queries[slot];
+        query->end_time = bpf_ktime_get_ns();
+        query->rows_affected = rows_affected;
+        query->error = error;
+        bpf_perf_event_output(ctx, &db_events, BPF_F_CURRENT_CPU, query, sizeof(*query));
+        return;
+    }
+}
+
+static __always_inline u64 statement_name_hash(void* ptr, u64 len) {
+    char name[MAX_STATEMENT_NAME_SIZE] = {};
+    u64 size = sizeof(name);
+    size = size < len ? size : len;
+    if (!ptr || !size || bpf_probe_read(name, size, ptr) != 0) {
+        return 0;
+    }
+    return fnv1a_update(FNV_OFFSET_BASIS, name, sizeof(name));
+}
+
+// tokio_postgres::prepare::encode(client, name: &str, query: &str, types)
+//     -> Result<Bytes, Error>
+SEC("uprobe/postgres_prepare_encode")
+int uprobe_postgres_prepare_encode(struct pt_regs *ctx) {
+    // The result is returned through a pointer in the first argument.
+    u64 statement_id = fingerprint_statement(ctx, get_argument_at(ctx, &query_ptr_arg_loc, 5),
+                                             (u64)get_argument_at(ctx, &query_len_arg_loc, 6));
+    if (!statement_id) {
+        return 0;
+    }
+    u64 name = statement_name_hash(get_argument_at(ctx, &name_ptr_arg_loc, 3),
+                                   (u64)get_argument_at(ctx, &name_len_arg_loc, 4));
+    if (name) {
+        bpf_map_update_elem(&prepared_statements, &name, &statement_id, 0);
+    }
+    // Preparing is part of the query when it is run from a `&str`, or the
+    // first use of a statement prepared ahead of time.
+    start_db_query(get_argument_at(ctx, &prepare_client_arg_loc, 2), statement_id, QUERY_PREPARE);
+    return 0;
+}
+
+// tokio_postgres::query::encode(client, statement: &Statement, params)
+//     -> Result<Bytes, Error>
+SEC("uprobe/postgres_query_encode")
+int uprobe_postgres_query_encode(struct pt_regs *ctx) {
+    void* statement = get_argument_at(ctx, &statement_arg_loc, 3);
+    void* inner = NULL;
+    if (!statement || bpf_probe_read(&inner, sizeof(inner), statement) != 0 || !inner) {
+        return 0;
+    }
+    void* name_ptr = NULL;
+    u64 name_len = 0;
+    bpf_probe_read(&name_ptr, sizeof(name_ptr), inner + statement_name_ptr_pos);
+    bpf_probe_read(&name_len, sizeof(name_len), inner + statement_name_len_pos);
+    u64 name = statement_name_hash(name_ptr, name_len);
+    u64* statement_id = bpf_map_lookup_elem(&prepared_statements, &name);
+    if (!statement_id) {
+        return 0;
+    }
+
+    // Keep the start of a query whose statement this task just prepared.
+    void* conn = get_argument_at(ctx, &query_client_arg_loc, 2);
+    if (execute_prepared_query(conn, *statement_id) == 0) {
+        return 0;
+    }
+    start_db_query(conn, *statement_id, QUERY_EXECUTE);
+    return 0;
+}
+
+// tokio_postgres::simple_query::encode(client, query: &str) -> Result<Bytes, Error>
+SEC("uprobe/postgres_simple_query_encode")
+int uprobe_postgres_simple_query_encode(struct pt_regs *ctx) {
+    u64 statement_id = fingerprint_statement(ctx, get_argument_at(ctx, &simple_query_ptr_arg_loc, 3),
+                                             (u64)get_argument_at(ctx, &simple_query_len_arg_loc, 4));
+    start_db_query(get_argument_at(ctx, &simple_query_client_arg_loc, 2), statement_id, QUERY_SIMPLE);
+    return 0;
+}
+
+// tokio_postgres::query::extract_row_affected(body: &CommandCompleteBody)
+//     -> Result<u64, Error>
+// The row count is the last word of the command tag, e.g. `INSERT 0 5`.
+SEC("uprobe/postgres_command_complete")
+int uprobe_postgres_command_complete(struct pt_regs *ctx) {
+    void* body = get_argument_at(ctx, &body_arg_loc, 1);
+    void* tag_ptr = NULL;
+    u64 tag_len = 0;
+    bpf_probe_read(&tag_ptr, sizeof(tag_ptr), body + command_tag_ptr_pos);
+    bpf_probe_read(&tag_len, sizeof(tag_len), body + command_tag_len_pos);
+
+    char tag[MAX_COMMAND_TAG_SIZE] = {};
+    u64 size = sizeof(tag);
+    size = size < tag_len ? size : tag_len;
+    u64 rows = 0;
+    if (tag_ptr && size && bpf_probe_read(tag, size, tag_ptr) == 0) {
+        for (u32 i = 0; i < MAX_COMMAND_TAG_SIZE; i++) {
+            if (i >= size) {
+                break;
+            }
+            if (tag[i] >= '0' && tag[i] <= '9') {
+                rows = rows * 10 + (tag[i] - '0');
+            } else {
+                rows = 0;
+            }
+        }
+    }
+    end_db_query(ctx, rows, 0);
+    return 0;
+}
+
+// tokio_postgres::error::DbError::parse(fields) -> io::Result<DbError>,
+// which turns every ErrorResponse the server sends into an error.
+SEC("uprobe/postgres_db_error")
+int uprobe_postgres_db_error(struct pt_regs *ctx) {
+    end_db_query(ctx, 0, 1);
+    return 0;
+}
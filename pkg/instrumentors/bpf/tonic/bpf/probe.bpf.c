@@ -1,6 +1,9 @@
 #include "arguments.h"
 #include "span_context.h"
 #include "rust_context.h"
+#include "header_map.h"
+#include "propagation.h"
+#include "baggage.h"
 
 char __license[] SEC("license") = "Dual MIT/GPL";
 
@@ -13,26 +16,103 @@ struct {
     __uint(max_entries, MAX_CONCURRENT);
 } context_to_grpc_events SEC(".maps");
 
+// Calls are built in a per-CPU scratch slot, leaving the BPF stack to the
+// header lookups.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct grpc_request_t);
+    __uint(max_entries, 1);
+} grpc_request_scratch SEC(".maps");
+
+// Server calls; client calls are reported on grpc_client_events.
 struct {
     __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
 } grpc_events SEC(".maps");
 
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} grpc_client_events SEC(".maps");
+
 volatile const u64 service_ptr_pos;
 volatile const u64 method_ptr_pos;
+volatile const u64 metadata_ptr_pos;
+// The headers and the Bytes of the URI path of the http::Request a server
+// call is given.
+volatile const u64 request_headers_pos;
+volatile const u64 request_path_pos;
+
+// Entry locations of the `self` and `req` of the server calls and of the
+// `self` and `request` of the client calls. Entry locations do not hold at
+// return, so the return probes keep reading `self` from the stack.
+volatile const struct arg_loc server_arg_loc;
+volatile const struct arg_loc server_request_arg_loc;
+volatile const struct arg_loc client_arg_loc;
+volatile const struct arg_loc request_arg_loc;
+
+// Reads the &str or Bytes whose pointer and length are at field into buf.
+static __always_inline void read_str(void* field, char* buf, u64 buf_size) {
+    void* ptr = NULL;
+    bpf_probe_read(&ptr, sizeof(ptr), field);
+    if (!ptr) {
+        return;
+    }
+    u64 len = 0;
+    bpf_probe_read(&len, sizeof(len), (void*)(field + 8));
+    u64 size = buf_size < len ? buf_size : len;
+    bpf_probe_read(buf, size, ptr);
+}
+
+// Hash of the gRPC path, "/<service>/<method>". Server calls keep the
+// whole path, as read from the request's URI, in service.
+static __always_inline u64 grpc_route_hash(struct grpc_request_t* req) {
+    if (!req->method[0]) {
+        return fnv1a_update(FNV_OFFSET_BASIS, req->service, MAX_PATH_SIZE);
+    }
+    u64 hash = fnv1a_update(FNV_OFFSET_BASIS, "/", 1);
+    hash = fnv1a_update(hash, req->service, MAX_PATH_SIZE);
+    hash = fnv1a_update(hash, "/", 1);
+    return fnv1a_update(hash, req->method, MAX_METHOD_SIZE);
+}
 
 SEC("uprobe/tonic_server_serve")
 int uprobe_tonic_server_serve(struct pt_regs *ctx) {
-    struct grpc_request_t grpcReq = {};
-    grpcReq.start_time = bpf_ktime_get_ns();
-
-    void* self_ptr = get_argument(ctx, 1);
+    void* self_ptr = get_argument_at(ctx, &server_arg_loc, 1);
     if (!self_ptr) {
         return 0;
     }
 
-    grpcReq.sc = generate_span_context();
-    bpf_map_update_elem(&context_to_grpc_events, &self_ptr, &grpcReq, 0);
-    bpf_map_update_elem(&spans_in_progress, &self_ptr, &grpcReq.sc, 0);
+    u32 zero = 0;
+    struct grpc_request_t* grpcReq = bpf_map_lookup_elem(&grpc_request_scratch, &zero);
+    if (!grpcReq) {
+        return 0;
+    }
+    __builtin_memset(grpcReq, 0, sizeof(*grpcReq));
+    grpcReq->start_time = bpf_ktime_get_ns();
+
+    // The call joins the caller's trace when its request carries a context.
+    void* request_ptr = get_argument_at(ctx, &server_request_arg_loc, 3);
+    if (request_ptr) {
+        read_str((void*)(request_ptr + request_path_pos), grpcReq->service, sizeof(grpcReq->service));
+    }
+    void* headers = request_ptr ? (void*)(request_ptr + request_headers_pos) : NULL;
+    if (headers && extract_span_context(headers, &grpcReq->psc) == 0) {
+        grpcReq->sc = generate_child_span_context(&grpcReq->psc);
+    } else {
+        __builtin_memset(&grpcReq->psc, 0, sizeof(grpcReq->psc));
+        grpcReq->sc = generate_span_context();
+    }
+    if (headers) {
+        capture_baggage(ctx, headers, &grpcReq->sc);
+    }
+    grpcReq->entry_stack_id = get_entry_stack_id(ctx);
+    bpf_map_update_elem(&context_to_grpc_events, &self_ptr, grpcReq, 0);
+    bpf_map_update_elem(&spans_in_progress, &self_ptr, &grpcReq->sc, 0);
+
+    void* task_key = get_task_key();
+    bpf_map_update_elem(&spans_in_progress, &task_key, &grpcReq->sc, 0);
+    set_server_span(task_key, &grpcReq->sc);
+    start_poll_accounting(task_key);
 
     return 0;
 }
@@ -53,46 +133,58 @@ int uprobe_tonic_server_serve_return(struct pt_regs *ctx) {
     bpf_probe_read(&grpcReq, sizeof(grpcReq), grpcReq_ptr);
     grpcReq.end_time = bpf_ktime_get_ns();
 
+    capture_slow_request_stacks(ctx, grpc_route_hash(&grpcReq), grpcReq.end_time - grpcReq.start_time,
+                                &grpcReq.entry_stack_id, &grpcReq.return_stack_id);
+
+    void* task_key = get_task_key();
+    finish_poll_accounting(task_key, &grpcReq.polls);
+    grpcReq.errors = take_trace_errors(&grpcReq.sc);
+    grpcReq.baggage_id = take_trace_baggage(&grpcReq.sc);
+
     bpf_perf_event_output(ctx, &grpc_events, BPF_F_CURRENT_CPU, &grpcReq, sizeof(grpcReq));
     bpf_map_delete_elem(&context_to_grpc_events, &self_ptr);
     bpf_map_delete_elem(&spans_in_progress, &self_ptr);
+    bpf_map_delete_elem(&spans_in_progress, &task_key);
+    bpf_map_delete_elem(&task_server_spans, &task_key);
 
     return 0;
 }
 
 SEC("uprobe/tonic_client_call")
 int uprobe_tonic_client_call(struct pt_regs *ctx) {
-    struct grpc_request_t grpcReq = {};
-    grpcReq.start_time = bpf_ktime_get_ns();
-
-    void* self_ptr = get_argument(ctx, 1);
+    void* self_ptr = get_argument_at(ctx, &client_arg_loc, 1);
     if (!self_ptr) {
         return 0;
     }
 
-    void* service_ptr = NULL;
-    bpf_probe_read(&service_ptr, sizeof(service_ptr), (void*)(self_ptr + service_ptr_pos));
-    if (service_ptr) {
-        u64 service_len = 0;
-        bpf_probe_read(&service_len, sizeof(service_len), (void*)(self_ptr + service_ptr_pos + 8));
-        u64 service_size = sizeof(grpcReq.service);
-        service_size = service_size < service_len ? service_size : service_len;
-        bpf_probe_read(&grpcReq.service, service_size, service_ptr);
+    u32 zero = 0;
+    struct grpc_request_t* grpcReq = bpf_map_lookup_elem(&grpc_request_scratch, &zero);
+    if (!grpcReq) {
+        return 0;
     }
+    __builtin_memset(grpcReq, 0, sizeof(*grpcReq));
+    grpcReq->start_time = bpf_ktime_get_ns();
+
+    read_str((void*)(self_ptr + service_ptr_pos), grpcReq->service, sizeof(grpcReq->service));
+    read_str((void*)(self_ptr + method_ptr_pos), grpcReq->method, sizeof(grpcReq->method));
+
+    struct span_context* parent = get_current_span_context();
+    if (parent) {
+        grpcReq->psc = *parent;
+        grpcReq->sc = generate_child_span_context(parent);
+    } else {
+        grpcReq->sc = generate_span_context();
+    }
+    grpcReq->entry_stack_id = get_entry_stack_id(ctx);
 
-    void* method_ptr = NULL;
-    bpf_probe_read(&method_ptr, sizeof(method_ptr), (void*)(self_ptr + method_ptr_pos));
-    if (method_ptr) {
-        u64 method_len = 0;
-        bpf_probe_read(&method_len, sizeof(method_len), (void*)(self_ptr + method_ptr_pos + 8));
-        u64 method_size = sizeof(grpcReq.method);
-        method_size = method_size < method_len ? method_size : method_len;
-        bpf_probe_read(&grpcReq.method, method_size, method_ptr);
+    void* request_ptr = get_argument_at(ctx, &request_arg_loc, 2);
+    if (request_ptr) {
+        inject_span_context((void*)(request_ptr + metadata_ptr_pos), &grpcReq->sc);
+        inject_baggage((void*)(request_ptr + metadata_ptr_pos));
     }
 
-    grpcReq.sc = generate_span_context();
-    bpf_map_update_elem(&context_to_grpc_events, &self_ptr, &grpcReq, 0);
-    bpf_map_update_elem(&spans_in_progress, &self_ptr, &grpcReq.sc, 0);
+    bpf_map_update_elem(&context_to_grpc_events, &self_ptr, grpcReq, 0);
+    bpf_map_update_elem(&spans_in_progress, &self_ptr, &grpcReq->sc, 0);
 
     return 0;
 }
@@ -113,7 +205,11 @@ int uprobe_tonic_client_call_return(struct pt_regs *ctx) {
     bpf_probe_read(&grpcReq, sizeof(grpcReq), grpcReq_ptr);
     grpcReq.end_time = bpf_ktime_get_ns();
 
-    bpf_perf_event_output(ctx, &grpc_events, BPF_F_CURRENT_CPU, &grpcReq, sizeof(grpcReq));
+    capture_slow_request_stacks(ctx, grpc_route_hash(&grpcReq), grpcReq.end_time - grpcReq.start_time,
+                                &grpcReq.entry_stack_id, &grpcReq.return_stack_id);
+    grpcReq.errors = take_trace_errors(&grpcReq.sc);
+
+    bpf_perf_event_output(ctx, &grpc_client_events, BPF_F_CURRENT_CPU, &grpcReq, sizeof(grpcReq));
     bpf_map_delete_elem(&context_to_grpc_events, &self_ptr);
     bpf_map_delete_elem(&spans_in_progress, &self_ptr);
 
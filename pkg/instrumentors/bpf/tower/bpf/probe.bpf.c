@@ -0,0 +1,201 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 50
+#define MAX_LAYER_FUTURES 10240
+
+// One program serves every monomorphised Service::call, Future::poll and
+// drop_in_place of the enabled layers. The agent attaches it once per
+// symbol with the layer's ID as the BPF cookie. While a layer's future is
+// polled its span is the task's active span, so the layers it polls in
+// turn, and any spans started below them, nest under it.
+
+// Entry locations of the response future's `self` in poll and of the
+// pointer drop_in_place is given.
+volatile const struct arg_loc future_arg_loc;
+volatile const struct arg_loc drop_arg_loc;
+
+struct layer_span_t {
+    u64 start_time;
+    u64 end_time;
+    u64 layer_id;
+    u64 polls;
+    u64 busy_ns;
+    struct span_context sc;
+    struct span_context psc;
+};
+
+struct layer_task_key {
+    void* task;
+    u64 layer_id;
+};
+
+struct layer_thread_key {
+    u64 pid_tgid;
+    u64 layer_id;
+};
+
+// A poll in progress and the span the task had active before it.
+struct layer_poll_t {
+    void* future;
+    u64 start;
+    struct span_context psc;
+};
+
+// When each layer's Service::call last ran on a task. The span starts
+// there, before the response future exists.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct layer_task_key);
+    __type(value, u64);
+    __uint(max_entries, MAX_CONCURRENT);
+} layer_calls SEC(".maps");
+
+// Spans of live layer response futures, keyed by the pinned future's
+// address, which is stable from the first poll until it is dropped.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, void*);
+    __type(value, struct layer_span_t);
+    __uint(max_entries, MAX_LAYER_FUTURES);
+} layer_spans SEC(".maps");
+
+// Polls in progress. Layers poll the layer below them, so polls nest on a
+// thread and are keyed by layer as well.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, struct layer_thread_key);
+    __type(value, struct layer_poll_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} layer_polls SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} layer_events SEC(".maps");
+
+// <Layer<S> as tower_service::Service<R>>::call(&mut self, req)
+SEC("uprobe/tower_service_call")
+int uprobe_tower_service_call(struct pt_regs *ctx) {
+    struct layer_task_key key = {};
+    key.task = get_task_key();
+    key.layer_id = bpf_get_attach_cookie(ctx);
+
+    u64 now = bpf_ktime_get_ns();
+    bpf_map_update_elem(&layer_calls, &key, &now, 0);
+
+    return 0;
+}
+
+// <LayerFuture<F> as Future>::poll(self: Pin<&mut Self>, cx)
+SEC("uprobe/tower_future_poll")
+int uprobe_tower_future_poll(struct pt_regs *ctx) {
+    // Layer futures resolve to Result<Response, _>, which is returned
+    // through a hidden pointer, so self defaults to the second argument.
+    void* future = get_argument_at(ctx, &future_arg_loc, 2);
+    if (!future) {
+        return 0;
+    }
+
+    u64 layer_id = bpf_get_attach_cookie(ctx);
+    u64 now = bpf_ktime_get_ns();
+
+    struct layer_span_t* span_ptr = bpf_map_lookup_elem(&layer_spans, &future);
+    if (!span_ptr) {
+        struct layer_span_t span = {};
+        span.start_time = now;
+        span.layer_id = layer_id;
+
+        struct layer_task_key call_key = {};
+        call_key.task = get_task_key();
+        call_key.layer_id = layer_id;
+        u64* call_time = bpf_map_lookup_elem(&layer_calls, &call_key);
+        if (call_time) {
+            span.start_time = *call_time;
+            bpf_map_delete_elem(&layer_calls, &call_key);
+        }
+
+        struct span_context* parent = get_current_span_context();
+        if (parent) {
+            span.psc = *parent;
+            span.sc = generate_child_span_context(parent);
+        } else {
+            span.sc = generate_span_context();
+        }
+        bpf_map_update_elem(&layer_spans, &future, &span, BPF_NOEXIST);
+        span_ptr = bpf_map_lookup_elem(&layer_spans, &future);
+        if (!span_ptr) {
+            return 0;
+        }
+    }
+
+    struct layer_thread_key poll_key = {};
+    poll_key.pid_tgid = bpf_get_current_pid_tgid();
+    poll_key.layer_id = layer_id;
+    struct layer_poll_t poll = {};
+    poll.future = future;
+    poll.start = now;
+    void* task_key = get_task_key();
+    struct span_context* active = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+    if (active) {
+        poll.psc = *active;
+    }
+    bpf_map_update_elem(&layer_polls, &poll_key, &poll, 0);
+    bpf_map_update_elem(&spans_in_progress, &task_key, &span_ptr->sc, 0);
+
+    return 0;
+}
+
+SEC("uprobe/tower_future_poll_return")
+int uprobe_tower_future_poll_return(struct pt_regs *ctx) {
+    struct layer_thread_key poll_key = {};
+    poll_key.pid_tgid = bpf_get_current_pid_tgid();
+    poll_key.layer_id = bpf_get_attach_cookie(ctx);
+
+    struct layer_poll_t* poll = bpf_map_lookup_elem(&layer_polls, &poll_key);
+    if (!poll) {
+        return 0;
+    }
+
+    struct layer_span_t* span = bpf_map_lookup_elem(&layer_spans, &poll->future);
+    if (span) {
+        span->polls++;
+        span->busy_ns += bpf_ktime_get_ns() - poll->start;
+    }
+
+    // Hand the task back to the span that was active before the poll.
+    void* task_key = get_task_key();
+    if (span_context_is_valid(&poll->psc)) {
+        bpf_map_update_elem(&spans_in_progress, &task_key, &poll->psc, 0);
+    } else {
+        bpf_map_delete_elem(&spans_in_progress, &task_key);
+    }
+    bpf_map_delete_elem(&layer_polls, &poll_key);
+
+    return 0;
+}
+
+// core::ptr::drop_in_place::<LayerFuture<F>>(*mut LayerFuture<F>)
+//
+// A response future is dropped once it completed or was cancelled, which
+// ends the layer's span either way.
+SEC("uprobe/tower_future_drop")
+int uprobe_tower_future_drop(struct pt_regs *ctx) {
+    void* future = get_argument_at(ctx, &drop_arg_loc, 1);
+    if (!future) {
+        return 0;
+    }
+
+    struct layer_span_t* span = bpf_map_lookup_elem(&layer_spans, &future);
+    if (!span) {
+        return 0;
+    }
+
+    span->end_time = bpf_ktime_get_ns();
+    bpf_perf_event_output(ctx, &layer_events, BPF_F_CURRENT_CPU, span, sizeof(*span));
+    bpf_map_delete_elem(&layer_spans, &future);
+
+    return 0;
+}
@@ -0,0 +1,337 @@
+#include "arguments.h"
+#include "span_context.h"
+#include "rust_context.h"
+#include "string_intern.h"
+#include "captures.h"
+
+char __license[] SEC("license") = "Dual MIT/GPL";
+
+#define MAX_CONCURRENT 1024
+#define MAX_TRACING_SPANS 10240
+#define MAX_TRACING_FIELDS 8
+#define MAX_VALUE_TYPES 1024
+
+// Spans of the `tracing` crate, bridged into the agent's traces. A span is
+// recorded when the dispatcher hands it to the subscriber, becomes the
+// task's active span while it is entered, so auto-instrumented spans below
+// it are its children, and is reported when the subscriber closes it.
+// Spans only reach the dispatcher when a subscriber enables them.
+
+// Layout of tracing_core::Metadata.
+volatile const u64 metadata_level_pos;
+volatile const u64 metadata_name_pos;
+volatile const u64 metadata_target_pos;
+// Layout of tracing_core::span::Attributes and tracing_core::field::ValueSet.
+volatile const u64 attributes_values_pos;
+volatile const u64 value_set_values_pos;
+// Layout of tracing_core::field::Field: its FieldSet's names and its index.
+volatile const u64 field_names_pos;
+volatile const u64 field_index_pos;
+// Position of the span::Id in a tracing::Span.
+volatile const u64 span_id_pos;
+
+// Entry locations of Span::make_with's `meta` and `new_span`, and the
+// register holding the pointer the Span is returned through.
+volatile const struct arg_loc meta_arg_loc;
+volatile const struct arg_loc attributes_arg_loc;
+volatile const u32 return_pointer_reg;
+
+// An element of ValueSet's `&[(&Field, Option<&dyn Value>)]`.
+struct value_entry {
+    void* field;
+    void* data;
+    void* vtable;
+};
+
+struct tracing_field_t {
+    // Interned field name.
+    u64 name_id;
+    // Identifies the value's type to the agent.
+    u64 vtable;
+    struct captured_value value;
+};
+
+struct tracing_span_t {
+    u64 start_time;
+    u64 end_time;
+    // Interned span name and target.
+    u64 name_id;
+    u64 target_id;
+    // Time spent entered, e.g. polling an instrumented future.
+    u64 busy_ns;
+    u64 max_entered_ns;
+    u32 entries;
+    u32 level;
+    u32 field_count;
+    u32 padding;
+    struct span_context sc;
+    struct span_context psc;
+    struct tracing_field_t fields[MAX_TRACING_FIELDS];
+};
+
+struct tracing_span_state_t {
+    struct tracing_span_t span;
+    // The task's active span before this one was entered.
+    struct span_context prev;
+    u64 entered_at;
+    u32 entered;
+    u32 padding;
+};
+
+struct make_span_call_t {
+    void* metadata;
+    void* attributes;
+    void* span;
+};
+
+// Span::make_with calls in progress, by thread.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, struct make_span_call_t);
+    __uint(max_entries, MAX_CONCURRENT);
+} make_span_calls SEC(".maps");
+
+// Dispatch::try_close calls in progress, by thread, with the span ID.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, u64);
+    __uint(max_entries, MAX_CONCURRENT);
+} close_span_calls SEC(".maps");
+
+// Open spans by span::Id. The subscriber reuses IDs only after closing
+// them; spans of subscribers that never close are evicted by the LRU.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, struct tracing_span_state_t);
+    __uint(max_entries, MAX_TRACING_SPANS);
+} tracing_spans SEC(".maps");
+
+// How to read field values, by the address of their `Value` vtable. Filled
+// in by the agent from DWARF; values of other types are not recorded.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, u64);
+    __type(value, struct capture_recipe);
+    __uint(max_entries, MAX_VALUE_TYPES);
+} value_types SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, struct tracing_span_state_t);
+    __uint(max_entries, 1);
+} tracing_span_scratch SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+} tracing_events SEC(".maps");
+
+static __always_inline u64 intern_str_at(void* ctx, void* str_ptr) {
+    struct {
+        void* ptr;
+        u64 len;
+    } str = {};
+    if (bpf_probe_read(&str, sizeof(str), str_ptr)) {
+        return 0;
+    }
+    return intern_string(ctx, str.ptr, str.len);
+}
+
+static __always_inline void read_fields(void* ctx, void* values, struct tracing_span_t* span) {
+    void* entries = NULL;
+    u64 len = 0;
+    bpf_probe_read(&entries, sizeof(entries), values + value_set_values_pos);
+    bpf_probe_read(&len, sizeof(len), values + value_set_values_pos + 8);
+    if (!entries) {
+        return;
+    }
+
+    u32 count = 0;
+    for (u32 i = 0; i < MAX_TRACING_FIELDS; i++) {
+        if (i >= len) {
+            break;
+        }
+        struct value_entry entry = {};
+        if (bpf_probe_read(&entry, sizeof(entry), entries + i * sizeof(entry))) {
+            break;
+        }
+        // Fields declared as Empty have no value yet.
+        if (!entry.data || !entry.field) {
+            continue;
+        }
+        u64 vtable = (u64)entry.vtable;
+        struct capture_recipe* recipe = bpf_map_lookup_elem(&value_types, &vtable);
+        if (!recipe) {
+            continue;
+        }
+
+        void* names = NULL;
+        u64 index = 0;
+        bpf_probe_read(&names, sizeof(names), entry.field + field_names_pos);
+        bpf_probe_read(&index, sizeof(index), entry.field + field_index_pos);
+        if (!names || count >= MAX_TRACING_FIELDS) {
+            continue;
+        }
+        struct tracing_field_t* field = &span->fields[count];
+        field->name_id = intern_str_at(ctx, names + index * 16);
+        field->vtable = vtable;
+        read_capture(entry.data, recipe, &field->value);
+        count++;
+    }
+    span->field_count = count;
+}
+
+// tracing::span::Span::make_with(meta, new_span: Attributes, dispatch),
+// where the dispatcher's new_span is inlined. Only reached for spans the
+// subscriber enabled.
+SEC("uprobe/tracing_make_span")
+int uprobe_tracing_make_span(struct pt_regs *ctx) {
+    struct make_span_call_t call = {};
+    call.metadata = get_argument_at(ctx, &meta_arg_loc, 2);
+    call.attributes = get_argument_at(ctx, &attributes_arg_loc, 3);
+    call.span = get_register(ctx, return_pointer_reg);
+    if (!call.metadata || !call.attributes || !call.span) {
+        return 0;
+    }
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&make_span_calls, &pid_tgid, &call, 0);
+    return 0;
+}
+
+SEC("uprobe/tracing_make_span_return")
+int uprobe_tracing_make_span_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    struct make_span_call_t* call = bpf_map_lookup_elem(&make_span_calls, &pid_tgid);
+    if (!call) {
+        return 0;
+    }
+    void* metadata = call->metadata;
+    void* attributes = call->attributes;
+    u64 id = 0;
+    bpf_probe_read(&id, sizeof(id), call->span + span_id_pos);
+    bpf_map_delete_elem(&make_span_calls, &pid_tgid);
+    if (!id) {
+        return 0;
+    }
+
+    u32 zero = 0;
+    struct tracing_span_state_t* state = bpf_map_lookup_elem(&tracing_span_scratch, &zero);
+    if (!state) {
+        return 0;
+    }
+    __builtin_memset(state, 0, sizeof(*state));
+    struct tracing_span_t* span = &state->span;
+    span->start_time = bpf_ktime_get_ns();
+    span->name_id = intern_str_at(ctx, metadata + metadata_name_pos);
+    span->target_id = intern_str_at(ctx, metadata + metadata_target_pos);
+    bpf_probe_read(&span->level, sizeof(span->level), metadata + metadata_level_pos);
+
+    void* values = NULL;
+    bpf_probe_read(&values, sizeof(values), attributes + attributes_values_pos);
+    if (values) {
+        read_fields(ctx, values, span);
+    }
+
+    // The span's parent is whatever the task runs in when it is created,
+    // which includes the request span and entered `tracing` spans.
+    struct span_context* parent = get_current_span_context();
+    if (parent) {
+        span->psc = *parent;
+        span->sc = generate_child_span_context(parent);
+    } else {
+        span->sc = generate_span_context();
+    }
+
+    bpf_map_update_elem(&tracing_spans, &id, state, 0);
+    return 0;
+}
+
+// tracing_core::dispatcher::Dispatch::enter(&self, span: &Id)
+SEC("uprobe/tracing_enter")
+int uprobe_tracing_enter(struct pt_regs *ctx) {
+    u64 id = 0;
+    bpf_probe_read(&id, sizeof(id), get_argument(ctx, 2));
+    struct tracing_span_state_t* state = bpf_map_lookup_elem(&tracing_spans, &id);
+    if (!state || state->entered) {
+        return 0;
+    }
+
+    void* task_key = get_task_key();
+    struct span_context* prev = bpf_map_lookup_elem(&spans_in_progress, &task_key);
+    if (prev) {
+        state->prev = *prev;
+    } else {
+        __builtin_memset(&state->prev, 0, sizeof(state->prev));
+    }
+    state->entered = 1;
+    state->entered_at = bpf_ktime_get_ns();
+    state->span.entries++;
+    bpf_map_update_elem(&spans_in_progress, &task_key, &state->span.sc, 0);
+    return 0;
+}
+
+// tracing_core::dispatcher::Dispatch::exit(&self, span: &Id)
+SEC("uprobe/tracing_exit")
+int uprobe_tracing_exit(struct pt_regs *ctx) {
+    u64 id = 0;
+    bpf_probe_read(&id, sizeof(id), get_argument(ctx, 2));
+    struct tracing_span_state_t* state = bpf_map_lookup_elem(&tracing_spans, &id);
+    if (!state || !state->entered) {
+        return 0;
+    }
+
+    u64 entered_ns = bpf_ktime_get_ns() - state->entered_at;
+    state->span.busy_ns += entered_ns;
+    if (entered_ns > state->span.max_entered_ns) {
+        state->span.max_entered_ns = entered_ns;
+    }
+    state->entered = 0;
+
+    void* task_key = get_task_key();
+    if (span_context_is_valid(&state->prev)) {
+        bpf_map_update_elem(&spans_in_progress, &task_key, &state->prev, 0);
+    } else {
+        bpf_map_delete_elem(&spans_in_progress, &task_key);
+    }
+    return 0;
+}
+
+// tracing_core::dispatcher::Dispatch::try_close(&self, id: Id) -> bool
+SEC("uprobe/tracing_try_close")
+int uprobe_tracing_try_close(struct pt_regs *ctx) {
+    u64 id = (u64)get_argument(ctx, 2);
+    if (!bpf_map_lookup_elem(&tracing_spans, &id)) {
+        return 0;
+    }
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    bpf_map_update_elem(&close_span_calls, &pid_tgid, &id, 0);
+    return 0;
+}
+
+// Returns true once the last handle to the span is dropped.
+SEC("uprobe/tracing_try_close_return")
+int uprobe_tracing_try_close_return(struct pt_regs *ctx) {
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    u64* id_ptr = bpf_map_lookup_elem(&close_span_calls, &pid_tgid);
+    if (!id_ptr) {
+        return 0;
+    }
+    u64 id = *id_ptr;
+    bpf_map_delete_elem(&close_span_calls, &pid_tgid);
+    if (!(PT_REGS_RC(ctx) & 1)) {
+        return 0;
+    }
+
+    struct tracing_span_state_t* state = bpf_map_lookup_elem(&tracing_spans, &id);
+    if (!state) {
+        return 0;
+    }
+    state->span.end_time = bpf_ktime_get_ns();
+    bpf_perf_event_output(ctx, &tracing_events, BPF_F_CURRENT_CPU, &state->span, sizeof(state->span));
+    bpf_map_delete_elem(&tracing_spans, &id);
+    return 0;
+}